@@ -0,0 +1,701 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "backends.h"
+#include "gpudriven.h"
+#include "shaders.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <InstanceEncoding.h>
+
+// Golden angle in radians
+static const float GOLDEN_ANGLE = 2.39996323f;
+// Rotation of each spiral layer against the previous one
+static const float SPIRAL_TWIST = 0.1f;
+// Pi, the spiral spans the same area as the grid
+static const float PATTERN_PI = 3.14159265f;
+
+// PCG hash, must match the procedural vertex shader
+static GLuint hash(GLuint v)
+{
+  GLuint state = v * 747796405u + 2891336453u;
+  GLuint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// Uniform random vector from the [0, 1) range for the given instance
+static glm::vec3 random3(GLuint seed, GLuint index)
+{
+  GLuint h0 = hash(index + hash(seed));
+  GLuint h1 = hash(h0);
+  GLuint h2 = hash(h1);
+  return glm::vec3((float)(h0 >> 8u), (float)(h1 >> 8u), (float)(h2 >> 8u)) * (1.0f / 16777216.0f);
+}
+
+const char *GetPatternName(int pattern)
+{
+  switch (pattern)
+  {
+  case Pattern::Grid:
+    return "Grid";
+  case Pattern::JitteredGrid:
+    return "Jittered grid";
+  case Pattern::Spiral:
+    return "Spiral";
+  case Pattern::Random:
+    return "Random";
+  default:
+    return "Unknown";
+  }
+}
+
+glm::vec3 GeneratePosition(const GeneratorParams &params, unsigned int index)
+{
+  const GLuint n = params.instancesPerSide;
+  const float spacing = params.spacing;
+  const float halfExtent = 0.5f * n * spacing;
+
+  if (params.pattern == Pattern::Random)
+  {
+    // Random: uniformly distributed in the grid volume
+    return (random3(params.seed, index) - 0.5f) * 2.0f * halfExtent;
+  }
+
+  const GLuint layerSize = n * n;
+  const GLuint layer = index / layerSize;
+  const GLuint j = index % layerSize;
+  if (params.pattern == Pattern::Spiral)
+  {
+    // Spiral: Fermat's spiral in each layer, every layer slightly twisted
+    float r = spacing * sqrtf((float)j / PATTERN_PI);
+    float angle = j * GOLDEN_ANGLE + layer * SPIRAL_TWIST;
+    return glm::vec3(r * cosf(angle), spacing * layer - halfExtent, r * sinf(angle));
+  }
+
+  // Grid, optionally jittered by up to a quarter of the spacing
+  glm::vec3 p = glm::vec3((float)(j % n), (float)layer, (float)(j / n)) * spacing - halfExtent;
+  if (params.pattern == Pattern::JitteredGrid)
+  {
+    p += (random3(params.seed, index) - 0.5f) * 0.5f * spacing;
+  }
+  return p;
+}
+
+// ----------------------------------------------------------------------------
+// Per object draws without instancing, the transformation is passed as a uniform
+// ----------------------------------------------------------------------------
+class PerObjectBackend : public InstancingBackend
+{
+public:
+  const char *GetName() const override { return "Per object"; }
+  // A draw call per cube, more than this takes ages to benchmark
+  unsigned int GetMaxInstances() const override { return 25 * 25 * 25; }
+
+  size_t Draw(Mesh<Vertex_Pos_Tex> &mesh, const InstanceStore<InstanceData> &instances) override
+  {
+    const InstanceData *data = instances.GetData();
+    const unsigned int numInstances = instances.GetCount();
+
+    // Select shader program
+    glUseProgram(shaderProgram[ShaderProgram::Default]);
+
+    for (unsigned int i = 0; i < numInstances; ++i)
+    {
+      // Instance data are transposed, i.e., row major, let OpenGL transpose them back
+      glUniformMatrix4x3fv(0, 1, GL_TRUE, &data[i].transformation[0][0]);
+
+      // Draw the cube
+      glDrawElements(GL_TRIANGLES, mesh.GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+    }
+
+    return numInstances * sizeof(InstanceData);
+  }
+};
+
+// ----------------------------------------------------------------------------
+// Instancing via instanced vertex attributes
+// ----------------------------------------------------------------------------
+class VertexParamsBackend : public InstancingBackend
+{
+public:
+  const char *GetName() const override { return "Vertex params"; }
+
+  void Init(Mesh<Vertex_Pos_Tex> &mesh) override
+  {
+    // Bind and update the VAO with instanced vertex attributes
+    glBindVertexArray(mesh.GetVAO());
+
+    // Generate the instancing buffer but don't fill it with data
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+    glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCES * sizeof(InstanceData), nullptr, GL_DYNAMIC_DRAW);
+
+    // Enable the instanced vertex attributes, that's a matrix so we need to enable 3 additional
+    // attributes, once per each row of the instance transformation matrix. Bear in mind that
+    // the number of available attributes (vec4) per vertex is limited to 16
+    for (GLuint i = 0; i < 3; ++i)
+    {
+      glVertexAttribPointer(2 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), reinterpret_cast<void*>(i * sizeof(glm::vec4)));
+      glEnableVertexAttribArray(2 + i);
+      glVertexAttribDivisor(2 + i, 1); // Tell OpenGL to update this attribute for each instance
+    }
+
+    // Unbind the VAO, programs of the other backends don't read the extra attributes
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  void Release() override
+  {
+    glDeleteBuffers(1, &_buffer);
+  }
+
+  size_t Draw(Mesh<Vertex_Pos_Tex> &mesh, const InstanceStore<InstanceData> &instances) override
+  {
+    const unsigned int numInstances = instances.GetCount();
+    size_t uploadBytes = 0;
+
+    // The buffer holds all instances, upload them only when they change
+    if (_version != instances.GetVersion())
+    {
+      // Map the whole buffer to the system memory, perform memcpy and unmap - beware of reading the buffer -> it incurs slowdown
+      glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+      void *ptr = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+      memcpy(ptr, instances.GetData(), numInstances * sizeof(InstanceData));
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      _version = instances.GetVersion();
+      uploadBytes = numInstances * sizeof(InstanceData);
+    }
+
+    // Select shader program
+    glUseProgram(shaderProgram[ShaderProgram::VertexParamInstancing]);
+
+    // Draw all cubes
+    glDrawElementsInstanced(GL_TRIANGLES, mesh.GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), numInstances);
+
+    return uploadBytes;
+  }
+
+private:
+  // Instancing buffer handle
+  GLuint _buffer = 0;
+  // Version of the uploaded instance data
+  unsigned int _version = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Instancing via chains of instances stored in one large uniform buffer, each chain
+// is a range of the buffer bound to the uniform block at the chain offset
+// ----------------------------------------------------------------------------
+class UniformBlockBackend : public InstancingBackend
+{
+public:
+  const char *GetName() const override { return "Uniform block"; }
+
+  bool IsSupported() const override
+  {
+    // Check for available UBO size in bytes
+    GLint maxUboSize = 0;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxUboSize);
+    if (maxUboSize < static_cast<GLint>(MAX_INSTANCE_CHAIN_LENGTH * sizeof(InstanceData)))
+      return false;
+
+    // Chains are bound at multiples of the chain size, these must respect the offset alignment
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    return alignment > 0 && (MAX_INSTANCE_CHAIN_LENGTH * sizeof(InstanceData)) % alignment == 0;
+  }
+
+  void Init(Mesh<Vertex_Pos_Tex> &/*mesh*/) override
+  {
+    // Generate the instancing buffer as Uniform Buffer Object, storage is allocated on the first draw
+    glGenBuffers(1, &_buffer);
+
+    // Obtain UBO index and size from the instancing shader program, each chain is bound with this size
+    GLuint uboIndex = glGetUniformBlockIndex(shaderProgram[ShaderProgram::InstancingUniformBlock], "InstanceBuffer");
+    glGetActiveUniformBlockiv(shaderProgram[ShaderProgram::InstancingUniformBlock], uboIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &_chainSize);
+  }
+
+  void Release() override
+  {
+    glDeleteBuffers(1, &_buffer);
+  }
+
+  size_t Draw(Mesh<Vertex_Pos_Tex> &mesh, const InstanceStore<InstanceData> &instances) override
+  {
+    const unsigned int numInstances = instances.GetCount();
+    const unsigned int numChains = (numInstances + MAX_INSTANCE_CHAIN_LENGTH - 1) / MAX_INSTANCE_CHAIN_LENGTH;
+    size_t uploadBytes = 0;
+
+    // Upload all chains at once and only when the instances change, there's no map/unmap
+    // between the draws so the chains don't have to wait for each other
+    if (_version != instances.GetVersion())
+    {
+      glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+
+      // Every chain is bound with the full block size, the last one included
+      if (numChains > _numChains)
+      {
+        _numChains = numChains;
+        glBufferData(GL_UNIFORM_BUFFER, (_numChains - 1) * MAX_INSTANCE_CHAIN_LENGTH * sizeof(InstanceData) + _chainSize, nullptr, GL_DYNAMIC_DRAW);
+      }
+      glBufferSubData(GL_UNIFORM_BUFFER, 0, numInstances * sizeof(InstanceData), instances.GetData());
+
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+      _version = instances.GetVersion();
+      uploadBytes = numInstances * sizeof(InstanceData);
+    }
+
+    // Select shader program
+    glUseProgram(shaderProgram[ShaderProgram::InstancingUniformBlock]);
+
+    // Render the instance chains
+    for (unsigned int chain = 0; chain < numChains; ++chain)
+    {
+      const unsigned int offset = chain * MAX_INSTANCE_CHAIN_LENGTH;
+      const unsigned int chainLength = std::min(numInstances - offset, MAX_INSTANCE_CHAIN_LENGTH);
+
+      // Bind the chain to the index 1
+      glBindBufferRange(GL_UNIFORM_BUFFER, 1, _buffer, offset * sizeof(InstanceData), _chainSize);
+
+      // Draw the instance chain
+      glDrawElementsInstanced(GL_TRIANGLES, mesh.GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), chainLength);
+    }
+
+    // Unbind the instancing buffer
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
+
+    return uploadBytes;
+  }
+
+private:
+  // Instancing buffer handle
+  GLuint _buffer = 0;
+  // Size of the uniform block, i.e., of a single chain
+  GLint _chainSize = 0;
+  // Number of chains the buffer can hold
+  unsigned int _numChains = 0;
+  // Version of the uploaded instance data
+  unsigned int _version = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Instancing via chains of compactly encoded instances in one large uniform buffer, translation,
+// uniform scale and quaternion take 32 B instead of 48 B, or 16 B when the pattern is small enough
+// for half precision, so the same block holds 2x or 4x more instances than the matrices
+// ----------------------------------------------------------------------------
+class CompactBlockBackend : public InstancingBackend
+{
+public:
+  // Maximum number of instances per chain of each encoding, must match the compact instancing vertex shader!
+  static const unsigned int CHAIN_LENGTH = 2048;
+  static const unsigned int HALF_CHAIN_LENGTH = 4096;
+
+  const char *GetName() const override { return _half ? "Compact block (16 B)" : "Compact block (32 B)"; }
+
+  bool IsSupported() const override
+  {
+    // Programs are only created when the context supports the unpacking functions
+    if (shaderProgram[ShaderProgram::InstancingCompactBlock] == 0)
+      return false;
+
+    // Both encodings fill 64 kB blocks
+    GLint maxUboSize = 0;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxUboSize);
+    if (maxUboSize < static_cast<GLint>(CHAIN_LENGTH * sizeof(CompactInstance)))
+      return false;
+
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    return alignment > 0 && (CHAIN_LENGTH * sizeof(CompactInstance)) % alignment == 0;
+  }
+
+  void Init(Mesh<Vertex_Pos_Tex> &/*mesh*/) override
+  {
+    if (!IsSupported())
+      return;
+
+    // Generate the instancing buffer as Uniform Buffer Object, storage is allocated on the first draw
+    glGenBuffers(1, &_buffer);
+
+    // Obtain the block size from the program, both encodings have the same one
+    GLuint uboIndex = glGetUniformBlockIndex(shaderProgram[ShaderProgram::InstancingCompactBlock], "InstanceBuffer");
+    glGetActiveUniformBlockiv(shaderProgram[ShaderProgram::InstancingCompactBlock], uboIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &_chainSize);
+  }
+
+  void Release() override
+  {
+    glDeleteBuffers(1, &_buffer);
+  }
+
+  size_t Draw(Mesh<Vertex_Pos_Tex> &mesh, const InstanceStore<InstanceData> &instances) override
+  {
+    const unsigned int numInstances = instances.GetCount();
+    size_t uploadBytes = 0;
+
+    // Encode and upload all chains at once and only when the instances change
+    if (_version != instances.GetVersion())
+    {
+      // Decompose the transposed matrices, half precision is only used when the whole pattern fits
+      _transforms.resize(numInstances);
+      float extent = 0.0f;
+      for (unsigned int i = 0; i < numInstances; ++i)
+      {
+        _transforms[i] = decomposeTransform(glm::transpose(instances.GetData()[i].transformation));
+        const glm::vec3 t = glm::abs(_transforms[i].translation);
+        extent = std::max(extent, std::max(t.x, std::max(t.y, t.z)));
+      }
+      _half = extent <= HALF_ENCODING_MAX_EXTENT;
+
+      const void *data = nullptr;
+      if (_half)
+      {
+        _halfEncoded.resize(numInstances);
+        encodeInstances(_transforms.data(), _halfEncoded.data(), numInstances);
+        data = _halfEncoded.data();
+        uploadBytes = numInstances * sizeof(CompactInstanceHalf);
+      }
+      else
+      {
+        _encoded.resize(numInstances);
+        encodeInstances(_transforms.data(), _encoded.data(), numInstances);
+        data = _encoded.data();
+        uploadBytes = numInstances * sizeof(CompactInstance);
+      }
+
+      glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+
+      // Every chain is bound with the full block size, the last one included
+      const size_t bufferSize = uploadBytes + _chainSize;
+      if (bufferSize > _bufferSize)
+      {
+        _bufferSize = bufferSize;
+        glBufferData(GL_UNIFORM_BUFFER, _bufferSize, nullptr, GL_DYNAMIC_DRAW);
+      }
+      glBufferSubData(GL_UNIFORM_BUFFER, 0, uploadBytes, data);
+
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+      _version = instances.GetVersion();
+    }
+
+    // Select shader program of the current encoding
+    const unsigned int chainLength = _half ? HALF_CHAIN_LENGTH : CHAIN_LENGTH;
+    glUseProgram(shaderProgram[_half ? ShaderProgram::InstancingCompactHalfBlock : ShaderProgram::InstancingCompactBlock]);
+
+    // Render the instance chains, chains of both encodings span the whole block
+    for (unsigned int offset = 0, chain = 0; offset < numInstances; offset += chainLength, ++chain)
+    {
+      // Bind the chain to the index 1
+      glBindBufferRange(GL_UNIFORM_BUFFER, 1, _buffer, chain * _chainSize, _chainSize);
+
+      // Draw the instance chain
+      glDrawElementsInstanced(GL_TRIANGLES, mesh.GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), std::min(numInstances - offset, chainLength));
+    }
+
+    // Unbind the instancing buffer
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
+
+    return uploadBytes;
+  }
+
+private:
+  // Instancing buffer handle
+  GLuint _buffer = 0;
+  // Size of the uniform block, i.e., of a single chain
+  GLint _chainSize = 0;
+  // Allocated size of the buffer
+  size_t _bufferSize = 0;
+  // Version of the uploaded instance data
+  unsigned int _version = 0;
+  // Is the half encoding used?
+  bool _half = false;
+  // Decomposed and encoded instances, kept to avoid reallocations
+  std::vector<InstanceTransform> _transforms;
+  std::vector<CompactInstance> _encoded;
+  std::vector<CompactInstanceHalf> _halfEncoded;
+};
+
+// ----------------------------------------------------------------------------
+// Instancing via shader storage buffer, requires OpenGL 4.3
+// ----------------------------------------------------------------------------
+class StorageBufferBackend : public InstancingBackend
+{
+public:
+  const char *GetName() const override { return "Storage buffer"; }
+
+  // Program is only created when the context supports the storage buffers
+  bool IsSupported() const override { return shaderProgram[ShaderProgram::InstancingBuffer] != 0; }
+
+  void Init(Mesh<Vertex_Pos_Tex> &/*mesh*/) override
+  {
+    if (!IsSupported())
+      return;
+
+    // Generate the instancing buffer but don't fill it with data
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_INSTANCES * sizeof(InstanceData), nullptr, GL_DYNAMIC_DRAW);
+
+    // Unbind the buffer for now
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  }
+
+  void Release() override
+  {
+    glDeleteBuffers(1, &_buffer);
+  }
+
+  size_t Draw(Mesh<Vertex_Pos_Tex> &mesh, const InstanceStore<InstanceData> &instances) override
+  {
+    const unsigned int numInstances = instances.GetCount();
+    size_t uploadBytes = 0;
+
+    // Bind the whole instancing buffer to the index 0
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _buffer);
+
+    // The buffer holds all instances, upload them only when they change
+    if (_version != instances.GetVersion())
+    {
+      // Update the buffer data using mapping
+      void *ptr = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_WRITE_ONLY);
+      memcpy(ptr, instances.GetData(), numInstances * sizeof(InstanceData));
+      glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+
+      _version = instances.GetVersion();
+      uploadBytes = numInstances * sizeof(InstanceData);
+    }
+
+    // Select shader program
+    glUseProgram(shaderProgram[ShaderProgram::InstancingBuffer]);
+
+    // Draw all cubes
+    glDrawElementsInstanced(GL_TRIANGLES, mesh.GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), numInstances);
+
+    // Unbind the instancing buffer
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+
+    return uploadBytes;
+  }
+
+private:
+  // Instancing buffer handle
+  GLuint _buffer = 0;
+  // Version of the uploaded instance data
+  unsigned int _version = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Instances generated in the vertex shader from gl_InstanceID, only the small parameter
+// block lives on the CPU side so there's nothing to upload unless the pattern changes
+// ----------------------------------------------------------------------------
+class ProceduralBackend : public InstancingBackend
+{
+public:
+  const char *GetName() const override { return "Procedural"; }
+  bool ReadsInstanceData() const override { return false; }
+  void SetGenerator(const GeneratorParams &params) override { _params = params; }
+
+  void Init(Mesh<Vertex_Pos_Tex> &/*mesh*/) override
+  {
+    // Generate the parameter block as Uniform Buffer Object
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(GeneratorParams), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  void Release() override
+  {
+    glDeleteBuffers(1, &_buffer);
+  }
+
+  size_t Draw(Mesh<Vertex_Pos_Tex> &mesh, const InstanceStore<InstanceData> &/*instances*/) override
+  {
+    size_t uploadBytes = 0;
+
+    // Upload the parameters only when they change
+    if (!_uploaded || _uploadedParams != _params)
+    {
+      glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+      glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(GeneratorParams), &_params);
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+      _uploadedParams = _params;
+      _uploaded = true;
+      uploadBytes = sizeof(GeneratorParams);
+    }
+
+    // Bind the parameter block to the index 2
+    glBindBufferBase(GL_UNIFORM_BUFFER, 2, _buffer);
+
+    // Select shader program
+    glUseProgram(shaderProgram[ShaderProgram::ProceduralInstancing]);
+
+    // Draw all cubes
+    const GLsizei numInstances = _params.instancesPerSide * _params.instancesPerSide * _params.instancesPerSide;
+    glDrawElementsInstanced(GL_TRIANGLES, mesh.GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), numInstances);
+
+    // Unbind the parameter block
+    glBindBufferBase(GL_UNIFORM_BUFFER, 2, 0);
+
+    return uploadBytes;
+  }
+
+private:
+  // Parameter block handle
+  GLuint _buffer = 0;
+  // Current and uploaded parameters
+  GeneratorParams _params;
+  GeneratorParams _uploadedParams;
+  // Were the parameters uploaded at least once?
+  bool _uploaded = false;
+};
+
+// ----------------------------------------------------------------------------
+
+InstancingBackend *CreateBackend(int type)
+{
+  switch (type)
+  {
+  case Backend::PerObject:
+    return new PerObjectBackend();
+  case Backend::VertexParams:
+    return new VertexParamsBackend();
+  case Backend::UniformBlock:
+    return new UniformBlockBackend();
+  case Backend::CompactBlock:
+    return new CompactBlockBackend();
+  case Backend::StorageBuffer:
+    return new StorageBufferBackend();
+  case Backend::Procedural:
+    return new ProceduralBackend();
+  case Backend::GpuDriven:
+    return new GpuDrivenBackend();
+  default:
+    return nullptr;
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+const int InstancingBenchmark::SIZES[NUM_SIZES] = {1, 5, 10, 25, 50, 100};
+
+void InstancingBenchmark::Release()
+{
+  if (_queries[0])
+    glDeleteQueries(QUERY_LATENCY, _queries);
+  _queries[0] = 0;
+  _running = false;
+}
+
+void InstancingBenchmark::Start(InstancingBackend *const *backends)
+{
+  if (!_queries[0])
+    glGenQueries(QUERY_LATENCY, _queries);
+
+  _backends = backends;
+  _backend = 0;
+  _size = 0;
+  _frame = 0;
+  _cpuTime = 0.0;
+  _gpuTime = 0.0;
+  _uploadBytes = 0;
+  _running = Advance();
+
+  printf("%-16s %10s %12s %12s %12s\n", "Backend", "Instances", "CPU [ms]", "GPU [ms]", "Upload [KB]");
+}
+
+void InstancingBenchmark::BeginDraw()
+{
+  if (!_running || _frame < WARMUP_FRAMES)
+    return;
+
+  // Reuse the oldest query, its result should be long available
+  int query = (_frame - WARMUP_FRAMES) % QUERY_LATENCY;
+  if (_pending[query])
+    CollectQuery(query);
+
+  glBeginQuery(GL_TIME_ELAPSED, _queries[query]);
+  _drawStart = std::chrono::high_resolution_clock::now();
+}
+
+void InstancingBenchmark::EndDraw(size_t uploadBytes)
+{
+  if (!_running)
+    return;
+
+  if (_frame >= WARMUP_FRAMES)
+  {
+    // CPU time covers the upload and the draw call submission only
+    auto drawEnd = std::chrono::high_resolution_clock::now();
+    _cpuTime += std::chrono::duration<double, std::milli>(drawEnd - _drawStart).count();
+    _uploadBytes += uploadBytes;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    _pending[(_frame - WARMUP_FRAMES) % QUERY_LATENCY] = true;
+  }
+
+  if (++_frame == WARMUP_FRAMES + MEASURED_FRAMES)
+    NextCase();
+}
+
+void InstancingBenchmark::CollectQuery(int query)
+{
+  GLuint64 elapsed = 0;
+  glGetQueryObjectui64v(_queries[query], GL_QUERY_RESULT, &elapsed);
+  _gpuTime += elapsed * 1e-6;
+  _pending[query] = false;
+}
+
+void InstancingBenchmark::NextCase()
+{
+  // Finish the remaining queries of this case
+  for (int i = 0; i < QUERY_LATENCY; ++i)
+  {
+    if (_pending[i])
+      CollectQuery(i);
+  }
+
+  int instances = SIZES[_size] * SIZES[_size] * SIZES[_size];
+  printf("%-16s %10d %12.3f %12.3f %12.1f\n", _backends[_backend]->GetName(), instances,
+         _cpuTime / MEASURED_FRAMES, _gpuTime / MEASURED_FRAMES, _uploadBytes / (1024.0 * MEASURED_FRAMES));
+
+  _frame = 0;
+  _cpuTime = 0.0;
+  _gpuTime = 0.0;
+  _uploadBytes = 0;
+
+  ++_size;
+  _running = Advance();
+  if (!_running)
+    printf("Benchmark finished\n");
+}
+
+bool InstancingBenchmark::Advance()
+{
+  for (; _backend < Backend::NumBackends; ++_backend, _size = 0)
+  {
+    if (!_backends[_backend]->IsSupported())
+      continue;
+
+    for (; _size < NUM_SIZES; ++_size)
+    {
+      unsigned int instances = SIZES[_size] * SIZES[_size] * SIZES[_size];
+      if (instances <= _backends[_backend]->GetMaxInstances())
+        return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,165 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <Camera.h>
+#include <InstanceStore.h>
+#include <Mesh.h>
+#include <Vertex.h>
+
+// Maximum number of allowed instances - SSBO can be up to 128 MB! - it'd be safer to ask driver, though
+static const unsigned int MAX_INSTANCES = 1000000;
+// Maximum number of instances per single instanced draw call
+static const unsigned int MAX_INSTANCE_CHAIN_LENGTH = 1024; // must match the instancing vertex shader!
+
+// Data for a single object instance
+struct InstanceData
+{
+  // In this simple example just a transformation matrix, transposed for efficient storage
+  glm::mat3x4 transformation;
+};
+
+// Procedural instance patterns
+namespace Pattern
+{
+  enum
+  {
+    Grid, JitteredGrid, Spiral, Random, NumPatterns
+  };
+}
+
+// Parameters of the procedural instance generator, must match the ProceduralBlock in the vertex shader
+struct GeneratorParams
+{
+  // Generated pattern
+  GLuint pattern = Pattern::Grid;
+  // The pattern consists of instancesPerSide^3 instances
+  GLuint instancesPerSide = 1;
+  // Seed of the jittered and random patterns
+  GLuint seed = 0;
+  // Distance between neighbouring instances
+  GLfloat spacing = 2.0f;
+
+  bool operator == (const GeneratorParams &other) const
+  {
+    return pattern == other.pattern && instancesPerSide == other.instancesPerSide && seed == other.seed && spacing == other.spacing;
+  }
+  bool operator != (const GeneratorParams &other) const { return !(*this == other); }
+};
+
+// Returns name of the pattern
+const char *GetPatternName(int pattern);
+// Generates position of the instance on the CPU, mirrors the procedural vertex shader
+glm::vec3 GeneratePosition(const GeneratorParams &params, unsigned int index);
+
+// Instancing methods
+namespace Backend
+{
+  enum
+  {
+    PerObject, VertexParams, UniformBlock, CompactBlock, StorageBuffer, Procedural, GpuDriven, NumBackends
+  };
+}
+
+// Common interface of the instancing methods, each one owns its buffers
+class InstancingBackend
+{
+public:
+  virtual ~InstancingBackend() {}
+
+  // Name shown in the title bar and in the benchmark report
+  virtual const char *GetName() const = 0;
+  // Returns false if the method can't run in the current context
+  virtual bool IsSupported() const { return true; }
+  // Maximum number of instances worth benchmarking
+  virtual unsigned int GetMaxInstances() const { return MAX_INSTANCES; }
+  // Returns false if the method generates the instances itself, the CPU side instance data can stay stale then
+  virtual bool ReadsInstanceData() const { return true; }
+  // Sets the parameters of the instance generator, ignored by the methods reading the instance data
+  virtual void SetGenerator(const GeneratorParams &/*params*/) {}
+  // Sets the camera of the current frame for the methods culling on their own
+  virtual void SetCamera(const Camera &/*camera*/) {}
+  // Writes the method specific statistics shown in the title bar, returns false if there are none
+  virtual bool GetStatsText(char * /*text*/, size_t /*length*/) const { return false; }
+  // Creates the buffers, the mesh VAO may be modified
+  virtual void Init(Mesh<Vertex_Pos_Tex> &/*mesh*/) {}
+  // Releases the buffers
+  virtual void Release() {}
+  // Uploads the instance data and draws the mesh, returns the number of bytes uploaded, methods keeping
+  // all instances in a buffer only upload them when the version of the store changes
+  virtual size_t Draw(Mesh<Vertex_Pos_Tex> &mesh, const InstanceStore<InstanceData> &instances) = 0;
+};
+
+// Creates the instancing method of the given type
+InstancingBackend *CreateBackend(int type);
+
+// Sweeps all supported instancing methods over the instance counts and reports the CPU submit time,
+// GPU time and uploaded bytes per frame, GPU queries are read with a delay so the pipeline doesn't stall
+class InstancingBenchmark
+{
+public:
+  // Number of frames rendered before each measurement
+  static const int WARMUP_FRAMES = 10;
+  // Number of measured frames
+  static const int MEASURED_FRAMES = 60;
+  // Number of GPU queries in flight
+  static const int QUERY_LATENCY = 4;
+  // Swept numbers of instances per cube side
+  static const int NUM_SIZES = 6;
+  static const int SIZES[NUM_SIZES];
+
+  InstancingBenchmark() {}
+
+  // Releases the queries
+  void Release();
+  // Starts the sweep over the given backends
+  void Start(InstancingBackend *const *backends);
+  // Returns true while the sweep is running
+  bool IsRunning() const { return _running; }
+  // Returns the backend to render in this frame
+  int GetBackend() const { return _backend; }
+  // Returns the number of instances per side to render in this frame
+  int GetInstancesPerSide() const { return SIZES[_size]; }
+  // Call around the backend draw, upload bytes are returned by the backend
+  void BeginDraw();
+  void EndDraw(size_t uploadBytes);
+
+private:
+  // No copies allowed
+  InstancingBenchmark(const InstancingBenchmark &);
+  InstancingBenchmark & operator = (const InstancingBenchmark &);
+
+  // Reads the result of the query, waits if it's not available yet
+  void CollectQuery(int query);
+  // Prints the result of the current case and moves to the next one
+  void NextCase();
+  // Skips to the next case the current backend can run, returns false at the end of the sweep
+  bool Advance();
+
+  // Backends being benchmarked
+  InstancingBackend *const *_backends = nullptr;
+  // Is the sweep running?
+  bool _running = false;
+  // Current backend and size indices
+  int _backend = 0;
+  int _size = 0;
+  // Frames rendered in the current case
+  int _frame = 0;
+  // Time elapsed queries
+  GLuint _queries[QUERY_LATENCY] = {};
+  // Is the query waiting for its result?
+  bool _pending[QUERY_LATENCY] = {};
+  // Start of the CPU submit time measurement
+  std::chrono::high_resolution_clock::time_point _drawStart;
+  // Accumulated measurements of the current case
+  double _cpuTime = 0.0;
+  double _gpuTime = 0.0;
+  size_t _uploadBytes = 0;
+};
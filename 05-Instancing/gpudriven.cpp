@@ -0,0 +1,368 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "gpudriven.h"
+#include "shaders.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <glm/gtc/type_ptr.hpp>
+
+// Local work group size of the instance compute shaders
+static const unsigned int GPU_WORK_GROUP_SIZE = 256;
+// Local work group size of the Hi-Z compute shaders
+static const unsigned int HIZ_WORK_GROUP_SIZE = 8;
+// Bounding sphere radius of the unit cube
+static const float CUBE_BOUNDING_RADIUS = 0.8660254f;
+// Texture unit used by the culling shaders, unit 0 holds the cube texture
+static const GLuint HIZ_TEXTURE_UNIT = 1;
+
+bool GpuDrivenBackend::IsSupported() const
+{
+  // Programs are only created when the context is OpenGL 4.6
+  return shaderProgram[ShaderProgram::GpuDrivenInstancing] != 0 && _maxInstances > 0;
+}
+
+void GpuDrivenBackend::SetCamera(const Camera &camera)
+{
+  _viewProjection = camera.GetProjection() * camera.GetWorldToView();
+  _viewPos = camera.GetViewToWorld()[3];
+
+  // Extract the frustum planes from the view-projection matrix
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; ++i)
+    rows[i] = glm::vec4(_viewProjection[0][i], _viewProjection[1][i], _viewProjection[2][i], _viewProjection[3][i]);
+
+  // Left, right, bottom, top, near, far (depth range is [-1, 1])
+  _frustumPlanes[0] = rows[3] + rows[0];
+  _frustumPlanes[1] = rows[3] - rows[0];
+  _frustumPlanes[2] = rows[3] + rows[1];
+  _frustumPlanes[3] = rows[3] - rows[1];
+  _frustumPlanes[4] = rows[3] + rows[2];
+  _frustumPlanes[5] = rows[3] - rows[2];
+  for (int i = 0; i < 6; ++i)
+    _frustumPlanes[i] /= glm::length(glm::vec3(_frustumPlanes[i]));
+
+  // Pixels per world unit at the unit distance for the LOD selection
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  _pixelsPerUnit = 0.5f * camera.GetProjection()[1][1] * viewport[3];
+}
+
+bool GpuDrivenBackend::GetStatsText(char *text, size_t length) const
+{
+  if (!_statsValid)
+    return false;
+
+  snprintf(text, length, "visible %u + %u billboards, culled %u frustum + %u occlusion",
+           _stats.visible[0], _stats.visible[1], _stats.frustumCulled, _stats.occlusionCulled);
+  return true;
+}
+
+void GpuDrivenBackend::Init(Mesh<Vertex_Pos_Tex> &/*mesh*/)
+{
+  if (shaderProgram[ShaderProgram::GpuDrivenInstancing] == 0)
+    return;
+
+  // The bounds are the largest per instance storage, 16 B each
+  GLint64 maxBlockSize = 0;
+  glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlockSize);
+  _maxInstances = static_cast<unsigned int>(std::min<GLint64>(GPU_MAX_INSTANCES, maxBlockSize / sizeof(glm::vec4)));
+
+  // Counters start at zero, the finalize pass resets them each frame
+  const GLuint zeros[CULL_DATA_SIZE] = {};
+  glGenBuffers(1, &_cullBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _cullBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(zeros), zeros, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  glGenBuffers(1, &_boundsBuffer);
+  glGenBuffers(1, &_visibleBuffer);
+
+  // Coherent persistent mapping, the stats are visible once the fence is signaled
+  const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glGenBuffers(1, &_statsRing);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, _statsRing);
+  glBufferStorage(GL_COPY_WRITE_BUFFER, STATS_RING_SIZE * STATS_SIZE * sizeof(GLuint), nullptr, flags);
+  _statsData = static_cast<const GLuint*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, STATS_RING_SIZE * STATS_SIZE * sizeof(GLuint), flags));
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  if (!_statsData)
+    printf("Failed to map the culling stats readback ring!\n");
+}
+
+void GpuDrivenBackend::Release()
+{
+  for (unsigned int i = 0; i < STATS_RING_SIZE; ++i)
+  {
+    if (_statsFences[i])
+      glDeleteSync(_statsFences[i]);
+    _statsFences[i] = nullptr;
+  }
+
+  // Persistently mapped buffer can be deleted while mapped
+  glDeleteBuffers(1, &_statsRing);
+  glDeleteBuffers(1, &_boundsBuffer);
+  glDeleteBuffers(1, &_visibleBuffer);
+  glDeleteBuffers(1, &_cullBuffer);
+  glDeleteFramebuffers(1, &_hizFbo);
+  glDeleteTextures(1, &_hizDepth);
+  glDeleteTextures(1, &_hizTexture);
+}
+
+void GpuDrivenBackend::GenerateBounds(unsigned int numInstances)
+{
+  // Grow the instance buffers if needed, never shrink them
+  if (numInstances > _capacity)
+  {
+    _capacity = numInstances;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _boundsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _capacity * sizeof(glm::vec4), nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _visibleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_LODS * _capacity * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  }
+
+  GLuint program = shaderProgram[ShaderProgram::GpuBounds];
+  glUseProgram(program);
+  glUniform1ui(glGetUniformLocation(program, "pattern"), _params.pattern);
+  glUniform1ui(glGetUniformLocation(program, "instancesPerSide"), _params.instancesPerSide);
+  glUniform1ui(glGetUniformLocation(program, "seed"), _params.seed);
+  glUniform1f(glGetUniformLocation(program, "spacing"), _params.spacing);
+  glUniform1f(glGetUniformLocation(program, "boundingRadius"), CUBE_BOUNDING_RADIUS);
+  glUniform1ui(glGetUniformLocation(program, "numInstances"), numInstances);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _boundsBuffer);
+  glDispatchCompute((numInstances + GPU_WORK_GROUP_SIZE - 1) / GPU_WORK_GROUP_SIZE, 1, 1);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+
+  // Previous depth belongs to a different scene
+  _generatedParams = _params;
+  _hizValid = false;
+}
+
+void GpuDrivenBackend::ResizeHiZ(int width, int height)
+{
+  // Half resolution is plenty for the conservative test
+  width = std::max(width / 2, 1);
+  height = std::max(height / 2, 1);
+  if (_hizTexture && width == _hizWidth && height == _hizHeight)
+    return;
+
+  glDeleteFramebuffers(1, &_hizFbo);
+  glDeleteTextures(1, &_hizDepth);
+  glDeleteTextures(1, &_hizTexture);
+
+  _hizWidth = width;
+  _hizHeight = height;
+  _hizLevels = 1;
+  while ((std::max(width, height) >> _hizLevels) > 0)
+    ++_hizLevels;
+
+  // Depth of the visible instances
+  glGenTextures(1, &_hizDepth);
+  glBindTexture(GL_TEXTURE_2D, _hizDepth);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+
+  // Max depth pyramid, the texels are always fetched directly
+  glGenTextures(1, &_hizTexture);
+  glBindTexture(GL_TEXTURE_2D, _hizTexture);
+  glTexStorage2D(GL_TEXTURE_2D, _hizLevels, GL_R32F, width, height);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenFramebuffers(1, &_hizFbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, _hizFbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _hizDepth, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+    printf("Hi-Z framebuffer incomplete, status: 0x%x\n", status);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  _hizValid = false;
+}
+
+void GpuDrivenBackend::DrawVisible(Mesh<Vertex_Pos_Tex> &/*mesh*/)
+{
+  glUseProgram(shaderProgram[ShaderProgram::GpuDrivenInstancing]);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _boundsBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, _visibleBuffer);
+
+  // Both the commands and their count were written by the GPU
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _cullBuffer);
+  glBindBuffer(GL_PARAMETER_BUFFER, _cullBuffer);
+  glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<void*>(COMMANDS_OFFSET * sizeof(GLuint)),
+                                   DRAW_COUNT_OFFSET * sizeof(GLuint), NUM_LODS, 0);
+  glBindBuffer(GL_PARAMETER_BUFFER, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+}
+
+void GpuDrivenBackend::BuildHiZ(Mesh<Vertex_Pos_Tex> &mesh)
+{
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  // Render the depth of the visible instances, what was culled in this frame stays culled in the next one
+  // until it's disoccluded by the camera movement, which costs just a frame of latency
+  glBindFramebuffer(GL_FRAMEBUFFER, _hizFbo);
+  glViewport(0, 0, _hizWidth, _hizHeight);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  DrawVisible(mesh);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+  // Copy the depth to the top level of the pyramid
+  glUseProgram(shaderProgram[ShaderProgram::HiZCopy]);
+  glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_2D, _hizDepth);
+  glBindImageTexture(0, _hizTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+  glDispatchCompute((_hizWidth + HIZ_WORK_GROUP_SIZE - 1) / HIZ_WORK_GROUP_SIZE, (_hizHeight + HIZ_WORK_GROUP_SIZE - 1) / HIZ_WORK_GROUP_SIZE, 1);
+
+  // Reduce to the lower levels keeping the farthest depth
+  glUseProgram(shaderProgram[ShaderProgram::HiZDownsample]);
+  for (int level = 1; level < _hizLevels; ++level)
+  {
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    int width = std::max(_hizWidth >> level, 1);
+    int height = std::max(_hizHeight >> level, 1);
+    glBindImageTexture(0, _hizTexture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(1, _hizTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((width + HIZ_WORK_GROUP_SIZE - 1) / HIZ_WORK_GROUP_SIZE, (height + HIZ_WORK_GROUP_SIZE - 1) / HIZ_WORK_GROUP_SIZE, 1);
+  }
+
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+  glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  // The pyramid is fetched by the culling in the next frame
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+  _prevViewProjection = _viewProjection;
+  _hizValid = true;
+}
+
+void GpuDrivenBackend::ReadStats()
+{
+  if (!_statsData)
+    return;
+
+  // Copy the snapshot to the free slot, skip the frame if the ring is full
+  if (!_statsFences[_statsWriteSlot])
+  {
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, _cullBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _statsRing);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, STATS_OFFSET * sizeof(GLuint), _statsWriteSlot * STATS_SIZE * sizeof(GLuint), STATS_SIZE * sizeof(GLuint));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    _statsFences[_statsWriteSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _statsWriteSlot = (_statsWriteSlot + 1) % STATS_RING_SIZE;
+  }
+
+  // Consume the finished slots without waiting, the latest one wins
+  while (_statsFences[_statsReadSlot])
+  {
+    GLenum result = glClientWaitSync(_statsFences[_statsReadSlot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+      break;
+
+    glDeleteSync(_statsFences[_statsReadSlot]);
+    _statsFences[_statsReadSlot] = nullptr;
+
+    const GLuint *data = _statsData + _statsReadSlot * STATS_SIZE;
+    _stats.visible[0] = data[0];
+    _stats.visible[1] = data[1];
+    _stats.frustumCulled = data[2];
+    _stats.occlusionCulled = data[3];
+    _statsValid = true;
+
+    _statsReadSlot = (_statsReadSlot + 1) % STATS_RING_SIZE;
+  }
+}
+
+size_t GpuDrivenBackend::Draw(Mesh<Vertex_Pos_Tex> &mesh, const InstanceStore<InstanceData> &/*instances*/)
+{
+  const unsigned int numInstances = _params.instancesPerSide * _params.instancesPerSide * _params.instancesPerSide;
+  if (!IsSupported() || numInstances > _maxInstances)
+    return 0;
+
+  // Instances live on the GPU only, bounds are regenerated when the pattern changes
+  if (_generatedParams != _params)
+    GenerateBounds(numInstances);
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  ResizeHiZ(viewport[2], viewport[3]);
+
+  // --------------------------------------------------------------------------
+
+  // Cull and compact the visible instances
+  float lodDistance = 2.0f * CUBE_BOUNDING_RADIUS * _pixelsPerUnit / LOD_BILLBOARD_PIXELS;
+
+  GLuint program = shaderProgram[ShaderProgram::GpuCull];
+  glUseProgram(program);
+  glUniform1ui(glGetUniformLocation(program, "numInstances"), numInstances);
+  glUniform1ui(glGetUniformLocation(program, "listCapacity"), _capacity);
+  glUniform4fv(glGetUniformLocation(program, "frustumPlanes"), 6, glm::value_ptr(_frustumPlanes[0]));
+  glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, glm::value_ptr(_viewPos));
+  glUniform1f(glGetUniformLocation(program, "lodDistanceSq"), lodDistance * lodDistance);
+  glUniform1i(glGetUniformLocation(program, "occlusionEnabled"), _hizValid ? 1 : 0);
+  glUniformMatrix4fv(glGetUniformLocation(program, "prevViewProjection"), 1, GL_FALSE, glm::value_ptr(_prevViewProjection));
+  glUniform1i(glGetUniformLocation(program, "hizLevels"), _hizLevels);
+
+  glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_2D, _hizTexture);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _boundsBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _cullBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, _visibleBuffer);
+
+  // Make sure the generated bounds are visible to the culling shader
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  glDispatchCompute((numInstances + GPU_WORK_GROUP_SIZE - 1) / GPU_WORK_GROUP_SIZE, 1, 1);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  // Turn the counters into the draw commands, the empty LODs are left out of the draw count
+  program = shaderProgram[ShaderProgram::GpuFinalize];
+  glUseProgram(program);
+  const GLuint indexCounts[NUM_LODS] = {static_cast<GLuint>(mesh.GetIBOSize()), 6};
+  // Billboard is the front face of the cube, i.e., the third one in the index buffer
+  const GLuint firstIndices[NUM_LODS] = {0, 12};
+  glUniform1uiv(glGetUniformLocation(program, "indexCounts"), NUM_LODS, indexCounts);
+  glUniform1uiv(glGetUniformLocation(program, "firstIndices"), NUM_LODS, firstIndices);
+  glUniform1ui(glGetUniformLocation(program, "listCapacity"), _capacity);
+
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  glDispatchCompute(1, 1, 1);
+
+  for (GLuint i = 0; i < 3; ++i)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+
+  // Draw commands are consumed by the indirect draws, lists by the vertex shader
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // --------------------------------------------------------------------------
+
+  DrawVisible(mesh);
+  BuildHiZ(mesh);
+  ReadStats();
+
+  // Nothing but the uniforms is sent from the CPU
+  return 0;
+}
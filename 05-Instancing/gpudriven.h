@@ -0,0 +1,113 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include "backends.h"
+
+// GPU driven instancing, requires OpenGL 4.6: instance bounds are generated into a storage buffer
+// once per pattern, each frame a compute pass culls them against the frustum and the Hi-Z pyramid
+// of the previous frame, selects the LOD and compacts the visible instances into per LOD lists,
+// draw commands and their count are written by the GPU as well
+class GpuDrivenBackend : public InstancingBackend
+{
+public:
+  // Maximum number of instances, the storage buffers may limit it further
+  static const unsigned int GPU_MAX_INSTANCES = 256 * 256 * 256;
+  // Number of LODs: full cube and camera facing billboard
+  static const unsigned int NUM_LODS = 2;
+  // Cubes projected to less pixels than this are drawn as billboards
+  static constexpr float LOD_BILLBOARD_PIXELS = 24.0f;
+  // Number of slots in the stats readback ring
+  static const unsigned int STATS_RING_SIZE = 3;
+  // Layout of the cull data buffer in uints, must match the culling compute shaders
+  static const unsigned int COUNTERS_OFFSET = 0;    // visible per LOD, frustum culled, occlusion culled
+  static const unsigned int DRAW_COUNT_OFFSET = 4;  // number of the draw commands
+  static const unsigned int COMMANDS_OFFSET = 8;    // compacted draw commands
+  static const unsigned int STATS_OFFSET = COMMANDS_OFFSET + NUM_LODS * 5; // snapshot of the counters
+  static const unsigned int STATS_SIZE = 4;
+  static const unsigned int CULL_DATA_SIZE = STATS_OFFSET + STATS_SIZE;
+
+  // Culling results of a single frame
+  struct CullStats
+  {
+    // Number of visible instances per LOD
+    GLuint visible[NUM_LODS];
+    // Number of instances outside of the frustum
+    GLuint frustumCulled;
+    // Number of instances hidden behind the previous frame depth
+    GLuint occlusionCulled;
+  };
+
+  GpuDrivenBackend() {}
+
+  const char *GetName() const override { return "GPU driven"; }
+  bool IsSupported() const override;
+  unsigned int GetMaxInstances() const override { return _maxInstances; }
+  bool ReadsInstanceData() const override { return false; }
+  void SetGenerator(const GeneratorParams &params) override { _params = params; }
+  void SetCamera(const Camera &camera) override;
+  bool GetStatsText(char *text, size_t length) const override;
+  void Init(Mesh<Vertex_Pos_Tex> &mesh) override;
+  void Release() override;
+  size_t Draw(Mesh<Vertex_Pos_Tex> &mesh, const InstanceStore<InstanceData> &instances) override;
+
+private:
+  // No copies allowed
+  GpuDrivenBackend(const GpuDrivenBackend &);
+  GpuDrivenBackend & operator = (const GpuDrivenBackend &);
+
+  // Generates the instance bounds of the current pattern
+  void GenerateBounds(unsigned int numInstances);
+  // Recreates the Hi-Z pyramid if the viewport size changed
+  void ResizeHiZ(int width, int height);
+  // Builds the Hi-Z pyramid from the depth of the visible instances
+  void BuildHiZ(Mesh<Vertex_Pos_Tex> &mesh);
+  // Issues the indirect draws of the visible instances
+  void DrawVisible(Mesh<Vertex_Pos_Tex> &mesh);
+  // Copies the culling stats to the readback ring and consumes the finished slots
+  void ReadStats();
+
+  // Maximum number of instances the buffers can hold
+  unsigned int _maxInstances = 0;
+  // Capacity of the instance buffers
+  unsigned int _capacity = 0;
+  // Current generator parameters and the ones the bounds were generated with
+  GeneratorParams _params;
+  GeneratorParams _generatedParams = {Pattern::NumPatterns};
+  // Camera data of this and the previous frame
+  glm::mat4 _viewProjection = glm::mat4(1.0f);
+  glm::mat4 _prevViewProjection = glm::mat4(1.0f);
+  glm::vec4 _frustumPlanes[6];
+  glm::vec3 _viewPos = glm::vec3(0.0f);
+  float _pixelsPerUnit = 1.0f;
+
+  // Instance bounds: center and radius
+  GLuint _boundsBuffer = 0;
+  // Visible instance lists, one per LOD
+  GLuint _visibleBuffer = 0;
+  // Counters, draw commands and draw count
+  GLuint _cullBuffer = 0;
+
+  // Hi-Z pyramid of the previous frame and the depth it's built from
+  GLuint _hizTexture = 0;
+  GLuint _hizDepth = 0;
+  GLuint _hizFbo = 0;
+  int _hizWidth = 0;
+  int _hizHeight = 0;
+  int _hizLevels = 0;
+  // Is the pyramid usable for the occlusion culling?
+  bool _hizValid = false;
+
+  // Persistently mapped stats readback ring
+  GLuint _statsRing = 0;
+  const GLuint *_statsData = nullptr;
+  GLsync _statsFences[STATS_RING_SIZE] = {};
+  unsigned int _statsWriteSlot = 0;
+  unsigned int _statsReadSlot = 0;
+  // Latest consumed stats
+  CullStats _stats = {};
+  bool _statsValid = false;
+};
@@ -15,13 +15,9 @@
 #include <Geometry.h>
 #include <Textures.h>
 
+#include "backends.h"
 #include "shaders.h"
 
-// Chooses instancing method, there's also third via SSBO which requires OpenGL 4.3
-// (see _ALLOW_SSBO_INSTANCING in shaders.h)
-#define _VERTEX_PARAMS_INSTANCING 0
-#define _UNIFORM_BLOCK_INSTANCING 1
-
 // Set to 1 to create debugging context that reports errors, requires OpenGL 4.3!
 #define _ENABLE_OPENGL_DEBUG 0
 
@@ -93,13 +89,6 @@ static constexpr float CameraTurboSpeed = 50.0f;
 
 // ----------------------------------------------------------------------------
 
-#if _UNIFORM_BLOCK_INSTANCING
-// Maximum number of instances per single instanced draw call
-static const unsigned int MAX_INSTANCE_CHAIN_LENGTH = 1024; // must match the instancing vertex shader!
-#endif
-
-// Maximum number of allowed instances - SSBO can be up to 128 MB! - it'd be safer to ask driver, though
-static const unsigned int MAX_INSTANCES = 1000000;
 // Max buffer length
 static const unsigned int MAX_TEXT_LENGTH = 256;
 // MSAA samples
@@ -117,25 +106,39 @@ GLuint checkerTex = 0;
 bool vsync = true;
 // Depth test on?
 bool depthTest = true;
-// Use instancing?
-bool useInstancing = false;
+// All instancing methods, switchable at runtime
+InstancingBackend *backends[Backend::NumBackends] = {nullptr};
+// Currently used instancing method
+int currentBackend = Backend::UniformBlock;
+// Benchmark sweeping all instancing methods
+InstancingBenchmark benchmark;
 // Current number of instances per cube side in the scene
 int instancesPerSide = 1;
 // Current number of instances in the scene
 int numInstances = 1;
-// Instancing buffer handle
-GLuint instancingBuffer = 0;
+// Parameters of the instance pattern
+GeneratorParams generator;
+// CPU side instance data, only rebuilt when the pattern changes
+InstanceStore<InstanceData> instances;
+// Pattern the CPU side instance data were generated with, none yet
+GeneratorParams instancesGenerator = {Pattern::NumPatterns};
 // Transformation matrices uniform buffer object
 GLuint transformBlockUBO = 0;
 
-// Data for a single object instance
-struct InstanceData
+// ----------------------------------------------------------------------------
+
+// Returns true if the instancing method can render the current number of instances, methods reading
+// the CPU side instance data are limited by MAX_INSTANCES
+bool canRender(int backend)
 {
-  // In this simple example just a transformation matrix, transposed for efficient storage
-  glm::mat3x4 transformation;
-};
+  if (!backends[backend]->IsSupported())
+    return false;
 
-// ----------------------------------------------------------------------------
+  if (backends[backend]->ReadsInstanceData())
+    return numInstances <= static_cast<int>(MAX_INSTANCES);
+
+  return backend != Backend::GpuDriven || numInstances <= static_cast<int>(backends[backend]->GetMaxInstances());
+}
 
 // Callback for handling GLFW errors
 void errorCallback(int error, const char* description)
@@ -220,10 +223,26 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
       glfwSwapInterval(0);
   }
 
-  // Enable/disable vsync
-  if (key == GLFW_KEY_F6 && action == GLFW_PRESS)
+  // Cycle through the supported instancing methods
+  if (key == GLFW_KEY_F6 && action == GLFW_PRESS && !benchmark.IsRunning())
+  {
+    do
+    {
+      currentBackend = (currentBackend + 1) % Backend::NumBackends;
+    } while (!canRender(currentBackend));
+  }
+
+  // Run the benchmark of all instancing methods, vsync is disabled for the run
+  if (key == GLFW_KEY_F7 && action == GLFW_PRESS && !benchmark.IsRunning())
   {
-    useInstancing = !useInstancing;
+    glfwSwapInterval(0);
+    benchmark.Start(backends);
+  }
+
+  // Cycle through the instance patterns
+  if (key == GLFW_KEY_F8 && action == GLFW_PRESS)
+  {
+    generator.pattern = (generator.pattern + 1) % Pattern::NumPatterns;
   }
 
   // Zoom in
@@ -281,7 +300,17 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     instancesPerSide = 100;
   }
 
+  // Ten million cubes, only for the methods generating the instances on the GPU
+  if (key == GLFW_KEY_7 && action == GLFW_PRESS && !benchmark.IsRunning())
+  {
+    instancesPerSide = 216;
+  }
+
   numInstances = instancesPerSide * instancesPerSide * instancesPerSide;
+
+  // Switch to a method that can handle the instance count
+  if (!canRender(currentBackend))
+    currentBackend = canRender(Backend::GpuDriven) ? Backend::GpuDriven : Backend::Procedural;
 }
 
 // ----------------------------------------------------------------------------
@@ -292,58 +321,12 @@ void createGeometry()
   // Prepare meshes
   cube = Geometry::CreateCubeTex();
 
-#if _VERTEX_PARAMS_INSTANCING
-  // Bind and update the VAO with instanced vertex attributes
-  glBindVertexArray(cube->GetVAO());
-
-  // Generate the instancing buffer but don't fill it with data
-  glGenBuffers(1, &instancingBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, instancingBuffer);
-  glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCES * sizeof(InstanceData), nullptr, GL_DYNAMIC_DRAW);
-
-  // Enable the instanced vertex attributes, that's a matrix so we need to enable 3 additional
-  // attributes, once per each row of the instance transformation matrix. Bear in mind that
-  // the number of available attributes (vec4) per vertex is limited to 16
-  glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), reinterpret_cast<void*>(0));
-  glEnableVertexAttribArray(2);
-  glVertexAttribDivisor(2, 1); // Tell OpenGL to update this attribute for each instance
-
-  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), reinterpret_cast<void*>(sizeof(glm::vec4)));
-  glEnableVertexAttribArray(3);
-  glVertexAttribDivisor(3, 1); // Tell OpenGL to update this attribute for each instance
-
-  glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), reinterpret_cast<void*>(2 * sizeof(glm::vec4)));
-  glEnableVertexAttribArray(4);
-  glVertexAttribDivisor(4, 1); // Tell OpenGL to update this attribute for each instance
-
-  // Unbind the VAO
-  glBindVertexArray(0);
-#elif _ALLOW_SSBO_INSTANCING
-  // Generate the instancing buffer but don't fill it with data
-  glGenBuffers(1, &instancingBuffer);
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, instancingBuffer);
-  glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_INSTANCES * sizeof(InstanceData), nullptr, GL_DYNAMIC_DRAW);
-
-  // Unbind the buffer for now
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-#elif _UNIFORM_BLOCK_INSTANCING
+  // Create all instancing methods and their buffers
+  for (int i = 0; i < Backend::NumBackends; ++i)
   {
-    // Generate the instancing buffer as Uniform Buffer Object
-    glGenBuffers(1, &instancingBuffer);
-    glBindBuffer(GL_UNIFORM_BUFFER, instancingBuffer);
-
-    // Obtain UBO index and size from the instancing shader program
-    GLuint uboIndex = glGetUniformBlockIndex(shaderProgram[ShaderProgram::InstancingUniformBlock], "InstanceBuffer");
-    GLint uboSize = 0;
-    glGetActiveUniformBlockiv(shaderProgram[ShaderProgram::InstancingUniformBlock], uboIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &uboSize);
-
-    // Describe the buffer data - we're going to change this every frame
-    glBufferData(GL_UNIFORM_BUFFER, uboSize, nullptr, GL_DYNAMIC_DRAW);
-
-    // Unbind the GL_UNIFORM_BUFFER target for now
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    backends[i] = CreateBackend(i);
+    backends[i]->Init(*cube);
   }
-#endif
 
   // Generate the transform UBO handle
   glGenBuffers(1, &transformBlockUBO);
@@ -380,14 +363,9 @@ bool initOpenGL()
   // Initialize the GLFW library
   if (!glfwInit()) return false;
 
-  // Request OpenGL 3.3 core profile upon window creation
-#if _ALLOW_SSBO_INSTANCING
+  // Request OpenGL 4.6 core profile upon window creation so that all instancing methods are available
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
-#else
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-#endif
   glfwWindowHint(GLFW_SAMPLES, MSAA_SAMPLES);
 #if _ENABLE_OPENGL_DEBUG
   glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
@@ -397,6 +375,13 @@ bool initOpenGL()
   // Create the window
   mainWindow.handle = glfwCreateWindow(Window::DefaultWidth, Window::DefaultHeight, "", nullptr, nullptr);
   if (mainWindow.handle == nullptr)
+  {
+    // Fall back to OpenGL 3.3, SSBO instancing won't be available
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    mainWindow.handle = glfwCreateWindow(Window::DefaultWidth, Window::DefaultHeight, "", nullptr, nullptr);
+  }
+  if (mainWindow.handle == nullptr)
   {
     printf("Failed to create the GLFW window!");
     return false;
@@ -419,18 +404,6 @@ bool initOpenGL()
   glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, &unusedIds, true);
 #endif
 
-#if _UNIFORM_BLOCK_INSTANCING
-  // Check for available UBO size in bytes
-  GLint maxUboSize;
-  const GLint expectedUboSize = 4096 * 4 * 4;
-  glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxUboSize);
-  if (maxUboSize < expectedUboSize)
-  {
-    printf("Implementation allowed UBO size: %d B smaller than expected (%d B)!", maxUboSize, expectedUboSize);
-    return false;
-  }
-#endif
-
   // Enable vsync
   if (vsync)
     glfwSwapInterval(1);
@@ -476,8 +449,15 @@ void shutDown()
   delete cube;
   cube = nullptr;
 
-  // Release the instancing buffer
-  glDeleteBuffers(1, &instancingBuffer);
+  // Release the instancing methods
+  for (int i = 0; i < Backend::NumBackends; ++i)
+  {
+    if (backends[i])
+      backends[i]->Release();
+    delete backends[i];
+    backends[i] = nullptr;
+  }
+  benchmark.Release();
 
   // Release the window
   glfwDestroyWindow(mainWindow.handle);
@@ -543,21 +523,16 @@ void processInput(float dt)
 // Helper method to update transformation uniform block
 void updateTransformBlock()
 {
-  // Tell OpenGL we want to work with our transform block
-  glBindBuffer(GL_UNIFORM_BUFFER, transformBlockUBO);
-
-  // Note: we should properly obtain block members size and offset via
-  // glGetActiveUniformBlockiv() with GL_UNIFORM_SIZE, GL_UNIFORM_OFFSET,
-  // I'm yoloing it here...
-
   // Update the world to view transformation matrix - transpose to 3 columns, 4 rows for storage in an uniform block:
   // per std140 layout column matrix CxR is stored as an array of C columns with R elements, i.e., 4x3 matrix would
   // waste space because it would require padding to vec4
-  glm::mat3x4 worldToView = glm::transpose(camera.GetWorldToView());
-  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat3x4), static_cast<const void*>(&*glm::value_ptr(worldToView)));
+  TransformBlock block;
+  block.worldToView = glm::transpose(camera.GetWorldToView());
+  block.projection = camera.GetProjection();
 
-  // Update the projection matrix
-  glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat3x4), sizeof(glm::mat4x4), static_cast<const void*>(&*glm::value_ptr(camera.GetProjection())));
+  // The struct layout was verified against the shaders when linking them, so it goes in with a single call
+  glBindBuffer(GL_UNIFORM_BUFFER, transformBlockUBO);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(TransformBlock), &block);
 
   // Unbind the GL_UNIFORM_BUFFER target for now
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
@@ -597,107 +572,53 @@ void renderScene()
   // Bind the Vertex Array Object
   glBindVertexArray(cube->GetVAO());
 
-  // Create transformation matrix - 4 columns, 3 rows, last (0, 0, 0, 1) implicit to save space
-  glm::mat4x3 transformation = glm::mat4x3(1.0f);
-  // Instance data CPU side buffer
-  static std::vector<InstanceData> instanceData(MAX_INSTANCES);
-
-  updateTransformBlock();
-
-  if (useInstancing)
+  // Benchmark overrides the instancing method and the number of instances
+  int backend = currentBackend;
+  if (benchmark.IsRunning())
   {
-    // Update transformation matrices for all cubes
-    for (int x = 0; x < instancesPerSide; ++x)
-    {
-      for (int y = 0; y < instancesPerSide; ++y)
-      {
-        for (int z = 0; z < instancesPerSide; ++z)
-        {
-          transformation = glm::translate(glm::vec3((float)(2 * x - instancesPerSide), (2 * y - instancesPerSide), (float)(2 * z - instancesPerSide)));
-          instanceData[x + instancesPerSide * (y + instancesPerSide * z)].transformation = glm::transpose(transformation);
-        }
-      }
-    }
-
-    // Update the instance data
-#if _VERTEX_PARAMS_INSTANCING
-    // It is possible to update the buffer using the glBufferSubData() call but that may incur overhead. So unless you have very
-    // good reason like updating only part of the buffer, the latter method is advised
-    //glBufferSubData(GL_ARRAY_BUFFER, 0, numInstances * sizeof(InstanceData), static_cast<void*>(&*instanceData.begin()));
-
-    // Map the whole buffer to the system memory, perform memcpy and unmap - beware of reading the buffer -> it incurs slowdown
-    void *ptr = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-    memcpy(ptr, &*instanceData.begin(), numInstances * sizeof(InstanceData));
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-
-    // Select shader program
-    glUseProgram(shaderProgram[ShaderProgram::VertexParamInstancing]);
-
-    // Draw all cubes
-    glDrawElementsInstanced(GL_TRIANGLES, cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), numInstances);
-#elif _UNIFORM_BLOCK_INSTANCING
-    // Bind the whole instancing buffer to the index 1
-    glBindBufferBase(GL_UNIFORM_BUFFER, 1, instancingBuffer);
-
-    // Select shader program
-    glUseProgram(shaderProgram[ShaderProgram::InstancingUniformBlock]);
-
-    // Build instance chains and render them
-    for (int offset = 0, remaining = numInstances; remaining > 0; offset += MAX_INSTANCE_CHAIN_LENGTH, remaining -= MAX_INSTANCE_CHAIN_LENGTH)
-    {
-      const int unsigned chainLength = std::min((unsigned int)remaining, MAX_INSTANCE_CHAIN_LENGTH);
-
-      // Update the buffer data using mapping
-      void *ptr = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-      memcpy(ptr, &*(instanceData.begin() + offset), chainLength * sizeof(InstanceData));
-      glUnmapBuffer(GL_UNIFORM_BUFFER);
+    backend = benchmark.GetBackend();
+    instancesPerSide = benchmark.GetInstancesPerSide();
+    numInstances = instancesPerSide * instancesPerSide * instancesPerSide;
+  }
 
-      // Draw the instance chain
-      glDrawElementsInstanced(GL_TRIANGLES, cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), chainLength);
-    }
+  updateTransformBlock();
 
-    // Unbind the instancing buffer
-    glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
-#elif _ALLOW_SSBO_INSTANCING
-    // Bind the whole instancing buffer to the index 0
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instancingBuffer);
+  generator.instancesPerSide = instancesPerSide;
 
-    // Update the buffer data using mapping
-    void *ptr = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_WRITE_ONLY);
-    memcpy(ptr, &*instanceData.begin(), numInstances * sizeof(InstanceData));
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+  // Generate the instances on the CPU only when the pattern changes and the method reads them,
+  // procedural method evaluates the pattern in the vertex shader
+  if (backends[backend]->ReadsInstanceData() && instancesGenerator != generator)
+  {
+    instancesGenerator = generator;
 
-    // Select shader program
-    glUseProgram(shaderProgram[ShaderProgram::InstancingBuffer]);
+    // Resize the store if needed, all instances become dirty
+    if (instances.GetCount() != static_cast<unsigned int>(numInstances))
+      instances.Resize(numInstances);
+    else
+      instances.MarkAllDirty();
 
-    // Draw all cubes
-    glDrawElementsInstanced(GL_TRIANGLES, cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), numInstances);
+    // Create transformation matrix - 4 columns, 3 rows, last (0, 0, 0, 1) implicit to save space
+    instances.Update([](unsigned int i, InstanceData &data)
+    {
+      glm::mat4x3 transformation(glm::translate(GeneratePosition(generator, i)));
+      data.transformation = glm::transpose(transformation);
+    });
 
-    // Unbind the instancing buffer
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
-#endif
+    // Backends track the changes via the store version
+    instances.ClearDirty();
   }
-  else
-  {
-    // Select shader program
-    glUseProgram(shaderProgram[ShaderProgram::Default]);
+  backends[backend]->SetGenerator(generator);
+  backends[backend]->SetCamera(camera);
 
-    for (int x = 0; x < instancesPerSide; ++x)
-    {
-      for (int y = 0; y < instancesPerSide; ++y)
-      {
-        for (int z = 0; z < instancesPerSide; ++z)
-        {
-          // Update transformation matrix for the cube
-          transformation = glm::translate(glm::vec3((float)(2 * x - instancesPerSide), (2 * y - instancesPerSide), (float)(2 * z - instancesPerSide)));
-          glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(transformation));
+  // Upload the instance data and draw all cubes using the selected method
+  bool benchmarkRunning = benchmark.IsRunning();
+  benchmark.BeginDraw();
+  size_t uploadBytes = backends[backend]->Draw(*cube, instances);
+  benchmark.EndDraw(uploadBytes);
 
-          // Draw the cube
-          glDrawElements(GL_TRIANGLES, cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
-        }
-      }
-    }
-  }
+  // Restore the vsync once the benchmark is done
+  if (benchmarkRunning && !benchmark.IsRunning())
+    glfwSwapInterval(vsync ? 1 : 0);
 
   // --------------------------------------------------------------------------
 
@@ -720,8 +641,12 @@ void mainLoop()
 
     // Print it to the title bar
     static char title[MAX_TEXT_LENGTH];
-    static char instacing[] = "[Instancing] ";
-    snprintf(title, MAX_TEXT_LENGTH, "%sNum cubes = %d, dt = %.2fms, FPS = %.1f", useInstancing ? instacing : "", numInstances, dt * 1000.0f, 1.0f / dt);
+    static char stats[MAX_TEXT_LENGTH];
+    const InstancingBackend *titleBackend = backends[benchmark.IsRunning() ? benchmark.GetBackend() : currentBackend];
+    bool hasStats = titleBackend->GetStatsText(stats, MAX_TEXT_LENGTH);
+    snprintf(title, MAX_TEXT_LENGTH, "%s[%s] %s, Num cubes = %d, dt = %.2fms, FPS = %.1f%s%s", benchmark.IsRunning() ? "[Benchmark] " : "",
+             titleBackend->GetName(), GetPatternName(generator.pattern), numInstances, dt * 1000.0f, 1.0f / dt,
+             hasStats ? ", " : "", hasStats ? stats : "");
     glfwSetWindowTitle(mainWindow.handle, title);
 
     // Poll the events like keyboard, mouse, etc.
@@ -11,9 +11,12 @@ bool compileShaders()
 {
   GLuint vertexShader[VertexShader::NumVertexShaders] = {0};
   GLuint fragmentShader[FragmentShader::NumFragmentShaders] = {0};
+  GLuint computeShader[ComputeShader::NumComputeShaders] = {0};
+  // Half encoding variant of the compact instancing vertex shader
+  GLuint compactHalfShader = 0;
 
   // Cleanup lambda
-  auto cleanUp = [&vertexShader, &fragmentShader]()
+  auto cleanUp = [&vertexShader, &fragmentShader, &computeShader, &compactHalfShader]()
   {
     // First detach shaders from programs
     GLsizei count = 0;
@@ -36,11 +39,20 @@ bool compileShaders()
         glDeleteShader(vertexShader[i]);
     }
 
+    if (glIsShader(compactHalfShader))
+      glDeleteShader(compactHalfShader);
+
     for (int i = 0; i < FragmentShader::NumFragmentShaders; ++i)
     {
       if (glIsShader(fragmentShader[i]))
         glDeleteShader(fragmentShader[i]);
     }
+
+    for (int i = 0; i < ComputeShader::NumComputeShaders; ++i)
+    {
+      if (glIsShader(computeShader[i]))
+        glDeleteShader(computeShader[i]);
+    }
   };
 
   // UBO explicit binding lambda - call after program linking
@@ -52,14 +64,23 @@ bool compileShaders()
     glUniformBlockBinding(program, uboIndex, binding);
   };
 
-  // Compile all vertex shaders
-#if _ALLOW_SSBO_INSTANCING
-  const int numVertexShaders = VertexShader::NumVertexShaders;
-#else
-  const int numVertexShaders = VertexShader::InstancingBuffer;
-#endif
-  for (int i = 0; i < numVertexShaders; ++i)
+  // Compact instancing requires OpenGL 4.2 for the unpacking functions
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  const bool compactSupported = major > 4 || (major == 4 && minor >= 2);
+  // SSBO instancing requires OpenGL 4.3
+  const bool ssboSupported = major > 4 || (major == 4 && minor >= 3);
+  // GPU driven instancing requires OpenGL 4.6 for the indirect draw count and the draw parameters
+  const bool gpuDrivenSupported = major > 4 || (major == 4 && minor >= 6);
+
+  // Compile all vertex shaders the context supports
+  for (int i = 0; i < VertexShader::NumVertexShaders; ++i)
   {
+    if ((i == VertexShader::InstancingCompactBlock && !compactSupported) || (i == VertexShader::InstancingBuffer && !ssboSupported) ||
+        (i == VertexShader::GpuDrivenInstancing && !gpuDrivenSupported))
+      continue;
+
     vertexShader[i] = ShaderCompiler::CompileShader(vsSource, i, GL_VERTEX_SHADER);
     if (!vertexShader[i])
     {
@@ -68,6 +89,17 @@ bool compileShaders()
     }
   }
 
+  // Both compact encodings share the same source
+  if (compactSupported)
+  {
+    compactHalfShader = ShaderCompiler::CompileShader(vsSource, VertexShader::InstancingCompactBlock, GL_VERTEX_SHADER, "#define HALF_INSTANCE_ENCODING\n");
+    if (!compactHalfShader)
+    {
+      cleanUp();
+      return false;
+    }
+  }
+
   // Compile all fragment shaders
   for (int i = 0; i < FragmentShader::NumFragmentShaders; ++i)
   {
@@ -79,6 +111,18 @@ bool compileShaders()
     }
   }
 
+  // Compile all compute shaders
+  const int numComputeShaders = gpuDrivenSupported ? ComputeShader::NumComputeShaders : 0;
+  for (int i = 0; i < numComputeShaders; ++i)
+  {
+    computeShader[i] = ShaderCompiler::CompileShader(csSource, i, GL_COMPUTE_SHADER);
+    if (!computeShader[i])
+    {
+      cleanUp();
+      return false;
+    }
+  }
+
   // Create all shader programs:
   shaderProgram[ShaderProgram::Default] = glCreateProgram();
   glAttachShader(shaderProgram[ShaderProgram::Default], vertexShader[VertexShader::Default]);
@@ -111,17 +155,93 @@ bool compileShaders()
   uniformBlockBinding(shaderProgram[ShaderProgram::InstancingUniformBlock]);
   uniformBlockBinding(shaderProgram[ShaderProgram::InstancingUniformBlock], "InstanceBuffer", 1);
 
-#if _ALLOW_SSBO_INSTANCING
-  shaderProgram[ShaderProgram::InstancingBuffer] = glCreateProgram();
-  glAttachShader(shaderProgram[ShaderProgram::InstancingBuffer], vertexShader[VertexShader::InstancingBuffer]);
-  glAttachShader(shaderProgram[ShaderProgram::InstancingBuffer], fragmentShader[FragmentShader::Default]);
-  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::InstancingBuffer]))
+  if (compactSupported)
+  {
+    shaderProgram[ShaderProgram::InstancingCompactBlock] = glCreateProgram();
+    glAttachShader(shaderProgram[ShaderProgram::InstancingCompactBlock], vertexShader[VertexShader::InstancingCompactBlock]);
+    glAttachShader(shaderProgram[ShaderProgram::InstancingCompactBlock], fragmentShader[FragmentShader::Default]);
+    if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::InstancingCompactBlock]))
+    {
+      cleanUp();
+      return false;
+    }
+    uniformBlockBinding(shaderProgram[ShaderProgram::InstancingCompactBlock]);
+    uniformBlockBinding(shaderProgram[ShaderProgram::InstancingCompactBlock], "InstanceBuffer", 1);
+
+    shaderProgram[ShaderProgram::InstancingCompactHalfBlock] = glCreateProgram();
+    glAttachShader(shaderProgram[ShaderProgram::InstancingCompactHalfBlock], compactHalfShader);
+    glAttachShader(shaderProgram[ShaderProgram::InstancingCompactHalfBlock], fragmentShader[FragmentShader::Default]);
+    if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::InstancingCompactHalfBlock]))
+    {
+      cleanUp();
+      return false;
+    }
+    uniformBlockBinding(shaderProgram[ShaderProgram::InstancingCompactHalfBlock]);
+    uniformBlockBinding(shaderProgram[ShaderProgram::InstancingCompactHalfBlock], "InstanceBuffer", 1);
+  }
+
+  shaderProgram[ShaderProgram::ProceduralInstancing] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::ProceduralInstancing], vertexShader[VertexShader::ProceduralInstancing]);
+  glAttachShader(shaderProgram[ShaderProgram::ProceduralInstancing], fragmentShader[FragmentShader::Default]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::ProceduralInstancing]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::ProceduralInstancing]);
+  uniformBlockBinding(shaderProgram[ShaderProgram::ProceduralInstancing], "ProceduralBlock", 2);
+
+  if (ssboSupported)
+  {
+    shaderProgram[ShaderProgram::InstancingBuffer] = glCreateProgram();
+    glAttachShader(shaderProgram[ShaderProgram::InstancingBuffer], vertexShader[VertexShader::InstancingBuffer]);
+    glAttachShader(shaderProgram[ShaderProgram::InstancingBuffer], fragmentShader[FragmentShader::Default]);
+    if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::InstancingBuffer]))
+    {
+      cleanUp();
+      return false;
+    }
+    uniformBlockBinding(shaderProgram[ShaderProgram::InstancingBuffer]);
+  }
+
+  if (gpuDrivenSupported)
+  {
+    shaderProgram[ShaderProgram::GpuDrivenInstancing] = glCreateProgram();
+    glAttachShader(shaderProgram[ShaderProgram::GpuDrivenInstancing], vertexShader[VertexShader::GpuDrivenInstancing]);
+    glAttachShader(shaderProgram[ShaderProgram::GpuDrivenInstancing], fragmentShader[FragmentShader::Default]);
+    if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::GpuDrivenInstancing]))
+    {
+      cleanUp();
+      return false;
+    }
+    uniformBlockBinding(shaderProgram[ShaderProgram::GpuDrivenInstancing]);
+
+    // Compute programs follow the compute shaders order
+    for (int i = 0; i < ComputeShader::NumComputeShaders; ++i)
+    {
+      GLuint &program = shaderProgram[ShaderProgram::GpuBounds + i];
+      program = glCreateProgram();
+      glAttachShader(program, computeShader[i]);
+      if (!ShaderCompiler::LinkProgram(program))
+      {
+        cleanUp();
+        return false;
+      }
+    }
+  }
+
+  // Check the C++ struct against the transform block of all linked programs, some of them don't use it at all
+  bool validBlocks = true;
+  for (int i = 0; i < ShaderProgram::NumShaderPrograms; ++i)
+  {
+    if (glIsProgram(shaderProgram[i]) && glGetUniformBlockIndex(shaderProgram[i], "TransformBlock") != GL_INVALID_INDEX)
+      validBlocks &= BlockLayout::Verify(shaderProgram[i], "TransformBlock", BlockLayout::Std140, transformBlockLayout, sizeof(TransformBlock));
+  }
+  if (!validBlocks)
   {
     cleanUp();
     return false;
   }
-  uniformBlockBinding(shaderProgram[ShaderProgram::InstancingBuffer]);
-#endif
 
   cleanUp();
   return true;
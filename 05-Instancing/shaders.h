@@ -5,26 +5,45 @@
 
 #pragma once
 
-#include <ShaderCompiler.h>
+#include <glm/glm.hpp>
 
-// Uses instancing via SSBO buffer, requires OpenGL 4.3 and higher
-#define _ALLOW_SSBO_INSTANCING 0
+#include <BlockLayout.h>
+#include <ShaderCompiler.h>
 
 // Shader programs
 namespace ShaderProgram
 {
   enum
   {
-    Default, VertexParamInstancing, InstancingUniformBlock, InstancingBuffer, NumShaderPrograms
+    Default, VertexParamInstancing, InstancingUniformBlock, InstancingCompactBlock, InstancingCompactHalfBlock,
+    ProceduralInstancing, InstancingBuffer, GpuDrivenInstancing, GpuBounds, GpuCull, GpuFinalize, HiZCopy,
+    HiZDownsample, NumShaderPrograms
   };
 }
 
 // Shader programs handle
 extern GLuint shaderProgram[ShaderProgram::NumShaderPrograms];
 
-// Helper function for creating and compiling the shaders
+// Helper function for creating and compiling the shaders, compact instancing programs are only created
+// when the context supports them (OpenGL 4.2 and higher), SSBO instancing program requires OpenGL 4.3,
+// GPU driven programs require OpenGL 4.6, verifies the transform block as well
 bool compileShaders();
 
+// Per-frame constants, uploaded at once
+struct TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  glm::mat3x4 worldToView;
+  glm::mat4x4 projection;
+};
+
+static constexpr BlockLayout::Member transformBlockLayout[] =
+{
+  BLOCK_MEMBER(TransformBlock, worldToView, Mat3x4),
+  BLOCK_MEMBER(TransformBlock, projection, Mat4x4)
+};
+static_assert(BlockLayout::IsValid(transformBlockLayout, sizeof(TransformBlock), BlockLayout::Std140), "TransformBlock doesn't follow std140 rules!");
+
 // ============================================================================
 
 // Vertex shader types
@@ -32,7 +51,8 @@ namespace VertexShader
 {
   enum
   {
-    Default, VertexParamInstancing, InstancingUniformBlock, InstancingBuffer, NumVertexShaders
+    Default, VertexParamInstancing, InstancingUniformBlock, InstancingCompactBlock, ProceduralInstancing, InstancingBuffer,
+    GpuDrivenInstancing, NumVertexShaders
   };
 }
 
@@ -50,7 +70,7 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
-// Uniform blocks, i.e., constants
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
 layout (std140, binding = 0) uniform TransformBlock
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
@@ -92,7 +112,7 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
-// Uniform blocks, i.e., constants
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
 layout (std140, binding = 0) uniform TransformBlock
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
@@ -133,7 +153,7 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
-// Uniform blocks, i.e., constants
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
 layout (std140, binding = 0) uniform TransformBlock
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
@@ -178,12 +198,214 @@ void main()
 }
 )",
 // ----------------------------------------------------------------------------
-// Instancing vertex shader using instancing buffer via SSBO
+// Instancing vertex shader using compact instance encoding via uniform buffer objects,
+// requires OpenGL 4.2 for the unpacking functions
 // ----------------------------------------------------------------------------
 R"(
-#version 460 core
+#version 420 core
 
-// Uniform blocks, i.e., constants
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
+layout (std140, binding = 0) uniform TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  mat3x4 worldToView;
+  mat4x4 projection;
+};
+
+// Vertex attribute block, i.e., input
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec2 texCoord;
+
+#ifdef HALF_INSTANCE_ENCODING
+// Must match CompactInstanceHalf on the CPU side: translation and scale as half4, quaternion as snorm16x4
+struct InstanceData
+{
+  uvec4 packedData;
+};
+
+// 16 B per instance, 4096 instances fill 64 kB
+const int CHAIN_LENGTH = 4096;
+#else
+// Must match CompactInstance on the CPU side: translation and scale as float4, quaternion as snorm16x4
+struct InstanceData
+{
+  vec4 translationScale;
+  uvec2 rotation;
+  uvec2 padding;
+};
+
+// 32 B per instance, 2048 instances fill 64 kB
+const int CHAIN_LENGTH = 2048;
+#endif
+
+// Uniform buffer used for instances
+layout (std140, binding = 1) uniform InstanceBuffer
+{
+  InstanceData instanceBuffer[CHAIN_LENGTH];
+};
+
+// Decodes the translation and uniform scale
+vec4 decodeTranslationScale(InstanceData data)
+{
+#ifdef HALF_INSTANCE_ENCODING
+  return vec4(unpackHalf2x16(data.packedData.x), unpackHalf2x16(data.packedData.y));
+#else
+  return data.translationScale;
+#endif
+}
+
+// Decodes the unit quaternion, renormalized to hide the quantization
+vec4 decodeRotation(InstanceData data)
+{
+#ifdef HALF_INSTANCE_ENCODING
+  uvec2 rotation = data.packedData.zw;
+#else
+  uvec2 rotation = data.rotation;
+#endif
+  return normalize(vec4(unpackSnorm2x16(rotation.x), unpackSnorm2x16(rotation.y)));
+}
+
+// Rotates the vector by the unit quaternion
+vec3 rotate(vec4 q, vec3 v)
+{
+  return v + 2.0f * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+// Vertex output
+out vec2 vTexCoord;
+
+void main()
+{
+  vTexCoord = texCoord;
+
+  // Decode the instance transformation
+  InstanceData data = instanceBuffer[gl_InstanceID];
+  vec4 translationScale = decodeTranslationScale(data);
+  vec4 rotation = decodeRotation(data);
+
+  // Scale, rotate and translate, no matrix needed
+  vec4 worldPos = vec4(rotate(rotation, position.xyz * translationScale.w) + translationScale.xyz, 1.0f);
+  vec4 viewPos = vec4(worldPos * worldToView, 1.0f);
+
+  gl_Position = projection * viewPos;
+}
+)",
+// ----------------------------------------------------------------------------
+// Instancing vertex shader generating the instances procedurally from gl_InstanceID
+// ----------------------------------------------------------------------------
+R"(
+#version 330 core
+
+// The following is not not needed since GLSL version #430
+#extension GL_ARB_explicit_uniform_location : require
+
+// The following is not not needed since GLSL version #420
+#extension GL_ARB_shading_language_420pack : require
+
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
+layout (std140, binding = 0) uniform TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  mat3x4 worldToView;
+  mat4x4 projection;
+};
+
+// Parameters of the instance generator, must match the GeneratorParams on the CPU side
+layout (std140, binding = 2) uniform ProceduralBlock
+{
+  // Generated pattern: grid, jittered grid, spiral, random
+  uint pattern;
+  // The pattern consists of instancesPerSide^3 instances
+  uint instancesPerSide;
+  // Seed of the jittered and random patterns
+  uint seed;
+  // Distance between neighbouring instances
+  float spacing;
+};
+
+// Vertex attribute block, i.e., input
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec2 texCoord;
+
+// Vertex output
+out vec2 vTexCoord;
+
+// Golden angle in radians
+const float GOLDEN_ANGLE = 2.39996323f;
+// Rotation of each spiral layer against the previous one
+const float SPIRAL_TWIST = 0.1f;
+// Pi, the spiral spans the same area as the grid
+const float PI = 3.14159265f;
+
+// PCG hash, must match the CPU version
+uint hash(uint v)
+{
+  uint state = v * 747796405u + 2891336453u;
+  uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// Uniform random vector from the [0, 1) range for the given instance
+vec3 random3(uint index)
+{
+  uint h0 = hash(index + hash(seed));
+  uint h1 = hash(h0);
+  uint h2 = hash(h1);
+  return vec3(h0 >> 8u, h1 >> 8u, h2 >> 8u) * (1.0f / 16777216.0f);
+}
+
+// Generates position of the instance, must match the CPU version
+vec3 generatePosition(uint index)
+{
+  uint n = instancesPerSide;
+  float halfExtent = 0.5f * float(n) * spacing;
+
+  if (pattern == 3u)
+  {
+    // Random: uniformly distributed in the grid volume
+    return (random3(index) - 0.5f) * 2.0f * halfExtent;
+  }
+
+  uint layerSize = n * n;
+  uint layer = index / layerSize;
+  uint j = index % layerSize;
+  if (pattern == 2u)
+  {
+    // Spiral: Fermat's spiral in each layer, every layer slightly twisted
+    float r = spacing * sqrt(float(j) / PI);
+    float angle = float(j) * GOLDEN_ANGLE + float(layer) * SPIRAL_TWIST;
+    return vec3(r * cos(angle), spacing * float(layer) - halfExtent, r * sin(angle));
+  }
+
+  // Grid, optionally jittered by up to a quarter of the spacing
+  vec3 p = vec3(uvec3(j % n, layer, j / n)) * spacing - halfExtent;
+  if (pattern == 1u)
+  {
+    p += (random3(index) - 0.5f) * 0.5f * spacing;
+  }
+  return p;
+}
+
+void main()
+{
+  vTexCoord = texCoord;
+
+  // Instances are just translated, no matrix needed
+  vec4 worldPos = vec4(position.xyz + generatePosition(uint(gl_InstanceID)), 1.0f);
+
+  // We must multiply from the left because of transposed worldToView
+  vec4 viewPos = vec4(worldPos * worldToView, 1.0f);
+
+  gl_Position = projection * viewPos;
+}
+)",
+// ----------------------------------------------------------------------------
+// Instancing vertex shader using instancing buffer via SSBO, requires OpenGL 4.3
+// ----------------------------------------------------------------------------
+R"(
+#version 430 core
+
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
 layout (std140, binding = 0) uniform TransformBlock
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
@@ -226,6 +448,62 @@ void main()
   gl_Position = projection * viewPos;
 }
 )",
+// ----------------------------------------------------------------------------
+// Instancing vertex shader drawing the visible instances of the GPU driven pipeline, requires OpenGL 4.6
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
+layout (std140, binding = 0) uniform TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  mat3x4 worldToView;
+  mat4x4 projection;
+};
+
+// Vertex attribute block, i.e., input
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec2 texCoord;
+
+// Instance bounds: center and radius
+layout (std430, binding = 0) readonly buffer InstanceBounds
+{
+  vec4 bounds[];
+};
+
+// Visible instance lists, base instance of each draw command points to the list of its LOD
+layout (std430, binding = 2) readonly buffer VisibleInstances
+{
+  uint visibleIndex[];
+};
+
+// Vertex output
+out vec2 vTexCoord;
+
+// Size of the billboard relative to the cube side, roughly the average projected size of the cube
+const float BILLBOARD_SCALE = 1.2f;
+
+void main()
+{
+  vTexCoord = texCoord;
+
+  vec3 center = bounds[visibleIndex[gl_BaseInstance + gl_InstanceID]].xyz;
+
+  // The first LOD list starts at zero, others are drawn as billboards facing the camera,
+  // rows of the transposed worldToView are the camera axes in the world space
+  vec3 worldPos;
+  if (gl_BaseInstance == 0)
+    worldPos = center + position;
+  else
+    worldPos = center + (worldToView[0].xyz * position.x + worldToView[1].xyz * position.y) * BILLBOARD_SCALE;
+
+  // We must multiply from the left because of transposed worldToView
+  vec4 viewPos = vec4(vec4(worldPos, 1.0f) * worldToView, 1.0f);
+
+  gl_Position = projection * viewPos;
+}
+)",
 ""};
 
 // ============================================================================
@@ -266,3 +544,407 @@ void main()
   color = vec4(texSample, 1.0f);
 }
 )", ""};
+
+// ============================================================================
+
+// Compute shader types, require OpenGL 4.6
+namespace ComputeShader
+{
+  enum
+  {
+    GpuBounds, GpuCull, GpuFinalize, HiZCopy, HiZDownsample, NumComputeShaders
+  };
+}
+
+// Compute shader sources
+static const char* csSource[] = {
+// ----------------------------------------------------------------------------
+// Instance bounds generation compute shader source, patterns must match the CPU version
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 256) in;
+
+// Generator parameters, see GeneratorParams
+uniform uint pattern;
+uniform uint instancesPerSide;
+uniform uint seed;
+uniform float spacing;
+// Bounding sphere radius of a single instance
+uniform float boundingRadius;
+// Number of instances
+uniform uint numInstances;
+
+// Instance bounds: center and radius
+layout (std430, binding = 0) writeonly buffer InstanceBounds
+{
+  vec4 bounds[];
+};
+
+// Golden angle in radians
+const float GOLDEN_ANGLE = 2.39996323f;
+// Rotation of each spiral layer against the previous one
+const float SPIRAL_TWIST = 0.1f;
+// Pi, the spiral spans the same area as the grid
+const float PI = 3.14159265f;
+
+// PCG hash, must match the CPU version
+uint hash(uint v)
+{
+  uint state = v * 747796405u + 2891336453u;
+  uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// Uniform random vector from the [0, 1) range for the given instance
+vec3 random3(uint index)
+{
+  uint h0 = hash(index + hash(seed));
+  uint h1 = hash(h0);
+  uint h2 = hash(h1);
+  return vec3(h0 >> 8u, h1 >> 8u, h2 >> 8u) * (1.0f / 16777216.0f);
+}
+
+// Generates position of the instance, must match the CPU version
+vec3 generatePosition(uint index)
+{
+  uint n = instancesPerSide;
+  float halfExtent = 0.5f * float(n) * spacing;
+
+  if (pattern == 3u)
+  {
+    // Random: uniformly distributed in the grid volume
+    return (random3(index) - 0.5f) * 2.0f * halfExtent;
+  }
+
+  uint layerSize = n * n;
+  uint layer = index / layerSize;
+  uint j = index % layerSize;
+  if (pattern == 2u)
+  {
+    // Spiral: Fermat's spiral in each layer, every layer slightly twisted
+    float r = spacing * sqrt(float(j) / PI);
+    float angle = float(j) * GOLDEN_ANGLE + float(layer) * SPIRAL_TWIST;
+    return vec3(r * cos(angle), spacing * float(layer) - halfExtent, r * sin(angle));
+  }
+
+  // Grid, optionally jittered by up to a quarter of the spacing
+  vec3 p = vec3(uvec3(j % n, layer, j / n)) * spacing - halfExtent;
+  if (pattern == 1u)
+  {
+    p += (random3(index) - 0.5f) * 0.5f * spacing;
+  }
+  return p;
+}
+
+void main()
+{
+  uint index = gl_GlobalInvocationID.x;
+  if (index >= numInstances)
+    return;
+
+  bounds[index] = vec4(generatePosition(index), boundingRadius);
+}
+)",
+// ----------------------------------------------------------------------------
+// Frustum and Hi-Z occlusion culling, LOD selection and compaction compute shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 256) in;
+
+// Number of LODs, must match GpuDrivenBackend::NUM_LODS
+#define NUM_LODS 2
+// Layout of the cull data buffer, must match GpuDrivenBackend
+#define COUNTERS_OFFSET 0
+#define FRUSTUM_CULLED (COUNTERS_OFFSET + NUM_LODS)
+#define OCCLUSION_CULLED (COUNTERS_OFFSET + NUM_LODS + 1)
+
+// Number of instances
+uniform uint numInstances;
+// Capacity of a single visible instance list
+uniform uint listCapacity;
+// World space frustum planes: left, right, bottom, top, near, far
+uniform vec4 frustumPlanes[6];
+// View position in world space
+uniform vec3 viewPos;
+// Squared distance where the full LOD ends
+uniform float lodDistanceSq;
+// Is the Hi-Z pyramid of the previous frame valid?
+uniform bool occlusionEnabled;
+// View-projection matrix the Hi-Z pyramid was rendered with
+uniform mat4 prevViewProjection;
+// Number of the Hi-Z pyramid levels
+uniform int hizLevels;
+
+// Hi-Z pyramid, the farthest depth of the covered texels
+layout (binding = 1) uniform sampler2D hizTexture;
+
+// Instance bounds: center and radius
+layout (std430, binding = 0) readonly buffer InstanceBounds
+{
+  vec4 bounds[];
+};
+
+// Counters, draw commands and draw count
+layout (std430, binding = 1) buffer CullData
+{
+  uint cullData[];
+};
+
+// Visible instance lists, one per LOD
+layout (std430, binding = 2) writeonly buffer VisibleInstances
+{
+  uint visibleIndex[];
+};
+
+// Work group local counters, so that only one global atomic per counter is needed
+shared uint groupCount[NUM_LODS];
+shared uint groupFrustumCulled;
+shared uint groupOcclusionCulled;
+// Where the work group writes to in the global lists
+shared uint groupBase[NUM_LODS];
+
+// Tests the bounding box of the sphere against the Hi-Z pyramid of the previous frame
+bool isOccluded(vec3 center, float radius)
+{
+  vec3 ndcMin = vec3(1.0f);
+  vec3 ndcMax = vec3(-1.0f);
+  for (int i = 0; i < 8; ++i)
+  {
+    vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0f : -1.0f, (i & 2) != 0 ? 1.0f : -1.0f, (i & 4) != 0 ? 1.0f : -1.0f);
+    vec4 clip = prevViewProjection * vec4(corner, 1.0f);
+
+    // Box crosses the camera plane, can't tell
+    if (clip.w <= 0.0f)
+      return false;
+
+    vec3 ndc = clip.xyz / clip.w;
+    ndcMin = min(ndcMin, ndc);
+    ndcMax = max(ndcMax, ndc);
+  }
+
+  // Screen rectangle of the box
+  vec2 uvMin = clamp(ndcMin.xy * 0.5f + 0.5f, 0.0f, 1.0f);
+  vec2 uvMax = clamp(ndcMax.xy * 0.5f + 0.5f, 0.0f, 1.0f);
+
+  // Pick the level where the rectangle spans at most 2x2 texels
+  vec2 size = (uvMax - uvMin) * vec2(textureSize(hizTexture, 0));
+  int level = clamp(int(ceil(log2(max(max(size.x, size.y), 1.0f)))), 0, hizLevels - 1);
+
+  ivec2 levelSize = textureSize(hizTexture, level);
+  ivec2 p0 = clamp(ivec2(uvMin * vec2(levelSize)), ivec2(0), levelSize - 1);
+  ivec2 p1 = clamp(ivec2(uvMax * vec2(levelSize)), ivec2(0), levelSize - 1);
+  float farthest = max(max(texelFetch(hizTexture, p0, level).r, texelFetch(hizTexture, ivec2(p1.x, p0.y), level).r),
+                       max(texelFetch(hizTexture, ivec2(p0.x, p1.y), level).r, texelFetch(hizTexture, p1, level).r));
+
+  // Occluded if even the closest point of the box lies behind everything in the rectangle
+  return ndcMin.z * 0.5f + 0.5f > farthest;
+}
+
+void main()
+{
+  if (gl_LocalInvocationIndex < NUM_LODS)
+    groupCount[gl_LocalInvocationIndex] = 0;
+  if (gl_LocalInvocationIndex == 0)
+  {
+    groupFrustumCulled = 0;
+    groupOcclusionCulled = 0;
+  }
+
+  memoryBarrierShared();
+  barrier();
+
+  uint index = gl_GlobalInvocationID.x;
+  bool visible = false;
+  uint lod = 0;
+  if (index < numInstances)
+  {
+    vec4 sphere = bounds[index];
+
+    // Test the bounding sphere against the frustum planes
+    visible = true;
+    for (int i = 0; i < 6; ++i)
+    {
+      if (dot(frustumPlanes[i].xyz, sphere.xyz) + frustumPlanes[i].w < -sphere.w)
+        visible = false;
+    }
+
+    if (!visible)
+    {
+      atomicAdd(groupFrustumCulled, 1);
+    }
+    else if (occlusionEnabled && isOccluded(sphere.xyz, sphere.w))
+    {
+      visible = false;
+      atomicAdd(groupOcclusionCulled, 1);
+    }
+
+    // Select the LOD based on the distance
+    vec3 d = sphere.xyz - viewPos;
+    lod = dot(d, d) < lodDistanceSq ? 0 : 1;
+  }
+
+  // Reserve a slot in the work group
+  uint localSlot = 0;
+  if (visible)
+    localSlot = atomicAdd(groupCount[lod], 1);
+
+  memoryBarrierShared();
+  barrier();
+
+  // Reserve space for the whole work group in the global lists
+  if (gl_LocalInvocationIndex < NUM_LODS && groupCount[gl_LocalInvocationIndex] > 0)
+    groupBase[gl_LocalInvocationIndex] = atomicAdd(cullData[COUNTERS_OFFSET + gl_LocalInvocationIndex], groupCount[gl_LocalInvocationIndex]);
+
+  if (gl_LocalInvocationIndex == 0)
+  {
+    if (groupFrustumCulled > 0)
+      atomicAdd(cullData[FRUSTUM_CULLED], groupFrustumCulled);
+    if (groupOcclusionCulled > 0)
+      atomicAdd(cullData[OCCLUSION_CULLED], groupOcclusionCulled);
+  }
+
+  memoryBarrierShared();
+  barrier();
+
+  // Write out the instance index to the list of the LOD
+  if (visible)
+    visibleIndex[lod * listCapacity + groupBase[lod] + localSlot] = index;
+}
+)",
+// ----------------------------------------------------------------------------
+// Draw command generation compute shader source, runs as a single invocation
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 1) in;
+
+// Number of LODs, must match GpuDrivenBackend::NUM_LODS
+#define NUM_LODS 2
+// Layout of the cull data buffer, must match GpuDrivenBackend
+#define COUNTERS_OFFSET 0
+#define DRAW_COUNT_OFFSET 4
+#define COMMANDS_OFFSET 8
+#define STATS_OFFSET (COMMANDS_OFFSET + NUM_LODS * DRAW_COMMAND_SIZE)
+#define STATS_SIZE 4
+// Size of a single draw command in uints
+#define DRAW_COMMAND_SIZE 5
+
+// Number of indices and the first index of each LOD
+uniform uint indexCounts[NUM_LODS];
+uniform uint firstIndices[NUM_LODS];
+// Capacity of a single visible instance list
+uniform uint listCapacity;
+
+// Counters, draw commands and draw count
+layout (std430, binding = 1) buffer CullData
+{
+  uint cullData[];
+};
+
+void main()
+{
+  // Compact the commands so that the empty LODs aren't drawn at all
+  uint drawCount = 0;
+  for (uint lod = 0; lod < NUM_LODS; ++lod)
+  {
+    uint count = cullData[COUNTERS_OFFSET + lod];
+    if (count > 0)
+    {
+      uint command = COMMANDS_OFFSET + drawCount * DRAW_COMMAND_SIZE;
+      cullData[command + 0] = indexCounts[lod];
+      cullData[command + 1] = count;
+      cullData[command + 2] = firstIndices[lod];
+      cullData[command + 3] = 0;
+      cullData[command + 4] = lod * listCapacity;
+      ++drawCount;
+    }
+  }
+  cullData[DRAW_COUNT_OFFSET] = drawCount;
+
+  // Snapshot the counters for the readback and reset them for the next frame
+  for (uint i = 0; i < STATS_SIZE; ++i)
+  {
+    cullData[STATS_OFFSET + i] = cullData[COUNTERS_OFFSET + i];
+    cullData[COUNTERS_OFFSET + i] = 0;
+  }
+}
+)",
+// ----------------------------------------------------------------------------
+// Hi-Z top level copy compute shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// Depth of the visible instances
+layout (binding = 1) uniform sampler2D depthTexture;
+// Top level of the pyramid
+layout (r32f, binding = 0) writeonly uniform image2D hizLevel;
+
+void main()
+{
+  ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(p, imageSize(hizLevel))))
+    return;
+
+  imageStore(hizLevel, p, vec4(texelFetch(depthTexture, p, 0).r));
+}
+)",
+// ----------------------------------------------------------------------------
+// Hi-Z reduction compute shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// Previous and current level of the pyramid
+layout (r32f, binding = 0) readonly uniform image2D srcLevel;
+layout (r32f, binding = 1) writeonly uniform image2D dstLevel;
+
+void main()
+{
+  ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 dstSize = imageSize(dstLevel);
+  if (any(greaterThanEqual(p, dstSize)))
+    return;
+
+  // Keep the farthest depth of the 2x2 footprint
+  ivec2 srcSize = imageSize(srcLevel);
+  ivec2 s = 2 * p;
+  float farthest = max(max(imageLoad(srcLevel, min(s, srcSize - 1)).r, imageLoad(srcLevel, min(s + ivec2(1, 0), srcSize - 1)).r),
+                       max(imageLoad(srcLevel, min(s + ivec2(0, 1), srcSize - 1)).r, imageLoad(srcLevel, min(s + ivec2(1, 1), srcSize - 1)).r));
+
+  // Odd sizes leave an extra row or column for the last texel, it must not be lost to stay conservative
+  bool extraX = srcSize.x > 1 && (srcSize.x & 1) != 0 && p.x == dstSize.x - 1;
+  bool extraY = srcSize.y > 1 && (srcSize.y & 1) != 0 && p.y == dstSize.y - 1;
+  if (extraX)
+  {
+    farthest = max(farthest, imageLoad(srcLevel, ivec2(s.x + 2, min(s.y, srcSize.y - 1))).r);
+    farthest = max(farthest, imageLoad(srcLevel, ivec2(s.x + 2, min(s.y + 1, srcSize.y - 1))).r);
+  }
+  if (extraY)
+  {
+    farthest = max(farthest, imageLoad(srcLevel, ivec2(min(s.x, srcSize.x - 1), s.y + 2)).r);
+    farthest = max(farthest, imageLoad(srcLevel, ivec2(min(s.x + 1, srcSize.x - 1), s.y + 2)).r);
+  }
+  if (extraX && extraY)
+  {
+    farthest = max(farthest, imageLoad(srcLevel, s + ivec2(2, 2)).r);
+  }
+
+  imageStore(dstLevel, p, vec4(farthest));
+}
+)",
+""};
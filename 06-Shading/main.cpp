@@ -12,7 +12,11 @@
 
 #include <MathSupport.h>
 #include <Camera.h>
+#include <DepthSort.h>
+#include <HdrFormat.h>
 #include <Geometry.h>
+#include <InstanceStore.h>
+#include <OverdrawQuery.h>
 #include <Textures.h>
 
 #include "shaders.h"
@@ -88,8 +92,6 @@ static constexpr float CameraTurboSpeed = 50.0f;
 
 // ----------------------------------------------------------------------------
 
-// Maximum number of allowed instances - must match the instancing vertex shader!
-static const unsigned int MAX_INSTANCES = 1024;
 // Max buffer length
 static const unsigned int MAX_TEXT_LENGTH = 256;
 // MSAA samples
@@ -134,12 +136,18 @@ GLuint instancingBuffer = 0;
 // Transformation matrices uniform buffer object
 GLuint transformBlockUBO = 0;
 
-// Data for a single object instance
-struct InstanceData
-{
-  // In this simple example just a transformation matrix, transposed for efficient storage
-  glm::mat3x4 transformation;
-};
+// CPU side instance data, the cubes are static so they're generated and uploaded just once
+InstanceStore<InstanceData> instances;
+// Cube stored in each instance slot
+std::vector<unsigned int> instanceOrder;
+
+// Depth prepass on?
+bool depthPrepass = false;
+// Front to back sorting of the cubes for the depth prepass
+DepthSort depthSort;
+// Overdraw of the depth prepass and the shading pass
+OverdrawQuery prepassOverdraw;
+OverdrawQuery shadingOverdraw;
 
 // ----------------------------------------------------------------------------
 
@@ -250,6 +258,12 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     tonemapping = !tonemapping;
   }
 
+  // Enable/disable the depth prepass
+  if (key == GLFW_KEY_F7 && action == GLFW_PRESS)
+  {
+    depthPrepass = !depthPrepass;
+  }
+
   // Zoom in
   if (key == GLFW_KEY_KP_ADD || key == GLFW_KEY_EQUAL && action == GLFW_PRESS)
   {
@@ -357,6 +371,9 @@ void createGeometry()
 
     cubePositions.push_back(glm::vec3(x, y, z));
   }
+
+  // All instances start dirty
+  instances.Resize(numCubes);
 }
 
 // Helper method for OpenGL initialization
@@ -486,17 +503,18 @@ void createFramebuffer(int width, int height, GLsizei MSAA)
     glGenTextures(1, &renderTarget);
   }
 
-  // Bind and recreate the render target texture
+  // Bind and recreate the render target texture, R11G11B10F halves the bandwidth unless its error is too high
+  const GLenum hdrFormat = HdrFormat::Select(HdrFormat::Auto);
   if (MSAA > 1)
   {
     glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, renderTarget);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, MSAA, GL_RGB16F, width, height, GL_TRUE);
+    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, MSAA, hdrFormat, width, height, GL_TRUE);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, renderTarget, 0);
   }
   else
   {
     glBindTexture(GL_TEXTURE_2D, renderTarget);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, hdrFormat, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderTarget, 0);
@@ -660,62 +678,51 @@ void bindTextures(const GLuint &diffuse, const GLuint &normal, const GLuint &spe
 // Helper function for creating and updating the instance data
 void updateInstanceData()
 {
-  // Create transformation matrix
-  static glm::mat4x4 transformation;
-  // Instance data CPU side buffer
-  static std::vector<InstanceData> instanceData(MAX_INSTANCES);
-
-  // Cubes
-  float angle = 20.0f;
-  for (int i = 0; i < numCubes; ++i)
+  // Cubes are stored front to back for the depth prepass, in the creation order otherwise
+  static std::vector<unsigned int> creationOrder;
+  if (creationOrder.empty())
   {
-    transformation = glm::translate(cubePositions[i]);
-    transformation *= glm::rotate(glm::radians(i * angle), glm::vec3(1.0f, 1.0f, 1.0f));
-
-    instanceData[i].transformation = glm::transpose(transformation);
+    for (int i = 0; i < numCubes; ++i)
+      creationOrder.push_back(i);
   }
 
-  // Bind the whole instancing buffer to the index 1
-  glBindBufferBase(GL_UNIFORM_BUFFER, 1, instancingBuffer);
-
-  // Update the buffer data using mapping
-  void *ptr = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-  memcpy(ptr, &*(instanceData.begin()), numCubes * sizeof(InstanceData));
-  glUnmapBuffer(GL_UNIFORM_BUFFER);
-}
+  const std::vector<unsigned int> &order = depthPrepass ? depthSort.FrontToBack(camera.GetWorldToView(), cubePositions.data(), numCubes) : creationOrder;
+  if (order != instanceOrder)
+  {
+    instanceOrder = order;
+    instances.MarkAllDirty();
+  }
 
-void updateProgramData(GLuint program, const glm::vec3 &lightPosition)
-{
-  // TODO: make this a transform block as well
+  // Cubes, only the dirty instances are regenerated
+  const float angle = 20.0f;
+  instances.Update([angle](unsigned int i, InstanceData &data)
+  {
+    const unsigned int cube = instanceOrder[i];
+    glm::mat4x4 transformation = glm::translate(cubePositions[cube]);
+    transformation *= glm::rotate(glm::radians(cube * angle), glm::vec3(1.0f, 1.0f, 1.0f));
 
-  // Update the light position
-  GLint lightLoc = glGetUniformLocation(program, "lightPosWS");
-  glUniform3f(lightLoc, lightPosition.x, lightPosition.y, lightPosition.z);
+    data.modelToWorld = glm::transpose(transformation);
+  });
 
-  // Update the view position
-  GLint viewPosLoc = glGetUniformLocation(program, "viewPosWS");
-  glm::vec4 viewPos = camera.GetViewToWorld()[3];
-  glUniform4f(viewPosLoc, viewPos.x, viewPos.y, viewPos.z, viewPos.w);
+  // Upload the dirty ranges, static scene skips the upload entirely
+  instances.Upload(GL_UNIFORM_BUFFER, instancingBuffer);
 }
 
-// Helper method to update transformation uniform block
-void updateTransformBlock()
+// Helper method to update the per-pass uniform block
+void updateTransformBlock(const glm::vec3 &lightPosition)
 {
-  // Tell OpenGL we want to work with our transform block
-  glBindBuffer(GL_UNIFORM_BUFFER, transformBlockUBO);
-
-  // Note: we should properly obtain block members size and offset via
-  // glGetActiveUniformBlockiv() with GL_UNIFORM_SIZE, GL_UNIFORM_OFFSET,
-  // I'm yoloing it here...
-
   // Update the world to view transformation matrix - transpose to 3 columns, 4 rows for storage in an uniform block:
   // per std140 layout column matrix CxR is stored as an array of C columns with R elements, i.e., 4x3 matrix would
   // waste space because it would require padding to vec4
-  glm::mat3x4 worldToView = glm::transpose(camera.GetWorldToView());
-  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat3x4), static_cast<const void*>(&*glm::value_ptr(worldToView)));
+  TransformBlock block;
+  block.worldToView = glm::transpose(camera.GetWorldToView());
+  block.projection = camera.GetProjection();
+  block.lightPosWS = glm::vec4(lightPosition, 1.0f);
+  block.viewPosWS = camera.GetViewToWorld()[3];
 
-  // Update the projection matrix
-  glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat3x4), sizeof(glm::mat4x4), static_cast<const void*>(&*glm::value_ptr(camera.GetProjection())));
+  // The struct layout was verified against the shaders when linking them, so it goes in with a single call
+  glBindBuffer(GL_UNIFORM_BUFFER, transformBlockUBO);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(TransformBlock), &block);
 
   // Unbind the GL_UNIFORM_BUFFER target for now
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
@@ -723,7 +730,11 @@ void updateTransformBlock()
 
 void renderScene()
 {
-  updateTransformBlock();
+  // Light position
+  static glm::vec3 lightPosition(-3.0f, 3.0f, 0.0f);
+
+  // Update all per-pass uniforms at once
+  updateTransformBlock(lightPosition);
 
   // Bind the framebuffer
   glBindFramebuffer(GL_FRAMEBUFFER, fbo);
@@ -758,43 +769,70 @@ void renderScene()
 
   // --------------------------------------------------------------------------
 
-  // Light position
-  static glm::vec3 lightPosition(-3.0f, 3.0f, 0.0f);
-
-  // Draw the scene floor:
+  // Draws the floor and the cubes with the given programs
+  auto drawScene = [](GLuint defaultProgram, GLuint instancingProgram)
   {
-    glUseProgram(shaderProgram[ShaderProgram::Default]);
-    updateProgramData(shaderProgram[ShaderProgram::Default], lightPosition);
+    // Draw the scene floor:
+    {
+      glUseProgram(defaultProgram);
 
-    // Create transformation matrix - 4 columns, 3 rows, last (0, 0, 0, 1) implicit to save space
-    glm::mat4x3 transformation = glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
-    glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(transformation));
+      // Create transformation matrix - 4 columns, 3 rows, last (0, 0, 0, 1) implicit to save space
+      glm::mat4x3 transformation = glm::scale(glm::vec3(30.0f, 1.0f, 30.0f));
+      glUniformMatrix4x3fv(0, 1, GL_FALSE, glm::value_ptr(transformation));
 
-    bindTextures(loadedTextures[LoadedTextures::CheckerBoard], loadedTextures[LoadedTextures::Blue], loadedTextures[LoadedTextures::Grey], loadedTextures[LoadedTextures::White]);
+      bindTextures(loadedTextures[LoadedTextures::CheckerBoard], loadedTextures[LoadedTextures::Blue], loadedTextures[LoadedTextures::Grey], loadedTextures[LoadedTextures::White]);
 
-    glBindVertexArray(quad->GetVAO());
-    glDrawElements(GL_TRIANGLES, quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
-  }
+      glBindVertexArray(quad->GetVAO());
+      glDrawElements(GL_TRIANGLES, quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
+    }
 
-  // --------------------------------------------------------------------------
+    // Draw cubes:
+    {
+      glUseProgram(instancingProgram);
 
-  // Draw cubes:
-  {
-    glUseProgram(shaderProgram[ShaderProgram::Instancing]);
+      // Bind the instancing buffer
+      glBindBufferBase(GL_UNIFORM_BUFFER, 1, instancingBuffer);
+
+      bindTextures(loadedTextures[LoadedTextures::Diffuse], loadedTextures[LoadedTextures::Normal], loadedTextures[LoadedTextures::Specular], loadedTextures[LoadedTextures::Occlusion]);
 
-    // Update the transformation & projection matrices
-    updateProgramData(shaderProgram[ShaderProgram::Instancing], lightPosition);
+      glBindVertexArray(cube->GetVAO());
+      glDrawElementsInstanced(GL_TRIANGLES, cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), numCubes);
 
-    // Update instances and bind the instancing buffer
-    updateInstanceData();
+      // Unbind the instancing buffer
+      glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
+    }
+  };
 
-    bindTextures(loadedTextures[LoadedTextures::Diffuse], loadedTextures[LoadedTextures::Normal], loadedTextures[LoadedTextures::Specular], loadedTextures[LoadedTextures::Occlusion]);
+  // Update instances, sorted front to back for the depth prepass
+  updateInstanceData();
 
-    glBindVertexArray(cube->GetVAO());
-    glDrawElementsInstanced(GL_TRIANGLES, cube->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), numCubes);
+  // Samples of the whole framebuffer for the overdraw measurement
+  const GLuint64 framebufferSamples = static_cast<GLuint64>(mainWindow.width) * mainWindow.height * msaaLevel;
 
-    // Unbind the instancing buffer
-    glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
+  // Depth prepass: depth only, the shading pass then shades only the visible fragments, the samples passing
+  // here are what the shading would cost without the prepass
+  const bool prepass = depthPrepass && depthTest;
+  if (prepass)
+  {
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    prepassOverdraw.Begin();
+    drawScene(shaderProgram[ShaderProgram::DefaultDepthPass], shaderProgram[ShaderProgram::InstancingDepthPass]);
+    prepassOverdraw.End(framebufferSamples);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    // Depth buffer is final, shade only the fragments matching it exactly
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+  }
+
+  shadingOverdraw.Begin();
+  drawScene(shaderProgram[ShaderProgram::Default], shaderProgram[ShaderProgram::Instancing]);
+  shadingOverdraw.End(framebufferSamples);
+
+  if (prepass)
+  {
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_TRUE);
   }
 
   // --------------------------------------------------------------------------
@@ -803,13 +841,9 @@ void renderScene()
   {
     glUseProgram(shaderProgram[ShaderProgram::PointRendering]);
 
-    // Update the light position
-    GLint loc = glGetUniformLocation(shaderProgram[ShaderProgram::PointRendering], "position");
-    glUniform3fv(loc, 1, glm::value_ptr(lightPosition));
-
-    // Update the color
-    loc = glGetUniformLocation(shaderProgram[ShaderProgram::PointRendering], "color");
-    glUniform3f(0, 1.0f, 1.0f, 1.0f);
+    // Update the color, the light position comes from the transform block
+    GLint loc = glGetUniformLocation(shaderProgram[ShaderProgram::PointRendering], "color");
+    glUniform3f(loc, 1.0f, 1.0f, 1.0f);
 
     glPointSize(10.0f);
     glBindVertexArray(vao);
@@ -881,7 +915,10 @@ void mainLoop()
 
     // Print it to the title bar
     static char title[MAX_TEXT_LENGTH];
-    snprintf(title, MAX_TEXT_LENGTH, "dt = %.2fms, FPS = %.1f", dt * 1000.0f, 1.0f / dt);
+    if (depthPrepass)
+      snprintf(title, MAX_TEXT_LENGTH, "dt = %.2fms, FPS = %.1f, overdraw = %.2f -> %.2f (prepass)", dt * 1000.0f, 1.0f / dt, prepassOverdraw.GetOverdraw(), shadingOverdraw.GetOverdraw());
+    else
+      snprintf(title, MAX_TEXT_LENGTH, "dt = %.2fms, FPS = %.1f, overdraw = %.2f", dt * 1000.0f, 1.0f / dt, shadingOverdraw.GetOverdraw());
     glfwSetWindowTitle(mainWindow.handle, title);
 
     // Poll the events like keyboard, mouse, etc.
@@ -85,6 +85,17 @@ bool compileShaders()
   }
   uniformBlockBinding(shaderProgram[ShaderProgram::Default]);
 
+  // Depth prepass variant, unused outputs of the vertex shader are stripped when linking with the null fragment shader
+  shaderProgram[ShaderProgram::DefaultDepthPass] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::DefaultDepthPass], vertexShader[VertexShader::Default]);
+  glAttachShader(shaderProgram[ShaderProgram::DefaultDepthPass], fragmentShader[FragmentShader::Null]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::DefaultDepthPass]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::DefaultDepthPass]);
+
   shaderProgram[ShaderProgram::Instancing] = glCreateProgram();
   glAttachShader(shaderProgram[ShaderProgram::Instancing], vertexShader[VertexShader::Instancing]);
   glAttachShader(shaderProgram[ShaderProgram::Instancing], fragmentShader[FragmentShader::Default]);
@@ -96,6 +107,17 @@ bool compileShaders()
   uniformBlockBinding(shaderProgram[ShaderProgram::Instancing]);
   uniformBlockBinding(shaderProgram[ShaderProgram::Instancing], "InstanceBuffer", 1);
 
+  shaderProgram[ShaderProgram::InstancingDepthPass] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::InstancingDepthPass], vertexShader[VertexShader::Instancing]);
+  glAttachShader(shaderProgram[ShaderProgram::InstancingDepthPass], fragmentShader[FragmentShader::Null]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::InstancingDepthPass]))
+  {
+    cleanUp();
+    return false;
+  }
+  uniformBlockBinding(shaderProgram[ShaderProgram::InstancingDepthPass]);
+  uniformBlockBinding(shaderProgram[ShaderProgram::InstancingDepthPass], "InstanceBuffer", 1);
+
   shaderProgram[ShaderProgram::PointRendering] = glCreateProgram();
   glAttachShader(shaderProgram[ShaderProgram::PointRendering], vertexShader[VertexShader::Point]);
   glAttachShader(shaderProgram[ShaderProgram::PointRendering], fragmentShader[FragmentShader::SingleColor]);
@@ -106,6 +128,17 @@ bool compileShaders()
   }
   uniformBlockBinding(shaderProgram[ShaderProgram::PointRendering]);
 
+  // Check the C++ structs against the uniform blocks of the linked programs
+  bool validBlocks = BlockLayout::Verify(shaderProgram[ShaderProgram::Default], "TransformBlock", BlockLayout::Std140, transformBlockLayout, sizeof(TransformBlock));
+  validBlocks &= BlockLayout::Verify(shaderProgram[ShaderProgram::Instancing], "TransformBlock", BlockLayout::Std140, transformBlockLayout, sizeof(TransformBlock));
+  validBlocks &= BlockLayout::Verify(shaderProgram[ShaderProgram::PointRendering], "TransformBlock", BlockLayout::Std140, transformBlockLayout, sizeof(TransformBlock));
+  validBlocks &= BlockLayout::Verify(shaderProgram[ShaderProgram::Instancing], "InstanceBuffer", BlockLayout::Std140, instanceDataLayout, sizeof(InstanceData), "instanceBuffer", MAX_INSTANCES);
+  if (!validBlocks)
+  {
+    cleanUp();
+    return false;
+  }
+
   shaderProgram[ShaderProgram::Tonemapping] = glCreateProgram();
   glAttachShader(shaderProgram[ShaderProgram::Tonemapping], vertexShader[VertexShader::ScreenQuad]);
   glAttachShader(shaderProgram[ShaderProgram::Tonemapping], fragmentShader[FragmentShader::Tonemapping]);
@@ -5,6 +5,9 @@
 
 #pragma once
 
+#include <glm/glm.hpp>
+
+#include <BlockLayout.h>
 #include <ShaderCompiler.h>
 
 // Shader programs
@@ -12,16 +15,53 @@ namespace ShaderProgram
 {
   enum
   {
-    Default, Instancing, PointRendering, Tonemapping, NumShaderPrograms
+    Default, DefaultDepthPass, Instancing, InstancingDepthPass, PointRendering, Tonemapping, NumShaderPrograms
   };
 }
 
 // Shader programs handle
 extern GLuint shaderProgram[ShaderProgram::NumShaderPrograms];
 
-// Helper function for creating and compiling the shaders
+// Helper function for creating and compiling the shaders, verifies the uniform blocks as well
 bool compileShaders();
 
+// Maximum number of allowed instances - must match the instancing vertex shader!
+static const unsigned int MAX_INSTANCES = 1024;
+
+// Per-pass constants, uploaded at once
+struct TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  glm::mat3x4 worldToView;
+  glm::mat4x4 projection;
+  // Light position/direction
+  glm::vec4 lightPosWS;
+  // View position in world space coordinates
+  glm::vec4 viewPosWS;
+};
+
+static constexpr BlockLayout::Member transformBlockLayout[] =
+{
+  BLOCK_MEMBER(TransformBlock, worldToView, Mat3x4),
+  BLOCK_MEMBER(TransformBlock, projection, Mat4x4),
+  BLOCK_MEMBER(TransformBlock, lightPosWS, Vec4),
+  BLOCK_MEMBER(TransformBlock, viewPosWS, Vec4)
+};
+static_assert(BlockLayout::IsValid(transformBlockLayout, sizeof(TransformBlock), BlockLayout::Std140), "TransformBlock doesn't follow std140 rules!");
+
+// Data for a single object instance
+struct InstanceData
+{
+  // In this simple example just a transformation matrix, transposed for efficient storage
+  glm::mat3x4 modelToWorld;
+};
+
+static constexpr BlockLayout::Member instanceDataLayout[] =
+{
+  BLOCK_MEMBER(InstanceData, modelToWorld, Mat3x4)
+};
+static_assert(BlockLayout::IsValid(instanceDataLayout, sizeof(InstanceData), BlockLayout::Std140), "InstanceData doesn't follow std140 rules!");
+
 // ============================================================================
 
 // Vertex shader types
@@ -47,12 +87,16 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
-// Uniform blocks, i.e., constants
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
 layout (std140, binding = 0) uniform TransformBlock
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
   mat3x4 worldToView;
   mat4x4 projection;
+  // Light position/direction
+  vec4 lightPosWS;
+  // View position in world space coordinates
+  vec4 viewPosWS;
 };
 
 // Model to world transformation separately, takes 4 slots!
@@ -74,6 +118,9 @@ out VertexData
   vec4 worldPos;
 } vOut;
 
+// Depth prepass and shading pass must produce identical depths for GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
   // Pass texture coordinates to the fragment shader
@@ -108,12 +155,16 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
-// Uniform blocks, i.e., constants
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
 layout (std140, binding = 0) uniform TransformBlock
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
   mat3x4 worldToView;
   mat4x4 projection;
+  // Light position/direction
+  vec4 lightPosWS;
+  // View position in world space coordinates
+  vec4 viewPosWS;
 };
 
 // Vertex attribute block, i.e., input
@@ -147,6 +198,9 @@ out VertexData
   vec4 worldPos;
 } vOut;
 
+// Depth prepass and shading pass must produce identical depths for GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
   // Pass texture coordinates to the fragment shader
@@ -173,7 +227,7 @@ void main()
 }
 )",
 // ----------------------------------------------------------------------------
-// Vertex shader for point rendering
+// Vertex shader for point rendering of the light
 // ----------------------------------------------------------------------------
 R"(
 #version 330 core
@@ -181,20 +235,22 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
-// Uniform blocks, i.e., constants
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
 layout (std140, binding = 0) uniform TransformBlock
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
   mat3x4 worldToView;
   mat4x4 projection;
+  // Light position/direction
+  vec4 lightPosWS;
+  // View position in world space coordinates
+  vec4 viewPosWS;
 };
 
-uniform vec3 position;
-
 void main()
 {
   // We must multiply from the left because of transposed worldToView
-  vec4 viewPos = vec4(vec4(position, 1.0f) * worldToView, 1.0f);
+  vec4 viewPos = vec4(vec4(lightPosWS.xyz, 1.0f) * worldToView, 1.0f);
   gl_Position = projection * viewPos;
 }
 )",
@@ -230,7 +286,7 @@ namespace FragmentShader
 {
   enum
   {
-    Default, SingleColor, Tonemapping, NumFragmentShaders
+    Default, SingleColor, Null, Tonemapping, NumFragmentShaders
   };
 }
 
@@ -254,13 +310,17 @@ layout (binding = 1) uniform sampler2D Normal;
 layout (binding = 2) uniform sampler2D Specular;
 layout (binding = 3) uniform sampler2D Occlusion;
 
-// Note: explicit location because AMD APU drivers screw up position when linking against
-// the default vertex shader with mat4x3 modelToWorld at location 0 occupying 4 slots
-
-// Light position/direction
-layout (location = 4) uniform vec3 lightPosWS;
-// View position in world space coordinates
-layout (location = 5) uniform vec4 viewPosWS;
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
+layout (std140, binding = 0) uniform TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  mat3x4 worldToView;
+  mat4x4 projection;
+  // Light position/direction
+  vec4 lightPosWS;
+  // View position in world space coordinates
+  vec4 viewPosWS;
+};
 
 // Fragment shader inputs
 in VertexData
@@ -350,6 +410,16 @@ void main()
 }
 )",
 // ----------------------------------------------------------------------------
+// Null fragment shader for the depth prepass
+// ----------------------------------------------------------------------------
+R"(
+#version 330 core
+
+void main()
+{
+}
+)",
+// ----------------------------------------------------------------------------
 // Tonemapping fragment shader source
 // ----------------------------------------------------------------------------
 R"(
@@ -12,6 +12,7 @@
 
 #include <MathSupport.h>
 #include <Camera.h>
+#include <HdrFormat.h>
 
 #include "shaders.h"
 #include "scene.h"
@@ -333,17 +334,18 @@ void createFramebuffer(int width, int height, GLsizei MSAA)
     glGenTextures(1, &renderTarget);
   }
 
-  // Bind and recreate the render target texture
+  // Bind and recreate the render target texture, R11G11B10F halves the bandwidth unless its error is too high
+  const GLenum hdrFormat = HdrFormat::Select(HdrFormat::Auto);
   if (MSAA > 1)
   {
     glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, renderTarget);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, MSAA, GL_RGB16F, width, height, GL_TRUE);
+    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, MSAA, hdrFormat, width, height, GL_TRUE);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, renderTarget, 0);
   }
   else
   {
     glBindTexture(GL_TEXTURE_2D, renderTarget);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, hdrFormat, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderTarget, 0);
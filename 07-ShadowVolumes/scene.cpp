@@ -130,6 +130,9 @@ void Scene::Init(int numCubes, int numLights)
     _cubePositions.push_back(glm::vec3(x, y, z));
   }
 
+  // All instances start dirty
+  _instances.Resize(_numCubes);
+
   // --------------------------------------------------------------------------
 
   // Ambient intensity for the lights
@@ -213,84 +216,46 @@ void Scene::BindTextures(const GLuint &diffuse, const GLuint &normal, const GLui
 
 void Scene::UpdateInstanceData()
 {
-  // Create transformation matrix
-  glm::mat4x4 transformation = glm::mat4x4(1.0f);
-  // Instance data CPU side buffer
-  static std::vector<InstanceData> instanceData(MAX_INSTANCES);
-
-  // Cubes
-  float angle = 20.0f;
-  for (int i = 0; i < _numCubes; ++i)
+  // Cubes, only the dirty instances are regenerated
+  const float angle = 20.0f;
+  _instances.Update([this, angle](unsigned int i, InstanceData &data)
   {
-    // Create unit matrix
-    transformation = glm::translate(_cubePositions[i]);
+    glm::mat4x4 transformation = glm::translate(_cubePositions[i]);
     transformation *= glm::rotate(glm::radians(i * angle), glm::vec3(1.0f, 1.0f, 1.0f));
 
-    instanceData[i].transformation = glm::transpose(transformation);
-  }
-
-  // Bind the instancing buffer to the index 1
-  glBindBufferBase(GL_UNIFORM_BUFFER, 1, _instancingBuffer);
-
-  // Update the buffer data using mapping
-  void *ptr = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-  memcpy(ptr, &*instanceData.begin(), _numCubes * sizeof(InstanceData));
-  glUnmapBuffer(GL_UNIFORM_BUFFER);
-
-  // Unbind the instancing buffer
-  glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
-}
-
-void Scene::UpdateProgramData(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
-{
-  // Update the light position, use 4th component to pass direct light intensity
-  if ((int)renderPass & ((int)RenderPass::ShadowVolume | (int)RenderPass::LightPass))
-  {
-    GLint lightLoc = glGetUniformLocation(program, "lightPosWS");
-    glUniform4f(lightLoc, lightPosition.x, lightPosition.y, lightPosition.z, ((int)renderPass & (int)RenderPass::DirectLight) ? 1.0f : 0.0f);
-  }
+    data.transformation = glm::transpose(transformation);
+  });
 
-  // Update view position and light color
-  if ((int)renderPass & (int)RenderPass::LightPass)
-  {
-    // Update the view position
-    GLint viewPosLoc = glGetUniformLocation(program, "viewPosWS");
-    glm::vec4 viewPos = camera.GetViewToWorld()[3];
-    glUniform4fv(viewPosLoc, 1, glm::value_ptr(viewPos));
-
-    // Update the light color, 4th component controls ambient light intensity
-    GLint lightColorLoc = glGetUniformLocation(program, "lightColor");
-    glUniform4f(lightColorLoc, lightColor.x, lightColor.y, lightColor.z, ((int)renderPass & (int)RenderPass::AmbientLight) ? lightColor.w : 0.0f);
-  }
+  // Upload the dirty ranges, static scene skips the upload entirely
+  _instances.Upload(GL_UNIFORM_BUFFER, _instancingBuffer);
 }
 
-void Scene::UpdateTransformBlock(const Camera &camera)
+void Scene::UpdateTransformBlock(const Camera &camera, RenderPass renderPass, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
 {
-  // Tell OpenGL we want to work with our transform block
-  glBindBuffer(GL_UNIFORM_BUFFER, _transformBlockUBO);
-
-  // Note: we should properly obtain block members size and offset via
-  // glGetActiveUniformBlockiv() with GL_UNIFORM_SIZE, GL_UNIFORM_OFFSET,
-  // I'm yoloing it here...
-
   // Update the world to view transformation matrix - transpose to 3 columns, 4 rows for storage in an uniform block:
   // per std140 layout column matrix CxR is stored as an array of C columns with R elements, i.e., 4x3 matrix would
   // waste space because it would require padding to vec4
-  glm::mat3x4 worldToView = glm::transpose(camera.GetWorldToView());
-  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat3x4), static_cast<const void*>(&*glm::value_ptr(worldToView)));
+  TransformBlock block;
+  block.worldToView = glm::transpose(camera.GetWorldToView());
+  block.projection = camera.GetProjection();
+  // Update the light position, use 4th component to pass direct light intensity
+  block.lightPosWS = glm::vec4(lightPosition, ((int)renderPass & (int)RenderPass::DirectLight) ? 1.0f : 0.0f);
+  block.viewPosWS = camera.GetViewToWorld()[3];
+  // Update the light color, 4th component controls ambient light intensity
+  block.lightColor = glm::vec4(glm::vec3(lightColor), ((int)renderPass & (int)RenderPass::AmbientLight) ? lightColor.w : 0.0f);
 
-  // Update the projection matrix
-  glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat3x4), sizeof(glm::mat4x4), static_cast<const void*>(&*glm::value_ptr(camera.GetProjection())));
+  // The struct layout was verified against the shaders when linking them, so it goes in with a single call
+  glBindBuffer(GL_UNIFORM_BUFFER, _transformBlockUBO);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(TransformBlock), &block);
 
   // Unbind the GL_UNIFORM_BUFFER target for now
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
-void Scene::DrawBackground(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
+void Scene::DrawBackground(GLuint program, RenderPass renderPass)
 {
-  // Bind the shader program and update its data
+  // Bind the shader program, its data are in the transform block
   glUseProgram(program);
-  UpdateProgramData(program, renderPass, camera, lightPosition, lightColor);
 
   // Bind textures
   if ((int)renderPass & (int)RenderPass::LightPass)
@@ -324,12 +289,10 @@ void Scene::DrawBackground(GLuint program, RenderPass renderPass, const Camera &
   glDrawElements(GL_TRIANGLES, _quad->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0));
 }
 
-void Scene::DrawObjects(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
+void Scene::DrawObjects(GLuint program, RenderPass renderPass, const glm::vec4 &lightColor)
 {
-  // Bind the shader program and update its data
+  // Bind the shader program, its data are in the transform block
   glUseProgram(program);
-  // Update the transformation & projection matrices
-  UpdateProgramData(program, renderPass, camera, lightPosition, lightColor);
 
   // Bind the instancing buffer to the index 1
   glBindBufferBase(GL_UNIFORM_BUFFER, 1, _instancingBuffer);
@@ -362,14 +325,11 @@ void Scene::DrawObjects(GLuint program, RenderPass renderPass, const Camera &cam
   // Draw the light object during the ambient pass
   if ((int)renderPass & (int)RenderPass::AmbientLight)
   {
+    // The light position comes from the transform block
     glUseProgram(shaderProgram[ShaderProgram::PointRendering]);
 
-    // Update the light position
-    GLint loc = glGetUniformLocation(shaderProgram[ShaderProgram::PointRendering], "position");
-    glUniform3fv(loc, 1, glm::value_ptr(lightPosition));
-
     // Update the color
-    loc = glGetUniformLocation(shaderProgram[ShaderProgram::PointRendering], "color");
+    GLint loc = glGetUniformLocation(shaderProgram[ShaderProgram::PointRendering], "color");
     glUniform3fv(loc, 1, glm::value_ptr(lightColor * 0.05f));
 
     // Disable blending for lights
@@ -383,16 +343,15 @@ void Scene::DrawObjects(GLuint program, RenderPass renderPass, const Camera &cam
 
 void Scene::Draw(const Camera &camera, const RenderMode &renderMode, bool carmackReverse)
 {
-  UpdateTransformBlock(camera);
-
   // --------------------------------------------------------------------------
   // Depth pass drawing:
   // --------------------------------------------------------------------------
   auto depthPass = [this, &renderMode, &camera]()
   {
     // No need to pass real light position and color as we don't need them in the depth pass
-    DrawBackground(shaderProgram[ShaderProgram::DefaultDepthPass], RenderPass::DepthPass, camera, glm::vec3(0.0f), glm::vec4(0.0f));
-    DrawObjects(shaderProgram[ShaderProgram::InstancingDepthPass], RenderPass::DepthPass, camera, glm::vec3(0.0f), glm::vec4(0.0f));
+    UpdateTransformBlock(camera, RenderPass::DepthPass, glm::vec3(0.0f), glm::vec4(0.0f));
+    DrawBackground(shaderProgram[ShaderProgram::DefaultDepthPass], RenderPass::DepthPass);
+    DrawObjects(shaderProgram[ShaderProgram::InstancingDepthPass], RenderPass::DepthPass, glm::vec4(0.0f));
   };
 
   // --------------------------------------------------------------------------
@@ -408,14 +367,19 @@ void Scene::Draw(const Camera &camera, const RenderMode &renderMode, bool carmac
     // Pass only if equal to 0, i.e., outside shadow volume
     glStencilFunc(GL_EQUAL, 0x00, 0xff);
 
+    // Depth buffer is primed by the same geometry, shade only the visible fragments
+    glDepthFunc(GL_EQUAL);
+
     // Don't update the stencil buffer
     glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
 
-    DrawBackground(shaderProgram[ShaderProgram::Default], renderPass, camera, lightPosition, lightColor);
-    DrawObjects(shaderProgram[ShaderProgram::Instancing], renderPass, camera, lightPosition, lightColor);
+    UpdateTransformBlock(camera, renderPass, lightPosition, lightColor);
+    DrawBackground(shaderProgram[ShaderProgram::Default], renderPass);
+    DrawObjects(shaderProgram[ShaderProgram::Instancing], renderPass, lightColor);
 
-    // Disable blending after this pass
+    // Disable blending after this pass, shadow volumes need the regular depth test
     glDisable(GL_BLEND);
+    glDepthFunc(GL_LEQUAL);
   };
 
   // --------------------------------------------------------------------------
@@ -444,7 +408,8 @@ void Scene::Draw(const Camera &camera, const RenderMode &renderMode, bool carmac
       glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
     }
 
-    DrawObjects(shaderProgram[ShaderProgram::InstancedShadowVolume], RenderPass::ShadowVolume, camera, lightPosition, lightColor);
+    UpdateTransformBlock(camera, RenderPass::ShadowVolume, lightPosition, lightColor);
+    DrawObjects(shaderProgram[ShaderProgram::InstancedShadowVolume], RenderPass::ShadowVolume, lightColor);
 
     // Enable it back again
     glEnable(GL_CULL_FACE);
@@ -482,8 +447,7 @@ void Scene::Draw(const Camera &camera, const RenderMode &renderMode, bool carmac
   glColorMask(false, false, false, false);
   depthPass();
 
-  // We primed the depth buffer, no need to write to it anymore
-  // Note: for depth primed geometry, it would be the best option to also set depth function to GL_EQUAL
+  // We primed the depth buffer, no need to write to it anymore, light passes test it with GL_EQUAL
   glDepthMask(GL_FALSE);
 
   // For each light we need to render the scene with its contribution
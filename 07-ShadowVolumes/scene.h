@@ -7,6 +7,7 @@
 
 #include <Camera.h>
 #include <Geometry.h>
+#include <InstanceStore.h>
 #include <Textures.h>
 
 // Textures we'll be using
@@ -91,14 +92,12 @@ private:
   void BindTextures(const GLuint &diffuse, const GLuint &normal, const GLuint &specular, const GLuint &occlusion);
   // Helper function for creating and updating the instance data
   void UpdateInstanceData();
-  // Helper function for updating shader program data
-  void UpdateProgramData(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
-  // Helper method to update transformation uniform block
-  void UpdateTransformBlock(const Camera &camera);
+  // Helper method to update the per-pass uniform block, i.e., transformations and light data
+  void UpdateTransformBlock(const Camera &camera, RenderPass renderPass, const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
   // Draw the backdrop, floor and walls
-  void DrawBackground(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
+  void DrawBackground(GLuint program, RenderPass renderPass);
   // Draw cubes
-  void DrawObjects(GLuint program, RenderPass renderPass, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
+  void DrawObjects(GLuint program, RenderPass renderPass, const glm::vec4 &lightColor);
 
   // Textures helper instance
   Textures &_textures;
@@ -122,6 +121,8 @@ private:
   Mesh<Vertex_Pos> *_cubeAdjacency = nullptr;
   // Instancing buffer handle
   GLuint _instancingBuffer = 0;
+  // CPU side instance data of the cubes
+  InstanceStore<InstanceData> _instances;
   // Transformation matrices uniform buffer object
   GLuint _transformBlockUBO = 0;
 };
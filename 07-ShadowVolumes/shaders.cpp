@@ -163,6 +163,17 @@ bool compileShaders()
   }
   uniformBlockBinding(shaderProgram[ShaderProgram::PointRendering]);
 
+  // Check the C++ struct against the uniform blocks of the linked programs
+  bool validBlocks = BlockLayout::Verify(shaderProgram[ShaderProgram::Default], "TransformBlock", BlockLayout::Std140, transformBlockLayout, sizeof(TransformBlock));
+  validBlocks &= BlockLayout::Verify(shaderProgram[ShaderProgram::Instancing], "TransformBlock", BlockLayout::Std140, transformBlockLayout, sizeof(TransformBlock));
+  validBlocks &= BlockLayout::Verify(shaderProgram[ShaderProgram::InstancedShadowVolume], "TransformBlock", BlockLayout::Std140, transformBlockLayout, sizeof(TransformBlock));
+  validBlocks &= BlockLayout::Verify(shaderProgram[ShaderProgram::PointRendering], "TransformBlock", BlockLayout::Std140, transformBlockLayout, sizeof(TransformBlock));
+  if (!validBlocks)
+  {
+    cleanUp();
+    return false;
+  }
+
   // Shader program for rendering tonemapping post-process
   shaderProgram[ShaderProgram::Tonemapping] = glCreateProgram();
   glAttachShader(shaderProgram[ShaderProgram::Tonemapping], vertexShader[VertexShader::ScreenQuad]);
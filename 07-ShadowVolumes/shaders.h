@@ -5,6 +5,9 @@
 
 #pragma once
 
+#include <glm/glm.hpp>
+
+#include <BlockLayout.h>
 #include <ShaderCompiler.h>
 
 // Shader programs
@@ -19,9 +22,33 @@ namespace ShaderProgram
 // Shader programs handle
 extern GLuint shaderProgram[ShaderProgram::NumShaderPrograms];
 
-// Helper function for creating and compiling the shaders
+// Helper function for creating and compiling the shaders, verifies the uniform blocks as well
 bool compileShaders();
 
+// Per-pass constants, uploaded at once
+struct TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  glm::mat3x4 worldToView;
+  glm::mat4x4 projection;
+  // Light position/direction, 4th component is the direct light intensity
+  glm::vec4 lightPosWS;
+  // View position in world space coordinates
+  glm::vec4 viewPosWS;
+  // Light color, 4th component is the ambient light intensity
+  glm::vec4 lightColor;
+};
+
+static constexpr BlockLayout::Member transformBlockLayout[] =
+{
+  BLOCK_MEMBER(TransformBlock, worldToView, Mat3x4),
+  BLOCK_MEMBER(TransformBlock, projection, Mat4x4),
+  BLOCK_MEMBER(TransformBlock, lightPosWS, Vec4),
+  BLOCK_MEMBER(TransformBlock, viewPosWS, Vec4),
+  BLOCK_MEMBER(TransformBlock, lightColor, Vec4)
+};
+static_assert(BlockLayout::IsValid(transformBlockLayout, sizeof(TransformBlock), BlockLayout::Std140), "TransformBlock doesn't follow std140 rules!");
+
 // ============================================================================
 
 // Vertex shader types
@@ -47,12 +74,18 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
-// Uniform blocks, i.e., constants
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
 layout (std140, binding = 0) uniform TransformBlock
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
   mat3x4 worldToView;
   mat4x4 projection;
+  // Light position/direction
+  vec4 lightPosWS;
+  // View position in world space coordinates
+  vec4 viewPosWS;
+  // Light color
+  vec4 lightColor;
 };
 
 // Model to world transformation separately, takes 4 slots!
@@ -74,6 +107,9 @@ out VertexData
   vec4 worldPos;
 } vOut;
 
+// Depth prepass and shading pass must produce identical depths for GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
   // Pass texture coordinates to the fragment shader
@@ -108,12 +144,18 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
-// Uniform blocks, i.e., constants
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
 layout (std140, binding = 0) uniform TransformBlock
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
   mat3x4 worldToView;
   mat4x4 projection;
+  // Light position/direction
+  vec4 lightPosWS;
+  // View position in world space coordinates
+  vec4 viewPosWS;
+  // Light color
+  vec4 lightColor;
 };
 
 // Vertex attribute block, i.e., input
@@ -147,6 +189,9 @@ out VertexData
   vec4 worldPos;
 } vOut;
 
+// Depth prepass and shading pass must produce identical depths for GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
   // Pass texture coordinates to the fragment shader
@@ -225,20 +270,24 @@ R"(
 // The following is not not needed since GLSL version #420
 #extension GL_ARB_shading_language_420pack : require
 
-// Uniform blocks, i.e., constants
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
 layout (std140, binding = 0) uniform TransformBlock
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
   mat3x4 worldToView;
   mat4x4 projection;
+  // Light position/direction
+  vec4 lightPosWS;
+  // View position in world space coordinates
+  vec4 viewPosWS;
+  // Light color
+  vec4 lightColor;
 };
 
-uniform vec3 position;
-
 void main()
 {
   // We must multiply from the left because of transposed worldToView
-  vec4 viewPos = vec4(vec4(position, 1.0f) * worldToView, 1.0f);
+  vec4 viewPos = vec4(vec4(lightPosWS.xyz, 1.0f) * worldToView, 1.0f);
   gl_Position = projection * viewPos;
 }
 )",
@@ -298,15 +347,19 @@ layout (binding = 1) uniform sampler2D Normal;
 layout (binding = 2) uniform sampler2D Specular;
 layout (binding = 3) uniform sampler2D Occlusion;
 
-// Note: explicit location because AMD APU drivers screw up position when linking against
-// the default vertex shader with mat4x3 modelToWorld at location 0 occupying 4 slots
-
-// Light position/direction
-layout (location = 4) uniform vec4 lightPosWS;
-// View position in world space coordinates
-layout (location = 5) uniform vec4 viewPosWS;
-// Light color
-layout (location = 6) uniform vec4 lightColor;
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
+layout (std140, binding = 0) uniform TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  mat3x4 worldToView;
+  mat4x4 projection;
+  // Light position/direction
+  vec4 lightPosWS;
+  // View position in world space coordinates
+  vec4 viewPosWS;
+  // Light color
+  vec4 lightColor;
+};
 
 // Fragment shader inputs
 in VertexData
@@ -479,17 +532,20 @@ layout (triangles_adjacency) in;
 layout (triangle_strip, max_vertices = 18) out;
 
 
-// Uniform blocks, i.e., constants
+// Uniform blocks, i.e., constants, must match the TransformBlock struct on the CPU side
 layout (std140, binding = 0) uniform TransformBlock
 {
   // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
   mat3x4 worldToView;
   mat4x4 projection;
+  // Light position/direction
+  vec4 lightPosWS;
+  // View position in world space coordinates
+  vec4 viewPosWS;
+  // Light color
+  vec4 lightColor;
 };
 
-// Location 0 is fine, we're linking only against instancing VS
-layout (location = 0) uniform vec4 lightPosWS;
-
 // Vertex input
 in VertexData
 {
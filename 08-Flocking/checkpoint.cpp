@@ -0,0 +1,231 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// ----------------------------------------------------------------------------
+
+bool MappedFile::Open(const char *path)
+{
+  Close();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  _file = file;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+  {
+    Close();
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping)
+  {
+    Close();
+    return false;
+  }
+  _mapping = mapping;
+
+  _data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!_data)
+  {
+    Close();
+    return false;
+  }
+  _size = static_cast<size_t>(size.QuadPart);
+#else
+  int file = open(path, O_RDONLY);
+  if (file < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(file, &info) != 0 || info.st_size == 0)
+  {
+    close(file);
+    return false;
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  void *data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (data == MAP_FAILED)
+    return false;
+
+  _data = data;
+  _size = static_cast<size_t>(info.st_size);
+#endif
+
+  return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+  if (_data)
+    UnmapViewOfFile(_data);
+  if (_mapping)
+    CloseHandle(_mapping);
+  if (_file)
+    CloseHandle(_file);
+  _mapping = nullptr;
+  _file = nullptr;
+#else
+  if (_data)
+    munmap(const_cast<void*>(_data), _size);
+#endif
+  _data = nullptr;
+  _size = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+CheckpointWriter::~CheckpointWriter()
+{
+  // Finish the pending write, the GPU request is lost at this point anyway
+  if (_writer.joinable())
+    _writer.join();
+
+  if (_fence)
+    glDeleteSync(_fence);
+  glDeleteBuffers(1, &_readbackBuffer);
+}
+
+bool CheckpointWriter::Request(const char *path, const CheckpointHeader &header, GLuint buffer, GLsizeiptr size)
+{
+  // Only one request at the time
+  if (_fence)
+    return false;
+
+  // (Re)create the readback buffer if needed, it's only ever read by the CPU
+  if (!_readbackBuffer || _readbackSize < size)
+  {
+    glDeleteBuffers(1, &_readbackBuffer);
+    glGenBuffers(1, &_readbackBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _readbackBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_READ);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    _readbackSize = size;
+  }
+
+  // Make sure the compute shader writes are finished before the copy
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+  // Copy the data on the GPU, it will be mapped once the fence is signaled
+  glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, _readbackBuffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  _fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  _path = path;
+  _header = header;
+
+  return true;
+}
+
+void CheckpointWriter::Poll()
+{
+  if (!_fence)
+    return;
+
+  // Don't wait, just check the state of the fence, flush the commands so it's signaled eventually
+  GLenum result = glClientWaitSync(_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+    return;
+
+  glDeleteSync(_fence);
+  _fence = nullptr;
+
+  // Previous write must be finished before we reuse the thread
+  if (_writer.joinable())
+    _writer.join();
+
+  // Copy the data out of the mapped buffer, the file is written on a separate thread
+  GLsizeiptr size = static_cast<GLsizeiptr>(_header.flockSize) * _header.recordSize;
+  std::vector<unsigned char> data(sizeof(CheckpointHeader) + size);
+  memcpy(data.data(), &_header, sizeof(CheckpointHeader));
+
+  glBindBuffer(GL_COPY_READ_BUFFER, _readbackBuffer);
+  const void *mapped = glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, GL_MAP_READ_BIT);
+  if (!mapped)
+  {
+    printf("Failed to map the checkpoint readback buffer!\n");
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    return;
+  }
+  memcpy(data.data() + sizeof(CheckpointHeader), mapped, size);
+  glUnmapBuffer(GL_COPY_READ_BUFFER);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+  _writer = std::thread([path = _path, data = std::move(data)]()
+  {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+      printf("Failed to open checkpoint file: %s\n", path.c_str());
+      return;
+    }
+
+    if (fwrite(data.data(), 1, data.size(), file) != data.size())
+      printf("Failed to write checkpoint file: %s\n", path.c_str());
+    else
+      printf("Checkpoint saved: %s\n", path.c_str());
+
+    fclose(file);
+  });
+}
+
+// ----------------------------------------------------------------------------
+
+const void *LoadCheckpoint(MappedFile &file, const char *path, CheckpointHeader &header)
+{
+  if (!file.Open(path))
+  {
+    printf("Failed to open checkpoint file: %s\n", path);
+    return nullptr;
+  }
+
+  if (file.GetSize() < sizeof(CheckpointHeader))
+  {
+    printf("Checkpoint file is too small: %s\n", path);
+    return nullptr;
+  }
+
+  memcpy(&header, file.GetData(), sizeof(CheckpointHeader));
+  if (header.magic != CheckpointHeader::MAGIC || header.version != CheckpointHeader::VERSION)
+  {
+    printf("Unsupported checkpoint file: %s\n", path);
+    return nullptr;
+  }
+
+  size_t size = static_cast<size_t>(header.flockSize) * header.recordSize;
+  if (file.GetSize() < sizeof(CheckpointHeader) + size)
+  {
+    printf("Checkpoint file is truncated: %s\n", path);
+    return nullptr;
+  }
+
+  return static_cast<const unsigned char*>(file.GetData()) + sizeof(CheckpointHeader);
+}
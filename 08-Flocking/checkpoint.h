@@ -0,0 +1,125 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Parameters of the flocking simulation which need to be stored to reproduce a run
+struct SimulationParams
+{
+  // How close can flock members get together (squared)
+  float closestDistanceSq;
+  // Maximum allowed speed
+  float maxSpeed;
+  // Simulation time step
+  float timeStep;
+  // Padding to keep the following vec4 aligned
+  float padding;
+  // Weight rules: collision avoidance, follow others, follow goal, flock center
+  glm::vec4 ruleWeights;
+};
+
+// Header of the binary checkpoint file, followed by flockSize instance records
+struct CheckpointHeader
+{
+  // Magic number identifying the file
+  static const uint32_t MAGIC = 0x4346504e; // "NPFC"
+  // Current version of the format, version 2 stores the time since the last update in velocity.w
+  static const uint32_t VERSION = 2;
+
+  // File identification
+  uint32_t magic;
+  // Format version
+  uint32_t version;
+  // Size of a single instance record in bytes
+  uint32_t recordSize;
+  // Number of flock members
+  uint32_t flockSize;
+  // Size of the work group the simulation was running with
+  uint32_t workGroupSize;
+  // Number of simulation steps performed
+  uint32_t stepIndex;
+  // Seed used for the initial state generation
+  uint32_t seed;
+  // Light animation timer
+  float animationTime;
+  // Simulation parameters
+  SimulationParams params;
+};
+
+// Read only memory mapped file
+class MappedFile
+{
+public:
+  MappedFile() {}
+  ~MappedFile() { Close(); }
+
+  // Maps the whole file to the memory, returns false on failure
+  bool Open(const char *path);
+  // Unmaps the file and releases all handles
+  void Close();
+  // Returns pointer to the mapped data
+  const void *GetData() const { return _data; }
+  // Returns the size of the mapped data in bytes
+  size_t GetSize() const { return _size; }
+
+private:
+  // No copies allowed
+  MappedFile(const MappedFile &);
+  MappedFile & operator = (const MappedFile &);
+
+  // Mapped data
+  const void *_data = nullptr;
+  // Size of the mapped data
+  size_t _size = 0;
+#ifdef _WIN32
+  // File handle
+  void *_file = nullptr;
+  // File mapping handle
+  void *_mapping = nullptr;
+#endif
+};
+
+// Asynchronous checkpoint writer, copies GPU buffer to a readback buffer and writes it
+// to the disk once the GPU signals the copy is done without stalling the pipeline
+class CheckpointWriter
+{
+public:
+  CheckpointWriter() {}
+  ~CheckpointWriter();
+
+  // Enqueues copy of the buffer range for writing, returns false if previous request is still pending
+  bool Request(const char *path, const CheckpointHeader &header, GLuint buffer, GLsizeiptr size);
+  // Checks whether the copy finished and hands the data to the writing thread, call once per frame
+  void Poll();
+  // Returns true if there's no outstanding request
+  bool IsIdle() const { return _fence == nullptr; }
+
+private:
+  // No copies allowed
+  CheckpointWriter(const CheckpointWriter &);
+  CheckpointWriter & operator = (const CheckpointWriter &);
+
+  // Buffer the GPU copies the state into
+  GLuint _readbackBuffer = 0;
+  // Size of the readback buffer
+  GLsizeiptr _readbackSize = 0;
+  // Fence signaled when the copy is finished
+  GLsync _fence = nullptr;
+  // Path of the pending checkpoint
+  std::string _path;
+  // Header of the pending checkpoint
+  CheckpointHeader _header;
+  // Thread writing the data to the disk
+  std::thread _writer;
+};
+
+// Loads the checkpoint header and returns pointer to the mapped instance data, nullptr on failure
+const void *LoadCheckpoint(MappedFile &file, const char *path, CheckpointHeader &header);
@@ -3,7 +3,10 @@
  * Licensed under the zlib license, see LICENSE.txt in the root directory.
  */
 
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -12,6 +15,9 @@
 
 #include <MathSupport.h>
 #include <Camera.h>
+#include <GpuTimer.h>
+#include <HdrFormat.h>
+#include <Textures.h>
 
 #include "shaders.h"
 #include "scene.h"
@@ -83,16 +89,35 @@ static constexpr float CameraTurboSpeed = 50.0f;
 static const unsigned int MAX_TEXT_LENGTH = 256;
 // MSAA samples
 static const GLsizei MSAA_SAMPLES = 4;
+// Weight of the history in the temporal anti-aliasing resolve, higher is smoother but blurrier in motion
+static const float TAA_HISTORY_WEIGHT = 0.9f;
+// Auto exposure: middle grey the average luminance is mapped to, exposure limits, and the adaptation speed
+static const float EXPOSURE_KEY = 0.18f;
+static const float EXPOSURE_MIN = 0.5f;
+static const float EXPOSURE_MAX = 2.0f;
+static const float EXPOSURE_ADAPTATION_SPEED = 1.5f;
+// Size of the luminance histogram, must match HISTOGRAM_BINS in the tonemapping shaders
+static const unsigned int HISTOGRAM_BINS = 256;
+// Size of the tonemapping work group tile, must match the tonemapping compute shader
+static const unsigned int TONEMAPPING_TILE_SIZE = 16;
+// Maximum distance to the end of an edge searched by SMAA, must match MAX_DISTANCE in the blending weight shader
+static const unsigned int SMAA_MAX_DISTANCE = 16;
+// Seed for the initial flock state, keeps the runs reproducible
+static const unsigned int FLOCK_SEED = 0x2021;
+// Size of the compute shader work group, must match the compute shader
+static const unsigned int FLOCK_WORK_GROUP_SIZE = 256;
+// Default number of flock members
+static const unsigned int FLOCK_DEFAULT_SIZE = 64 * FLOCK_WORK_GROUP_SIZE;
 
 // Camera instance
 Camera camera;
 // Scene helper instance
 Scene &scene(Scene::GetInstance());
 // Render modes
-RenderMode renderMode = {true, false, true, MSAA_SAMPLES};
+RenderMode renderMode = {true, false, true, MSAA_SAMPLES, true, false, false, PostAntiAliasing::None};
 // Enable/disable light movement
 bool animate = false;
-// Enable/disable faster flock movement
+// Enable/disable faster simulation time
 bool turbo = false;
 
 // Our framebuffer object
@@ -101,6 +126,34 @@ GLuint fbo = 0;
 GLuint renderTarget = 0;
 // Our depth stencil for rendering
 GLuint depthStencil = 0;
+// Screen space motion for the temporal anti-aliasing
+GLuint velocityTarget = 0;
+// Resolved HDR images of the temporal anti-aliasing, the previous one is the history of the current one
+GLuint historyTarget[2] = {0};
+GLuint historyFbo[2] = {0};
+// Index of the latest resolved image
+unsigned int historyIndex = 0;
+// Is the history usable? Not after the targets are recreated
+bool historyValid = false;
+// Frame counter driving the sub-pixel jitter
+unsigned int jitterIndex = 0;
+// Tonemapped image, sRGB for sampling and blitting, viewed as RGBA8 for the compute tonemapping to store to it
+GLuint ldrTarget = 0;
+GLuint ldrImageView = 0;
+GLuint ldrFbo = 0;
+// Exposure and the luminance histogram of the auto exposure
+GLuint exposureBuffer = 0;
+// SMAA edges and blending weights
+GLuint smaaEdgesTarget = 0;
+GLuint smaaEdgesFbo = 0;
+GLuint smaaBlendTarget = 0;
+GLuint smaaBlendFbo = 0;
+// SMAA precomputed areas
+GLuint smaaAreaTexture = 0;
+// Memory of all the render targets, for comparing the anti-aliasing modes
+size_t renderTargetBytes = 0;
+// GPU time of the scene, its anti-aliasing, and tonemapping
+GpuTimer sceneTimer;
 
 // ----------------------------------------------------------------------------
 
@@ -147,12 +200,26 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
     glfwSetWindowShouldClose(window, true);
 
-  // Enable/disable MSAA - note that it still uses the MSAA buffer
+  // Cycle the anti-aliasing: MSAA, then TAA, FXAA, and SMAA on single sampled targets, none
   if (key == GLFW_KEY_F1 && action == GLFW_PRESS)
   {
     if (renderMode.msaaLevel > 1)
     {
       renderMode.msaaLevel = 1;
+      renderMode.taa = true;
+    }
+    else if (renderMode.taa)
+    {
+      renderMode.taa = false;
+      renderMode.postAA = PostAntiAliasing::FXAA;
+    }
+    else if (renderMode.postAA == PostAntiAliasing::FXAA)
+    {
+      renderMode.postAA = PostAntiAliasing::SMAA;
+    }
+    else if (renderMode.postAA == PostAntiAliasing::SMAA)
+    {
+      renderMode.postAA = PostAntiAliasing::None;
     }
     else
     {
@@ -190,12 +257,57 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     animate = !animate;
   }
 
-  // Enable/disable faster flock movement
+  // Enable/disable faster simulation time
   if (key == GLFW_KEY_F6 && action == GLFW_PRESS)
   {
     turbo = !turbo;
   }
 
+  // Save the simulation state, file name contains the step so the checkpoints don't overwrite each other
+  if (key == GLFW_KEY_F7 && action == GLFW_PRESS)
+  {
+    char path[MAX_TEXT_LENGTH];
+    snprintf(path, MAX_TEXT_LENGTH, "flock_%08u.chk", scene.GetStepIndex());
+    if (!scene.SaveCheckpoint(path))
+      printf("Previous checkpoint is still being saved!\n");
+  }
+
+  // Enable/disable GPU frustum culling and LOD selection
+  if (key == GLFW_KEY_F8 && action == GLFW_PRESS)
+  {
+    renderMode.culling = !renderMode.culling;
+  }
+
+  // Cycle the simulation quality, lower quality updates the distant flock members less often
+  if (key == GLFW_KEY_F9 && action == GLFW_PRESS)
+  {
+    scene.SetSimulationQuality(scene.GetSimulationQuality() + 1);
+  }
+
+  // Measure the deviation of the current simulation quality from the full simulation
+  if (key == GLFW_KEY_F10 && action == GLFW_PRESS)
+  {
+    scene.MeasureDeviation();
+  }
+
+  // Enable/disable the Barnes-Hut approximation of the flocking forces
+  if (key == GLFW_KEY_F11 && action == GLFW_PRESS)
+  {
+    scene.SetBarnesHut(!scene.GetBarnesHut());
+  }
+
+  // Measure the error of the Barnes-Hut approximation against the brute force
+  if (key == GLFW_KEY_F12 && action == GLFW_PRESS)
+  {
+    scene.MeasureForceError();
+  }
+
+  // Enable/disable the depth prepass, function keys are all taken
+  if (key == GLFW_KEY_P && action == GLFW_PRESS)
+  {
+    renderMode.depthPrepass = !renderMode.depthPrepass;
+  }
+
   // Zoom in
   if (key == GLFW_KEY_KP_ADD || key == GLFW_KEY_EQUAL && action == GLFW_PRESS)
   {
@@ -296,6 +408,46 @@ bool initOpenGL()
   return true;
 }
 
+// Helper function for (re)creating a single sampled color target with its own framebuffer
+void createColorTarget(GLuint &texture, GLuint &framebuffer, GLenum internalFormat, GLenum format, int width, int height, GLint filter)
+{
+  if (!framebuffer)
+  {
+    glGenFramebuffers(1, &framebuffer);
+  }
+
+  if (glIsTexture(texture))
+  {
+    glDeleteTextures(1, &texture);
+  }
+
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+  {
+    printf("Failed to create framebuffer: 0x%04X\n", status);
+  }
+}
+
+// Helper function for releasing a color target no longer in use, its framebuffer is kept for later
+void deleteColorTarget(GLuint &texture)
+{
+  if (glIsTexture(texture))
+  {
+    glDeleteTextures(1, &texture);
+    texture = 0;
+  }
+}
+
 // Helper function for creating the HDR framebuffer
 void createFramebuffer(int width, int height, GLsizei MSAA)
 {
@@ -328,17 +480,18 @@ void createFramebuffer(int width, int height, GLsizei MSAA)
     glGenTextures(1, &renderTarget);
   }
 
-  // Bind and recreate the render target texture
+  // Bind and recreate the render target texture, R11G11B10F halves the bandwidth unless its error is too high
+  const GLenum hdrFormat = HdrFormat::Select(HdrFormat::Auto);
   if (MSAA > 1)
   {
     glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, renderTarget);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, MSAA, GL_RGB16F, width, height, GL_TRUE);
+    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, MSAA, hdrFormat, width, height, GL_TRUE);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, renderTarget, 0);
   }
   else
   {
     glBindTexture(GL_TEXTURE_2D, renderTarget);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, hdrFormat, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderTarget, 0);
@@ -373,9 +526,42 @@ void createFramebuffer(int width, int height, GLsizei MSAA)
   }
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
 
+  // --------------------------------------------------------------------------
+  // Temporal anti-aliasing targets:
+  // --------------------------------------------------------------------------
+
+  // Delete them if necessary, they only exist while TAA is on
+  if (glIsTexture(velocityTarget))
+  {
+    glDeleteTextures(1, &velocityTarget);
+    velocityTarget = 0;
+  }
+
+  deleteColorTarget(historyTarget[0]);
+  deleteColorTarget(historyTarget[1]);
+
+  // New targets have no history
+  historyValid = false;
+
+  // Velocity is only written to the single sampled target
+  const bool taa = renderMode.taa && MSAA == 1;
+  if (taa)
+  {
+    glGenTextures(1, &velocityTarget);
+    glBindTexture(GL_TEXTURE_2D, velocityTarget);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, velocityTarget, 0);
+  }
+  else
+  {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+  }
+
   // Set the list of draw buffers.
-  GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0};
-  glDrawBuffers(1, drawBuffers);
+  GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  glDrawBuffers(taa ? 2 : 1, drawBuffers);
 
   // Check for completeness
   GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
@@ -384,6 +570,85 @@ void createFramebuffer(int width, int height, GLsizei MSAA)
     printf("Failed to create framebuffer: 0x%04X\n", status);
   }
 
+  if (taa)
+  {
+    // Resolved images are sampled bilinearly at the reprojected positions
+    createColorTarget(historyTarget[0], historyFbo[0], GL_RGB16F, GL_RGB, width, height, GL_LINEAR);
+    createColorTarget(historyTarget[1], historyFbo[1], GL_RGB16F, GL_RGB, width, height, GL_LINEAR);
+  }
+
+  // --------------------------------------------------------------------------
+  // Tonemapping targets:
+  // --------------------------------------------------------------------------
+
+  // Delete them if necessary, the view must go first
+  deleteColorTarget(ldrImageView);
+  deleteColorTarget(ldrTarget);
+
+  // Tonemapped image, sRGB keeps the precision where the eye needs it, FXAA samples it bilinearly,
+  // views require the immutable storage which can't be empty, minimized window gets a single texel
+  glGenTextures(1, &ldrTarget);
+  glBindTexture(GL_TEXTURE_2D, ldrTarget);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_SRGB8_ALPHA8, std::max(width, 1), std::max(height, 1));
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glGenTextures(1, &ldrImageView);
+  glTextureView(ldrImageView, GL_TEXTURE_2D, ldrTarget, GL_RGBA8, 0, 1, 0, 1);
+
+  if (!ldrFbo)
+  {
+    glGenFramebuffers(1, &ldrFbo);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, ldrFbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ldrTarget, 0);
+  status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+  {
+    printf("Failed to create framebuffer: 0x%04X\n", status);
+  }
+
+  // Exposure doesn't depend on the resolution, create it just once, exposure 1 to start with
+  if (!exposureBuffer)
+  {
+    std::vector<GLuint> data(2 + HISTOGRAM_BINS, 0);
+    const float exposure[] = {1.0f, log2f(EXPOSURE_KEY)};
+    memcpy(data.data(), exposure, sizeof(exposure));
+
+    glGenBuffers(1, &exposureBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, exposureBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, data.size() * sizeof(GLuint), data.data(), GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  }
+
+  // --------------------------------------------------------------------------
+  // Post-process anti-aliasing targets:
+  // --------------------------------------------------------------------------
+
+  // Delete them if necessary, they only exist while SMAA is on
+  deleteColorTarget(smaaEdgesTarget);
+  deleteColorTarget(smaaBlendTarget);
+
+  const bool smaa = renderMode.postAA == PostAntiAliasing::SMAA && MSAA == 1;
+  if (smaa)
+  {
+    createColorTarget(smaaEdgesTarget, smaaEdgesFbo, GL_RG8, GL_RG, width, height, GL_NEAREST);
+    createColorTarget(smaaBlendTarget, smaaBlendFbo, GL_RGBA8, GL_RGBA, width, height, GL_NEAREST);
+
+    // Areas don't depend on the resolution, create them just once
+    if (!smaaAreaTexture)
+    {
+      smaaAreaTexture = Textures::CreateSmaaAreaTexture(SMAA_MAX_DISTANCE);
+    }
+  }
+
+  // Memory of the targets per pixel, RGB16F is padded to 8 B by the drivers: color and depth-stencil per sample,
+  // tonemapped image, velocity and two history images for TAA, edges and weights for SMAA
+  size_t bytesPerPixel = (HdrFormat::GetBytesPerPixel(hdrFormat) + 4) * MSAA + 4 + (taa ? 4 + 2 * 8 : 0) + (smaa ? 2 + 4 : 0);
+  renderTargetBytes = bytesPerPixel * width * height;
+
   // Bind back the window system provided framebuffer
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
@@ -400,7 +665,19 @@ void shutDown()
   // Release the framebuffer
   glDeleteTextures(1, &renderTarget);
   glDeleteTextures(1, &depthStencil);
+  glDeleteTextures(1, &velocityTarget);
+  glDeleteTextures(2, historyTarget);
+  glDeleteTextures(1, &ldrImageView);
+  glDeleteTextures(1, &ldrTarget);
+  glDeleteBuffers(1, &exposureBuffer);
+  glDeleteTextures(1, &smaaEdgesTarget);
+  glDeleteTextures(1, &smaaBlendTarget);
+  glDeleteTextures(1, &smaaAreaTexture);
   glDeleteFramebuffers(1, &fbo);
+  glDeleteFramebuffers(2, historyFbo);
+  glDeleteFramebuffers(1, &ldrFbo);
+  glDeleteFramebuffers(1, &smaaEdgesFbo);
+  glDeleteFramebuffers(1, &smaaBlendFbo);
 
   // Release the window
   glfwDestroyWindow(mainWindow.handle);
@@ -463,8 +740,146 @@ void processInput(float dt)
   }
 }
 
-void renderScene()
+// Blends the jittered render target with the reprojected history to the next resolved image
+void resolveTemporal()
+{
+  // The latest resolved image becomes the history of the new one
+  unsigned int previous = historyIndex;
+  historyIndex ^= 1;
+  glBindFramebuffer(GL_FRAMEBUFFER, historyFbo[historyIndex]);
+
+  // Solid fill always, no depth test
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glDisable(GL_DEPTH_TEST);
+
+  glUseProgram(shaderProgram[ShaderProgram::TemporalResolve]);
+  glUniform1f(0, historyValid ? TAA_HISTORY_WEIGHT : 0.0f);
+
+  // Bind the current image, the history, and the velocity
+  GLuint textures[] = {renderTarget, historyTarget[previous], velocityTarget};
+  for (int i = 0; i < 3; ++i)
+  {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    glBindSampler(i, 0);
+  }
+
+  // Draw fullscreen quad
+  glBindVertexArray(scene.GetGenericVAO());
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+
+  // Unbind the shader program and other resources
+  for (int i = 2; i >= 0; --i)
+  {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  glBindVertexArray(0);
+  glUseProgram(0);
+
+  historyValid = true;
+}
+
+// Applies FXAA or SMAA to the tonemapped image and writes the result to the screen
+void applyPostAntiAliasing()
 {
+  glBindVertexArray(scene.GetGenericVAO());
+
+  if (renderMode.postAA == PostAntiAliasing::FXAA)
+  {
+    // Single pass straight to the screen
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glUseProgram(shaderProgram[ShaderProgram::Fxaa]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, ldrTarget);
+    glBindSampler(0, 0);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+  }
+  else
+  {
+    // Both intermediate targets must be cleared, the passes discard the pixels without edges
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+    // Edge detection
+    glBindFramebuffer(GL_FRAMEBUFFER, smaaEdgesFbo);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glUseProgram(shaderProgram[ShaderProgram::SmaaEdgeDetection]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, ldrTarget);
+    glBindSampler(0, 0);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    // Blending weights from the edge shapes and the precomputed areas
+    glBindFramebuffer(GL_FRAMEBUFFER, smaaBlendFbo);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glUseProgram(shaderProgram[ShaderProgram::SmaaBlendingWeights]);
+    glBindTexture(GL_TEXTURE_2D, smaaEdgesTarget);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, smaaAreaTexture);
+    glBindSampler(1, 0);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    // Neighborhood blending to the screen
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glUseProgram(shaderProgram[ShaderProgram::SmaaNeighborhoodBlending]);
+    glBindTexture(GL_TEXTURE_2D, smaaBlendTarget);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, ldrTarget);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // Unbind the shader program and other resources
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindVertexArray(0);
+  glUseProgram(0);
+}
+
+// Tonemaps the HDR image to the LDR target with the automatic exposure
+void tonemap(GLuint hdrImage, float dt)
+{
+  // Fused MSAA resolve, exposure, and tonemapping, the luminance histogram is gathered along the way
+  glUseProgram(shaderProgram[ShaderProgram::Tonemapping]);
+  glUniform1i(0, renderMode.msaaLevel);
+
+  // Multisampled and single sampled images have their own units as the sampler types differ
+  GLenum target = (renderMode.msaaLevel > 1) ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+  GLuint unit = (renderMode.msaaLevel > 1) ? 0 : 1;
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(target, hdrImage);
+  glBindSampler(unit, 0); // Very important!
+
+  glBindImageTexture(0, ldrImageView, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, exposureBuffer);
+  glDispatchCompute((mainWindow.width + TONEMAPPING_TILE_SIZE - 1) / TONEMAPPING_TILE_SIZE, (mainWindow.height + TONEMAPPING_TILE_SIZE - 1) / TONEMAPPING_TILE_SIZE, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // Adapt the exposure of the next frame to the histogram, no readback needed
+  glUseProgram(shaderProgram[ShaderProgram::AutoExposure]);
+  glUniform1f(0, 1.0f - expf(-dt * EXPOSURE_ADAPTATION_SPEED));
+  glUniform1ui(1, mainWindow.width * mainWindow.height);
+  glUniform3f(2, EXPOSURE_KEY, EXPOSURE_MIN, EXPOSURE_MAX);
+  glDispatchCompute(1, 1, 1);
+
+  // Tonemapped image is blitted or sampled next, the exposure is read by the next frame
+  glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // Unbind the shader program and other resources
+  glBindTexture(target, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+  glUseProgram(0);
+}
+
+void renderScene(float dt)
+{
+  // Measure the scene together with its anti-aliasing and tonemapping, so that all the modes are comparable
+  sceneTimer.Begin();
+
   // Bind the framebuffer
   glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 
@@ -474,10 +889,19 @@ void renderScene()
   glBindVertexArray(0);
   glUseProgram(0);
 
+  // Final HDR image is either the render target or the temporally resolved one
+  GLuint hdrImage = renderTarget;
+  GLuint hdrFbo = fbo;
+  if (renderMode.taa)
+  {
+    resolveTemporal();
+    hdrImage = historyTarget[historyIndex];
+    hdrFbo = historyFbo[historyIndex];
+  }
+
   if (renderMode.tonemapping)
   {
-    // Unbind the framebuffer and bind the window system provided FBO
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    tonemap(hdrImage, dt);
 
     // Solid fill always
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
@@ -486,38 +910,30 @@ void renderScene()
     glDisable(GL_MULTISAMPLE);
     glDisable(GL_DEPTH_TEST);
 
-    // Clear the color
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    // Tonemapping
-    glUseProgram(shaderProgram[ShaderProgram::Tonemapping]);
-
-    // Send in the required data
-    glUniform1f(0, (float)renderMode.msaaLevel);
-
-    // Bind the HDR render target as texture
-    GLenum target = (renderMode.msaaLevel > 1) ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(target, renderTarget);
-    glBindSampler(0, 0); // Very important!
-
-    // Draw fullscreen quad
-    glBindVertexArray(scene.GetGenericVAO());
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-
-    // Unbind the shader program and other resources
-    glBindVertexArray(0);
-    glUseProgram(0);
+    if (renderMode.postAA != PostAntiAliasing::None && renderMode.msaaLevel == 1)
+    {
+      applyPostAntiAliasing();
+    }
+    else
+    {
+      // Copy the tonemapped image to the screen, both are sRGB
+      glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, ldrFbo);
+      glDrawBuffer(GL_BACK);
+      glBlitFramebuffer(0, 0, mainWindow.width, mainWindow.height, 0, 0, mainWindow.width, mainWindow.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
   }
   else
   {
-    // Just copy the render target to the screen
+    // Just copy the render target to the screen, post-process anti-aliasing works on the tonemapped image only
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, hdrFbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
     glDrawBuffer(GL_BACK);
     glBlitFramebuffer(0, 0, mainWindow.width, mainWindow.height, 0, 0, mainWindow.width, mainWindow.height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
   }
+
+  sceneTimer.End();
 }
 
 // Helper method for implementing the application main loop
@@ -534,28 +950,62 @@ void mainLoop()
     // Print it to the title bar
     static char title[MAX_TEXT_LENGTH];
     static char instacing[] = "[Instancing] ";
-    snprintf(title, MAX_TEXT_LENGTH, "dt = %.2fms, FPS = %.1f", dt * 1000.0f, 1.0f / dt);
+    static char overdraw[MAX_TEXT_LENGTH];
+    if (renderMode.depthPrepass)
+      snprintf(overdraw, MAX_TEXT_LENGTH, "%.2f -> %.2f (prepass)", scene.GetPrepassOverdraw(), scene.GetShadingOverdraw());
+    else
+      snprintf(overdraw, MAX_TEXT_LENGTH, "%.2f", scene.GetShadingOverdraw());
+    const char *postAntiAliasing[] = {"off", "FXAA", "SMAA"};
+    const char *antiAliasing = renderMode.msaaLevel > 1 ? "MSAA" : renderMode.taa ? "TAA" : postAntiAliasing[(int)renderMode.postAA];
+    snprintf(title, MAX_TEXT_LENGTH, "dt = %.2fms, FPS = %.1f, steps = %u, dropped = %.2fs, quality = %u, active = %.1f%%, clusters = %u, overdraw = %s, AA = %s (%.2fms, %.1fMB)%s%s",
+             dt * 1000.0f, 1.0f / dt, scene.GetStepsPerFrame(), scene.GetDroppedTime(), scene.GetSimulationQuality(), scene.GetActiveRatio() * 100.0f, scene.GetStats().clusters, overdraw,
+             antiAliasing, sceneTimer.GetMilliseconds(), renderTargetBytes / (1024.0f * 1024.0f), scene.GetBarnesHut() ? ", Barnes-Hut" : "",
+             subgroupFlocking ? ", subgroups" : "");
     glfwSetWindowTitle(mainWindow.handle, title);
 
     // Poll the events like keyboard, mouse, etc.
     glfwPollEvents();
 
+    // Remember the camera of the last frame for the reprojection
+    camera.StorePreviousFrame();
+
     // Process keyboard input
     processInput(dt);
 
+    // Jitter the projection by a different sub-pixel offset every frame for TAA
+    if (renderMode.taa)
+      camera.SetJitter(jitterIndex++, mainWindow.width, mainWindow.height);
+    else
+      camera.ClearJitter();
+
     // Update scene
-    scene.Update(dt, animate, turbo);
+    scene.Update(dt, camera, animate, turbo);
 
     // Render the scene
-    renderScene();
+    renderScene(dt);
 
     // Swap actual buffers on the GPU
     glfwSwapBuffers(mainWindow.handle);
   }
 }
 
-int main()
+// Usage: 08-Flocking [-n flockSize] [-s snapshotInterval] [checkpoint], checkpoint overrides the flock size
+int main(int argc, char *argv[])
 {
+  // Parse the command line
+  unsigned int flockSize = FLOCK_DEFAULT_SIZE;
+  unsigned int snapshotInterval = 0;
+  const char *checkpoint = nullptr;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      flockSize = std::max(static_cast<unsigned int>(strtoul(argv[++i], nullptr, 10)), 1u);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      snapshotInterval = static_cast<unsigned int>(strtoul(argv[++i], nullptr, 10));
+    else
+      checkpoint = argv[i];
+  }
+
   // Initialize the OpenGL context and create a window
   if (!initOpenGL())
   {
@@ -573,7 +1023,8 @@ int main()
   }
 
   // Scene initialization
-  scene.Init(256, 64);
+  scene.Init(FLOCK_WORK_GROUP_SIZE, (flockSize + FLOCK_WORK_GROUP_SIZE - 1) / FLOCK_WORK_GROUP_SIZE, FLOCK_SEED, checkpoint);
+  scene.SetSnapshotInterval(snapshotInterval);
 
   // Enter the application main loop
   mainLoop();
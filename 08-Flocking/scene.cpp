@@ -6,22 +6,67 @@
 #include "scene.h"
 #include "shaders.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
 #include <vector>
 #include <glad/glad.h>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/transform.hpp>
 
+#include <JobSystem.h>
 #include <MathSupport.h>
+#include <Random.h>
+
+// Limit the storage buffer chunk size (in flock members) to test the chunking, 0 uses the driver limit
+#define _DEBUG_CHUNK_SIZE 0
 
 // Scaling factor for lights movement curve
 static const glm::vec3 scale = glm::vec3(35.0f, 25.0f, 60.0f);
 
+// Distances from the camera or the goal where the update period of the flock member doubles, per quality level
+static const glm::vec2 periodDistances[Scene::NumQualityLevels] =
+{
+  glm::vec2(FLT_MAX, FLT_MAX),
+  glm::vec2(80.0f, 160.0f),
+  glm::vec2(40.0f, 80.0f),
+  glm::vec2(20.0f, 40.0f),
+};
+
+// Size of the active members buffer header, dispatch arguments and active count for each chunk
+static const unsigned int ACTIVE_LIST_HEADER = Scene::MAX_FLOCK_CHUNKS * 4;
+
+// Random numbers needed to generate a flock member: position and velocity
+static const unsigned int RANDOM_NUMBERS_PER_BOID = 6;
+// Number of flock members generated at once, also the smallest parallel job
+static const unsigned int FLOCK_GENERATION_GRAIN = 256;
+
+// Number of leaf cells of the dense octree
+static const unsigned int OCTREE_LEAVES = 1u << (3 * Scene::OCTREE_DEPTH);
+// Number of nodes of the dense octree
+static const unsigned int OCTREE_NODES = ((1u << (3 * (Scene::OCTREE_DEPTH + 1))) - 1) / 7;
+// Octree buffer layout: bounds, leaf cell ranges, nodes (2x vec4)
+static const GLsizeiptr OCTREE_CELLS_OFFSET = 8 * sizeof(GLuint);
+static const GLsizeiptr OCTREE_NODES_OFFSET = OCTREE_CELLS_OFFSET + OCTREE_LEAVES * 2 * sizeof(GLuint);
+static const GLsizeiptr OCTREE_SIZE = OCTREE_NODES_OFFSET + OCTREE_NODES * 2 * sizeof(glm::vec4);
+// Size of the compact flock member record used by the octree
+static const GLsizeiptr OCTREE_MEMBER_SIZE = 2 * sizeof(glm::vec4);
+
 // Lissajous curve position calculation based on the parameters
 auto lissajous = [](const glm::vec4 &p, float t) -> glm::vec3
 {
   return glm::vec3(sinf(p.x * t), cosf(p.y * t), sinf(p.z * t) * cosf(p.w * t));
 };
 
+// Checks the simulation parameters loaded from a checkpoint, the update divides by the time step
+static bool isValid(const SimulationParams &params)
+{
+  auto valid = [](float value) { return std::isfinite(value) && value >= 0.0f; };
+  return std::isfinite(params.timeStep) && params.timeStep > 0.0f && valid(params.closestDistanceSq) && valid(params.maxSpeed) &&
+         valid(params.ruleWeights.x) && valid(params.ruleWeights.y) && valid(params.ruleWeights.z) && valid(params.ruleWeights.w);
+}
+
 // ----------------------------------------------------------------------------
 
 Scene& Scene::GetInstance()
@@ -40,15 +85,34 @@ Scene::~Scene()
   // Delete meshes
   delete _tetrahedron;
   _tetrahedron = nullptr;
+  delete _tetrahedronReduced;
+  _tetrahedronReduced = nullptr;
 
   // Release the instancing buffer
   glDeleteBuffers(2, _sbo);
 
+  // Release the simulation LOD buffers
+  glDeleteBuffers(1, &_activeMembers);
+  glDeleteBuffers(1, &_activeReadback);
+  glDeleteBuffers(2, _referenceData);
+  if (_activeFence)
+    glDeleteSync(_activeFence);
+
+  // Release the octree buffers
+  glDeleteBuffers(1, &_sortKeys);
+  glDeleteBuffers(1, &_compactMembers);
+  glDeleteBuffers(1, &_sortedMembers);
+  glDeleteBuffers(1, &_octree);
+
+  // Release the culling buffers
+  glDeleteBuffers(1, &_drawCommands);
+  glDeleteBuffers(1, &_visibleInstances);
+
   // Release the generic VAO
   glDeleteVertexArrays(1, &_vao);
 }
 
-void Scene::Init(unsigned int workGroupSize, unsigned int numWorkGroups)
+void Scene::Init(unsigned int workGroupSize, unsigned int numWorkGroups, unsigned int seed, const char *checkpoint)
 {
   // Check if already initialized and return
   if (_vao)
@@ -57,102 +121,752 @@ void Scene::Init(unsigned int workGroupSize, unsigned int numWorkGroups)
   _workGroupSize = workGroupSize;
   _numWorkGroups = numWorkGroups;
   _flockSize = _workGroupSize * _numWorkGroups;
+  _seed = seed;
 
   // Prepare meshes
   _tetrahedron = Geometry::CreateTetrahedron();
+  _tetrahedronReduced = Geometry::CreateTetrahedronShared();
+
+  // --------------------------------------------------------------------------
+
+  // Ambient intensity for the lights
+  const float ambientIntentsity = 1e-3f;
+
+  // Position & color of the light
+  glm::vec4 p = glm::vec4(0.34f, 0.29f, 0.12f, 0.5f);
+  _light = {lissajous(p, 0.0f) * scale, glm::vec4(100.0f, 100.0f, 100.0f, ambientIntentsity), p};
 
   // --------------------------------------------------------------------------
 
   // Create general use VAO
   glGenVertexArrays(1, &_vao);
 
-  // Generate the instancing buffers
+  // Generate the instancing buffers, they're allocated once we know the flock size
   glGenBuffers(ShaderData::NumBuffers, _sbo);
+  glGenBuffers(1, &_activeMembers);
+  glGenBuffers(1, &_activeReadback);
+  glGenBuffers(1, &_sortKeys);
+  glGenBuffers(1, &_compactMembers);
+  glGenBuffers(1, &_sortedMembers);
+  glGenBuffers(1, &_octree);
+  glGenBuffers(1, &_drawCommands);
+  glGenBuffers(1, &_visibleInstances);
+
+  // Restore the state from the checkpoint if requested, fall back to the generated one
+  if (!checkpoint || !LoadFlock(checkpoint))
+  {
+    // Shrink the flock if it doesn't fit even when split to the maximum number of chunks
+    if (!ComputeChunks() && _chunkSize > 0)
+    {
+      _numWorkGroups = MAX_FLOCK_CHUNKS * _chunkSize / _workGroupSize;
+      _flockSize = _workGroupSize * _numWorkGroups;
+      ComputeChunks();
+      printf("Flock is too large, using %u members instead!\n", _flockSize);
+    }
+
+    CreateBuffers();
+    GenerateFlock();
+  }
+
+  // Both buffers start with the same state so that the first frames can interpolate between them
+  glBindBuffer(GL_COPY_READ_BUFFER, _sbo[ShaderData::Flock0]);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, _sbo[ShaderData::Flock1]);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, _flockSize * sizeof(InstanceData));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+bool Scene::ComputeChunks()
+{
+  // Ask the driver how large the storage block can be and how the ranges need to be aligned
+  GLint64 maxBlockSize = 0;
+  glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlockSize);
+  _maxBlockSize = maxBlockSize;
+  GLint offsetAlignment = 1;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+
+#if _DEBUG_CHUNK_SIZE
+  // Force smaller chunks to exercise the chunked path on drivers with large limits
+  maxBlockSize = std::min<GLint64>(maxBlockSize, _DEBUG_CHUNK_SIZE * sizeof(InstanceData));
+#endif
+
+  // Chunk must consist of whole work groups so that the whole group accesses the same chunk
+  // and its size in bytes must respect the offset alignment of the following chunk
+  GLint64 groupSize = static_cast<GLint64>(_workGroupSize) * sizeof(InstanceData);
+  GLint64 groupsPerChunk = std::min<GLint64>(maxBlockSize / groupSize, _numWorkGroups);
+  while (groupsPerChunk > 1 && (groupsPerChunk * groupSize) % offsetAlignment != 0)
+    --groupsPerChunk;
+
+  _chunkSize = static_cast<unsigned int>(groupsPerChunk) * _workGroupSize;
+  if (_chunkSize == 0)
+  {
+    // Block can't hold even a single work group, there's no way to split the flock
+    printf("Storage block of %lld B can't hold a work group of %lld B!\n", static_cast<long long>(maxBlockSize), static_cast<long long>(groupSize));
+    _numChunks = 0;
+    return false;
+  }
 
-  // Create both VAOs for use with flocking simulation
+  _numChunks = (_flockSize + _chunkSize - 1) / _chunkSize;
+  return _numChunks <= MAX_FLOCK_CHUNKS;
+}
+
+void Scene::CreateBuffers()
+{
   for (int i = 0; i < ShaderData::NumBuffers; ++i)
   {
     // Create the instancing buffer, it will be used for drawing and also updated by the GPU
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, _sbo[ShaderData::Flock0 + i]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_INSTANCES * sizeof(InstanceData), nullptr, GL_DYNAMIC_COPY);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _flockSize * sizeof(InstanceData), nullptr, GL_DYNAMIC_COPY);
   }
 
+  // Active member lists, header is followed by the lists of the chunks
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _activeMembers);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, (ACTIVE_LIST_HEADER + _flockSize) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _activeReadback);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, ACTIVE_LIST_HEADER * sizeof(GLuint), nullptr, GL_STREAM_READ);
+
+  // Octree buffers, sort keys are padded to the power of two for the bitonic sort
+  _sortSize = _workGroupSize;
+  while (_sortSize < _flockSize)
+    _sortSize <<= 1;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _sortKeys);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, _sortSize * 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _compactMembers);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, _flockSize * OCTREE_MEMBER_SIZE, nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _sortedMembers);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, _flockSize * OCTREE_MEMBER_SIZE, nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _octree);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, OCTREE_SIZE, nullptr, GL_DYNAMIC_COPY);
+
+  // Visible instance lists, each LOD can hold the whole flock
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _visibleInstances);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, NumLods * _flockSize * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  // Draw commands are reset by the CPU and filled by the culling shader every frame
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _drawCommands);
+  glBufferData(GL_DRAW_INDIRECT_BUFFER, NumLods * MAX_FLOCK_CHUNKS * sizeof(DrawCommand), nullptr, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  // Statistics buffer and its readback ring
+  _statsReadback.Init();
+}
+
+void Scene::BindChunks(GLuint buffer, GLuint firstBinding)
+{
+  for (unsigned int i = 0; i < _numChunks; ++i)
+  {
+    unsigned int first = i * _chunkSize;
+    unsigned int count = std::min(_chunkSize, _flockSize - first);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, firstBinding + i, buffer, first * sizeof(InstanceData), count * sizeof(InstanceData));
+  }
+}
+
+void Scene::GenerateFlock()
+{
   // Initialize data for the first frame
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, _sbo[ShaderData::Flock0]);
   InstanceData* data = reinterpret_cast<InstanceData*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, _flockSize * sizeof(InstanceData), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
 
-  for (unsigned int i = 0; i < _flockSize; ++i)
+  // Same seed always leads to the same initial state: each job jumps ahead to the numbers of its first boid,
+  // so the flock doesn't depend on the number of threads
+  const uint64_t seed = _seed;
+  JobSystem::GetInstance().ParallelFor(_flockSize, FLOCK_GENERATION_GRAIN, [data, seed](unsigned int begin, unsigned int end)
   {
-    // Generate position
-    float x = getRandom(-150.0f, 150.0f);
-    float y = getRandom(-150.0f, 150.0f);
-    float z = getRandom(-150.0f, 150.0f);
-    data[i].transformation[3] = glm::vec4(x, y, z, 1.0f);
+    Pcg32 random(seed);
+    random.Advance(static_cast<uint64_t>(begin) * RANDOM_NUMBERS_PER_BOID);
 
-    // Generate velocity
-    x = getRandom(-0.5f, 0.5f);
-    y = getRandom(-0.5f, 0.5f);
-    z = getRandom(-0.5f, 0.5f);
-    data[i].velocity = glm::vec4(x, y, z, 1.0f);
+    float numbers[FLOCK_GENERATION_GRAIN * RANDOM_NUMBERS_PER_BOID];
+    for (unsigned int first = begin; first < end; first += FLOCK_GENERATION_GRAIN)
+    {
+      const unsigned int count = std::min(FLOCK_GENERATION_GRAIN, end - first);
+      random.FillUniform(numbers, count * RANDOM_NUMBERS_PER_BOID, -0.5f, 0.5f);
 
-    // Set the aside, up, and dir using orthonormalization with scene up
-    glm::vec3 direction = glm::normalize(glm::vec3(x, y, z));
-    data[i].transformation[0] = glm::vec4(glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), direction)), 0.0f);
-    data[i].transformation[1] = glm::vec4(glm::normalize(glm::cross(direction, glm::vec3(data[i].transformation[0]))), 0.0f);
-    data[i].transformation[2] = glm::vec4(direction, 0.0f);
-  }
+      for (unsigned int i = 0; i < count; ++i)
+      {
+        const float *n = numbers + i * RANDOM_NUMBERS_PER_BOID;
+        InstanceData &boid = data[first + i];
+
+        // Generate position
+        boid.transformation[3] = glm::vec4(300.0f * n[0], 300.0f * n[1], 300.0f * n[2], 1.0f);
+
+        // Generate velocity
+        glm::vec3 velocity(n[3], n[4], n[5]);
+        boid.velocity = glm::vec4(velocity, 0.0f);
+
+        // Set the aside, up, and dir using orthonormalization with scene up
+        glm::vec3 direction = glm::normalize(velocity);
+        boid.transformation[0] = glm::vec4(glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), direction)), 0.0f);
+        boid.transformation[1] = glm::vec4(glm::normalize(glm::cross(direction, glm::vec3(boid.transformation[0]))), 0.0f);
+        boid.transformation[2] = glm::vec4(direction, 0.0f);
+      }
+    }
+  });
 
   // Unmap and unbind the buffer for now
   glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
 
-  // --------------------------------------------------------------------------
+bool Scene::LoadFlock(const char *path)
+{
+  // File is mapped directly so the data goes to the buffer without any intermediate copy
+  MappedFile file;
+  CheckpointHeader header;
+  const void *data = LoadCheckpoint(file, path, header);
+  if (!data)
+    return false;
 
-  // Ambient intensity for the lights
-  const float ambientIntentsity = 1e-3f;
+  // Compute shader has fixed work group size, the parameters must give a meaningful simulation
+  if (header.recordSize != sizeof(InstanceData) || header.workGroupSize != _workGroupSize ||
+      header.flockSize == 0 || header.flockSize % header.workGroupSize != 0 || !isValid(header.params))
+  {
+    printf("Checkpoint %s doesn't match the simulation setup!\n", path);
+    return false;
+  }
 
-  // Position & color of the light
-  glm::vec4 p = glm::vec4(0.34f, 0.29f, 0.12f, 0.5f);
-  _light = {lissajous(p, 0.0f) * scale, glm::vec4(100.0f, 100.0f, 100.0f, ambientIntentsity), p};
+  // Flock size is given by the checkpoint, make sure we can fit it
+  unsigned int numWorkGroups = _numWorkGroups;
+  _numWorkGroups = header.flockSize / header.workGroupSize;
+  _flockSize = header.flockSize;
+  if (!ComputeChunks())
+  {
+    printf("Checkpoint %s contains too large flock!\n", path);
+    _numWorkGroups = numWorkGroups;
+    _flockSize = _workGroupSize * _numWorkGroups;
+    return false;
+  }
+
+  _seed = header.seed;
+  _stepIndex = header.stepIndex;
+  _animationTime = header.animationTime;
+  _params = header.params;
+
+  // Light is evaluated at the start of the step, restore it for the first frame
+  _light.position = lissajous(_light.movement, _animationTime) * scale;
+
+  CreateBuffers();
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _sbo[ShaderData::Flock0]);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, _flockSize * sizeof(InstanceData), data);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  printf("Checkpoint loaded: %s (%u members, step %u)\n", path, _flockSize, _stepIndex);
+  return true;
+}
+
+bool Scene::SaveCheckpoint(const char *path)
+{
+  CheckpointHeader header = {};
+  header.magic = CheckpointHeader::MAGIC;
+  header.version = CheckpointHeader::VERSION;
+  header.recordSize = sizeof(InstanceData);
+  header.flockSize = _flockSize;
+  header.workGroupSize = _workGroupSize;
+  header.stepIndex = _stepIndex;
+  header.seed = _seed;
+  header.animationTime = _animationTime;
+  header.params = _params;
+
+  // Current state is the result of the last step, the rendering interpolation isn't part of it
+  return _checkpointWriter.Request(path, header, _sbo[_currentFrameData], _flockSize * sizeof(InstanceData));
 }
 
-void Scene::Update(float dt, bool moveLight, bool turbo)
+void Scene::Update(float dt, const Camera &camera, bool moveLight, bool turbo)
 {
-  // Animation timer
-  static float t = 0.0f;
-  // Frame index
-  static unsigned int frameIndex = 0;
+  // Write out the pending checkpoint if the GPU is done with the copy
+  _checkpointWriter.Poll();
+  // Update the ratio of the active flock members if the GPU is done with the copy
+  PollActiveCount();
+  // Consume the statistics the GPU is done with
+  _statsReadback.Poll();
+
+  // Simulation LOD is driven by the distance to the camera
+  _viewPosition = glm::vec3(camera.GetViewToWorld()[3]);
+
+  // Accumulate the elapsed time, turbo mode just scales the simulation time
+  _frameTime = turbo ? dt * TURBO_TIME_SCALE : dt;
+  _accumulator += _frameTime;
+
+  // Consume the accumulated time by fixed time steps, but only up to the budget
+  _stepsPerFrame = 0;
+  while (_accumulator >= _params.timeStep && _stepsPerFrame < MAX_SUBSTEPS)
+  {
+    Step(moveLight);
+    _accumulator -= _params.timeStep;
+    ++_stepsPerFrame;
+  }
+
+  // We can't keep up, drop the whole steps we didn't manage to simulate
+  if (_accumulator >= _params.timeStep)
+  {
+    float dropped = floorf(_accumulator / _params.timeStep) * _params.timeStep;
+    _accumulator -= dropped;
+    _droppedTime += dropped;
+    _frameTime -= dropped;
+  }
 
+  // Gather the statistics of the new state
+  if (_stepsPerFrame > 0)
+    GatherStats();
+
+  // Remaining time determines how far between the last two states we are
+  _interpolation = _accumulator / _params.timeStep;
+}
+
+void Scene::Step(bool moveLight)
+{
   // Update the light position
-  _light.position = lissajous(_light.movement, t) * scale;
+  _light.position = lissajous(_light.movement, _animationTime) * scale;
 
   // Update the animation timer
-  t += moveLight ? dt : 0.0f;
+  _animationTime += moveLight ? _params.timeStep : 0.0f;
 
   // --------------------------------------------------------------------------
 
-  // Bind the simulation compute shader and update the goal position
-  glUseProgram(shaderProgram[ShaderProgram::Flocking]);
-  GLint goalLoc = glGetUniformLocation(shaderProgram[ShaderProgram::Flocking], "goal_dt");
-  glUniform4f(goalLoc, _light.position.x, _light.position.y, _light.position.z, turbo ? dt * 10.0f : dt);
-
-  // Bind input/output buffers
-  unsigned int _previousFrameData = frameIndex & 0x01;
-  unsigned int _currentFrameData = _previousFrameData ^ 0x01;
-  // We will read from this buffer
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _sbo[_previousFrameData]);
-  // We will put the simulation results to this buffer
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _sbo[_currentFrameData]);
-
-  // Perform the simulation step in the compute shader
+  // Swap the input/output buffers
+  _previousFrameData = _stepIndex & 0x01;
+  _currentFrameData = _previousFrameData ^ 0x01;
+
+  // Perform the simulation step using the current quality
+  SimulateStep(_sbo[_previousFrameData], _sbo[_currentFrameData], periodDistances[_simulationQuality], _barnesHut);
+
+  // Copy the active counts for the statistics unless the previous copy is still pending
+  if (!_activeFence)
+  {
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_COPY_READ_BUFFER, _activeMembers);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _activeReadback);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, ACTIVE_LIST_HEADER * sizeof(GLuint));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    _activeFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+
+  // Run the brute force simulation from the same state to get the error of the approximation
+  if (_measureForceError)
+  {
+    _measureForceError = false;
+    if (!_barnesHut)
+    {
+      printf("Barnes-Hut approximation is disabled!\n");
+    }
+    else if (_deviationSteps > 0)
+    {
+      printf("Deviation measurement is running, try again later!\n");
+    }
+    else
+    {
+      CreateReferenceBuffers();
+      SimulateStep(_sbo[_previousFrameData], _referenceData[_currentFrameData], periodDistances[_simulationQuality], false);
+      FinishForceError();
+    }
+  }
+
+  // Run the full brute force simulation alongside when measuring the deviation
+  if (_deviationSteps > 0)
+  {
+    SimulateStep(_referenceData[_previousFrameData], _referenceData[_currentFrameData], periodDistances[QualityFull], false);
+    if (--_deviationSteps == 0)
+      FinishDeviation();
+  }
+
+  // Advance step counter
+  ++_stepIndex;
+
+  // Stream out the snapshot, it's skipped if the previous one is still pending
+  if (_snapshotInterval > 0 && _stepIndex % _snapshotInterval == 0 && _checkpointWriter.IsIdle())
+  {
+    char path[32];
+    snprintf(path, sizeof(path), "snapshot_%08u.chk", _stepIndex);
+    SaveCheckpoint(path);
+  }
+}
+
+void Scene::GatherStats()
+{
+  // Results are consumed a few frames later, there's no point in reducing them when the ring is full
+  if (!_statsReadback.CanSubmit())
+    return;
+
+  _statsReadback.Reset();
+
+  BindChunks(_sbo[_currentFrameData], 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, _statsReadback.GetStatsBuffer());
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // Bounds use the same layout as the octree so its reduction is reused
+  GLuint program = shaderProgram[ShaderProgram::OctreeBounds];
+  glUseProgram(program);
+  glUniform1ui(glGetUniformLocation(program, "chunkSize"), _chunkSize);
+  glDispatchCompute(_numWorkGroups, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // Speed histogram and occupancy of the grid spanning the bounds
+  program = shaderProgram[ShaderProgram::FlockStats];
+  glUseProgram(program);
+  glUniform1ui(glGetUniformLocation(program, "chunkSize"), _chunkSize);
+  glUniform1f(glGetUniformLocation(program, "maxSpeed"), _params.maxSpeed);
   glDispatchCompute(_numWorkGroups, 1, 1);
 
+  for (unsigned int i = 0; i < 8; ++i)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+
+  _statsReadback.Submit(_stepIndex);
+}
+
+void Scene::SimulateStep(GLuint input, GLuint output, const glm::vec2 &distances, bool barnesHut)
+{
+  // Reset the dispatch arguments and active counts of all chunks
+  GLuint header[ACTIVE_LIST_HEADER];
+  for (unsigned int i = 0; i < MAX_FLOCK_CHUNKS; ++i)
+  {
+    header[4 * i + 0] = 0;
+    header[4 * i + 1] = 1;
+    header[4 * i + 2] = 1;
+    header[4 * i + 3] = 0;
+  }
+  glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, _activeMembers);
+  glBufferSubData(GL_DISPATCH_INDIRECT_BUFFER, 0, sizeof(header), header);
+
+  // Make sure the previous step finished writing before we read its results
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // --------------------------------------------------------------------------
+
+  // Classify the flock members, extrapolate the inactive ones and gather the active ones
+  GLuint program = shaderProgram[ShaderProgram::Classify];
+  glUseProgram(program);
+  glUniform4f(glGetUniformLocation(program, "goal_dt"), _light.position.x, _light.position.y, _light.position.z, _params.timeStep);
+  glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, glm::value_ptr(_viewPosition));
+  glUniform2fv(glGetUniformLocation(program, "periodDistances"), 1, glm::value_ptr(distances));
+  glUniform1ui(glGetUniformLocation(program, "stepIndex"), _stepIndex);
+  glUniform1ui(glGetUniformLocation(program, "chunkSize"), _chunkSize);
+  GLint chunkIndexLoc = glGetUniformLocation(program, "chunkIndex");
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, _activeMembers);
+  for (unsigned int i = 0; i < _numChunks; ++i)
+  {
+    unsigned int first = i * _chunkSize;
+    unsigned int count = std::min(_chunkSize, _flockSize - first);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, input, first * sizeof(InstanceData), count * sizeof(InstanceData));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, output, first * sizeof(InstanceData), count * sizeof(InstanceData));
+    glUniform1ui(chunkIndexLoc, i);
+    glDispatchCompute(count / _workGroupSize, 1, 1);
+  }
+
+  // Active lists and dispatch arguments must be visible to the simulation
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+  // --------------------------------------------------------------------------
+
+  // Build the octree for the far field approximation
+  if (barnesHut)
+    BuildOctree(input);
+
+  // Bind the simulation compute shader and update the goal position
+  program = shaderProgram[barnesHut ? ShaderProgram::FlockingBarnesHut : ShaderProgram::Flocking];
+  glUseProgram(program);
+  glUniform4f(glGetUniformLocation(program, "goal_dt"), _light.position.x, _light.position.y, _light.position.z, _params.timeStep);
+
+  // Update the simulation parameters, they're part of the checkpoint
+  glUniform1f(glGetUniformLocation(program, "closestDistanceSq"), _params.closestDistanceSq);
+  glUniform1f(glGetUniformLocation(program, "maxSpeed"), _params.maxSpeed);
+  glUniform4fv(glGetUniformLocation(program, "ruleWeights"), 1, glm::value_ptr(_params.ruleWeights));
+  glUniform1ui(glGetUniformLocation(program, "chunkSize"), _chunkSize);
+  glUniform1ui(glGetUniformLocation(program, "flockSize"), _flockSize);
+  glUniform1f(glGetUniformLocation(program, "theta"), BARNES_HUT_THETA);
+  GLint activeChunkLoc = glGetUniformLocation(program, "activeChunk");
+
+  // We will read from all chunks of this buffer
+  BindChunks(input, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MAX_FLOCK_CHUNKS + 1, _activeMembers);
+  if (barnesHut)
+  {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, _sortedMembers);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, _octree);
+  }
+
+  // Simulate the active members chunk by chunk, the size of the dispatch was decided by the classification
+  for (unsigned int i = 0; i < _numChunks; ++i)
+  {
+    // We will put the simulation results to this chunk
+    unsigned int first = i * _chunkSize;
+    unsigned int count = std::min(_chunkSize, _flockSize - first);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, MAX_FLOCK_CHUNKS, output, first * sizeof(InstanceData), count * sizeof(InstanceData));
+    glUniform1ui(activeChunkLoc, i);
+    glDispatchComputeIndirect(4 * i * sizeof(GLuint));
+  }
+
   // Unbind the input/output buffers
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+  for (unsigned int i = 0; i < 8; ++i)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+  glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+}
+
+void Scene::BuildOctree(GLuint input)
+{
+  // Reset the bounds and the leaf cell ranges, empty cells have empty ranges
+  const GLuint bounds[8] = {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0, 0, 0, 0, 0};
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _octree);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(bounds), bounds);
+  glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, OCTREE_CELLS_OFFSET, OCTREE_LEAVES * 2 * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  BindChunks(input, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, _sortKeys);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, _compactMembers);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, _sortedMembers);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, _octree);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // Bounds of the flock define the octree root
+  GLuint program = shaderProgram[ShaderProgram::OctreeBounds];
+  glUseProgram(program);
+  glUniform1ui(glGetUniformLocation(program, "chunkSize"), _chunkSize);
+  glDispatchCompute(_numWorkGroups, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // Morton codes of the members and their compact copy
+  program = shaderProgram[ShaderProgram::OctreeMorton];
+  glUseProgram(program);
+  glUniform1ui(glGetUniformLocation(program, "chunkSize"), _chunkSize);
+  glUniform1ui(glGetUniformLocation(program, "flockSize"), _flockSize);
+  glDispatchCompute(_sortSize / _workGroupSize, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // Bitonic sort of the Morton codes, each merge step is a separate dispatch
+  program = shaderProgram[ShaderProgram::BitonicSort];
+  glUseProgram(program);
+  GLint blockLoc = glGetUniformLocation(program, "sortBlock");
+  GLint strideLoc = glGetUniformLocation(program, "sortStride");
+  for (unsigned int block = 2; block <= _sortSize; block <<= 1)
+  {
+    glUniform1ui(blockLoc, block);
+    for (unsigned int stride = block >> 1; stride > 0; stride >>= 1)
+    {
+      glUniform1ui(strideLoc, stride);
+      glDispatchCompute(_sortSize / _workGroupSize, 1, 1);
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+  }
+
+  // Gather the members to the Morton order and find the leaf cell ranges
+  program = shaderProgram[ShaderProgram::OctreeLeaves];
+  glUseProgram(program);
+  glUniform1ui(glGetUniformLocation(program, "flockSize"), _flockSize);
+  glDispatchCompute(_numWorkGroups, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // Aggregate the nodes from the leaves up to the root
+  program = shaderProgram[ShaderProgram::OctreeNodes];
+  glUseProgram(program);
+  GLint levelLoc = glGetUniformLocation(program, "level");
+  for (int level = OCTREE_DEPTH; level >= 0; --level)
+  {
+    GLuint cells = 1u << (3 * level);
+    glUniform1ui(levelLoc, level);
+    glDispatchCompute((cells + _workGroupSize - 1) / _workGroupSize, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  }
+
+  for (unsigned int i = 0; i < 8; ++i)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+}
+
+void Scene::PollActiveCount()
+{
+  if (!_activeFence)
+    return;
+
+  // Don't wait, just check the state of the fence
+  GLenum result = glClientWaitSync(_activeFence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+    return;
+
+  glDeleteSync(_activeFence);
+  _activeFence = nullptr;
+
+  GLuint header[ACTIVE_LIST_HEADER];
+  glBindBuffer(GL_COPY_READ_BUFFER, _activeReadback);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(header), header);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+  unsigned int active = 0;
+  for (unsigned int i = 0; i < _numChunks; ++i)
+    active += header[4 * i + 3];
+  _activeRatio = static_cast<float>(active) / _flockSize;
+}
+
+void Scene::CreateReferenceBuffers()
+{
+  // Created on the first use only
+  if (_referenceData[0])
+    return;
+
+  glGenBuffers(ShaderData::NumBuffers, _referenceData);
+  for (int i = 0; i < ShaderData::NumBuffers; ++i)
+  {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _referenceData[i]);
+    glBufferData(GL_COPY_WRITE_BUFFER, _flockSize * sizeof(InstanceData), nullptr, GL_DYNAMIC_COPY);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void Scene::MeasureDeviation()
+{
+  // Already measuring
+  if (_deviationSteps > 0)
+    return;
+
+  CreateReferenceBuffers();
+
+  // Reference starts from the current state
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_COPY_READ_BUFFER, _sbo[_currentFrameData]);
+  for (int i = 0; i < ShaderData::NumBuffers; ++i)
+  {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _referenceData[i]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, _flockSize * sizeof(InstanceData));
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  _deviationSteps = DEVIATION_STEPS;
+}
+
+void Scene::FinishDeviation()
+{
+  // This stalls the pipeline, but it's a one-off measurement
+  std::vector<InstanceData> simulated(_flockSize);
+  std::vector<InstanceData> reference(_flockSize);
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_COPY_READ_BUFFER, _sbo[_currentFrameData]);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, _flockSize * sizeof(InstanceData), simulated.data());
+  glBindBuffer(GL_COPY_READ_BUFFER, _referenceData[_currentFrameData]);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, _flockSize * sizeof(InstanceData), reference.data());
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+  // Position error statistics
+  double sum = 0.0;
+  float maxError = 0.0f;
+  for (unsigned int i = 0; i < _flockSize; ++i)
+  {
+    float error = glm::length(glm::vec3(simulated[i].transformation[3] - reference[i].transformation[3]));
+    sum += error;
+    maxError = std::max(maxError, error);
+  }
+
+  printf("Simulation quality %u deviation after %u steps: mean %.3f, max %.3f\n",
+         _simulationQuality, DEVIATION_STEPS, static_cast<float>(sum / _flockSize), maxError);
+}
 
-  // Advance frame counter
-  ++frameIndex;
+void Scene::SetBarnesHut(bool enable)
+{
+  // Octree buffers aren't chunked, they need to fit a single storage block
+  if (enable && (_sortSize * 2 * sizeof(GLuint) > static_cast<size_t>(_maxBlockSize) ||
+                 _flockSize * OCTREE_MEMBER_SIZE > _maxBlockSize || OCTREE_SIZE > _maxBlockSize))
+  {
+    printf("Flock is too large for the Barnes-Hut approximation!\n");
+    return;
+  }
+
+  _barnesHut = enable;
+}
+
+void Scene::FinishForceError()
+{
+  // This stalls the pipeline, but it's a one-off measurement
+  std::vector<InstanceData> previous(_flockSize);
+  std::vector<InstanceData> approximated(_flockSize);
+  std::vector<InstanceData> reference(_flockSize);
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_COPY_READ_BUFFER, _sbo[_previousFrameData]);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, _flockSize * sizeof(InstanceData), previous.data());
+  glBindBuffer(GL_COPY_READ_BUFFER, _sbo[_currentFrameData]);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, _flockSize * sizeof(InstanceData), approximated.data());
+  glBindBuffer(GL_COPY_READ_BUFFER, _referenceData[_currentFrameData]);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, _flockSize * sizeof(InstanceData), reference.data());
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+  // Error of the velocity change relative to the brute force velocity change
+  double errorSum = 0.0;
+  double changeSum = 0.0;
+  float maxError = 0.0f;
+  for (unsigned int i = 0; i < _flockSize; ++i)
+  {
+    float error = glm::length(glm::vec3(approximated[i].velocity - reference[i].velocity));
+    errorSum += error;
+    changeSum += glm::length(glm::vec3(reference[i].velocity - previous[i].velocity));
+    maxError = std::max(maxError, error);
+  }
+
+  printf("Barnes-Hut velocity error (theta = %.2f): relative %.3f%%, max %.5f\n",
+         BARNES_HUT_THETA, changeSum > 0.0 ? static_cast<float>(100.0 * errorSum / changeSum) : 0.0f, maxError);
+}
+
+void Scene::Cull(const Camera &camera, bool enabled)
+{
+  // Reset the draw commands, instance counts are filled by the culling shader
+  DrawCommand commands[NumLods * MAX_FLOCK_CHUNKS] = {};
+  for (unsigned int i = 0; i < _numChunks; ++i)
+  {
+    commands[LodFull * MAX_FLOCK_CHUNKS + i].elements = {static_cast<GLuint>(_tetrahedron->GetIBOSize()), 0, 0, 0, GetVisibleListOffset(LodFull, i)};
+    commands[LodReduced * MAX_FLOCK_CHUNKS + i].elements = {static_cast<GLuint>(_tetrahedronReduced->GetIBOSize()), 0, 0, 0, GetVisibleListOffset(LodReduced, i)};
+    // Impostor triangle is generated in the vertex shader
+    commands[LodImpostor * MAX_FLOCK_CHUNKS + i].arrays = {3, 0, 0, GetVisibleListOffset(LodImpostor, i), 0};
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _drawCommands);
+  glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(commands), commands);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  // Extract the frustum planes from the view-projection matrix, far plane is skipped as we clamp the depth
+  glm::mat4 viewProjection = camera.GetProjection() * camera.GetWorldToView();
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; ++i)
+    rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+  // Left, right, bottom, top, near (depth range is [0, 1])
+  glm::vec4 planes[5] = {rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[2]};
+  for (int i = 0; i < 5; ++i)
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+
+  // Convert the projected size thresholds to distances
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  float pixelsPerUnit = 0.5f * camera.GetProjection()[1][1] * viewport[3];
+  float reducedDistance = 2.0f * BOID_RADIUS * pixelsPerUnit / LOD_REDUCED_PIXELS;
+  float impostorDistance = 2.0f * BOID_RADIUS * pixelsPerUnit / LOD_IMPOSTOR_PIXELS;
+
+  // Rendered position is interpolated, enlarge the bounding sphere by the maximum distance covered in a step
+  float boundingRadius = BOID_RADIUS + _params.maxSpeed * _params.timeStep;
+
+  // --------------------------------------------------------------------------
+
+  GLuint program = shaderProgram[ShaderProgram::Culling];
+  glUseProgram(program);
+  glUniform1ui(glGetUniformLocation(program, "flockSize"), _flockSize);
+  glUniform1ui(glGetUniformLocation(program, "chunkSize"), _chunkSize);
+  glUniform4fv(glGetUniformLocation(program, "frustumPlanes"), 5, glm::value_ptr(planes[0]));
+  glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, glm::value_ptr(camera.GetViewToWorld()[3]));
+  glUniform2f(glGetUniformLocation(program, "lodDistancesSq"), reducedDistance * reducedDistance, impostorDistance * impostorDistance);
+  glUniform1f(glGetUniformLocation(program, "boundingRadius"), boundingRadius);
+  glUniform1i(glGetUniformLocation(program, "cullingEnabled"), enabled ? 1 : 0);
+
+  // Cull the current state, commands and lists follow the state chunks
+  BindChunks(_sbo[_currentFrameData], 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MAX_FLOCK_CHUNKS, _drawCommands);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MAX_FLOCK_CHUNKS + 1, _visibleInstances);
+
+  // Make sure the simulation results and the reset commands are visible to the culling shader
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  glDispatchCompute(_numWorkGroups, 1, 1);
+
+  for (unsigned int i = 0; i < MAX_FLOCK_CHUNKS + 2; ++i)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+
+  // Draw commands are consumed by the indirect draws, lists by the vertex shader
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
 }
 
 void Scene::UpdateProgramData(GLuint program, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
@@ -161,6 +875,13 @@ void Scene::UpdateProgramData(GLuint program, const Camera &camera, const glm::v
   glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(camera.GetWorldToView()));
   glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(camera.GetProjection()));
 
+  // Update the unjittered matrices and the elapsed time for the motion vectors
+  glm::mat4x4 viewProjection = camera.GetUnjitteredProjection() * camera.GetWorldToView();
+  glm::mat4x4 previousViewProjection = camera.GetPreviousProjection() * camera.GetPreviousWorldToView();
+  glUniformMatrix4fv(5, 1, GL_FALSE, glm::value_ptr(viewProjection));
+  glUniformMatrix4fv(9, 1, GL_FALSE, glm::value_ptr(previousViewProjection));
+  glUniform1f(13, _frameTime);
+
   // Update the light position
   GLint lightLoc = glGetUniformLocation(program, "lightPosWS");
   glUniform4f(lightLoc, lightPosition.x, lightPosition.y, lightPosition.z, 1.0f);
@@ -175,25 +896,69 @@ void Scene::UpdateProgramData(GLuint program, const Camera &camera, const glm::v
   glUniform4f(lightColorLoc, lightColor.x, lightColor.y, lightColor.z, lightColor.w);
 }
 
-void Scene::DrawObjects(GLuint program, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
+void Scene::DrawFlock(GLuint meshProgram, GLuint impostorProgram, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
 {
   // Bind the shader program and update its data
-  glUseProgram(program);
+  glUseProgram(meshProgram);
   // Update the transformation & projection matrices
-  UpdateProgramData(program, camera, lightPosition, lightColor);
+  UpdateProgramData(meshProgram, camera, lightPosition, lightColor);
 
-  // Bind the instancing buffer to the index 0
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _sbo[_currentFrameData]);
+  // Interpolate between the last two simulation states based on the remaining time
+  glUniform1f(3, _interpolation);
 
-  // Draw the flock
-  glBindVertexArray(_tetrahedron->GetVAO());
-  glDrawElementsInstanced(GL_TRIANGLES, _tetrahedron->GetIBOSize(), GL_UNSIGNED_INT, reinterpret_cast<void*>(0), _flockSize);
+  // Visible instance lists produced by the culling, base instance of each command points to its list
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _drawCommands);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, _visibleInstances);
 
-  // Unbind the instancing buffer
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+  // Draw the flock chunk by chunk, each LOD with its own indirect command
+  auto commandOffset = [](unsigned int lod, unsigned int chunk)
+  {
+    return reinterpret_cast<void*>((lod * MAX_FLOCK_CHUNKS + chunk) * sizeof(DrawCommand));
+  };
 
-  // --------------------------------------------------------------------------
+  // Bind the previous and current state chunks to the index 0 and 1
+  auto bindChunk = [this](unsigned int chunk)
+  {
+    unsigned int first = chunk * _chunkSize;
+    unsigned int count = std::min(_chunkSize, _flockSize - first);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, _sbo[_previousFrameData], first * sizeof(InstanceData), count * sizeof(InstanceData));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, _sbo[_currentFrameData], first * sizeof(InstanceData), count * sizeof(InstanceData));
+    // Chunk offset gives the shader the global index of the member
+    glUniform1ui(4, first);
+  };
+
+  for (unsigned int i = 0; i < _numChunks; ++i)
+  {
+    bindChunk(i);
+
+    glBindVertexArray(_tetrahedron->GetVAO());
+    glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, commandOffset(LodFull, i));
+
+    glBindVertexArray(_tetrahedronReduced->GetVAO());
+    glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, commandOffset(LodReduced, i));
+  }
+
+  // Impostors are generated from the instance data only, they share the fragment shader with the meshes
+  glUseProgram(impostorProgram);
+  UpdateProgramData(impostorProgram, camera, lightPosition, lightColor);
+  glUniform1f(3, _interpolation);
+
+  glBindVertexArray(_vao);
+  for (unsigned int i = 0; i < _numChunks; ++i)
+  {
+    bindChunk(i);
+    glDrawArraysIndirect(GL_TRIANGLES, commandOffset(LodImpostor, i));
+  }
+
+  // Unbind the instancing buffers
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
 
+void Scene::DrawLight(const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor)
+{
   // Draw the light object
   glUseProgram(shaderProgram[ShaderProgram::PointRendering]);
 
@@ -235,6 +1000,45 @@ void Scene::Draw(const Camera &camera, const RenderMode &renderMode)
   glClearColor(0.01f, 0.02f, 0.04f, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  // Draw all scene objects
-  DrawObjects(shaderProgram[ShaderProgram::Instancing], camera, _light.position, _light.color);
+  // Background doesn't move with anything but the camera, zero velocity is close enough for the clear color
+  if (renderMode.taa)
+  {
+    const GLfloat zeroVelocity[] = {0.0f, 0.0f, 0.0f, 0.0f};
+    glClearBufferfv(GL_COLOR, 1, zeroVelocity);
+  }
+
+  // Select the visible flock members and their LODs
+  Cull(camera, renderMode.culling);
+
+  // Samples of the whole framebuffer for the overdraw measurement
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  const GLuint64 framebufferSamples = static_cast<GLuint64>(viewport[2]) * viewport[3] * renderMode.msaaLevel;
+
+  // Depth prepass: lay down the depth of the flock without any shading
+  // Note: the visible lists are filled by the culling in no particular order, the flock isn't sorted front to back
+  if (renderMode.depthPrepass)
+  {
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    _prepassOverdraw.Begin();
+    DrawFlock(shaderProgram[ShaderProgram::InstancingDepthPass], shaderProgram[ShaderProgram::ImpostorDepthPass], camera, _light.position, _light.color);
+    _prepassOverdraw.End(framebufferSamples);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    // Shade only the fragments that won the depth test in the prepass
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+  }
+
+  // Draw the flock
+  _shadingOverdraw.Begin();
+  DrawFlock(shaderProgram[ShaderProgram::Instancing], shaderProgram[ShaderProgram::Impostor], camera, _light.position, _light.color);
+  _shadingOverdraw.End(framebufferSamples);
+
+  // Restore the regular depth test for the rest of the scene
+  glDepthFunc(GL_LEQUAL);
+  glDepthMask(GL_TRUE);
+
+  // Draw the light object
+  DrawLight(camera, _light.position, _light.color);
 }
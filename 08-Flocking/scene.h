@@ -7,8 +7,12 @@
 
 #include <Camera.h>
 #include <Geometry.h>
+#include <OverdrawQuery.h>
 #include <Textures.h>
 
+#include "checkpoint.h"
+#include "telemetry.h"
+
 // Textures we'll be using
 namespace LoadedTextures
 {
@@ -18,6 +22,12 @@ namespace LoadedTextures
   };
 }
 
+// Anti-aliasing of the tonemapped image
+enum class PostAntiAliasing : int
+{
+  None, FXAA, SMAA
+};
+
 // Render mode structure
 struct RenderMode
 {
@@ -29,6 +39,14 @@ struct RenderMode
   bool tonemapping;
   // Used MSAA samples
   GLsizei msaaLevel;
+  // GPU frustum culling and LOD selection on?
+  bool culling;
+  // Depth prepass on? Shading pass then runs with GL_EQUAL and without depth writes
+  bool depthPrepass;
+  // Temporal anti-aliasing on? Requires single sampled targets and writes the velocity to the second one
+  bool taa;
+  // Post-process anti-aliasing after tonemapping, requires single sampled targets
+  PostAntiAliasing postAA;
 };
 
 // Very simple scene abstraction class
@@ -44,19 +62,72 @@ public:
     glm::vec4 velocity;
   };
 
-  // Maximum number of allowed instances - SSBO can be up to 128 MB! - it'd be safer to ask driver, though
-  static const unsigned int MAX_INSTANCES = 2 << 16;
+  // Maximum number of storage buffer chunks the flock can be split to, must match the compute shader
+  static const unsigned int MAX_FLOCK_CHUNKS = 4;
+  // Number of steps over which the deviation of the simulation LOD is measured
+  static const unsigned int DEVIATION_STEPS = 240;
+  // Depth of the Barnes-Hut octree, must match the compute shaders
+  static const unsigned int OCTREE_DEPTH = 6;
+  // Barnes-Hut opening criterion, nodes smaller than theta times their distance are approximated
+  static constexpr float BARNES_HUT_THETA = 0.5f;
+  // Radius of the flock member bounding sphere
+  static constexpr float BOID_RADIUS = 1.6f;
+  // Projected size in pixels below which the reduced mesh is used
+  static constexpr float LOD_REDUCED_PIXELS = 24.0f;
+  // Projected size in pixels below which the flock member is drawn as an impostor
+  static constexpr float LOD_IMPOSTOR_PIXELS = 12.0f;
+  // Fixed simulation time step in seconds, simulation is independent of the frame rate
+  static constexpr float SIMULATION_TIMESTEP = 1.0f / 60.0f;
+  // Simulation time scale used in turbo mode
+  static constexpr float TURBO_TIME_SCALE = 10.0f;
+  // Maximum number of simulation steps per frame, excess time is dropped to avoid the death spiral
+  static const unsigned int MAX_SUBSTEPS = 8;
+
+  // Simulation quality levels, lower levels update distant flock members less often
+  enum SimulationQuality
+  {
+    QualityFull, QualityHigh, QualityMedium, QualityLow, NumQualityLevels
+  };
 
   // Get and create instance for this singleton
   static Scene& GetInstance();
-  // Initialize the test scene
-  void Init(unsigned int workGroupSize, unsigned int numWorkGroups);
-  // Updates positions
-  void Update(float dt, bool moveLight, bool turbo);
+  // Initialize the test scene, flock is either generated from the seed or restored from the checkpoint
+  void Init(unsigned int workGroupSize, unsigned int numWorkGroups, unsigned int seed, const char *checkpoint = nullptr);
+  // Advances the simulation by fixed time steps covering the elapsed frame time
+  void Update(float dt, const Camera &camera, bool moveLight, bool turbo);
   // Draw the scene
   void Draw(const Camera &camera, const RenderMode &renderMode);
   // Return the generic VAO for rendering
   GLuint GetGenericVAO() { return _vao; }
+  // Return the number of simulation steps performed during the last update
+  unsigned int GetStepsPerFrame() const { return _stepsPerFrame; }
+  // Return the total simulation time dropped because of the substep budget
+  float GetDroppedTime() const { return _droppedTime; }
+  // Return the number of simulation steps performed since the initial state
+  unsigned int GetStepIndex() const { return _stepIndex; }
+  // Set the simulation quality, i.e., how often are the distant flock members updated
+  void SetSimulationQuality(unsigned int quality) { _simulationQuality = quality % NumQualityLevels; }
+  // Return the simulation quality
+  unsigned int GetSimulationQuality() const { return _simulationQuality; }
+  // Return the ratio of the flock members fully simulated during a recent step
+  float GetActiveRatio() const { return _activeRatio; }
+  // Runs the full simulation alongside for DEVIATION_STEPS steps and reports the difference
+  void MeasureDeviation();
+  // Enable/disable the Barnes-Hut approximation of the flocking forces
+  void SetBarnesHut(bool enable);
+  // Return whether the Barnes-Hut approximation is used
+  bool GetBarnesHut() const { return _barnesHut; }
+  // Compares the next Barnes-Hut step with the brute force one and reports the difference
+  void MeasureForceError() { _measureForceError = true; }
+  // Asynchronously saves the current simulation state, returns false if previous save is still pending
+  bool SaveCheckpoint(const char *path);
+  // Stream out the state snapshots every given number of steps, 0 disables the snapshots
+  void SetSnapshotInterval(unsigned int steps) { _snapshotInterval = steps; }
+  // Return the latest flock statistics, these lag a few frames behind the simulation
+  const FlockStats &GetStats() const { return _statsReadback.GetStats(); }
+  // Return the overdraw of the depth prepass and the shading pass, a few frames old
+  float GetPrepassOverdraw() const { return _prepassOverdraw.GetOverdraw(); }
+  float GetShadingOverdraw() const { return _shadingOverdraw.GetOverdraw(); }
 
 private:
   // Shader data indices for double buffering
@@ -65,6 +136,39 @@ private:
     Flock0, Flock1, NumBuffers
   };
 
+  // Levels of detail used for flock rendering
+  enum FlockLod
+  {
+    LodFull, LodReduced, LodImpostor, NumLods
+  };
+
+  // Indirect draw command for indexed geometry
+  struct DrawElementsCommand
+  {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+  };
+
+  // Indirect draw command for non-indexed geometry, padded to the size of the indexed one
+  struct DrawArraysCommand
+  {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+    GLuint padding;
+  };
+
+  // Both command types share the buffer, culling shader only touches the instance count
+  union DrawCommand
+  {
+    DrawElementsCommand elements;
+    DrawArraysCommand arrays;
+  };
+
   // Structure describing light
   struct Light
   {
@@ -83,10 +187,42 @@ private:
   Scene(const Scene &);
   Scene & operator = (const Scene &);
 
+  // Splits the flock to chunks fitting the storage block size limit, returns false if it's too large
+  bool ComputeChunks();
+  // Creates the storage buffers sized to the flock
+  void CreateBuffers();
+  // Binds all chunks of the buffer to consecutive binding points
+  void BindChunks(GLuint buffer, GLuint firstBinding);
+  // Returns the offset of the visible instance list for the given LOD and chunk
+  unsigned int GetVisibleListOffset(unsigned int lod, unsigned int chunk) const { return lod * _flockSize + chunk * _chunkSize; }
+  // Generates the initial flock state from the seed
+  void GenerateFlock();
+  // Restores the simulation state from the checkpoint file
+  bool LoadFlock(const char *path);
+  // Performs a single fixed time step of the simulation
+  void Step(bool moveLight);
+  // Simulates a single step from the input to the output buffer, flock members farther than the distances update less often
+  void SimulateStep(GLuint input, GLuint output, const glm::vec2 &periodDistances, bool barnesHut);
+  // Reduces the statistics of the current state and hands them to the readback ring
+  void GatherStats();
+  // Builds the Barnes-Hut octree from the input buffer
+  void BuildOctree(GLuint input);
+  // Creates the buffers for the reference simulation
+  void CreateReferenceBuffers();
+  // Compares the Barnes-Hut and brute force results of the last step and prints the difference
+  void FinishForceError();
+  // Compares the simulated and reference states and prints the deviation
+  void FinishDeviation();
+  // Reads back the number of active flock members once the GPU is done
+  void PollActiveCount();
+  // Culls the flock against the camera frustum and sorts the visible members to LOD lists
+  void Cull(const Camera &camera, bool enabled);
   // Helper function for updating shader program data
   void UpdateProgramData(GLuint program, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
-  // Draw cubes
-  void DrawObjects(GLuint program, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
+  // Draws the visible flock members, meshes and impostors with the given programs
+  void DrawFlock(GLuint meshProgram, GLuint impostorProgram, const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
+  // Draws the light object
+  void DrawLight(const Camera &camera, const glm::vec3 &lightPosition, const glm::vec4 &lightColor);
 
   // Size of the work group
   unsigned int _workGroupSize;
@@ -94,16 +230,85 @@ private:
   unsigned int _numWorkGroups;
   // Size of the whole flock
   unsigned int _flockSize;
-  // Single Storage Buffer for all models used for instance data
+  // Number of flock members in a single storage buffer chunk
+  unsigned int _chunkSize;
+  // Number of storage buffer chunks
+  unsigned int _numChunks;
+  // Seed of the initial flock state
+  unsigned int _seed = 0;
+  // Parameters of the simulation
+  SimulationParams _params = {50.0f, 10.0f, SIMULATION_TIMESTEP, 0.0f, glm::vec4(0.18f, 0.05f, 0.17f, 0.02f)};
+  // Writer for the checkpoints, saves the state without stalling the GPU
+  CheckpointWriter _checkpointWriter;
+  // Number of steps between the state snapshots, 0 when disabled
+  unsigned int _snapshotInterval = 0;
+  // Readback channel for the flock statistics
+  StatsReadback _statsReadback;
+  // Storage buffers for the flock state, each is bound as multiple chunks if needed
   GLuint _sbo[ShaderData::NumBuffers];
-  // Index of the SSBO to be read from
-  unsigned int _previousFrameData;
-  // Index of the SSBO to be written to and rendered from
-  unsigned int _currentFrameData;
+  // Dispatch arguments and active counts per chunk followed by the per chunk lists of active members
+  GLuint _activeMembers = 0;
+  // Readback buffer for the active member counts
+  GLuint _activeReadback = 0;
+  // Fence signaled when the active member counts are copied
+  GLsync _activeFence = nullptr;
+  // Ratio of the flock members fully simulated during a recent step
+  float _activeRatio = 1.0f;
+  // Simulation quality level
+  unsigned int _simulationQuality = QualityFull;
+  // State of the full simulation used to measure the deviation
+  GLuint _referenceData[ShaderData::NumBuffers] = {0, 0};
+  // Remaining steps of the deviation measurement
+  unsigned int _deviationSteps = 0;
+  // Maximum size of the storage block
+  GLint64 _maxBlockSize = 0;
+  // Use the Barnes-Hut approximation?
+  bool _barnesHut = false;
+  // Measure the Barnes-Hut error during the next step?
+  bool _measureForceError = false;
+  // Number of sort keys, the flock size rounded up to the power of two
+  unsigned int _sortSize = 0;
+  // Morton code and member index pairs
+  GLuint _sortKeys = 0;
+  // Compact copy of the flock in the original order
+  GLuint _compactMembers = 0;
+  // Compact copy of the flock in the Morton order
+  GLuint _sortedMembers = 0;
+  // Bounds, leaf cell ranges and the dense octree levels
+  GLuint _octree = 0;
+  // View position used for the simulation LOD
+  glm::vec3 _viewPosition = glm::vec3(0.0f);
+  // Indirect draw commands, one per LOD and chunk
+  GLuint _drawCommands = 0;
+  // Lists of visible flock members, one per LOD and chunk
+  GLuint _visibleInstances = 0;
+  // Index of the SSBO holding the previous simulation state
+  unsigned int _previousFrameData = ShaderData::Flock0;
+  // Index of the SSBO holding the current simulation state
+  unsigned int _currentFrameData = ShaderData::Flock0;
+  // Number of performed simulation steps
+  unsigned int _stepIndex = 0;
+  // Simulation time not yet consumed by the fixed time steps
+  float _accumulator = 0.0f;
+  // Interpolation factor between the previous and current simulation state
+  float _interpolation = 0.0f;
+  // Simulation time elapsed since the previous frame for the motion vectors
+  float _frameTime = 0.0f;
+  // Simulation steps performed during the last update
+  unsigned int _stepsPerFrame = 0;
+  // Total simulation time dropped because of the substep budget
+  float _droppedTime = 0.0f;
+  // Light animation timer advanced with the simulation steps
+  float _animationTime = 0.0f;
   // The single light object
   Light _light;
+  // Overdraw of the depth prepass and the shading pass
+  OverdrawQuery _prepassOverdraw;
+  OverdrawQuery _shadingOverdraw;
   // General use VAO
   GLuint _vao = 0;
   // Tetrahedron instance
   Mesh<Vertex_Pos_Nrm> *_tetrahedron = nullptr;
+  // Tetrahedron with shared vertices for the reduced LOD
+  Mesh<Vertex_Pos_Nrm> *_tetrahedronReduced = nullptr;
 };
@@ -5,13 +5,62 @@
 
 #include "shaders.h"
 
+#include <cstdio>
+#include <cstring>
+
+// Use the subgroup flocking kernel variant when the driver supports it?
+#define _USE_SUBGROUPS 1
+
+// GL_KHR_shader_subgroup tokens, in case the loader was generated without the extension
+#ifndef GL_SUBGROUP_SIZE_KHR
+#define GL_SUBGROUP_SIZE_KHR 0x9532
+#define GL_SUBGROUP_SUPPORTED_STAGES_KHR 0x9533
+#define GL_SUBGROUP_SUPPORTED_FEATURES_KHR 0x9534
+#define GL_SUBGROUP_FEATURE_BASIC_BIT_KHR 0x00000001
+#define GL_SUBGROUP_FEATURE_ARITHMETIC_BIT_KHR 0x00000004
+#define GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR 0x00000008
+#define GL_SUBGROUP_FEATURE_SHUFFLE_BIT_KHR 0x00000010
+#endif
+
+// Local work group size of the flocking kernel, must match the shader
+static const GLint FLOCKING_WORK_GROUP_SIZE = 256;
+
 GLuint shaderProgram[ShaderProgram::NumShaderPrograms] = {0};
+bool subgroupFlocking = false;
+
+// Checks whether the subgroup flocking kernel can run: the extension needs to be supported in the compute
+// stage with all the features used and the subgroups need to tile the work group
+static bool subgroupFlockingSupported()
+{
+  GLint numExtensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+
+  bool extension = false;
+  for (GLint i = 0; i < numExtensions && !extension; ++i)
+  {
+    const char *name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+    extension = name && strcmp(name, "GL_KHR_shader_subgroup") == 0;
+  }
+
+  if (!extension)
+    return false;
+
+  GLint stages = 0, features = 0, size = 0;
+  glGetIntegerv(GL_SUBGROUP_SUPPORTED_STAGES_KHR, &stages);
+  glGetIntegerv(GL_SUBGROUP_SUPPORTED_FEATURES_KHR, &features);
+  glGetIntegerv(GL_SUBGROUP_SIZE_KHR, &size);
+
+  const GLint required = GL_SUBGROUP_FEATURE_BASIC_BIT_KHR | GL_SUBGROUP_FEATURE_ARITHMETIC_BIT_KHR |
+                         GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR | GL_SUBGROUP_FEATURE_SHUFFLE_BIT_KHR;
+  return (stages & GL_COMPUTE_SHADER_BIT) && (features & required) == required &&
+         size > 0 && FLOCKING_WORK_GROUP_SIZE % size == 0;
+}
 
 bool compileShaders()
 {
   GLuint vertexShader[VertexShader::NumVertexShaders] = {0};
   GLuint fragmentShader[FragmentShader::NumFragmentShaders] = {0};
-  GLuint computeShader[FragmentShader::NumFragmentShaders] = {0};
+  GLuint computeShader[ComputeShader::NumComputeShaders] = {0};
 
   // Cleanup lambda
   auto cleanUp = [&]()
@@ -74,10 +123,19 @@ bool compileShaders()
     }
   }
 
+  // Pick the flocking kernel variant
+#if _USE_SUBGROUPS
+  bool subgroups = subgroupFlockingSupported();
+#else
+  bool subgroups = false;
+#endif
+  subgroupFlocking = subgroups;
+
   // Compile all compute shaders
   for (int i = 0; i < ComputeShader::NumComputeShaders; ++i)
   {
-    computeShader[i] = ShaderCompiler::CompileShader(csSource, i, GL_COMPUTE_SHADER);
+    const char *defines = (i == ComputeShader::Flocking && subgroups) ? "#define SUBGROUP_FLOCKING 1\n" : nullptr;
+    computeShader[i] = ShaderCompiler::CompileShader(csSource, i, GL_COMPUTE_SHADER, defines);
     if (!computeShader[i])
     {
       cleanUp();
@@ -85,6 +143,15 @@ bool compileShaders()
     }
   }
 
+  // Shader program for the simulation LOD classification
+  shaderProgram[ShaderProgram::Classify] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::Classify], computeShader[ComputeShader::Classify]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::Classify]))
+  {
+    cleanUp();
+    return false;
+  }
+
   // Shader program for flocking simulation
   shaderProgram[ShaderProgram::Flocking] = glCreateProgram();
   glAttachShader(shaderProgram[ShaderProgram::Flocking], computeShader[ComputeShader::Flocking]);
@@ -94,6 +161,96 @@ bool compileShaders()
     return false;
   }
 
+  // Shader program for the octree bounds
+  shaderProgram[ShaderProgram::OctreeBounds] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::OctreeBounds], computeShader[ComputeShader::OctreeBounds]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::OctreeBounds]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader program for the octree Morton codes
+  shaderProgram[ShaderProgram::OctreeMorton] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::OctreeMorton], computeShader[ComputeShader::OctreeMorton]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::OctreeMorton]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader program for the bitonic sort step
+  shaderProgram[ShaderProgram::BitonicSort] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::BitonicSort], computeShader[ComputeShader::BitonicSort]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::BitonicSort]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader program for the octree leaves
+  shaderProgram[ShaderProgram::OctreeLeaves] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::OctreeLeaves], computeShader[ComputeShader::OctreeLeaves]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::OctreeLeaves]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader program for the octree nodes
+  shaderProgram[ShaderProgram::OctreeNodes] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::OctreeNodes], computeShader[ComputeShader::OctreeNodes]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::OctreeNodes]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader program for the Barnes-Hut flocking simulation
+  shaderProgram[ShaderProgram::FlockingBarnesHut] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::FlockingBarnesHut], computeShader[ComputeShader::FlockingBarnesHut]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::FlockingBarnesHut]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader program for the flock statistics
+  shaderProgram[ShaderProgram::FlockStats] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::FlockStats], computeShader[ComputeShader::FlockStats]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::FlockStats]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader program for flock culling and LOD selection
+  shaderProgram[ShaderProgram::Culling] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::Culling], computeShader[ComputeShader::Culling]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::Culling]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader program for the fused MSAA resolve, exposure, tonemapping, and luminance histogram
+  shaderProgram[ShaderProgram::Tonemapping] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::Tonemapping], computeShader[ComputeShader::Tonemapping]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::Tonemapping]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader program for the exposure adaptation
+  shaderProgram[ShaderProgram::AutoExposure] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::AutoExposure], computeShader[ComputeShader::AutoExposure]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::AutoExposure]))
+  {
+    cleanUp();
+    return false;
+  }
+
   // Shader program for instanced geometry w/ color
   shaderProgram[ShaderProgram::Instancing] = glCreateProgram();
   glAttachShader(shaderProgram[ShaderProgram::Instancing], vertexShader[VertexShader::Instancing]);
@@ -104,6 +261,35 @@ bool compileShaders()
     return false;
   }
 
+  // Shader program for the impostors of the distant flock members
+  shaderProgram[ShaderProgram::Impostor] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::Impostor], vertexShader[VertexShader::Impostor]);
+  glAttachShader(shaderProgram[ShaderProgram::Impostor], fragmentShader[FragmentShader::Default]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::Impostor]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Depth only programs for the depth prepass, same vertex shaders so that the depths match exactly
+  shaderProgram[ShaderProgram::InstancingDepthPass] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::InstancingDepthPass], vertexShader[VertexShader::Instancing]);
+  glAttachShader(shaderProgram[ShaderProgram::InstancingDepthPass], fragmentShader[FragmentShader::Null]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::InstancingDepthPass]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  shaderProgram[ShaderProgram::ImpostorDepthPass] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::ImpostorDepthPass], vertexShader[VertexShader::Impostor]);
+  glAttachShader(shaderProgram[ShaderProgram::ImpostorDepthPass], fragmentShader[FragmentShader::Null]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::ImpostorDepthPass]))
+  {
+    cleanUp();
+    return false;
+  }
+
   // Shader program for point rendering w/ constant color
   shaderProgram[ShaderProgram::PointRendering] = glCreateProgram();
   glAttachShader(shaderProgram[ShaderProgram::PointRendering], vertexShader[VertexShader::Point]);
@@ -114,11 +300,49 @@ bool compileShaders()
     return false;
   }
 
-  // Shader program for rendering tonemapping post-process
-  shaderProgram[ShaderProgram::Tonemapping] = glCreateProgram();
-  glAttachShader(shaderProgram[ShaderProgram::Tonemapping], vertexShader[VertexShader::ScreenQuad]);
-  glAttachShader(shaderProgram[ShaderProgram::Tonemapping], fragmentShader[FragmentShader::Tonemapping]);
-  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::Tonemapping]))
+  // Shader program for the temporal anti-aliasing resolve
+  shaderProgram[ShaderProgram::TemporalResolve] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::TemporalResolve], vertexShader[VertexShader::ScreenQuad]);
+  glAttachShader(shaderProgram[ShaderProgram::TemporalResolve], fragmentShader[FragmentShader::TemporalResolve]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::TemporalResolve]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader program for the FXAA post-process
+  shaderProgram[ShaderProgram::Fxaa] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::Fxaa], vertexShader[VertexShader::ScreenQuad]);
+  glAttachShader(shaderProgram[ShaderProgram::Fxaa], fragmentShader[FragmentShader::Fxaa]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::Fxaa]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  // Shader programs for the SMAA passes: edge detection, blending weights, and neighborhood blending
+  shaderProgram[ShaderProgram::SmaaEdgeDetection] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::SmaaEdgeDetection], vertexShader[VertexShader::ScreenQuad]);
+  glAttachShader(shaderProgram[ShaderProgram::SmaaEdgeDetection], fragmentShader[FragmentShader::SmaaEdgeDetection]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::SmaaEdgeDetection]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  shaderProgram[ShaderProgram::SmaaBlendingWeights] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::SmaaBlendingWeights], vertexShader[VertexShader::ScreenQuad]);
+  glAttachShader(shaderProgram[ShaderProgram::SmaaBlendingWeights], fragmentShader[FragmentShader::SmaaBlendingWeights]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::SmaaBlendingWeights]))
+  {
+    cleanUp();
+    return false;
+  }
+
+  shaderProgram[ShaderProgram::SmaaNeighborhoodBlending] = glCreateProgram();
+  glAttachShader(shaderProgram[ShaderProgram::SmaaNeighborhoodBlending], vertexShader[VertexShader::ScreenQuad]);
+  glAttachShader(shaderProgram[ShaderProgram::SmaaNeighborhoodBlending], fragmentShader[FragmentShader::SmaaNeighborhoodBlending]);
+  if (!ShaderCompiler::LinkProgram(shaderProgram[ShaderProgram::SmaaNeighborhoodBlending]))
   {
     cleanUp();
     return false;
@@ -12,12 +12,14 @@ namespace ShaderProgram
 {
   enum
   {
-    Instancing, Flocking, PointRendering, Tonemapping, NumShaderPrograms
+    Instancing, InstancingDepthPass, Impostor, ImpostorDepthPass, Classify, Flocking, OctreeBounds, OctreeMorton, BitonicSort, OctreeLeaves, OctreeNodes, FlockingBarnesHut, FlockStats, Culling, PointRendering, Tonemapping, AutoExposure, TemporalResolve, Fxaa, SmaaEdgeDetection, SmaaBlendingWeights, SmaaNeighborhoodBlending, NumShaderPrograms
   };
 }
 
 // Shader programs handle
 extern GLuint shaderProgram[ShaderProgram::NumShaderPrograms];
+// Is the subgroup variant of the flocking kernel in use?
+extern bool subgroupFlocking;
 
 // Helper function for creating and compiling the shaders
 bool compileShaders();
@@ -29,7 +31,7 @@ namespace VertexShader
 {
   enum
   {
-    Instancing, Point, ScreenQuad, NumVertexShaders
+    Instancing, Impostor, Point, ScreenQuad, NumVertexShaders
   };
 }
 
@@ -45,6 +47,15 @@ R"(
 layout (location = 0) uniform mat4 worldToView;
 layout (location = 1) uniform mat4 projection;
 layout (location = 2) uniform mat4 modelToWorld;
+// Interpolation factor between the previous and current simulation state
+layout (location = 3) uniform float interpolation;
+// Index of the first flock member in the currently drawn chunk
+layout (location = 4) uniform uint chunkOffset;
+// Unjittered view projection of the current and the previous frame for the motion vectors
+layout (location = 5) uniform mat4 viewProjection;
+layout (location = 9) uniform mat4 previousViewProjection;
+// Simulation time elapsed since the previous frame
+layout (location = 13) uniform float frameTime;
 
 // Vertex attribute block, i.e., input
 layout (location = 0) in vec3 position;
@@ -55,16 +66,28 @@ struct InstanceData
 {
   // Model to world transformation
   mat4 modelToWorld;
-  // Velocity - unused in the vertex shader
+  // Velocity, used for the motion vectors
   vec4 velocity;
 };
 
-// Storage buffer used for instances using interface block syntax
-layout (binding = 0) buffer InstanceBuffer
+// Storage buffer with the previous simulation state using interface block syntax
+layout (binding = 0) readonly buffer PreviousInstanceBuffer
 {
   // Only one variable length array allowed inside the storage buffer block
   InstanceData data[];
-} instanceBuffer;
+} previousBuffer;
+
+// Storage buffer with the current simulation state
+layout (binding = 1) readonly buffer CurrentInstanceBuffer
+{
+  InstanceData data[];
+} currentBuffer;
+
+// Lists of visible instances produced by the culling, base instance points to the current list
+layout (std430, binding = 2) readonly buffer VisibleInstances
+{
+  uint visibleIndex[];
+};
 
 // Vertex output
 out VertexData
@@ -72,6 +95,9 @@ out VertexData
   vec4 WorldPos;
   vec3 Normal;
   vec3 Color;
+  // Unjittered clip space position in the current and the previous frame
+  vec4 ClipPos;
+  vec4 PreviousClipPos;
 } v;
 
 // From csflocking, OpenGL: SuperBible, 6th edition
@@ -84,25 +110,156 @@ vec3 generateColor(float f)
   return vec3(r, g, b) * 0.25f + vec3(0.75f);
 }
 
+// Depth prepass and shading pass must produce identical depths for GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
-  // Retrieve the model to world matrix from the instance buffer
-  mat4 modelToWorld = instanceBuffer.data[gl_InstanceID].modelToWorld;
+  // Fetch the index of the visible instance within the chunk
+  uint instance = visibleIndex[gl_BaseInstance + gl_InstanceID];
+
+  // Retrieve the last two model to world matrices from the instance buffers, these are bound per chunk
+  mat4 previous = previousBuffer.data[instance].modelToWorld;
+  mat4 current = currentBuffer.data[instance].modelToWorld;
 
-  // Construct the normal transformation matrix and transform normal
-  mat3 normalTransform = mat3(transpose(inverse(modelToWorld)));
-  v.Normal = normalize(normalTransform * normal);
+  // Interpolate position and direction, rebuild the orthonormal basis the same way the simulation does
+  vec3 direction = normalize(mix(previous[2].xyz, current[2].xyz, interpolation));
+  vec3 aside = normalize(cross(mix(previous[1].xyz, current[1].xyz, interpolation), direction));
+  vec3 up = cross(direction, aside);
+  vec3 translation = mix(previous[3].xyz, current[3].xyz, interpolation);
+  mat4 modelToWorld = mat4(vec4(aside, 0.0f), vec4(up, 0.0f), vec4(direction, 0.0f), vec4(translation, 1.0f));
+
+  // Basis is orthonormal, so the normal transformation is just the rotation part
+  v.Normal = normalize(mat3(modelToWorld) * normal);
 
   // Transform vertex position
   v.WorldPos = modelToWorld * vec4(position.xyz, 1.0f);
   gl_Position = projection * worldToView * v.WorldPos;
 
-  // Generate color based on instance ID
-  vec3 color = generateColor(fract(float(gl_InstanceID) / 1237.0f));
+  // Previous position is extrapolated back along the velocity, the rotation within a frame is negligible
+  vec3 velocity = mix(previousBuffer.data[instance].velocity.xyz, currentBuffer.data[instance].velocity.xyz, interpolation);
+  v.ClipPos = viewProjection * v.WorldPos;
+  v.PreviousClipPos = previousViewProjection * vec4(v.WorldPos.xyz - velocity * frameTime, 1.0f);
+
+  // Generate color based on the global instance ID
+  vec3 color = generateColor(fract(float(chunkOffset + instance) / 1237.0f));
   v.Color = mix(color * 0.2f, color, smoothstep(0.0f, 0.8f, abs(normal.z)));
 }
 )",
 // ----------------------------------------------------------------------------
+// Impostor vertex shader, distant flock members are a single camera facing triangle
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Uniform blocks, i.e., constants
+layout (location = 0) uniform mat4 worldToView;
+layout (location = 1) uniform mat4 projection;
+// Interpolation factor between the previous and current simulation state
+layout (location = 3) uniform float interpolation;
+// Index of the first flock member in the currently drawn chunk
+layout (location = 4) uniform uint chunkOffset;
+// Unjittered view projection of the current and the previous frame for the motion vectors
+layout (location = 5) uniform mat4 viewProjection;
+layout (location = 9) uniform mat4 previousViewProjection;
+// Simulation time elapsed since the previous frame
+layout (location = 13) uniform float frameTime;
+// View position in world space coordinates
+uniform vec4 viewPosWS;
+
+// Structure holding per instance data
+struct InstanceData
+{
+  // Model to world transformation
+  mat4 modelToWorld;
+  // Velocity, used for the motion vectors
+  vec4 velocity;
+};
+
+// Storage buffer with the previous simulation state
+layout (binding = 0) readonly buffer PreviousInstanceBuffer
+{
+  InstanceData data[];
+} previousBuffer;
+
+// Storage buffer with the current simulation state
+layout (binding = 1) readonly buffer CurrentInstanceBuffer
+{
+  InstanceData data[];
+} currentBuffer;
+
+// Lists of visible instances produced by the culling, base instance points to the current list
+layout (std430, binding = 2) readonly buffer VisibleInstances
+{
+  uint visibleIndex[];
+};
+
+// Vertex output, the same as for the instanced meshes so the default fragment shader can be used
+out VertexData
+{
+  vec4 WorldPos;
+  vec3 Normal;
+  vec3 Color;
+  // Unjittered clip space position in the current and the previous frame
+  vec4 ClipPos;
+  vec4 PreviousClipPos;
+} v;
+
+// Counter-clockwise triangle in the sprite space (x: along the projected direction, y: aside), matches the tetrahedron base
+const vec2 corners[] = {vec2(1.5f, 0.0f), vec2(-0.5f, 0.5f), vec2(-0.5f, -0.5f)};
+
+// From csflocking, OpenGL: SuperBible, 6th edition
+vec3 generateColor(float f)
+{
+  float r = sin(f * 6.2831853f);
+  float g = sin((f + 0.3333f) * 6.2831853f);
+  float b = sin((f + 0.6666f) * 6.2831853f);
+
+  return vec3(r, g, b) * 0.25f + vec3(0.75f);
+}
+
+// Depth prepass and shading pass must produce identical depths for GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+  // Fetch the index of the visible instance within the chunk
+  uint instance = visibleIndex[gl_BaseInstance + gl_InstanceID];
+
+  // Interpolate the position and the basis the same way the instancing shader does
+  mat4 previous = previousBuffer.data[instance].modelToWorld;
+  mat4 current = currentBuffer.data[instance].modelToWorld;
+  vec3 direction = normalize(mix(previous[2].xyz, current[2].xyz, interpolation));
+  vec3 up = normalize(mix(previous[1].xyz, current[1].xyz, interpolation));
+  vec3 translation = mix(previous[3].xyz, current[3].xyz, interpolation);
+
+  // Project the direction to the view plane, keep the foreshortening so that the triangle shrinks
+  // when the member flies towards the camera, just like the silhouette of the tetrahedron does
+  vec3 viewDir = normalize(viewPosWS.xyz - translation);
+  vec3 forward = direction - viewDir * dot(direction, viewDir);
+  float forwardLength = length(forward);
+  vec3 spriteX = forwardLength > 0.001f ? forward / forwardLength : normalize(cross(viewDir, up));
+  vec3 spriteY = cross(viewDir, spriteX);
+
+  vec2 corner = corners[gl_VertexID];
+  vec3 offset = spriteX * corner.x * max(forwardLength, 0.25f) + spriteY * corner.y;
+
+  // Visible faces of the tetrahedron point towards the viewer and its back
+  v.Normal = normalize(viewDir + up);
+  v.WorldPos = vec4(translation + offset, 1.0f);
+  gl_Position = projection * worldToView * v.WorldPos;
+
+  // Previous position is extrapolated back along the velocity, the same way the instancing shader does
+  vec3 velocity = mix(previousBuffer.data[instance].velocity.xyz, currentBuffer.data[instance].velocity.xyz, interpolation);
+  v.ClipPos = viewProjection * v.WorldPos;
+  v.PreviousClipPos = previousViewProjection * vec4(v.WorldPos.xyz - velocity * frameTime, 1.0f);
+
+  // Same color modulation as the instanced mesh, with the normal in the model space
+  vec3 color = generateColor(fract(float(chunkOffset + instance) / 1237.0f));
+  v.Color = mix(color * 0.2f, color, smoothstep(0.0f, 0.8f, abs(dot(v.Normal, direction))));
+}
+)",
+// ----------------------------------------------------------------------------
 // Vertex shader for point rendering
 // ----------------------------------------------------------------------------
 R"(
@@ -150,7 +307,7 @@ namespace FragmentShader
 {
   enum
   {
-    Default, SingleColor, Null, Tonemapping, NumFragmentShaders
+    Default, SingleColor, Null, TemporalResolve, Fxaa, SmaaEdgeDetection, SmaaBlendingWeights, SmaaNeighborhoodBlending, NumFragmentShaders
   };
 }
 
@@ -175,10 +332,15 @@ in VertexData
   vec4 WorldPos;
   vec3 Normal;
   vec3 Color;
+  // Unjittered clip space position in the current and the previous frame
+  vec4 ClipPos;
+  vec4 PreviousClipPos;
 } v;
 
 // Fragment shader outputs
 layout (location = 0) out vec4 color;
+// Screen space motion since the previous frame in UV units, ignored unless the velocity target is bound
+layout (location = 1) out vec2 velocity;
 
 void main()
 {
@@ -219,6 +381,9 @@ void main()
   // Calculate the final color
   vec3 finalColor = albedo * (ambient + diffuse) + specular;
   color = vec4(finalColor, 1.0f);
+
+  // NDC difference halved to get the UV difference
+  velocity = (v.ClipPos.xy / v.ClipPos.w - v.PreviousClipPos.xy / v.PreviousClipPos.w) * 0.5f;
 }
 )",
 // ----------------------------------------------------------------------------
@@ -231,11 +396,14 @@ R"(
 layout (location = 3) uniform vec3 color;
 
 // Output color
-out vec4 oColor;
+layout (location = 0) out vec4 oColor;
+// Light is a single point, its motion isn't worth tracking
+layout (location = 1) out vec2 oVelocity;
 
 void main()
 {
   oColor = vec4(color.rgb, 1.0f);
+  oVelocity = vec2(0.0f);
 }
 )",
 // ----------------------------------------------------------------------------
@@ -249,16 +417,20 @@ void main()
 }
 )",
 // ----------------------------------------------------------------------------
-// Tonemapping fragment shader source
+// Temporal anti-aliasing resolve fragment shader source
 // ----------------------------------------------------------------------------
 R"(
 #version 460 core
 
-// Our HDR buffer texture
-layout (binding = 0) uniform sampler2DMS HDR;
+// Jittered HDR render target of the current frame
+layout (binding = 0) uniform sampler2D current;
+// Resolved HDR image of the previous frame
+layout (binding = 1) uniform sampler2D history;
+// Screen space motion of the current frame
+layout (binding = 2) uniform sampler2D velocityMap;
 
-// Number of used MSAA samples
-layout (location = 0) uniform float MSAA_LEVEL;
+// Weight of the history, 0 discards it, e.g., after resize
+layout (location = 0) uniform float historyWeight;
 
 // Quad UV coordinates
 in vec2 UV;
@@ -266,30 +438,365 @@ in vec2 UV;
 // Output
 out vec4 color;
 
-vec3 ApplyTonemapping(vec3 hdr)
+// YCoCg separates luma from chroma, the neighborhood box is tighter around the actual colors than in RGB
+vec3 RGBToYCoCg(vec3 c)
 {
-  // Reinhard global operator
-  vec3 result = hdr / (hdr + vec3(1.0f));
+  return vec3(0.25f * c.r + 0.5f * c.g + 0.25f * c.b, 0.5f * c.r - 0.5f * c.b, -0.25f * c.r + 0.5f * c.g - 0.25f * c.b);
+}
 
-  return result;
+vec3 YCoCgToRGB(vec3 c)
+{
+  return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z);
+}
+
+void main()
+{
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+  ivec2 maxTexel = textureSize(current, 0) - 1;
+
+  // Color box of the 3x3 neighborhood, the longest motion in it keeps the edges of moving objects
+  // from picking the background motion
+  vec3 center = RGBToYCoCg(texelFetch(current, texel, 0).rgb);
+  vec3 minColor = center;
+  vec3 maxColor = center;
+  vec2 velocity = vec2(0.0f);
+  for (int y = -1; y <= 1; ++y)
+  {
+    for (int x = -1; x <= 1; ++x)
+    {
+      ivec2 neighbor = clamp(texel + ivec2(x, y), ivec2(0), maxTexel);
+      vec3 c = RGBToYCoCg(texelFetch(current, neighbor, 0).rgb);
+      minColor = min(minColor, c);
+      maxColor = max(maxColor, c);
+
+      vec2 v = texelFetch(velocityMap, neighbor, 0).xy;
+      velocity = dot(v, v) > dot(velocity, velocity) ? v : velocity;
+    }
+  }
+
+  // Reproject to the previous frame, clamp the history to the current neighborhood to reject stale colors
+  vec2 historyUV = UV - velocity;
+  vec3 previous = clamp(RGBToYCoCg(texture(history, historyUV).rgb), minColor, maxColor);
+
+  // Discard the history that fell off the screen
+  float weight = all(equal(historyUV, clamp(historyUV, 0.0f, 1.0f))) ? historyWeight : 0.0f;
+
+  // Weighting by the inverse luma keeps bright HDR samples from dominating, i.e., blends after tonemapping
+  float currentWeight = (1.0f - weight) / (1.0f + center.x);
+  float previousWeight = weight / (1.0f + previous.x);
+  vec3 result = (center * currentWeight + previous * previousWeight) / (currentWeight + previousWeight);
+
+  color = vec4(YCoCgToRGB(result), 1.0f);
+}
+)",
+// ----------------------------------------------------------------------------
+// FXAA 3.11 fragment shader source, quality preset 12, see Lottes: FXAA 3.11 (NVIDIA, 2011)
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Tonemapped image with the perceptual luma in alpha
+layout (binding = 0) uniform sampler2D ldr;
+
+// Amount of the sub-pixel aliasing removal, edge detection thresholds relative to the local maximum and absolute
+const float subpixelQuality = 0.75f;
+const float edgeThreshold = 0.166f;
+const float edgeThresholdMin = 0.0833f;
+
+// Search steps of the quality preset 12
+const int searchSteps = 5;
+const float stepSizes[searchSteps] = float[](1.0f, 1.5f, 2.0f, 4.0f, 12.0f);
+
+// Output
+out vec4 color;
+
+float Luma(vec2 uv)
+{
+  return textureLod(ldr, uv, 0.0f).a;
+}
+
+float Luma(vec2 uv, ivec2 offset)
+{
+  return textureLodOffset(ldr, uv, 0.0f, offset).a;
+}
+
+void main()
+{
+  vec2 rcpFrame = 1.0f / vec2(textureSize(ldr, 0));
+  vec2 posM = gl_FragCoord.xy * rcpFrame;
+  vec4 rgbyM = textureLod(ldr, posM, 0.0f);
+
+  // Local contrast, skip the pixels without an edge
+  float lumaM = rgbyM.a;
+  float lumaS = Luma(posM, ivec2( 0, -1));
+  float lumaE = Luma(posM, ivec2( 1,  0));
+  float lumaN = Luma(posM, ivec2( 0,  1));
+  float lumaW = Luma(posM, ivec2(-1,  0));
+
+  float rangeMax = max(max(lumaN, lumaW), max(lumaE, max(lumaS, lumaM)));
+  float rangeMin = min(min(lumaN, lumaW), min(lumaE, min(lumaS, lumaM)));
+  float range = rangeMax - rangeMin;
+  if (range < max(edgeThresholdMin, rangeMax * edgeThreshold))
+  {
+    color = rgbyM;
+    return;
+  }
+
+  float lumaNW = Luma(posM, ivec2(-1,  1));
+  float lumaSE = Luma(posM, ivec2( 1, -1));
+  float lumaNE = Luma(posM, ivec2( 1,  1));
+  float lumaSW = Luma(posM, ivec2(-1, -1));
+
+  // Edge orientation from the second derivatives in both directions
+  float lumaNS = lumaN + lumaS;
+  float lumaWE = lumaW + lumaE;
+  float lumaNESE = lumaNE + lumaSE;
+  float lumaNWNE = lumaNW + lumaNE;
+  float lumaNWSW = lumaNW + lumaSW;
+  float lumaSWSE = lumaSW + lumaSE;
+  float edgeHorz = abs(-2.0f * lumaW + lumaNWSW) + abs(-2.0f * lumaM + lumaNS) * 2.0f + abs(-2.0f * lumaE + lumaNESE);
+  float edgeVert = abs(-2.0f * lumaS + lumaSWSE) + abs(-2.0f * lumaM + lumaWE) * 2.0f + abs(-2.0f * lumaN + lumaNWNE);
+  bool horzSpan = edgeHorz >= edgeVert;
+
+  // Sub-pixel aliasing amount from the difference to the 3x3 average
+  float subpixA = (lumaNS + lumaWE) * 2.0f + lumaNWSW + lumaNESE;
+  float subpixB = subpixA * (1.0f / 12.0f) - lumaM;
+  float subpixC = clamp(abs(subpixB) / range, 0.0f, 1.0f);
+  float subpixF = (-2.0f * subpixC + 3.0f) * subpixC * subpixC;
+  float subpixH = subpixF * subpixF * subpixelQuality;
+
+  // Pick the side of the edge with the steeper gradient, N is the positive direction
+  if (!horzSpan)
+  {
+    lumaN = lumaE;
+    lumaS = lumaW;
+  }
+  float lengthSign = horzSpan ? rcpFrame.y : rcpFrame.x;
+  float gradientN = lumaN - lumaM;
+  float gradientS = lumaS - lumaM;
+  bool pairN = abs(gradientN) >= abs(gradientS);
+  float gradient = max(abs(gradientN), abs(gradientS));
+  if (!pairN)
+    lengthSign = -lengthSign;
+  float lumaNN = (pairN ? lumaN : lumaS) + lumaM;
+
+  // Search along the edge from the point between the pixel and its neighbor on the chosen side
+  vec2 posB = posM;
+  vec2 offNP = horzSpan ? vec2(rcpFrame.x, 0.0f) : vec2(0.0f, rcpFrame.y);
+  if (horzSpan)
+    posB.y += lengthSign * 0.5f;
+  else
+    posB.x += lengthSign * 0.5f;
+
+  float gradientScaled = gradient * 0.25f;
+  float lumaMM = lumaM - lumaNN * 0.5f;
+  bool lumaMLTZero = lumaMM < 0.0f;
+
+  vec2 posN = posB - offNP * stepSizes[0];
+  vec2 posP = posB + offNP * stepSizes[0];
+  float lumaEndN = Luma(posN) - lumaNN * 0.5f;
+  float lumaEndP = Luma(posP) - lumaNN * 0.5f;
+  bool doneN = abs(lumaEndN) >= gradientScaled;
+  bool doneP = abs(lumaEndP) >= gradientScaled;
+  for (int i = 1; i < searchSteps; ++i)
+  {
+    // The last step isn't checked, the edge is assumed to go on
+    if (!doneN)
+      posN -= offNP * stepSizes[i];
+    if (!doneP)
+      posP += offNP * stepSizes[i];
+    if ((doneN && doneP) || i == searchSteps - 1)
+      break;
+
+    if (!doneN)
+    {
+      lumaEndN = Luma(posN) - lumaNN * 0.5f;
+      doneN = abs(lumaEndN) >= gradientScaled;
+    }
+    if (!doneP)
+    {
+      lumaEndP = Luma(posP) - lumaNN * 0.5f;
+      doneP = abs(lumaEndP) >= gradientScaled;
+    }
+  }
+
+  // Distance to the closer end of the edge, the span is good if the luma change there has the opposite sign
+  float dstN = horzSpan ? posM.x - posN.x : posM.y - posN.y;
+  float dstP = horzSpan ? posP.x - posM.x : posP.y - posM.y;
+  bool directionN = dstN < dstP;
+  float dst = min(dstN, dstP);
+  bool goodSpan = directionN ? ((lumaEndN < 0.0f) != lumaMLTZero) : ((lumaEndP < 0.0f) != lumaMLTZero);
+  float pixelOffset = goodSpan ? 0.5f - dst / (dstN + dstP) : 0.0f;
+
+  // Shift the sample towards the edge by the larger of the edge and sub-pixel offsets
+  float offset = max(pixelOffset, subpixH) * lengthSign;
+  if (horzSpan)
+    posM.y += offset;
+  else
+    posM.x += offset;
+
+  color = vec4(textureLod(ldr, posM, 0.0f).rgb, lumaM);
+}
+)",
+// ----------------------------------------------------------------------------
+// SMAA 1x edge detection fragment shader source, see Jimenez et al.: SMAA: Enhanced Subpixel Morphological Antialiasing
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Tonemapped image with the perceptual luma in alpha
+layout (binding = 0) uniform sampler2D ldr;
+
+// Luma difference considered an edge
+const float threshold = 0.1f;
+// Edges weaker than the strongest neighboring one by this factor are suppressed
+const float localContrastFactor = 2.0f;
+
+// Edge on the left (red) and the top (green) side of the pixel
+out vec2 edges;
+
+float Luma(ivec2 texel)
+{
+  return texelFetch(ldr, clamp(texel, ivec2(0), textureSize(ldr, 0) - 1), 0).a;
 }
 
 void main()
 {
-  // Query the size of the texture and calculate texel coordinates
-  ivec2 texSize = textureSize(HDR);
-  ivec2 texel = ivec2(UV * texSize);
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+
+  // Luma differences to the left and top neighbors
+  float L = Luma(texel);
+  float Lleft = Luma(texel + ivec2(-1, 0));
+  float Ltop = Luma(texel + ivec2(0, 1));
+  vec2 delta = abs(L - vec2(Lleft, Ltop));
+  edges = step(threshold, delta);
+  if (edges.x + edges.y == 0.0f)
+    discard;
+
+  // Local contrast adaptation: maximum of the differences around the left and top edges
+  float Lright = Luma(texel + ivec2(1, 0));
+  float Lbottom = Luma(texel + ivec2(0, -1));
+  vec2 maxDelta = max(delta, abs(L - vec2(Lright, Lbottom)));
+  float Lleftleft = Luma(texel + ivec2(-2, 0));
+  float Ltoptop = Luma(texel + ivec2(0, 2));
+  maxDelta = max(maxDelta, abs(vec2(Lleft, Ltop) - vec2(Lleftleft, Ltoptop)));
+  float finalDelta = max(maxDelta.x, maxDelta.y);
+
+  edges *= step(finalDelta, localContrastFactor * delta);
+}
+)",
+// ----------------------------------------------------------------------------
+// SMAA 1x blending weight calculation fragment shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Edges from the edge detection pass
+layout (binding = 0) uniform sampler2D edgesTex;
+// Precomputed areas, see Textures::CreateSmaaAreaTexture() for the layout
+layout (binding = 1) uniform sampler2D areaTex;
+
+// Maximum distance to the end of the edge, must match SMAA_MAX_DISTANCE in main.cpp
+#define MAX_DISTANCE 16
+
+// Blending weights: top edge (x: pixel from the top one, y: top one from the pixel) and left edge (z, w)
+out vec4 weights;
+
+bool Edge(ivec2 texel, int component)
+{
+  return texelFetch(edgesTex, clamp(texel, ivec2(0), textureSize(edgesTex, 0) - 1), 0)[component] > 0.5f;
+}
+
+vec2 Area(int e1, int e2, int d1, int d2)
+{
+  return texelFetch(areaTex, ivec2(e1 * (MAX_DISTANCE + 1) + d1, e2 * (MAX_DISTANCE + 1) + d2), 0).rg;
+}
+
+void main()
+{
+  ivec2 p = ivec2(gl_FragCoord.xy);
+  vec2 e = texelFetch(edgesTex, p, 0).rg;
+  weights = vec4(0.0f);
+
+  if (e.g > 0.5f)
+  {
+    // Top edge: walk to both ends until the edge stops or a left edge crosses it in either row,
+    // crossing edges on the pixel row are the negative side, on the top row the positive side
+    int left = 0;
+    while (left < MAX_DISTANCE && !Edge(p + ivec2(-left, 0), 0) && !Edge(p + ivec2(-left, 1), 0) && Edge(p + ivec2(-left - 1, 0), 1))
+      ++left;
+    int right = 0;
+    while (right < MAX_DISTANCE && !Edge(p + ivec2(right + 1, 0), 0) && !Edge(p + ivec2(right + 1, 1), 0) && Edge(p + ivec2(right + 1, 0), 1))
+      ++right;
+
+    int e1 = int(Edge(p + ivec2(-left, 0), 0)) + 2 * int(Edge(p + ivec2(-left, 1), 0));
+    int e2 = int(Edge(p + ivec2(right + 1, 0), 0)) + 2 * int(Edge(p + ivec2(right + 1, 1), 0));
+    weights.xy = Area(e1, e2, left, right);
+  }
+
+  if (e.r > 0.5f)
+  {
+    // Left edge: the same along the column, crossing edges are the top edges of the pixel column (negative side)
+    // and the left column (positive side) just below the bottom end and at the top end
+    int bottom = 0;
+    while (bottom < MAX_DISTANCE && !Edge(p + ivec2(0, -bottom - 1), 1) && !Edge(p + ivec2(-1, -bottom - 1), 1) && Edge(p + ivec2(0, -bottom - 1), 0))
+      ++bottom;
+    int top = 0;
+    while (top < MAX_DISTANCE && !Edge(p + ivec2(0, top), 1) && !Edge(p + ivec2(-1, top), 1) && Edge(p + ivec2(0, top + 1), 0))
+      ++top;
+
+    int e1 = int(Edge(p + ivec2(0, -bottom - 1), 1)) + 2 * int(Edge(p + ivec2(-1, -bottom - 1), 1));
+    int e2 = int(Edge(p + ivec2(0, top), 1)) + 2 * int(Edge(p + ivec2(-1, top), 1));
+    weights.zw = Area(e1, e2, bottom, top);
+  }
+
+  if (weights == vec4(0.0f))
+    discard;
+}
+)",
+// ----------------------------------------------------------------------------
+// SMAA 1x neighborhood blending fragment shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Tonemapped image
+layout (binding = 0) uniform sampler2D ldr;
+// Weights from the blending weight calculation pass
+layout (binding = 1) uniform sampler2D blendTex;
 
-  // Accumulate color for all MSAA samples
-  vec3 finalColor = vec3(0.0f);
-  for (int i = 0; i < int(MSAA_LEVEL); ++i)
+// Output
+out vec4 color;
+
+vec4 Color(ivec2 texel)
+{
+  return texelFetch(ldr, clamp(texel, ivec2(0), textureSize(ldr, 0) - 1), 0);
+}
+
+void main()
+{
+  ivec2 p = ivec2(gl_FragCoord.xy);
+  ivec2 maxTexel = textureSize(blendTex, 0) - 1;
+
+  // Weights of all four edges of the pixel, the bottom and right ones are stored by the neighbors
+  vec4 w = texelFetch(blendTex, p, 0);
+  float top = w.x;
+  float bottom = texelFetch(blendTex, clamp(p + ivec2(0, -1), ivec2(0), maxTexel), 0).y;
+  float left = w.z;
+  float right = texelFetch(blendTex, clamp(p + ivec2(1, 0), ivec2(0), maxTexel), 0).w;
+
+  vec4 center = Color(p);
+  if (max(top, bottom) + max(left, right) == 0.0f)
   {
-     // Fetch a single sample from a single texel (no interpolation)
-     vec3 s = texelFetch(HDR, texel, i).rgb;
-     finalColor += ApplyTonemapping(s);
+    color = center;
+    return;
   }
 
-  color = vec4(finalColor.rgb / MSAA_LEVEL, 1.0f);
+  // Blend only along the dominant direction so that corners aren't blurred twice
+  if (max(top, bottom) >= max(left, right))
+    color = center * (1.0f - top - bottom) + Color(p + ivec2(0, 1)) * top + Color(p + ivec2(0, -1)) * bottom;
+  else
+    color = center * (1.0f - left - right) + Color(p + ivec2(-1, 0)) * left + Color(p + ivec2(1, 0)) * right;
 }
 )",
 ""};
@@ -301,18 +808,133 @@ namespace ComputeShader
 {
 enum
 {
-  Flocking, NumComputeShaders
+  Classify, Flocking, OctreeBounds, OctreeMorton, BitonicSort, OctreeLeaves, OctreeNodes, FlockingBarnesHut, FlockStats, Culling, Tonemapping, AutoExposure, NumComputeShaders
 };
 }
 
 // Fragment shader sources
 static const char* csSource[] = {
 // ----------------------------------------------------------------------------
-// Flocking compute shader source
+// Simulation LOD classification compute shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 256) in;
+
+// Maximum number of storage buffer chunks, must match Scene::MAX_FLOCK_CHUNKS
+#define MAX_FLOCK_CHUNKS 4
+// Size of the active members header, dispatch arguments and active count for each chunk
+#define ACTIVE_LIST_HEADER (MAX_FLOCK_CHUNKS * 4)
+
+// Goal position which the flock will chase, timestep packed in the last component
+uniform vec4 goal_dt;
+// View position in world space
+uniform vec3 viewPos;
+// Distances from the camera or the goal where the update period doubles
+uniform vec2 periodDistances;
+// Index of the current simulation step
+uniform uint stepIndex;
+// Number of flock members in a single storage buffer chunk
+uniform uint chunkSize;
+// Index of the classified chunk
+uniform uint chunkIndex;
+
+// Structured buffer record
+struct FlockMember
+{
+  // Model to world transformation matrix
+  mat4 transformation;
+  // Velocity, w holds the time since the last update
+  vec4 velocity;
+};
+
+// Previous state of the classified chunk
+layout (binding = 0) readonly buffer FlockIn
+{
+  FlockMember member[];
+} inputData;
+
+// Current state of the classified chunk, only the inactive members are written here
+layout (binding = 1) writeonly buffer FlockOut
+{
+  FlockMember member[];
+} outputData;
+
+// Header with the dispatch arguments and active counts for each chunk, followed by the per chunk lists
+layout (std430, binding = 2) buffer ActiveMembers
+{
+  uint activeData[];
+};
+
+// Work group local counter, so that only one global atomic is needed
+shared uint groupCount;
+// Where the work group writes to in the global list
+shared uint groupBase;
+
+void main()
+{
+  if (gl_LocalInvocationIndex == 0)
+    groupCount = 0;
+
+  memoryBarrierShared();
+  barrier();
+
+  uint index = gl_GlobalInvocationID.x;
+  FlockMember me = inputData.member[index];
+
+  // Members close to the camera or to the goal are updated every step, the others every 2nd or 4th step
+  vec3 position = me.transformation[3].xyz;
+  float d = min(distance(position, viewPos), distance(position, goal_dt.xyz));
+  uint period = d < periodDistances.x ? 1 : (d < periodDistances.y ? 2 : 4);
+
+  // Stagger the updates by the member index so that the load is the same every step
+  bool active = ((stepIndex + chunkIndex * chunkSize + index) & (period - 1)) == 0;
+
+  uint localSlot = 0;
+  if (active)
+  {
+    localSlot = atomicAdd(groupCount, 1);
+  }
+  else
+  {
+    // Extrapolate the inactive members, w accumulates the time until the next update
+    me.transformation[3].xyz += me.velocity.xyz * goal_dt.w;
+    me.velocity.w += goal_dt.w;
+    outputData.member[index] = me;
+  }
+
+  memoryBarrierShared();
+  barrier();
+
+  // Reserve space for the whole work group and grow the dispatch to cover it
+  if (gl_LocalInvocationIndex == 0 && groupCount > 0)
+  {
+    groupBase = atomicAdd(activeData[chunkIndex * 4 + 3], groupCount);
+    atomicMax(activeData[chunkIndex * 4], (groupBase + groupCount + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x);
+  }
+
+  memoryBarrierShared();
+  barrier();
+
+  if (active)
+    activeData[ACTIVE_LIST_HEADER + chunkIndex * chunkSize + groupBase + localSlot] = index;
+}
+)",
+// ----------------------------------------------------------------------------
+// Flocking compute shader source, SUBGROUP_FLOCKING selects the subgroup variant
 // ----------------------------------------------------------------------------
 R"(
 #version 460 core
 
+#ifdef SUBGROUP_FLOCKING
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_ballot : require
+#extension GL_KHR_shader_subgroup_shuffle : require
+#extension GL_KHR_shader_subgroup_arithmetic : require
+#endif
+
 // ----------------------------------------------------------------------------
 // Available system variables
 // ----------------------------------------------------------------------------
@@ -343,30 +965,50 @@ uniform float maxSpeed = 10.0f;
 uniform vec4 ruleWeights = vec4(0.18f, 0.05f, 0.17f, 0.02f);
 // Goal position which the flock will chase, timestep packed in the last component
 uniform vec4 goal_dt;
+// Number of flock members in a single storage buffer chunk, multiple of the work group size
+uniform uint chunkSize;
+// Number of flock members
+uniform uint flockSize;
+// Chunk whose active members are simulated
+uniform uint activeChunk;
+
+// Maximum number of storage buffer chunks, must match Scene::MAX_FLOCK_CHUNKS
+#define MAX_FLOCK_CHUNKS 4
+// Size of the active members header, dispatch arguments and active count for each chunk
+#define ACTIVE_LIST_HEADER (MAX_FLOCK_CHUNKS * 4)
 
 // Structured buffer record
 struct FlockMember
 {
   // Model to world transformation matrix
   mat4 transformation;
-  // Velocity
+  // Velocity, w holds the time since the last update
   vec4 velocity;
 };
 
-// Input structured buffer - previous frame state
+// Input structured buffer - previous frame state, split to chunks to get past the storage block size limit,
+// chunk index must be dynamically uniform, i.e., the same for the whole work group
 layout (binding = 0) readonly buffer FlockIn
 {
   FlockMember member[];
-} inputData;
+} inputData[MAX_FLOCK_CHUNKS];
 
-// Output structured buffer - current frame state (will be rendered)
-layout (binding = 1) buffer FlockOut
+// Output structured buffer - current frame state of the active chunk (will be rendered)
+layout (binding = MAX_FLOCK_CHUNKS) writeonly buffer FlockOut
 {
   FlockMember member[];
 } outputData;
 
+// Active members produced by the classification, header with counts followed by the per chunk lists
+layout (std430, binding = MAX_FLOCK_CHUNKS + 1) readonly buffer ActiveMembers
+{
+  uint activeData[];
+};
+
+#ifndef SUBGROUP_FLOCKING
 // Workgroup shared storage (faster access than global memory, e.g., FlockIn buffer)
 shared FlockMember membersCache[gl_WorkGroupSize.x];
+#endif
 
 // Rule #1: do not collide with others
 vec3 collisionAvoidance(vec3 myPosition, vec3 myVelocity, vec3 otherPosition, vec3 otherVelocity)
@@ -395,19 +1037,60 @@ vec3 followOthers(vec3 myPosition, vec3 myVelocity, vec3 otherPosition, vec3 oth
 // to a shared local workgroup memory
 void main()
 {
+  // Dispatch is rounded up to whole work groups, the extra invocations only help with the caching
+  bool valid = gl_GlobalInvocationID.x < activeData[activeChunk * 4 + 3];
+  uint myIndex = valid ? activeData[ACTIVE_LIST_HEADER + activeChunk * chunkSize + gl_GlobalInvocationID.x] : 0;
+  uint myId = activeChunk * chunkSize + myIndex;
+
   // Fetch our data from global memory
-  FlockMember me = inputData.member[gl_GlobalInvocationID.x];
+  FlockMember me = inputData[activeChunk].member[myIndex];
 
   // Our acceleration
   vec3 acceleration = vec3(0.0f);
   // Flock center
   vec3 flockCenter = vec3(0.0f);
 
-  // Iterate over all work groups
-  for (uint groupId = 0; groupId < gl_NumWorkGroups.x; ++groupId)
+#ifdef SUBGROUP_FLOCKING
+  // There are no work group barriers, subgroups without any active member can leave early
+  if (subgroupBallotBitCount(subgroupBallot(valid)) == 0)
+    return;
+
+  // Iterate over the whole flock in subgroup sized tiles, each invocation loads one member of the tile
+  // and the others read it straight from its registers, no shared memory and no barriers needed
+  vec3 loadedSum = vec3(0.0f);
+  for (uint tileFirst = 0; tileFirst < flockSize; tileFirst += gl_SubgroupSize)
+  {
+    // Tiles don't cross the chunk boundary, chunk size is a multiple of the work group size
+    uint tileChunk = tileFirst / chunkSize;
+    FlockMember loaded = inputData[tileChunk].member[tileFirst - tileChunk * chunkSize + gl_SubgroupInvocationID];
+    vec3 loadedPosition = loaded.transformation[3].xyz;
+    vec3 loadedVelocity = loaded.velocity.xyz;
+    loadedSum += loadedPosition;
+
+    for (uint lane = 0; lane < gl_SubgroupSize; ++lane)
+    {
+      vec3 otherPosition = subgroupShuffle(loadedPosition, lane);
+      vec3 otherVelocity = subgroupShuffle(loadedVelocity, lane);
+
+      // Make sure we discard ourselves
+      if (tileFirst + lane != myId)
+      {
+        acceleration += collisionAvoidance(me.transformation[3].xyz, me.velocity.xyz, otherPosition, otherVelocity) * ruleWeights.x;
+        acceleration += followOthers(me.transformation[3].xyz, me.velocity.xyz, otherPosition, otherVelocity) * ruleWeights.y;
+      }
+    }
+  }
+
+  // The subgroup loaded the whole flock, sum of its loads is the sum of all positions
+  flockCenter = subgroupAdd(loadedSum);
+#else
+  // Iterate over the whole flock in work group sized tiles
+  for (uint groupId = 0; groupId < flockSize / gl_WorkGroupSize.x; ++groupId)
   {
     // Fetch one data member from global memory and put it in shared local cache
-    membersCache[gl_LocalInvocationID.x] = inputData.member[groupId * gl_WorkGroupSize.x + gl_LocalInvocationID.x];
+    uint groupFirst = groupId * gl_WorkGroupSize.x;
+    uint groupChunk = groupFirst / chunkSize;
+    membersCache[gl_LocalInvocationID.x] = inputData[groupChunk].member[groupFirst - groupChunk * chunkSize + gl_LocalInvocationID.x];
 
     // Wait until the whole work group fetched the data
     memoryBarrierShared();
@@ -420,7 +1103,7 @@ void main()
       flockCenter += other.transformation[3].xyz;
 
       // Make sure we discard ourselves
-      if (groupId * gl_WorkGroupSize.x + localId != gl_GlobalInvocationID.x)
+      if (groupId * gl_WorkGroupSize.x + localId != myId)
       {
         acceleration += collisionAvoidance(me.transformation[3].xyz, me.velocity.xyz, other.transformation[3].xyz, other.velocity.xyz) * ruleWeights.x;
         acceleration += followOthers(me.transformation[3].xyz, me.velocity.xyz, other.transformation[3].xyz, other.velocity.xyz) * ruleWeights.y;
@@ -430,15 +1113,17 @@ void main()
     // Catch up with the other threads in the work group
     barrier();
   }
+#endif
 
   // Finish the update: Rule #3: follow common goal, Rule #4: try to reach flock center
-  flockCenter /= float(gl_NumWorkGroups.x * gl_WorkGroupSize.x);
+  flockCenter /= float(flockSize);
   acceleration += normalize(goal_dt.xyz - me.transformation[3].xyz) * ruleWeights.z;
   acceleration += normalize(flockCenter - me.transformation[3].xyz) * ruleWeights.w;
 
-  // Update the new position and velocity
+  // Update the new position and velocity, position was extrapolated during the skipped steps,
+  // but the acceleration needs to be applied for the whole time since the last update
   vec3 position = me.transformation[3].xyz + me.velocity.xyz * goal_dt.w;
-  vec3 velocity = me.velocity.xyz + acceleration * goal_dt.w;
+  vec3 velocity = me.velocity.xyz + acceleration * (goal_dt.w + me.velocity.w);
   float speed = length(velocity);
   vec3 direction = velocity / speed;
   if (speed > maxSpeed)
@@ -446,9 +1131,9 @@ void main()
     velocity = direction * maxSpeed;
   }
 
-  // Prepare the output data
+  // Prepare the output data, w holds the time since the last update
   FlockMember newMe;
-  newMe.velocity = vec4(velocity, 1.0f);
+  newMe.velocity = vec4(velocity, 0.0f);
 
   // Update the transformation matrix (aside, up, direction, position)
   newMe.transformation[0] = vec4(normalize(cross(me.transformation[1].xyz, direction)), 0.0f);
@@ -457,7 +1142,1020 @@ void main()
   newMe.transformation[3] = vec4(position, 1.0f);
 
   // Write out to the output buffer
-  outputData.member[gl_GlobalInvocationID.x] = newMe;
+  if (valid)
+    outputData.member[myIndex] = newMe;
+}
+)",
+// ----------------------------------------------------------------------------
+// Octree bounds compute shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 256) in;
+
+// Maximum number of storage buffer chunks, must match Scene::MAX_FLOCK_CHUNKS
+#define MAX_FLOCK_CHUNKS 4
+
+// Number of flock members in a single storage buffer chunk
+uniform uint chunkSize;
+
+// Structured buffer record
+struct FlockMember
+{
+  // Model to world transformation matrix
+  mat4 transformation;
+  // Velocity
+  vec4 velocity;
+};
+
+// Flock state split to chunks
+layout (binding = 0) readonly buffer FlockIn
+{
+  FlockMember member[];
+} inputData[MAX_FLOCK_CHUNKS];
+
+// Octree buffer, only the bounds are needed here
+layout (std430, binding = 7) buffer Octree
+{
+  // Flock bounds as ordered uints: min xyz, padding, max xyz, padding
+  uint bounds[8];
+};
+
+// Work group reduction storage
+shared vec3 groupMin[gl_WorkGroupSize.x];
+shared vec3 groupMax[gl_WorkGroupSize.x];
+
+// Maps float to uint so that the integer comparison gives the same ordering
+uint floatToOrdered(float f)
+{
+  uint u = floatBitsToUint(f);
+  return (u & 0x80000000u) != 0 ? ~u : u | 0x80000000u;
+}
+
+void main()
+{
+  // Whole work group lives in the same chunk
+  uint chunk = gl_GlobalInvocationID.x / chunkSize;
+  uint index = gl_GlobalInvocationID.x - chunk * chunkSize;
+  vec3 position = inputData[chunk].member[index].transformation[3].xyz;
+
+  groupMin[gl_LocalInvocationID.x] = position;
+  groupMax[gl_LocalInvocationID.x] = position;
+
+  memoryBarrierShared();
+  barrier();
+
+  // Parallel reduction in the shared memory
+  for (uint stride = gl_WorkGroupSize.x / 2; stride > 0; stride >>= 1)
+  {
+    if (gl_LocalInvocationID.x < stride)
+    {
+      groupMin[gl_LocalInvocationID.x] = min(groupMin[gl_LocalInvocationID.x], groupMin[gl_LocalInvocationID.x + stride]);
+      groupMax[gl_LocalInvocationID.x] = max(groupMax[gl_LocalInvocationID.x], groupMax[gl_LocalInvocationID.x + stride]);
+    }
+
+    memoryBarrierShared();
+    barrier();
+  }
+
+  // Merge with the other work groups
+  if (gl_LocalInvocationID.x == 0)
+  {
+    atomicMin(bounds[0], floatToOrdered(groupMin[0].x));
+    atomicMin(bounds[1], floatToOrdered(groupMin[0].y));
+    atomicMin(bounds[2], floatToOrdered(groupMin[0].z));
+    atomicMax(bounds[4], floatToOrdered(groupMax[0].x));
+    atomicMax(bounds[5], floatToOrdered(groupMax[0].y));
+    atomicMax(bounds[6], floatToOrdered(groupMax[0].z));
+  }
+}
+)",
+// ----------------------------------------------------------------------------
+// Octree Morton code compute shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 256) in;
+
+// Maximum number of storage buffer chunks, must match Scene::MAX_FLOCK_CHUNKS
+#define MAX_FLOCK_CHUNKS 4
+
+// Number of flock members in a single storage buffer chunk
+uniform uint chunkSize;
+// Number of flock members, the rest of the keys is padding for the sort
+uniform uint flockSize;
+
+// Structured buffer record
+struct FlockMember
+{
+  // Model to world transformation matrix
+  mat4 transformation;
+  // Velocity
+  vec4 velocity;
+};
+
+// Compact flock member record used by the octree, index of the member is stored in position.w
+struct OctreeMember
+{
+  vec4 position;
+  vec4 velocity;
+};
+
+// Flock state split to chunks
+layout (binding = 0) readonly buffer FlockIn
+{
+  FlockMember member[];
+} inputData[MAX_FLOCK_CHUNKS];
+
+// Sort keys: Morton code and flock member index
+layout (std430, binding = 4) writeonly buffer SortKeys
+{
+  uvec2 keys[];
+};
+
+// Compact flock members in the original order
+layout (std430, binding = 5) writeonly buffer CompactMembers
+{
+  OctreeMember compactMembers[];
+};
+
+// Octree buffer, only the bounds are needed here
+layout (std430, binding = 7) readonly buffer Octree
+{
+  // Flock bounds as ordered uints: min xyz, padding, max xyz, padding
+  uint bounds[8];
+};
+
+// Inverse of the ordered uint mapping
+float orderedToFloat(uint u)
+{
+  return uintBitsToFloat((u & 0x80000000u) != 0 ? u & 0x7fffffffu : ~u);
+}
+
+// Inserts two zero bits after each of the lower 10 bits
+uint expandBits(uint v)
+{
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+void main()
+{
+  uint id = gl_GlobalInvocationID.x;
+
+  // Padding sorts to the end, whole work groups are either in or out of the flock
+  if (id >= flockSize)
+  {
+    keys[id] = uvec2(0xFFFFFFFFu, id);
+    return;
+  }
+
+  uint chunk = id / chunkSize;
+  uint index = id - chunk * chunkSize;
+  FlockMember me = inputData[chunk].member[index];
+  vec3 position = me.transformation[3].xyz;
+
+  // Octree root is a cube enclosing the flock
+  vec3 rootMin = vec3(orderedToFloat(bounds[0]), orderedToFloat(bounds[1]), orderedToFloat(bounds[2]));
+  vec3 rootMax = vec3(orderedToFloat(bounds[4]), orderedToFloat(bounds[5]), orderedToFloat(bounds[6]));
+  vec3 extent = rootMax - rootMin;
+  float rootSize = max(max(extent.x, extent.y), max(extent.z, 1e-3f)) * 1.001f;
+
+  // 10 bits per axis
+  uvec3 q = uvec3(clamp((position - rootMin) / rootSize * 1024.0f, vec3(0.0f), vec3(1023.0f)));
+  uint code = (expandBits(q.x) << 2) | (expandBits(q.y) << 1) | expandBits(q.z);
+
+  keys[id] = uvec2(code, id);
+  compactMembers[id] = OctreeMember(vec4(position, uintBitsToFloat(id)), vec4(me.velocity.xyz, 0.0f));
+}
+)",
+// ----------------------------------------------------------------------------
+// Bitonic sort step compute shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 256) in;
+
+// Size of the currently merged bitonic sequences
+uniform uint sortBlock;
+// Distance of the compared elements
+uniform uint sortStride;
+
+// Sort keys: Morton code and flock member index
+layout (std430, binding = 4) buffer SortKeys
+{
+  uvec2 keys[];
+};
+
+void main()
+{
+  uint i = gl_GlobalInvocationID.x;
+  uint j = i ^ sortStride;
+
+  // Only one of the pair does the work
+  if (j <= i)
+    return;
+
+  uvec2 a = keys[i];
+  uvec2 b = keys[j];
+  bool ascending = (i & sortBlock) == 0;
+  if ((a.x > b.x) == ascending)
+  {
+    keys[i] = b;
+    keys[j] = a;
+  }
+}
+)",
+// ----------------------------------------------------------------------------
+// Octree leaves compute shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 256) in;
+
+// Depth of the octree, must match Scene::OCTREE_DEPTH
+#define OCTREE_DEPTH 6
+// Number of leaf cells
+#define OCTREE_LEAVES (1 << (3 * OCTREE_DEPTH))
+
+// Number of flock members
+uniform uint flockSize;
+
+// Compact flock member record used by the octree, index of the member is stored in position.w
+struct OctreeMember
+{
+  vec4 position;
+  vec4 velocity;
+};
+
+// Sorted keys: Morton code and flock member index
+layout (std430, binding = 4) readonly buffer SortKeys
+{
+  uvec2 keys[];
+};
+
+// Compact flock members in the original order
+layout (std430, binding = 5) readonly buffer CompactMembers
+{
+  OctreeMember compactMembers[];
+};
+
+// Compact flock members in the Morton order
+layout (std430, binding = 6) writeonly buffer SortedMembers
+{
+  OctreeMember sortedMembers[];
+};
+
+// Octree buffer
+layout (std430, binding = 7) buffer Octree
+{
+  // Flock bounds as ordered uints: min xyz, padding, max xyz, padding
+  uint bounds[8];
+  // Ranges of the sorted members in the leaf cells
+  uvec2 cells[OCTREE_LEAVES];
+};
+
+void main()
+{
+  uint i = gl_GlobalInvocationID.x;
+  uvec2 key = keys[i];
+
+  // Gather the members to the Morton order
+  sortedMembers[i] = compactMembers[key.y];
+
+  // Leaf cell is given by the top bits of the code, the cell range starts and ends where the cell changes
+  const uint shift = 30 - 3 * OCTREE_DEPTH;
+  uint cell = key.x >> shift;
+  if (i == 0 || (keys[i - 1].x >> shift) != cell)
+    cells[cell].x = i;
+  if (i == flockSize - 1 || (keys[i + 1].x >> shift) != cell)
+    cells[cell].y = i + 1;
+}
+)",
+// ----------------------------------------------------------------------------
+// Octree nodes compute shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 256) in;
+
+// Depth of the octree, must match Scene::OCTREE_DEPTH
+#define OCTREE_DEPTH 6
+// Number of leaf cells
+#define OCTREE_LEAVES (1 << (3 * OCTREE_DEPTH))
+
+// Currently built level of the octree
+uniform uint level;
+
+// Compact flock member record used by the octree, index of the member is stored in position.w
+struct OctreeMember
+{
+  vec4 position;
+  vec4 velocity;
+};
+
+// Octree node with the aggregated data
+struct OctreeNode
+{
+  // Centroid, mass (number of members) in w
+  vec4 centroid;
+  // Mean velocity
+  vec4 velocity;
+};
+
+// Compact flock members in the Morton order
+layout (std430, binding = 6) readonly buffer SortedMembers
+{
+  OctreeMember sortedMembers[];
+};
+
+// Octree buffer
+layout (std430, binding = 7) buffer Octree
+{
+  // Flock bounds as ordered uints: min xyz, padding, max xyz, padding
+  uint bounds[8];
+  // Ranges of the sorted members in the leaf cells
+  uvec2 cells[OCTREE_LEAVES];
+  // Dense octree levels from the root to the leaves
+  OctreeNode nodes[];
+};
+
+// Index of the first node of the level in the dense octree
+uint levelOffset(uint l)
+{
+  return ((1u << (3u * l)) - 1u) / 7u;
+}
+
+void main()
+{
+  uint cell = gl_GlobalInvocationID.x;
+  if (cell >= (1u << (3u * level)))
+    return;
+
+  vec3 positionSum = vec3(0.0f);
+  vec3 velocitySum = vec3(0.0f);
+  float mass = 0.0f;
+
+  if (level == OCTREE_DEPTH)
+  {
+    // Leaves aggregate their members
+    uvec2 range = cells[cell];
+    for (uint i = range.x; i < range.y; ++i)
+    {
+      positionSum += sortedMembers[i].position.xyz;
+      velocitySum += sortedMembers[i].velocity.xyz;
+      mass += 1.0f;
+    }
+  }
+  else
+  {
+    // Inner nodes aggregate their children, Morton order makes them consecutive
+    uint childOffset = levelOffset(level + 1) + (cell << 3);
+    for (uint i = 0; i < 8; ++i)
+    {
+      OctreeNode child = nodes[childOffset + i];
+      positionSum += child.centroid.xyz * child.centroid.w;
+      velocitySum += child.velocity.xyz * child.centroid.w;
+      mass += child.centroid.w;
+    }
+  }
+
+  OctreeNode node;
+  node.centroid = mass > 0.0f ? vec4(positionSum / mass, mass) : vec4(0.0f);
+  node.velocity = mass > 0.0f ? vec4(velocitySum / mass, 0.0f) : vec4(0.0f);
+  nodes[levelOffset(level) + cell] = node;
+}
+)",
+// ----------------------------------------------------------------------------
+// Barnes-Hut flocking compute shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 256) in;
+
+// Maximum number of storage buffer chunks, must match Scene::MAX_FLOCK_CHUNKS
+#define MAX_FLOCK_CHUNKS 4
+// Size of the active members header, dispatch arguments and active count for each chunk
+#define ACTIVE_LIST_HEADER (MAX_FLOCK_CHUNKS * 4)
+// Depth of the octree, must match Scene::OCTREE_DEPTH
+#define OCTREE_DEPTH 6
+// Number of leaf cells
+#define OCTREE_LEAVES (1 << (3 * OCTREE_DEPTH))
+// Traversal stack size, each level replaces one node with up to 8 children
+#define STACK_SIZE (7 * OCTREE_DEPTH + 1)
+
+// How close can flock members get together (squared)
+uniform float closestDistanceSq = 50.0;
+// Maximum allowed speed
+uniform float maxSpeed = 10.0f;
+// Weight rules
+uniform vec4 ruleWeights = vec4(0.18f, 0.05f, 0.17f, 0.02f);
+// Goal position which the flock will chase, timestep packed in the last component
+uniform vec4 goal_dt;
+// Number of flock members in a single storage buffer chunk, multiple of the work group size
+uniform uint chunkSize;
+// Chunk whose active members are simulated
+uniform uint activeChunk;
+// Opening criterion, nodes smaller than theta times their distance are approximated
+uniform float theta = 0.5f;
+
+// Structured buffer record
+struct FlockMember
+{
+  // Model to world transformation matrix
+  mat4 transformation;
+  // Velocity, w holds the time since the last update
+  vec4 velocity;
+};
+
+// Compact flock member record used by the octree, index of the member is stored in position.w
+struct OctreeMember
+{
+  vec4 position;
+  vec4 velocity;
+};
+
+// Octree node with the aggregated data
+struct OctreeNode
+{
+  // Centroid, mass (number of members) in w
+  vec4 centroid;
+  // Mean velocity
+  vec4 velocity;
+};
+
+// Input structured buffer - previous frame state split to chunks
+layout (binding = 0) readonly buffer FlockIn
+{
+  FlockMember member[];
+} inputData[MAX_FLOCK_CHUNKS];
+
+// Output structured buffer - current frame state of the active chunk (will be rendered)
+layout (binding = MAX_FLOCK_CHUNKS) writeonly buffer FlockOut
+{
+  FlockMember member[];
+} outputData;
+
+// Active members produced by the classification, header with counts followed by the per chunk lists
+layout (std430, binding = MAX_FLOCK_CHUNKS + 1) readonly buffer ActiveMembers
+{
+  uint activeData[];
+};
+
+// Compact flock members in the Morton order
+layout (std430, binding = 6) readonly buffer SortedMembers
+{
+  OctreeMember sortedMembers[];
+};
+
+// Octree buffer
+layout (std430, binding = 7) readonly buffer Octree
+{
+  // Flock bounds as ordered uints: min xyz, padding, max xyz, padding
+  uint bounds[8];
+  // Ranges of the sorted members in the leaf cells
+  uvec2 cells[OCTREE_LEAVES];
+  // Dense octree levels from the root to the leaves
+  OctreeNode nodes[];
+};
+
+// Inverse of the ordered uint mapping
+float orderedToFloat(uint u)
+{
+  return uintBitsToFloat((u & 0x80000000u) != 0 ? u & 0x7fffffffu : ~u);
+}
+
+// Removes two bits after each of the lower 10 bits, inverse of the Morton expansion
+uint compactBits(uint v)
+{
+  v &= 0x49249249u;
+  v = (v ^ (v >> 2)) & 0xC30C30C3u;
+  v = (v ^ (v >> 4)) & 0x0F00F00Fu;
+  v = (v ^ (v >> 8)) & 0xFF0000FFu;
+  v = (v ^ (v >> 16)) & 0x000003FFu;
+  return v;
+}
+
+// Index of the first node of the level in the dense octree
+uint levelOffset(uint l)
+{
+  return ((1u << (3u * l)) - 1u) / 7u;
+}
+
+// Rule #1: do not collide with others
+vec3 collisionAvoidance(vec3 myPosition, vec3 myVelocity, vec3 otherPosition, vec3 otherVelocity)
+{
+  // Pull away when too close
+  vec3 d = myPosition - otherPosition;
+  if (dot(d, d) < closestDistanceSq)
+    return d;
+
+  return vec3(0.0f);
+}
+
+// Rule #2: fly in the general direction as others
+vec3 followOthers(vec3 myPosition, vec3 myVelocity, vec3 otherPosition, vec3 otherVelocity)
+{
+  const float epsilonSq = 10.0f;
+  vec3 d = otherPosition - myPosition;
+  vec3 dv = otherVelocity - myVelocity;
+
+  // Take acceleration as velocity difference modulated by distance, prevent it from getting too large
+  return dv / (dot(d, d) + epsilonSq);
+}
+
+// Same as the brute force simulation, but the far field is approximated by the octree nodes
+void main()
+{
+  // Dispatch is rounded up to whole work groups
+  if (gl_GlobalInvocationID.x >= activeData[activeChunk * 4 + 3])
+    return;
+
+  uint myIndex = activeData[ACTIVE_LIST_HEADER + activeChunk * chunkSize + gl_GlobalInvocationID.x];
+  uint myId = activeChunk * chunkSize + myIndex;
+
+  // Fetch our data from global memory
+  FlockMember me = inputData[activeChunk].member[myIndex];
+  vec3 myPosition = me.transformation[3].xyz;
+  vec3 myVelocity = me.velocity.xyz;
+
+  // Octree root is a cube enclosing the flock
+  vec3 rootMin = vec3(orderedToFloat(bounds[0]), orderedToFloat(bounds[1]), orderedToFloat(bounds[2]));
+  vec3 rootMax = vec3(orderedToFloat(bounds[4]), orderedToFloat(bounds[5]), orderedToFloat(bounds[6]));
+  vec3 extent = rootMax - rootMin;
+  float rootSize = max(max(extent.x, extent.y), max(extent.z, 1e-3f)) * 1.001f;
+
+  // Our acceleration
+  vec3 acceleration = vec3(0.0f);
+  // Flock center is exactly the centroid of the root
+  vec3 flockCenter = nodes[0].centroid.xyz;
+
+  // Traverse the octree, entries hold the level in the top bits and the cell index in the rest
+  uint stack[STACK_SIZE];
+  int stackSize = 0;
+  stack[stackSize++] = 0u;
+  while (stackSize > 0)
+  {
+    uint entry = stack[--stackSize];
+    uint level = entry >> 24;
+    uint cell = entry & 0x00FFFFFFu;
+
+    OctreeNode node = nodes[levelOffset(level) + cell];
+    if (node.centroid.w == 0.0f)
+      continue;
+
+    // Distance to the node box, collisions are never approximated
+    float size = rootSize / float(1u << level);
+    vec3 cellMin = rootMin + vec3(compactBits(cell >> 2), compactBits(cell >> 1), compactBits(cell)) * size;
+    vec3 closest = clamp(myPosition, cellMin, cellMin + vec3(size));
+    vec3 toBox = closest - myPosition;
+    vec3 toCentroid = node.centroid.xyz - myPosition;
+
+    if (dot(toBox, toBox) > closestDistanceSq && size * size < theta * theta * dot(toCentroid, toCentroid))
+    {
+      // Far field: the whole node acts as its mass times a single member with the mean velocity
+      acceleration += node.centroid.w * followOthers(myPosition, myVelocity, node.centroid.xyz, node.velocity.xyz) * ruleWeights.y;
+    }
+    else if (level == OCTREE_DEPTH)
+    {
+      // Near field: exact evaluation over the members of the leaf
+      uvec2 range = cells[cell];
+      for (uint i = range.x; i < range.y; ++i)
+      {
+        OctreeMember other = sortedMembers[i];
+
+        // Make sure we discard ourselves
+        if (floatBitsToUint(other.position.w) != myId)
+        {
+          acceleration += collisionAvoidance(myPosition, myVelocity, other.position.xyz, other.velocity.xyz) * ruleWeights.x;
+          acceleration += followOthers(myPosition, myVelocity, other.position.xyz, other.velocity.xyz) * ruleWeights.y;
+        }
+      }
+    }
+    else
+    {
+      // Open the node
+      for (uint i = 0; i < 8; ++i)
+        stack[stackSize++] = ((level + 1) << 24) | (cell << 3) | i;
+    }
+  }
+
+  // Finish the update: Rule #3: follow common goal, Rule #4: try to reach flock center
+  acceleration += normalize(goal_dt.xyz - myPosition) * ruleWeights.z;
+  acceleration += normalize(flockCenter - myPosition) * ruleWeights.w;
+
+  // Update the new position and velocity, position was extrapolated during the skipped steps,
+  // but the acceleration needs to be applied for the whole time since the last update
+  vec3 position = myPosition + myVelocity * goal_dt.w;
+  vec3 velocity = myVelocity + acceleration * (goal_dt.w + me.velocity.w);
+  float speed = length(velocity);
+  vec3 direction = velocity / speed;
+  if (speed > maxSpeed)
+  {
+    velocity = direction * maxSpeed;
+  }
+
+  // Prepare the output data, w holds the time since the last update
+  FlockMember newMe;
+  newMe.velocity = vec4(velocity, 0.0f);
+
+  // Update the transformation matrix (aside, up, direction, position)
+  newMe.transformation[0] = vec4(normalize(cross(me.transformation[1].xyz, direction)), 0.0f);
+  newMe.transformation[1] = vec4(normalize(cross(direction, newMe.transformation[0].xyz)), 0.0f);
+  newMe.transformation[2] = vec4(direction, 0.0f);
+  newMe.transformation[3] = vec4(position, 1.0f);
+
+  // Write out to the output buffer
+  outputData.member[myIndex] = newMe;
+}
+)",
+// ----------------------------------------------------------------------------
+// Flock statistics compute shader source, runs after the bounds are reduced to the same buffer
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 256) in;
+
+// Maximum number of storage buffer chunks, must match Scene::MAX_FLOCK_CHUNKS
+#define MAX_FLOCK_CHUNKS 4
+// Number of speed histogram bins, must match FlockStats::HISTOGRAM_BINS
+#define HISTOGRAM_BINS 16
+// Resolution of the occupancy grid, must match FlockStats::GRID_SIZE
+#define GRID_SIZE 32
+
+// Number of flock members in a single storage buffer chunk
+uniform uint chunkSize;
+// Maximum allowed speed, i.e., the histogram range
+uniform float maxSpeed;
+
+// Structured buffer record
+struct FlockMember
+{
+  // Model to world transformation matrix
+  mat4 transformation;
+  // Velocity
+  vec4 velocity;
+};
+
+// Flock state split to chunks
+layout (binding = 0) readonly buffer FlockIn
+{
+  FlockMember member[];
+} inputData[MAX_FLOCK_CHUNKS];
+
+// Statistics buffer, layout must match StatsReadback
+layout (std430, binding = 7) buffer FlockStats
+{
+  // Flock bounds as ordered uints: min xyz, padding, max xyz, padding
+  uint bounds[8];
+  // Number of flock members per speed interval
+  uint speedHistogram[HISTOGRAM_BINS];
+  // Maximum speed, positive floats compare the same as their bits
+  uint maxSpeedBits;
+  uint padding[7];
+  // One bit per grid cell spanning the bounds, set when occupied
+  uint occupancy[];
+};
+
+// Work group partial results, so that only a few global atomics are needed
+shared uint groupHistogram[HISTOGRAM_BINS];
+shared uint groupMaxSpeed;
+
+// Inverse of the float to ordered uint mapping
+float orderedToFloat(uint u)
+{
+  return uintBitsToFloat((u & 0x80000000u) != 0 ? u & 0x7FFFFFFFu : ~u);
+}
+
+void main()
+{
+  if (gl_LocalInvocationIndex < HISTOGRAM_BINS)
+    groupHistogram[gl_LocalInvocationIndex] = 0;
+  if (gl_LocalInvocationIndex == 0)
+    groupMaxSpeed = 0;
+
+  memoryBarrierShared();
+  barrier();
+
+  // Whole work group lives in the same chunk
+  uint chunk = gl_GlobalInvocationID.x / chunkSize;
+  uint index = gl_GlobalInvocationID.x - chunk * chunkSize;
+  FlockMember me = inputData[chunk].member[index];
+
+  // Speed histogram
+  float speed = length(me.velocity.xyz);
+  uint bin = min(uint(speed / maxSpeed * HISTOGRAM_BINS), HISTOGRAM_BINS - 1);
+  atomicAdd(groupHistogram[bin], 1);
+  atomicMax(groupMaxSpeed, floatBitsToUint(speed));
+
+  // Mark the occupied grid cell, the grid spans the flock bounds
+  vec3 boundsMin = vec3(orderedToFloat(bounds[0]), orderedToFloat(bounds[1]), orderedToFloat(bounds[2]));
+  vec3 boundsMax = vec3(orderedToFloat(bounds[4]), orderedToFloat(bounds[5]), orderedToFloat(bounds[6]));
+  vec3 extent = max(boundsMax - boundsMin, vec3(0.001f));
+  uvec3 cell = min(uvec3((me.transformation[3].xyz - boundsMin) / extent * GRID_SIZE), uvec3(GRID_SIZE - 1));
+  uint bit = cell.x + GRID_SIZE * (cell.y + GRID_SIZE * cell.z);
+  atomicOr(occupancy[bit >> 5], 1u << (bit & 31));
+
+  memoryBarrierShared();
+  barrier();
+
+  // Merge with the other work groups
+  if (gl_LocalInvocationIndex < HISTOGRAM_BINS && groupHistogram[gl_LocalInvocationIndex] > 0)
+    atomicAdd(speedHistogram[gl_LocalInvocationIndex], groupHistogram[gl_LocalInvocationIndex]);
+  if (gl_LocalInvocationIndex == 0)
+    atomicMax(maxSpeedBits, groupMaxSpeed);
+}
+)",
+// ----------------------------------------------------------------------------
+// Frustum culling and LOD selection compute shader source
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Local work group size, i.e., how many invocations per work group
+layout (local_size_x = 256) in;
+
+// Maximum number of storage buffer chunks, must match Scene::MAX_FLOCK_CHUNKS
+#define MAX_FLOCK_CHUNKS 4
+// Number of LODs, must match Scene::NumLods
+#define NUM_LODS 3
+// Size of a single draw command in uints, instance count is the second member
+#define DRAW_COMMAND_SIZE 5
+
+// Number of flock members
+uniform uint flockSize;
+// Number of flock members in a single storage buffer chunk, multiple of the work group size
+uniform uint chunkSize;
+// World space frustum planes: left, right, bottom, top, near
+uniform vec4 frustumPlanes[5];
+// View position in world space
+uniform vec3 viewPos;
+// Squared distances where the full and reduced LODs end
+uniform vec2 lodDistancesSq;
+// Bounding sphere radius of a flock member
+uniform float boundingRadius;
+// When disabled, all flock members are drawn using the full LOD
+uniform bool cullingEnabled;
+
+// Structured buffer record
+struct FlockMember
+{
+  // Model to world transformation matrix
+  mat4 transformation;
+  // Velocity
+  vec4 velocity;
+};
+
+// Current simulation state split to chunks
+layout (binding = 0) readonly buffer FlockState
+{
+  FlockMember member[];
+} stateData[MAX_FLOCK_CHUNKS];
+
+// Indirect draw commands, one per LOD and chunk
+layout (std430, binding = MAX_FLOCK_CHUNKS) buffer DrawCommands
+{
+  uint commands[];
+};
+
+// Visible instance lists, one per LOD and chunk
+layout (std430, binding = MAX_FLOCK_CHUNKS + 1) writeonly buffer VisibleInstances
+{
+  uint visibleIndex[];
+};
+
+// Work group local counters, so that only one global atomic per LOD is needed
+shared uint groupCount[NUM_LODS];
+// Where the work group writes to in the global lists
+shared uint groupBase[NUM_LODS];
+
+void main()
+{
+  if (gl_LocalInvocationIndex < NUM_LODS)
+    groupCount[gl_LocalInvocationIndex] = 0;
+
+  memoryBarrierShared();
+  barrier();
+
+  // Whole work group lives in the same chunk
+  uint chunk = gl_GlobalInvocationID.x / chunkSize;
+  uint index = gl_GlobalInvocationID.x - chunk * chunkSize;
+  vec3 position = stateData[chunk].member[index].transformation[3].xyz;
+
+  // Test the bounding sphere against the frustum planes
+  bool visible = true;
+  uint lod = 0;
+  if (cullingEnabled)
+  {
+    for (int i = 0; i < 5; ++i)
+    {
+      if (dot(frustumPlanes[i].xyz, position) + frustumPlanes[i].w < -boundingRadius)
+        visible = false;
+    }
+
+    // Select the LOD based on the distance
+    vec3 d = position - viewPos;
+    float distanceSq = dot(d, d);
+    lod = distanceSq < lodDistancesSq.x ? 0 : (distanceSq < lodDistancesSq.y ? 1 : 2);
+  }
+
+  // Reserve a slot in the work group
+  uint localSlot = 0;
+  if (visible)
+    localSlot = atomicAdd(groupCount[lod], 1);
+
+  memoryBarrierShared();
+  barrier();
+
+  // Reserve space for the whole work group in the global lists, the command counts the instances
+  if (gl_LocalInvocationIndex < NUM_LODS && groupCount[gl_LocalInvocationIndex] > 0)
+  {
+    uint command = gl_LocalInvocationIndex * MAX_FLOCK_CHUNKS + chunk;
+    groupBase[gl_LocalInvocationIndex] = atomicAdd(commands[command * DRAW_COMMAND_SIZE + 1], groupCount[gl_LocalInvocationIndex]);
+  }
+
+  memoryBarrierShared();
+  barrier();
+
+  // Write out the index within the chunk to the list of the LOD
+  if (visible)
+    visibleIndex[lod * flockSize + chunk * chunkSize + groupBase[lod] + localSlot] = index;
+}
+)",
+// ----------------------------------------------------------------------------
+// Tonemapping compute shader source: resolves the MSAA samples, applies the exposure and the tonemapping operator,
+// and bins the luminance to the histogram for the exposure of the next frame, all in a single pass
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// 16x16 pixel tiles, one invocation per histogram bin
+layout (local_size_x = 16, local_size_y = 16) in;
+
+// HDR render target, multisampled or single sampled one is used based on the sample count
+layout (binding = 0) uniform sampler2DMS hdrMultisample;
+layout (binding = 1) uniform sampler2D hdrSingleSample;
+// Tonemapped output, sRGB target viewed as RGBA8 as images can't be stored to sRGB formats
+layout (rgba8, binding = 0) uniform writeonly image2D ldr;
+
+// Number of samples of the HDR render target
+layout (location = 0) uniform int sampleCount;
+
+// Log luminance range covered by the histogram, bin 0 holds the black pixels
+#define MIN_LOG_LUMINANCE -10.0f
+#define LOG_LUMINANCE_RANGE 22.0f
+#define HISTOGRAM_BINS 256
+
+// Exposure of the frame and the luminance histogram, the exposure is adapted from the previous frame's histogram
+layout (std430, binding = 0) buffer ExposureBuffer
+{
+  float exposure;
+  float adaptedLogLuminance;
+  uint histogram[HISTOGRAM_BINS];
+};
+
+// Histogram of the tile
+shared uint localHistogram[HISTOGRAM_BINS];
+
+float Luminance(vec3 color)
+{
+  return dot(color, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+uint LuminanceBin(float luminance)
+{
+  if (luminance < 1e-5f)
+    return 0;
+
+  float t = clamp((log2(luminance) - MIN_LOG_LUMINANCE) / LOG_LUMINANCE_RANGE, 0.0f, 1.0f);
+  return uint(t * (HISTOGRAM_BINS - 2) + 1.0f);
+}
+
+vec3 ApplyTonemapping(vec3 hdr)
+{
+  // Reinhard global operator
+  vec3 result = hdr / (hdr + vec3(1.0f));
+
+  return result;
+}
+
+// Images don't do the automatic sRGB conversion
+vec3 LinearToSRGB(vec3 color)
+{
+  return mix(color * 12.92f, 1.055f * pow(color, vec3(1.0f / 2.4f)) - 0.055f, greaterThan(color, vec3(0.0031308f)));
+}
+
+void main()
+{
+  localHistogram[gl_LocalInvocationIndex] = 0;
+  barrier();
+
+  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+  if (all(lessThan(texel, imageSize(ldr))))
+  {
+    // Tonemap each sample before averaging them, so that bright samples don't dominate the edges
+    vec3 finalColor = vec3(0.0f);
+    float luminance = 0.0f;
+    for (int i = 0; i < sampleCount; ++i)
+    {
+      vec3 s = sampleCount > 1 ? texelFetch(hdrMultisample, texel, i).rgb : texelFetch(hdrSingleSample, texel, 0).rgb;
+      luminance += Luminance(s);
+      finalColor += ApplyTonemapping(s * exposure);
+    }
+    finalColor /= float(sampleCount);
+    luminance /= float(sampleCount);
+
+    atomicAdd(localHistogram[LuminanceBin(luminance)], 1);
+
+    // Post-process anti-aliasing detects edges by the perceptual luma in alpha, square root is close enough to gamma
+    imageStore(ldr, texel, vec4(LinearToSRGB(finalColor), sqrt(Luminance(finalColor))));
+  }
+
+  // Merge the tile histogram to the global one, most bins are empty in a tile
+  barrier();
+  uint count = localHistogram[gl_LocalInvocationIndex];
+  if (count > 0)
+    atomicAdd(histogram[gl_LocalInvocationIndex], count);
+}
+)",
+// ----------------------------------------------------------------------------
+// Auto exposure compute shader source: averages the histogram and adapts the exposure for the next frame
+// ----------------------------------------------------------------------------
+R"(
+#version 460 core
+
+// Single work group, one invocation per histogram bin
+layout (local_size_x = 256) in;
+
+// Fraction of the way to the new luminance done this frame
+layout (location = 0) uniform float adaptation;
+// Number of pixels in the histogram
+layout (location = 1) uniform uint pixelCount;
+// Middle grey the average luminance is mapped to and the limits of the exposure
+layout (location = 2) uniform vec3 keyMinMax;
+
+// Log luminance range covered by the histogram, bin 0 holds the black pixels
+#define MIN_LOG_LUMINANCE -10.0f
+#define LOG_LUMINANCE_RANGE 22.0f
+#define HISTOGRAM_BINS 256
+
+// Exposure of the frame and the luminance histogram, the exposure is adapted from the previous frame's histogram
+layout (std430, binding = 0) buffer ExposureBuffer
+{
+  float exposure;
+  float adaptedLogLuminance;
+  uint histogram[HISTOGRAM_BINS];
+};
+
+// Histogram weighted by the bin indices for the reduction
+shared float weightedBins[HISTOGRAM_BINS];
+
+void main()
+{
+  uint bin = gl_LocalInvocationIndex;
+  uint count = histogram[bin];
+  weightedBins[bin] = float(count) * float(bin);
+
+  // Clear the histogram for the next frame
+  histogram[bin] = 0;
+  barrier();
+
+  // Parallel reduction of the weighted bins
+  for (uint stride = HISTOGRAM_BINS / 2; stride > 0; stride >>= 1)
+  {
+    if (bin < stride)
+      weightedBins[bin] += weightedBins[bin + stride];
+    barrier();
+  }
+
+  // The thread of the black bin knows how many pixels to leave out of the average
+  if (bin == 0)
+  {
+    float litPixels = max(float(pixelCount) - float(count), 1.0f);
+    float averageBin = weightedBins[0] / litPixels - 1.0f;
+    float averageLogLuminance = count < pixelCount ? averageBin / (HISTOGRAM_BINS - 2) * LOG_LUMINANCE_RANGE + MIN_LOG_LUMINANCE : adaptedLogLuminance;
+
+    // Smooth adaptation like the eye does
+    adaptedLogLuminance = mix(adaptedLogLuminance, averageLogLuminance, adaptation);
+    exposure = clamp(keyMinMax.x / exp2(adaptedLogLuminance), keyMinMax.y, keyMinMax.z);
+  }
 }
 )",
 ""
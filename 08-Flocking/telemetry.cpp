@@ -0,0 +1,157 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include "telemetry.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Inverse of the float to ordered uint mapping used by the shaders
+static float orderedToFloat(GLuint u)
+{
+  GLuint bits = (u & 0x80000000u) ? u & 0x7FFFFFFFu : ~u;
+  float f;
+  memcpy(&f, &bits, sizeof(float));
+  return f;
+}
+
+// ----------------------------------------------------------------------------
+
+StatsReadback::~StatsReadback()
+{
+  for (unsigned int i = 0; i < RING_SIZE; ++i)
+  {
+    if (_fences[i])
+      glDeleteSync(_fences[i]);
+  }
+
+  // Persistently mapped buffer can be deleted while mapped
+  glDeleteBuffers(1, &_ringBuffer);
+  glDeleteBuffers(1, &_statsBuffer);
+}
+
+void StatsReadback::Init()
+{
+  glGenBuffers(1, &_statsBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _statsBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, STATS_SIZE * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  // Coherent persistent mapping, the data are visible once the fence is signaled, no need to map each frame
+  const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glGenBuffers(1, &_ringBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, _ringBuffer);
+  glBufferStorage(GL_COPY_WRITE_BUFFER, RING_SIZE * STATS_SIZE * sizeof(GLuint), nullptr, flags);
+  _ringData = static_cast<const GLuint*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, RING_SIZE * STATS_SIZE * sizeof(GLuint), flags));
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  if (!_ringData)
+    printf("Failed to map the statistics readback ring!\n");
+}
+
+void StatsReadback::Reset()
+{
+  // Bounds start inverted, everything else at zero
+  const GLuint bounds[8] = {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0, 0, 0, 0, 0};
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _statsBuffer);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, BOUNDS_OFFSET * sizeof(GLuint), sizeof(bounds), bounds);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+bool StatsReadback::Submit(unsigned int stepIndex)
+{
+  if (!_ringData || !CanSubmit())
+    return false;
+
+  // Make sure the compute shader writes are finished before the copy
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+  glBindBuffer(GL_COPY_READ_BUFFER, _statsBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, _ringBuffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, _writeSlot * STATS_SIZE * sizeof(GLuint), STATS_SIZE * sizeof(GLuint));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  _fences[_writeSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  _stepIndices[_writeSlot] = stepIndex;
+  _writeSlot = (_writeSlot + 1) % RING_SIZE;
+
+  return true;
+}
+
+void StatsReadback::Poll()
+{
+  // Slots are signaled in order, free all finished ones, only the latest one is consumed
+  int latest = -1;
+  while (_fences[_readSlot])
+  {
+    GLenum result = glClientWaitSync(_fences[_readSlot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+      break;
+
+    glDeleteSync(_fences[_readSlot]);
+    _fences[_readSlot] = nullptr;
+
+    latest = _readSlot;
+    _readSlot = (_readSlot + 1) % RING_SIZE;
+  }
+
+  // Freed slot isn't written again before the next Submit()
+  if (latest >= 0)
+    Consume(_ringData + latest * STATS_SIZE, _stepIndices[latest]);
+}
+
+void StatsReadback::Consume(const GLuint *data, unsigned int stepIndex)
+{
+  _stats.stepIndex = stepIndex;
+  _stats.boundsMin = glm::vec3(orderedToFloat(data[BOUNDS_OFFSET + 0]), orderedToFloat(data[BOUNDS_OFFSET + 1]), orderedToFloat(data[BOUNDS_OFFSET + 2]));
+  _stats.boundsMax = glm::vec3(orderedToFloat(data[BOUNDS_OFFSET + 4]), orderedToFloat(data[BOUNDS_OFFSET + 5]), orderedToFloat(data[BOUNDS_OFFSET + 6]));
+  memcpy(&_stats.maxSpeed, data + MAX_SPEED_OFFSET, sizeof(float));
+  memcpy(_stats.speedHistogram, data + HISTOGRAM_OFFSET, sizeof(_stats.speedHistogram));
+
+  // Count the 6-connected components of the occupancy grid by flood filling it
+  const unsigned int N = FlockStats::GRID_SIZE;
+  const GLuint *occupancy = data + OCCUPANCY_OFFSET;
+  auto occupied = [occupancy](unsigned int cell) { return (occupancy[cell >> 5] >> (cell & 31)) & 1; };
+
+  _visited.assign(N * N * N, 0);
+
+  unsigned int clusters = 0;
+  for (unsigned int seed = 0; seed < N * N * N; ++seed)
+  {
+    if (_visited[seed] || !occupied(seed))
+      continue;
+
+    ++clusters;
+    _visited[seed] = 1;
+    _stack.push_back(seed);
+    while (!_stack.empty())
+    {
+      unsigned int cell = _stack.back();
+      _stack.pop_back();
+
+      unsigned int x = cell % N, y = (cell / N) % N, z = cell / (N * N);
+      const unsigned int neighbours[6][2] =
+      {
+        {x > 0, cell - 1}, {x < N - 1, cell + 1},
+        {y > 0, cell - N}, {y < N - 1, cell + N},
+        {z > 0, cell - N * N}, {z < N - 1, cell + N * N},
+      };
+
+      for (const auto &n : neighbours)
+      {
+        if (n[0] && !_visited[n[1]] && occupied(n[1]))
+        {
+          _visited[n[1]] = 1;
+          _stack.push_back(n[1]);
+        }
+      }
+    }
+  }
+
+  _stats.clusters = clusters;
+  _stats.valid = true;
+}
@@ -0,0 +1,94 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Flock statistics reduced on the GPU and finished on the CPU
+struct FlockStats
+{
+  // Number of speed histogram bins, must match the stats compute shader
+  static const unsigned int HISTOGRAM_BINS = 16;
+  // Resolution of the occupancy grid spanning the flock bounds, must match the stats compute shader
+  static const unsigned int GRID_SIZE = 32;
+
+  // Simulation step the statistics belong to
+  unsigned int stepIndex = 0;
+  // Flock bounding box
+  glm::vec3 boundsMin = glm::vec3(0.0f);
+  glm::vec3 boundsMax = glm::vec3(0.0f);
+  // Maximum speed of a flock member
+  float maxSpeed = 0.0f;
+  // Number of flock members per speed interval, the histogram spans [0, maximum allowed speed]
+  unsigned int speedHistogram[HISTOGRAM_BINS] = {};
+  // Number of connected groups of the occupied grid cells
+  unsigned int clusters = 0;
+  // Were the statistics gathered at least once?
+  bool valid = false;
+};
+
+// Readback channel for the flock statistics, the GPU reduces the stats to a small buffer which
+// is copied to a persistently mapped ring and consumed a few frames later once its fence is signaled
+class StatsReadback
+{
+public:
+  // Number of slots in the readback ring, i.e., how many frames the results can be in flight
+  static const unsigned int RING_SIZE = 3;
+  // Layout of the stats buffer in uints: bounds, histogram, maximum speed, occupancy bitset
+  static const unsigned int BOUNDS_OFFSET = 0;
+  static const unsigned int HISTOGRAM_OFFSET = 8;
+  static const unsigned int MAX_SPEED_OFFSET = HISTOGRAM_OFFSET + FlockStats::HISTOGRAM_BINS;
+  static const unsigned int OCCUPANCY_OFFSET = MAX_SPEED_OFFSET + 8;
+  static const unsigned int STATS_SIZE = OCCUPANCY_OFFSET + FlockStats::GRID_SIZE * FlockStats::GRID_SIZE * FlockStats::GRID_SIZE / 32;
+
+  StatsReadback() {}
+  ~StatsReadback();
+
+  // Creates the stats buffer and the readback ring
+  void Init();
+  // Returns the buffer the stats are reduced into
+  GLuint GetStatsBuffer() const { return _statsBuffer; }
+  // Returns true if there's a free slot in the ring, no point in reducing the stats otherwise
+  bool CanSubmit() const { return _fences[_writeSlot] == nullptr; }
+  // Resets the stats buffer before the reduction
+  void Reset();
+  // Copies the stats buffer to the next slot of the ring, returns false if the ring is full
+  bool Submit(unsigned int stepIndex);
+  // Consumes the slots the GPU is done with, never waits, call once per frame
+  void Poll();
+  // Returns the latest consumed statistics
+  const FlockStats &GetStats() const { return _stats; }
+
+private:
+  // No copies allowed
+  StatsReadback(const StatsReadback &);
+  StatsReadback & operator = (const StatsReadback &);
+
+  // Finishes the statistics from the raw slot data
+  void Consume(const GLuint *data, unsigned int stepIndex);
+
+  // Buffer the stats are reduced into
+  GLuint _statsBuffer = 0;
+  // Persistently mapped readback ring
+  GLuint _ringBuffer = 0;
+  // Mapped ring data
+  const GLuint *_ringData = nullptr;
+  // Fences of the ring slots, nullptr for the free slots
+  GLsync _fences[RING_SIZE] = {};
+  // Simulation steps of the ring slots
+  unsigned int _stepIndices[RING_SIZE] = {};
+  // Next slot to be written
+  unsigned int _writeSlot = 0;
+  // Oldest slot in flight
+  unsigned int _readSlot = 0;
+  // Latest consumed statistics
+  FlockStats _stats;
+  // Flood fill scratch memory, kept to avoid the allocations
+  std::vector<unsigned char> _visited;
+  std::vector<unsigned int> _stack;
+};
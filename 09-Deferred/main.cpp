@@ -12,6 +12,9 @@
 
 #include <MathSupport.h>
 #include <Camera.h>
+#include <GpuTimer.h>
+#include <HdrFormat.h>
+#include <MathBatch.h>
 
 #include "shaders.h"
 #include "scene.h"
@@ -19,6 +22,9 @@
 // Set to 1 to create debugging context that reports errors, requires OpenGL 4.3!
 #define _ENABLE_OPENGL_DEBUG 0
 
+// Set to 1 to verify the batch math kernels and print their throughput at startup
+#define _RUN_MATH_BENCHMARK 0
+
 // ----------------------------------------------------------------------------
 // GLM optional parameters:
 // GLM_FORCE_LEFT_HANDED       - use the left handed coordinate system
@@ -95,16 +101,38 @@ Camera camera;
 // Scene helper instance
 Scene &scene(Scene::GetInstance());
 // Render modes
-RenderMode renderMode = {true, DisplayMode::Default};
+RenderMode renderMode = {true, DisplayMode::Default, HdrFormat::Auto};
 // Enable/disable light movement
 bool animate = false;
 // All render targets that will be used
 RenderTargets renderTargets;
+// GPU time of the tonemapping pass
+GpuTimer tonemapTimer;
+
+// Sweep of the HDR formats comparing the GPU times of the passes
+struct FormatBenchmark
+{
+  // Number of frames rendered before each measurement, lets the smoothed timers settle
+  static const int WARMUP_FRAMES = 60;
+  // Number of measured frames
+  static const int MEASURED_FRAMES = 240;
+
+  // Is the sweep running?
+  bool running;
+  // Policy restored after the sweep
+  HdrFormat::Policy restorePolicy;
+  // Frames rendered with the current format
+  int frame;
+  // Accumulated GPU times of the passes
+  float gBuffer, ambient, lights, tonemap;
+} benchmark = {false, HdrFormat::Auto, 0, 0.0f, 0.0f, 0.0f, 0.0f};
 
 // ----------------------------------------------------------------------------
 
 // Forward declaration for the framebuffer creation
 void createFramebuffer(int width, int height);
+// Forward declaration for the HDR format benchmark
+void startBenchmark();
 
 // Callback for handling GLFW errors
 void errorCallback(int error, const char* description)
@@ -162,6 +190,19 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     animate = !animate;
   }
 
+  // Cycle the HDR format policies: auto, R11G11B10F, RGB16F
+  if (key == GLFW_KEY_F3 && action == GLFW_PRESS && !benchmark.running)
+  {
+    renderMode.hdrFormat = (HdrFormat::Policy)((renderMode.hdrFormat + 1) % HdrFormat::NumPolicies);
+    createFramebuffer(mainWindow.width, mainWindow.height);
+  }
+
+  // Run the benchmark of the HDR formats, vsync is disabled for the run
+  if (key == GLFW_KEY_F4 && action == GLFW_PRESS && !benchmark.running)
+  {
+    startBenchmark();
+  }
+
   // GBuffer visualization modes
   if (key == GLFW_KEY_1 && action == GLFW_PRESS)
   {
@@ -348,9 +389,10 @@ void createFramebuffer(int width, int height)
     glGenTextures(1, &renderTargets.hdrRT);
   }
 
-  // Bind and recreate the render target texture
+  // Bind and recreate the render target texture, R11G11B10F halves the bandwidth of the additive light passes
+  renderTargets.hdrFormat = HdrFormat::Select(renderMode.hdrFormat);
   glBindTexture(GL_TEXTURE_2D, renderTargets.hdrRT);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
+  glTexImage2D(GL_TEXTURE_2D, 0, renderTargets.hdrFormat, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderTargets.hdrRT, 0);
@@ -605,13 +647,70 @@ void renderScene()
 
   // Draw fullscreen quad
   glBindVertexArray(scene.GetGenericVAO());
+  tonemapTimer.Begin();
   glDrawArrays(GL_TRIANGLES, 0, 6);
+  tonemapTimer.End();
 
   // Unbind the shader program and other resources
   glBindVertexArray(0);
   glUseProgram(0);
 }
 
+// Switches the HDR format policy and recreates the render targets
+void setHdrFormat(HdrFormat::Policy policy)
+{
+  renderMode.hdrFormat = policy;
+  createFramebuffer(mainWindow.width, mainWindow.height);
+}
+
+// Starts the sweep over the HDR formats
+void startBenchmark()
+{
+  benchmark = {true, renderMode.hdrFormat, 0, 0.0f, 0.0f, 0.0f, 0.0f};
+  glfwSwapInterval(0);
+
+  printf("HDR format benchmark, %dx%d, GPU times in ms:\n", mainWindow.width, mainWindow.height);
+  setHdrFormat(HdrFormat::Packed);
+}
+
+// Accumulates the GPU times of the frame, prints them and moves to the next format once measured
+void updateBenchmark()
+{
+  if (!benchmark.running)
+    return;
+
+  // Timers are smoothed and lag a few frames behind, skip the frames after the switch
+  if (++benchmark.frame > FormatBenchmark::WARMUP_FRAMES)
+  {
+    benchmark.gBuffer += scene.GetGBufferTime();
+    benchmark.ambient += scene.GetAmbientTime();
+    benchmark.lights += scene.GetLightsTime();
+    benchmark.tonemap += tonemapTimer.GetMilliseconds();
+  }
+
+  if (benchmark.frame < FormatBenchmark::WARMUP_FRAMES + FormatBenchmark::MEASURED_FRAMES)
+    return;
+
+  const float n = (float)FormatBenchmark::MEASURED_FRAMES;
+  const float megabytes = mainWindow.width * mainWindow.height * HdrFormat::GetBytesPerPixel(renderTargets.hdrFormat) / (1024.0f * 1024.0f);
+  printf("%-10s (%.1f MB): GBuffer %.3f, ambient %.3f, lights %.3f, tonemap %.3f\n", HdrFormat::GetName(renderTargets.hdrFormat), megabytes,
+         benchmark.gBuffer / n, benchmark.ambient / n, benchmark.lights / n, benchmark.tonemap / n);
+
+  if (renderMode.hdrFormat == HdrFormat::Packed)
+  {
+    // Same scene with the half float target
+    benchmark = {true, benchmark.restorePolicy, 0, 0.0f, 0.0f, 0.0f, 0.0f};
+    setHdrFormat(HdrFormat::HalfFloat);
+  }
+  else
+  {
+    // Done, restore the original policy and vsync
+    benchmark.running = false;
+    setHdrFormat(benchmark.restorePolicy);
+    glfwSwapInterval(renderMode.vsync ? 1 : 0);
+  }
+}
+
 // Helper method for implementing the application main loop
 void mainLoop()
 {
@@ -626,7 +725,9 @@ void mainLoop()
     // Print it to the title bar
     static char title[MAX_TEXT_LENGTH];
     static char instacing[] = "[Instancing] ";
-    snprintf(title, MAX_TEXT_LENGTH, "dt = %.2fms, FPS = %.1f", dt * 1000.0f, 1.0f / dt);
+    snprintf(title, MAX_TEXT_LENGTH, "%sdt = %.2fms, FPS = %.1f, transforms = %.0f/ms, HDR = %s (%s), GPU: GBuffer %.2fms, ambient %.2fms, lights %.2fms, tonemap %.2fms",
+             benchmark.running ? "[Benchmark] " : "", dt * 1000.0f, 1.0f / dt, scene.GetTransformThroughput(), HdrFormat::GetName(renderTargets.hdrFormat),
+             HdrFormat::GetName(renderMode.hdrFormat), scene.GetGBufferTime(), scene.GetAmbientTime(), scene.GetLightsTime(), tonemapTimer.GetMilliseconds());
     glfwSetWindowTitle(mainWindow.handle, title);
 
     // Poll the events like keyboard, mouse, etc.
@@ -641,6 +742,9 @@ void mainLoop()
     // Render the scene
     renderScene();
 
+    // Measure the HDR formats if requested
+    updateBenchmark();
+
     // Swap actual buffers on the GPU
     glfwSwapBuffers(mainWindow.handle);
   }
@@ -648,6 +752,10 @@ void mainLoop()
 
 int main()
 {
+#if _RUN_MATH_BENCHMARK
+  MathBatch::RunBenchmark();
+#endif
+
   // Initialize the OpenGL context and create a window
   if (!initOpenGL())
   {
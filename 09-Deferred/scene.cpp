@@ -6,7 +6,6 @@
 #include "scene.h"
 #include "shaders.h"
 
-#include <functional>
 #include <vector>
 #include <glad/glad.h>
 #include <glm/gtc/type_ptr.hpp>
@@ -48,8 +47,9 @@ Scene::~Scene()
   delete _icosahedron;
   _icosahedron = nullptr;
 
-  // Release the instancing buffer
+  // Release the instancing buffers
   glDeleteBuffers(1, &_instancingBuffer);
+  glDeleteBuffers(1, &_cubeInstancingBuffer);
 
   // Release the light buffer
   glDeleteBuffers(1, &_lightBuffer);
@@ -79,18 +79,23 @@ void Scene::Init(int numCubes, int numLights)
   glGenVertexArrays(1, &_vao);
 
   {
-    // Generate the instancing buffer as Uniform Buffer Object
-    glGenBuffers(1, &_instancingBuffer);
-    glBindBuffer(GL_UNIFORM_BUFFER, _instancingBuffer);
-
     // Obtain UBO index and size from the instancing shader program
     GLuint uboIndex = glGetUniformBlockIndex(shaderProgram[ShaderProgram::InstancedGBuffer], "InstanceBuffer");
     GLint uboSize = 0;
     glGetActiveUniformBlockiv(shaderProgram[ShaderProgram::InstancedGBuffer], uboIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &uboSize);
 
+    // Generate the instancing buffer as Uniform Buffer Object
+    glGenBuffers(1, &_instancingBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, _instancingBuffer);
+
     // Describe the buffer data - we're going to change this every frame
     glBufferData(GL_UNIFORM_BUFFER, uboSize, nullptr, GL_DYNAMIC_DRAW);
 
+    // The same for the cubes, their data only change when they're marked dirty
+    glGenBuffers(1, &_cubeInstancingBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, _cubeInstancingBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, uboSize, nullptr, GL_DYNAMIC_DRAW);
+
     // Unbind the GL_UNIFORM_BUFFER target for now
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
   }
@@ -137,9 +142,20 @@ void Scene::Init(int numCubes, int numLights)
 
   // --------------------------------------------------------------------------
 
-  // Position the first cube half a meter above origin
-  _cubePositions.reserve(_numCubes);
-  _cubePositions.push_back(glm::vec3(0.0f, 0.5f, 0.0f));
+  // Position the first cube half a meter above origin, each cube is rotated a bit more than the previous one
+  const float angle = 20.0f;
+  const glm::vec3 axis = glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f));
+  auto createCube = [this, angle, axis](int i, const glm::vec3 &position)
+  {
+    Entity cube = _entities.Create<TransformComponent, CubeComponent>();
+    _entities.Get<CubeComponent>(cube)->instance = i;
+
+    TransformHandle node = _transforms.Create();
+    _transforms.SetLocal(node, position, glm::angleAxis(glm::radians(i * angle), axis));
+    _entities.Get<TransformComponent>(cube)->node = node;
+  };
+
+  createCube(0, glm::vec3(0.0f, 0.5f, 0.0f));
 
   // Generate random positions for the rest of the cubes
   for (int i = 1; i < _numCubes; ++i)
@@ -148,9 +164,12 @@ void Scene::Init(int numCubes, int numLights)
     float y = getRandom( 1.0f, 5.0f);
     float z = getRandom(-5.0f, 5.0f);
 
-    _cubePositions.push_back(glm::vec3(x, y, z));
+    createCube(i, glm::vec3(x, y, z));
   }
 
+  // All instances start dirty
+  _cubeInstances.Resize(_numCubes);
+
   // --------------------------------------------------------------------------
 
   // Ambient intensity for the lights
@@ -165,8 +184,20 @@ void Scene::Init(int numCubes, int numLights)
     return sqrt(luminousIntensity / cutoff);
   };
 
+  // The first light moves on its own, the rest is attached to the rig scaling and offsetting their curves
+  _lightRig = _transforms.Create();
+  _transforms.SetTranslation(_lightRig, offset);
+  _transforms.SetScale(_lightRig, scale);
+
+  auto createLight = [this](TransformHandle parent, const glm::vec3 &origin, const glm::vec4 &parameters, const glm::vec4 &color, float radius)
+  {
+    Entity light = _entities.Create<TransformComponent, LightComponent, MovementComponent>();
+    _entities.Get<TransformComponent>(light)->node = _transforms.Create(parent);
+    *_entities.Get<LightComponent>(light) = {origin, color, radius, false};
+    *_entities.Get<MovementComponent>(light) = {origin, parameters};
+  };
+
   // Position & color of the first light
-  _lights.reserve(_numLights);
   glm::vec4 p = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
 
   float r = 50.0f;
@@ -176,7 +207,7 @@ void Scene::Init(int numCubes, int numLights)
 
   float radius = getLightRadius(r, g, b);
 
-  _lights.push_back({glm::vec3(-3.0f, 3.0f, 0.0f), c, p, radius});
+  createLight(INVALID_TRANSFORM, glm::vec3(-3.0f, 2.0f, 0.0f), p, c, radius);
 
   // Generate random positions for the rest of the lights
   for (int i = 1; i < _numLights; ++i)
@@ -194,7 +225,7 @@ void Scene::Init(int numCubes, int numLights)
 
     radius = getLightRadius(r, g, b);
 
-    _lights.push_back({offset + lissajous(p, 0.0f) * scale, c, p, radius});
+    createLight(_lightRig, glm::vec3(0.0f), p, c, radius);
   }
 
   // --------------------------------------------------------------------------
@@ -220,35 +251,23 @@ void Scene::Update(float dt, const Camera &camera)
 
   glm::vec3 cameraPos = camera.GetViewToWorld()[3];
 
-  _insideLights.clear();
-  _outsideLights.clear();
-
-  // Assigns light set based on camera position, i.e., camera inside light volume or outside
-  auto assignLightSet = [this](const glm::vec3 cameraPosition, int lightIdx)
+  // Move the lights along their curves, the first light is offset by its origin, the rest by the rig
+  _entities.ParallelForEach<TransformComponent, MovementComponent>([this](Entity, TransformComponent &transform, MovementComponent &movement)
   {
-    glm::vec3 d = _lights[lightIdx].position - cameraPosition;
-    float rSqr = _lights[lightIdx].radius * _lights[lightIdx].radius;
-
-    if (glm::dot(d, d) < rSqr)
-    {
-      _insideLights.push_back(lightIdx);
-    }
-    else
-    {
-      _outsideLights.push_back(lightIdx);
-    }
-  };
+    _transforms.SetTranslation(transform.node, movement.origin + lissajous(movement.parameters, t));
+  });
 
-  // Treat the first light as a special case with offset
-  _lights[0].position = glm::vec3(-3.0f, 2.0f, 0.0f) + lissajous(_lights[0].movement, t);
-  assignLightSet(cameraPos, 0);
+  // Compute the world transformations of the whole hierarchy at once
+  _transforms.Update();
 
-  // Update the rest of the lights
-  for (int i = 1; i < _numLights; ++i)
+  // Assigns light set based on camera position, i.e., camera inside light volume or outside
+  _entities.ParallelForEach<TransformComponent, LightComponent>([this, cameraPos](Entity, TransformComponent &transform, LightComponent &light)
   {
-    _lights[i].position = offset + lissajous(_lights[i].movement, t) * scale;
-    assignLightSet(cameraPos, i);
-  }
+    light.position = _transforms.GetWorldPosition(transform.node);
+
+    glm::vec3 d = light.position - cameraPos;
+    light.inside = glm::dot(d, d) < light.radius * light.radius;
+  });
 
   // Update the animation timer
   t += dt;
@@ -276,35 +295,21 @@ void Scene::BindTextures(const GLuint &diffuse, const GLuint &normal, const GLui
 
 void Scene::UpdateInstanceData()
 {
-  // Create transformation matrix
-  glm::mat4x4 transformation = glm::mat4x4(1.0f);
-  // Instance data CPU side buffer
-  static std::vector<InstanceData> instanceData(MAX_INSTANCES);
-
-  // Cubes
-  float angle = 20.0f;
-  for (int i = 0; i < _numCubes; ++i)
+  // Cubes, only the dirty instances are copied, the transform system stores them in the GPU layout already
+  if (_cubeInstances.IsDirty())
   {
-    // Fill the transformation matrix
-    transformation = glm::translate(_cubePositions[i]);
-    transformation *= glm::rotate(glm::radians(i * angle), glm::vec3(1.0f, 1.0f, 1.0f));
-
-    instanceData[i].transformation = glm::transpose(transformation);
+    _entities.ForEach<TransformComponent, CubeComponent>([this](Entity, TransformComponent &transform, CubeComponent &cube)
+    {
+      if (_cubeInstances.IsDirty(cube.instance))
+        _cubeInstances.Set(cube.instance, {_transforms.GetWorld(transform.node)});
+    });
   }
 
-  // Start working with instancing buffer
-  glBindBuffer(GL_UNIFORM_BUFFER, _instancingBuffer);
+  // Upload the dirty ranges, static scene skips the upload entirely
+  _cubeInstances.Upload(GL_UNIFORM_BUFFER, _cubeInstancingBuffer);
 
   // Bind the instancing buffer to the index 1
-  glBindBufferBase(GL_UNIFORM_BUFFER, 1, _instancingBuffer);
-
-  // Update the buffer data using mapping
-  void *ptr = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-  memcpy(ptr, &*instanceData.begin(), _numCubes * sizeof(InstanceData));
-  glUnmapBuffer(GL_UNIFORM_BUFFER);
-
-  // Unbind the uniform buffer target
-  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glBindBufferBase(GL_UNIFORM_BUFFER, 1, _cubeInstancingBuffer);
 }
 
 int Scene::UpdateLightData(LightSet lightSet, bool visualization)
@@ -313,69 +318,31 @@ int Scene::UpdateLightData(LightSet lightSet, bool visualization)
   static std::vector<InstanceData> instanceData(MAX_INSTANCES);
   static std::vector<LightData> lightData(MAX_INSTANCES);
 
-  // Based on the selected light pass let as pick light using the appropriate way, i.e.,
-  // I'm doing here some lambda expressions magic because I'm lazy and lamdas are cool :)
-  int numLights = 0;
-  std::function<const Light &(int)> getLight;
-  switch (lightSet)
-  {
-    case LightSet::All:
-      numLights = _numLights;
-      getLight = [this](int idx) -> const Light &
-      {
-        return _lights[idx];
-      };
-      break;
-
-    case LightSet::Inside:
-      numLights = (int)_insideLights.size();
-      getLight = [this](int idx) -> const Light &
-      {
-        return _lights[_insideLights[idx]];
-      };
-      break;
-
-    case LightSet::Outside:
-      numLights = (int)_outsideLights.size();
-      getLight = [this](int idx) -> const Light &
-      {
-        return _lights[_outsideLights[idx]];
-      };
-      break;
-  }
-
   // Attenuation for visualization purposes
   const float attenuation = visualization ? 0.05f : 1.0f;
-  // Scale of the light volume
-  float scale;
-  // Transformation matrix of the light volume
-  glm::mat4x4 transformation = glm::mat4x4(1.0f);
 
   // For all lights in this light set
-  for (int i = 0; i < numLights; ++i)
+  int numLights = 0;
+  _entities.ForEach<LightComponent>([&](Entity, LightComponent &light)
   {
-    // Fetch the light from the _lights array using appropriate lambda expression
-    const Light &light = getLight(i);
+    // Based on the selected light pass let as pick the lights inside or outside of the camera
+    if ((lightSet == LightSet::Inside && !light.inside) || (lightSet == LightSet::Outside && light.inside) ||
+        numLights == static_cast<int>(MAX_INSTANCES))
+      return;
 
     // Apply scaling based on light intensity
-    if (visualization)
-    {
-      scale = 0.1f;
-    }
-    else
-    {
-      scale = light.radius;
-    }
+    const float scale = visualization ? 0.1f : light.radius;
 
     // Fill the transformation matrix
-    transformation = glm::translate(light.position);
+    glm::mat4x4 transformation = glm::translate(light.position);
     transformation *= glm::scale(glm::vec3(scale));
 
-    instanceData[i].transformation = glm::transpose(transformation);
+    instanceData[numLights].modelToWorld = glm::transpose(transformation);
 
-    lightData[i].position = glm::vec4(light.position, light.radius);
-    lightData[i].color = glm::vec4(light.color * attenuation);
-  }
+    lightData[numLights].positionWS = glm::vec4(light.position, light.radius);
+    lightData[numLights].color = glm::vec4(light.color * attenuation);
+    ++numLights;
+  });
 
   {
     // Start working with instancing buffer
@@ -414,21 +381,16 @@ int Scene::UpdateLightData(LightSet lightSet, bool visualization)
 
 void Scene::UpdateTransformBlock(const Camera &camera)
 {
-  // Tell OpenGL we want to work with our transform block
-  glBindBuffer(GL_UNIFORM_BUFFER, _transformBlockUBO);
-
-  // Note: we should properly obtain block members size and offset via
-  // glGetActiveUniformBlockiv() with GL_UNIFORM_SIZE, GL_UNIFORM_OFFSET,
-  // I'm yoloing it here...
-
   // Update the world to view transformation matrix - transpose to 3 columns, 4 rows for storage in an uniform block:
   // per std140 layout column matrix CxR is stored as an array of C columns with R elements, i.e., 4x3 matrix would
   // waste space because it would require padding to vec4
-  glm::mat3x4 worldToView = glm::transpose(camera.GetWorldToView());
-  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat3x4), static_cast<const void*>(&*glm::value_ptr(worldToView)));
+  TransformBlock block;
+  block.worldToView = glm::transpose(camera.GetWorldToView());
+  block.projection = camera.GetProjection();
 
-  // Update the projection matrix
-  glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat3x4), sizeof(glm::mat4x4), static_cast<const void*>(&*glm::value_ptr(camera.GetProjection())));
+  // The struct layout was verified against the shaders when linking them, so it goes in with a single call
+  glBindBuffer(GL_UNIFORM_BUFFER, _transformBlockUBO);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(TransformBlock), &block);
 
   // Unbind the GL_UNIFORM_BUFFER target for now
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
@@ -571,6 +533,7 @@ void Scene::Draw(const Camera &camera, const RenderTargets &renderTargets)
 
   // Bind the GBuffer
   glBindFramebuffer(GL_FRAMEBUFFER, renderTargets.gBufferFbo);
+  _gBufferTimer.Begin();
 
   // Clear the color and depth buffers
   glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
@@ -579,6 +542,7 @@ void Scene::Draw(const Camera &camera, const RenderTargets &renderTargets)
   // Render the scene into the GBuffer only
   DrawBackground();
   DrawObjects();
+  _gBufferTimer.End();
 
   // We primed the depth buffer, no need to write to it anymore
   glDepthMask(GL_FALSE);
@@ -587,6 +551,7 @@ void Scene::Draw(const Camera &camera, const RenderTargets &renderTargets)
 
   // Bind the HDR framebuffer
   glBindFramebuffer(GL_FRAMEBUFFER, renderTargets.hdrFbo);
+  _ambientTimer.Begin();
 
   // Clear the color buffer
   glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
@@ -611,11 +576,14 @@ void Scene::Draw(const Camera &camera, const RenderTargets &renderTargets)
   glBindTexture(GL_TEXTURE_2D, renderTargets.materialRT);
   glBindSampler(3, 0);
 
-  // Combine the GBuffer into the HDR buffer using ambient light
+  // Combine the GBuffer into the HDR buffer using ambient light, the clear is counted here as well
   DrawAmbientPass();
+  _ambientTimer.End();
 
-  // Draw all the lights in the scene using the GBuffer as input outputting to the HDR buffer
+  // Draw all the lights in the scene using the GBuffer as input outputting to the HDR buffer, blending dominates
+  _lightsTimer.Begin();
   DrawLights(camera);
+  _lightsTimer.End();
 
   // Disable blending
   glDisable(GL_BLEND);
@@ -6,9 +6,16 @@
 #pragma once
 
 #include <Camera.h>
+#include <EntityStorage.h>
 #include <Geometry.h>
+#include <GpuTimer.h>
+#include <HdrFormat.h>
+#include <InstanceStore.h>
+#include <TransformSystem.h>
 #include <Textures.h>
 
+#include "shaders.h"
+
 // Textures we'll be using
 namespace LoadedTextures
 {
@@ -33,6 +40,8 @@ struct RenderMode
   bool vsync;
   // Display mode for presentation
   int displayMode;
+  // Format policy of the HDR target
+  HdrFormat::Policy hdrFormat;
 };
 
 struct RenderTargets
@@ -51,15 +60,14 @@ struct RenderTargets
   GLuint normalRT = 0;
   // Material buffer
   GLuint materialRT = 0;
+  // Internal format of the HDR render target
+  GLenum hdrFormat = GL_RGB16F;
 };
 
 // Very simple scene abstraction class
 class Scene
 {
 public:
-  // Maximum number of allowed instances - must match the instancing vertex shader!
-  static const unsigned int MAX_INSTANCES = 1024;
-
   // Get and create instance for this singleton
   static Scene& GetInstance();
   // Initialize the test scene
@@ -70,35 +78,48 @@ public:
   void Draw(const Camera &camera, const RenderTargets &renderTargets);
   // Return the generic VAO for rendering
   GLuint GetGenericVAO() { return _vao; }
+  // Returns the throughput of the last transform update in transforms per millisecond
+  double GetTransformThroughput() const { return _transforms.GetThroughput(); }
+  // Returns the GPU times of the passes in milliseconds
+  float GetGBufferTime() const { return _gBufferTimer.GetMilliseconds(); }
+  float GetAmbientTime() const { return _ambientTimer.GetMilliseconds(); }
+  float GetLightsTime() const { return _lightsTimer.GetMilliseconds(); }
 
 private:
-  // GPU data for a single object instance
-  struct InstanceData
+  // Components of the scene entities:
+  // Transformation node of the entity
+  struct TransformComponent
   {
-    // In this simple example just a transformation matrix, transposed for efficient storage
-    glm::mat3x4 transformation;
+    TransformHandle node;
   };
 
-  // GPU data for a single light instance
-  struct LightData
+  // Cube drawn via instancing
+  struct CubeComponent
   {
-    // Position of the light
-    glm::vec4 position;
-    // Color of the light
-    glm::vec4 color;
+    // Index of the cube in the instance buffer
+    unsigned int instance;
   };
 
-  // Structure describing light
-  struct Light
+  // Light source
+  struct LightComponent
   {
     // Position of the light
     glm::vec3 position;
     // Color and ambient intensity of the light
     glm::vec4 color;
-    // Parameters for the light movement
-    glm::vec4 movement;
     // Radius of the light based on luminous intensity and cutoff value
     float radius;
+    // Is the camera inside the light volume?
+    bool inside;
+  };
+
+  // Movement along the Lissajous curve
+  struct MovementComponent
+  {
+    // Origin of the curve relative to the parent node
+    glm::vec3 origin;
+    // Parameters of the curve
+    glm::vec4 parameters;
   };
 
   // Which light set to update and set to instance buffer
@@ -137,16 +158,14 @@ private:
   GLuint _loadedTextures[LoadedTextures::NumTextures] = {0};
   // Number of cubes in the scene
   int _numCubes = 10;
-  // Cube positions
-  std::vector<glm::vec3> _cubePositions;
   // Number of lights in the scene
   int _numLights;
-  // All lights lights data
-  std::vector<Light> _lights;
-  // Indices of lights incident with camera
-  std::vector<int> _insideLights;
-  // Indices of lights well outside the camera
-  std::vector<int> _outsideLights;
+  // Cubes and lights
+  EntityStorage _entities;
+  // Transformation hierarchy of the cubes and lights
+  TransformSystem _transforms;
+  // Parent of the moving lights, scales and offsets their movement curve
+  TransformHandle _lightRig = INVALID_TRANSFORM;
   // General use VAO
   GLuint _vao = 0;
   // Quad instance
@@ -155,10 +174,18 @@ private:
   Mesh<Vertex_Pos_Nrm_Tgt_Tex> *_cube = nullptr;
   // Icosahedron instance for light rendering
   Mesh<Vertex_Pos> *_icosahedron = nullptr;
-  // Instancing buffer handle
+  // Instancing buffer handle, the light instances are streamed to it each light pass
   GLuint _instancingBuffer = 0;
+  // Instancing buffer of the cubes, kept separate so the static cubes are uploaded just once
+  GLuint _cubeInstancingBuffer = 0;
+  // CPU side instance data of the cubes
+  InstanceStore<InstanceData> _cubeInstances;
   // Light buffer handle
   GLuint _lightBuffer = 0;
   // Transformation matrices uniform buffer object
   GLuint _transformBlockUBO = 0;
+  // GPU time of the GBuffer, ambient, and light passes
+  GpuTimer _gBufferTimer;
+  GpuTimer _ambientTimer;
+  GpuTimer _lightsTimer;
 };
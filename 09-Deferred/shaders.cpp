@@ -133,6 +133,28 @@ bool compileShaders()
   uniformBlockBinding(shaderProgram[ShaderProgram::InstancedLightVis], "InstanceBuffer", 1);
   uniformBlockBinding(shaderProgram[ShaderProgram::InstancedLightVis], "LightBuffer", 2);
 
+  // Check the C++ structs against the uniform blocks of the linked programs
+  bool validBlocks = true;
+  const GLuint transformPrograms[] = {shaderProgram[ShaderProgram::DefaultGBuffer], shaderProgram[ShaderProgram::InstancedGBuffer],
+                                      shaderProgram[ShaderProgram::InstancedLightPass], shaderProgram[ShaderProgram::InstancedLightVis]};
+  for (GLuint program : transformPrograms)
+    validBlocks &= BlockLayout::Verify(program, "TransformBlock", BlockLayout::Std140, transformBlockLayout, sizeof(TransformBlock));
+
+  const GLuint instancePrograms[] = {shaderProgram[ShaderProgram::InstancedGBuffer], shaderProgram[ShaderProgram::InstancedLightPass],
+                                     shaderProgram[ShaderProgram::InstancedLightVis]};
+  for (GLuint program : instancePrograms)
+    validBlocks &= BlockLayout::Verify(program, "InstanceBuffer", BlockLayout::Std140, instanceDataLayout, sizeof(InstanceData), "instanceBuffer", MAX_INSTANCES);
+
+  const GLuint lightPrograms[] = {shaderProgram[ShaderProgram::InstancedLightPass], shaderProgram[ShaderProgram::InstancedLightVis]};
+  for (GLuint program : lightPrograms)
+    validBlocks &= BlockLayout::Verify(program, "LightBuffer", BlockLayout::Std140, lightDataLayout, sizeof(LightData), "lightBuffer", MAX_INSTANCES);
+
+  if (!validBlocks)
+  {
+    cleanUp();
+    return false;
+  }
+
   // Shader program for rendering tonemapping post-process
   shaderProgram[ShaderProgram::Tonemapping] = glCreateProgram();
   glAttachShader(shaderProgram[ShaderProgram::Tonemapping], vertexShader[VertexShader::ScreenQuad]);
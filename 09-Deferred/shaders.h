@@ -5,6 +5,9 @@
 
 #pragma once
 
+#include <glm/glm.hpp>
+
+#include <BlockLayout.h>
 #include <ShaderCompiler.h>
 
 // Shader programs
@@ -19,9 +22,56 @@ namespace ShaderProgram
 // Shader programs handle
 extern GLuint shaderProgram[ShaderProgram::NumShaderPrograms];
 
-// Helper function for creating and compiling the shaders
+// Helper function for creating and compiling the shaders, verifies the uniform blocks as well
 bool compileShaders();
 
+// Maximum number of allowed instances - must match the instancing vertex shader!
+static const unsigned int MAX_INSTANCES = 1024;
+
+// Per-pass transformations, uploaded at once
+struct TransformBlock
+{
+  // Transposed worldToView matrix - stored compactly as an array of 3 x vec4
+  glm::mat3x4 worldToView;
+  glm::mat4x4 projection;
+};
+
+static constexpr BlockLayout::Member transformBlockLayout[] =
+{
+  BLOCK_MEMBER(TransformBlock, worldToView, Mat3x4),
+  BLOCK_MEMBER(TransformBlock, projection, Mat4x4)
+};
+static_assert(BlockLayout::IsValid(transformBlockLayout, sizeof(TransformBlock), BlockLayout::Std140), "TransformBlock doesn't follow std140 rules!");
+
+// GPU data for a single object instance
+struct InstanceData
+{
+  // In this simple example just a transformation matrix, transposed for efficient storage
+  glm::mat3x4 modelToWorld;
+};
+
+static constexpr BlockLayout::Member instanceDataLayout[] =
+{
+  BLOCK_MEMBER(InstanceData, modelToWorld, Mat3x4)
+};
+static_assert(BlockLayout::IsValid(instanceDataLayout, sizeof(InstanceData), BlockLayout::Std140), "InstanceData doesn't follow std140 rules!");
+
+// GPU data for a single light instance
+struct LightData
+{
+  // Light position in world space and its radius
+  glm::vec4 positionWS;
+  // Light color and intensity
+  glm::vec4 color;
+};
+
+static constexpr BlockLayout::Member lightDataLayout[] =
+{
+  BLOCK_MEMBER(LightData, positionWS, Vec4),
+  BLOCK_MEMBER(LightData, color, Vec4)
+};
+static_assert(BlockLayout::IsValid(lightDataLayout, sizeof(LightData), BlockLayout::Std140), "LightData doesn't follow std140 rules!");
+
 // ============================================================================
 
 // Vertex shader types
@@ -0,0 +1,123 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <glad/glad.h>
+
+// Describes a member of a C++ struct mirroring a shader block, the name must match the GLSL one
+#define BLOCK_MEMBER(Struct, member, type) {#member, BlockLayout::type, 0, offsetof(Struct, member), sizeof(Struct::member)}
+// Describes an array member of a C++ struct mirroring a shader block
+#define BLOCK_ARRAY(Struct, member, type, count) {#member, BlockLayout::type, count, offsetof(Struct, member), sizeof(Struct::member)}
+
+// Layout of C++ structs uploaded to uniform and shader storage blocks: the members are described by constexpr
+// lists checked against the std140/std430 rules at compile time and against the linked program at runtime,
+// a struct passing both checks is uploaded as a whole with a single call, no per-member offsets needed
+class BlockLayout
+{
+public:
+  // Block layout rules
+  enum Rule
+  {
+    Std140, Std430
+  };
+
+  // GLSL types of the members
+  enum Type
+  {
+    Float, Int, UInt, Vec2, Vec3, Vec4, IVec2, IVec4, UVec2, UVec4, Mat3x4, Mat4x4
+  };
+
+  // Description of a single member
+  struct Member
+  {
+    // GLSL name
+    const char *name;
+    // GLSL type
+    Type type;
+    // Number of array elements, 0 for non-array members
+    unsigned int arraySize;
+    // Offset and size of the C++ member
+    size_t offset;
+    size_t size;
+  };
+
+  // Returns true if the C++ struct of the given size matches the layout rules
+  template <size_t N>
+  static constexpr bool IsValid(const Member (&members)[N], size_t structSize, Rule rule);
+
+  // Checks the block of the linked program against the C++ struct, prints all mismatches, the block either
+  // contains the members directly or, if arrayName is given, an array of count structs with the members
+  template <size_t N>
+  static bool Verify(GLuint program, const char *blockName, Rule rule, const Member (&members)[N], size_t structSize,
+                     const char *arrayName = nullptr, unsigned int count = 0)
+  {
+    return Verify(program, blockName, rule, members, N, structSize, arrayName, count);
+  }
+
+  // Helpers for the layout rules
+  static constexpr size_t RoundUp(size_t value, size_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+  static constexpr unsigned int GetComponents(Type type)
+  {
+    return (type == Float || type == Int || type == UInt) ? 1 :
+           (type == Vec2 || type == IVec2 || type == UVec2) ? 2 :
+           (type == Vec3 || type == Mat3x4) ? 3 : 4;
+  }
+  static constexpr unsigned int GetColumns(Type type) { return type == Mat3x4 ? 3 : type == Mat4x4 ? 4 : 1; }
+  static constexpr unsigned int GetRows(Type type) { return GetColumns(type) > 1 ? 4 : GetComponents(type); }
+  // Base alignment of the member
+  static constexpr size_t GetAlignment(const Member &member, Rule rule)
+  {
+    // Vectors of 3 components align as 4, std140 rounds arrays and matrix columns up to vec4
+    return (rule == Std140 && (member.arraySize > 0 || GetColumns(member.type) > 1)) ? 16 :
+           GetRows(member.type) == 1 ? 4 : GetRows(member.type) == 2 ? 8 : 16;
+  }
+  // Stride between the matrix columns, 0 for non-matrix types
+  static constexpr size_t GetMatrixStride(Type type, Rule rule)
+  {
+    return GetColumns(type) == 1 ? 0 : (rule == Std140 || GetRows(type) > 2) ? 16 : GetRows(type) * 4;
+  }
+  // Size of a single element of the member
+  static constexpr size_t GetElementSize(Type type, Rule rule)
+  {
+    return GetColumns(type) > 1 ? GetColumns(type) * GetMatrixStride(type, rule) : GetRows(type) * 4;
+  }
+  // Stride between the array elements, 0 for non-array members
+  static constexpr size_t GetArrayStride(const Member &member, Rule rule)
+  {
+    return member.arraySize > 0 ? RoundUp(GetElementSize(member.type, rule), GetAlignment(member, rule)) : 0;
+  }
+  // Size of the member in the block
+  static constexpr size_t GetSize(const Member &member, Rule rule)
+  {
+    return member.arraySize > 0 ? member.arraySize * GetArrayStride(member, rule) : GetElementSize(member.type, rule);
+  }
+
+private:
+  // Implementation of Verify() for any number of members
+  static bool Verify(GLuint program, const char *blockName, Rule rule, const Member *members, size_t numMembers, size_t structSize,
+                     const char *arrayName, unsigned int count);
+};
+
+template <size_t N>
+constexpr bool BlockLayout::IsValid(const Member (&members)[N], size_t structSize, Rule rule)
+{
+  // Structs are aligned to their largest member, std140 rounds that up to vec4
+  size_t offset = 0;
+  size_t alignment = rule == Std140 ? 16 : 4;
+  for (size_t i = 0; i < N; ++i)
+  {
+    const size_t memberAlignment = GetAlignment(members[i], rule);
+    offset = RoundUp(offset, memberAlignment);
+    if (members[i].offset != offset || members[i].size != GetSize(members[i], rule))
+      return false;
+
+    offset += members[i].size;
+    alignment = memberAlignment > alignment ? memberAlignment : alignment;
+  }
+
+  return RoundUp(offset, alignment) == structSize;
+}
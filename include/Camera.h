@@ -37,8 +37,22 @@ public:
   const glm::mat4x4& GetViewToWorld() const { return _viewToWorld; }
   // Sets camera projection using field of view and aspect ratio
   void SetProjection(float fov, float aspect, float nearClip, float farClip);
-  // Returns the camera projection matrix
+  // Returns the camera projection matrix, including the sub-pixel jitter if set
   const glm::mat4x4& GetProjection() const { return _projection; }
+  // Returns the camera projection matrix without the jitter
+  const glm::mat4x4& GetUnjitteredProjection() const { return _unjitteredProjection; }
+  // Offsets the projection by a sub-pixel jitter from the Halton (2, 3) sequence, used by the temporal anti-aliasing
+  void SetJitter(unsigned int frameIndex, int width, int height);
+  // Removes the sub-pixel jitter from the projection
+  void ClearJitter();
+  // Returns the current jitter in the normalized device coordinates
+  const glm::vec2& GetJitter() const { return _jitter; }
+  // Remembers the current transformation and unjittered projection as the previous frame ones, call once per frame
+  void StorePreviousFrame();
+  // Returns the world to view transformation of the previous frame
+  const glm::mat4x4& GetPreviousWorldToView() const { return _previousWorldToView; }
+  // Returns the unjittered projection of the previous frame
+  const glm::mat4x4& GetPreviousProjection() const { return _previousProjection; }
   // Returns the camera near clip plane
   const float GetNearClip() const { return _nearClip; }
   // Returns the camera far clip plane
@@ -47,12 +61,22 @@ public:
   void Move(MovementDirections direction, const glm::vec2& mouseMove, float dt);
 
 protected:
+  // Rebuilds the projection from the unjittered one and the current jitter
+  void ApplyJitter();
+
   // World to view transformation matrix (could be just 4x3 matrix)
   glm::mat4x4 _worldToView;
   // View to world transformation matrix (could be just 4x3 matrix)
   glm::mat4x4 _viewToWorld;
   // Projection matrix
   glm::mat4x4 _projection;
+  // Projection matrix without the jitter
+  glm::mat4x4 _unjitteredProjection;
+  // Sub-pixel jitter in the normalized device coordinates
+  glm::vec2 _jitter;
+  // Transformation and unjittered projection of the previous frame for the reprojection
+  glm::mat4x4 _previousWorldToView;
+  glm::mat4x4 _previousProjection;
   // Camera movement speed
   float _movementSpeed;
   // Camera sensitivity for mouse movement
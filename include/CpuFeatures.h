@@ -0,0 +1,65 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC allows the intrinsics in any function
+#define CPU_TARGET_SSE41
+#define CPU_TARGET_AVX2
+#else
+// GCC and Clang need the instruction set enabled per function to use the intrinsics without global flags
+#define CPU_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+// Returns true if the CPU supports SSE4.1, functions marked CPU_TARGET_SSE41 may only be called then
+inline bool cpuSupportsSse41()
+{
+  static const bool supported = []() -> bool
+  {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 19)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.1");
+#endif
+  }();
+  return supported;
+}
+
+// Returns true if both the CPU and the OS support AVX2 and FMA, functions marked CPU_TARGET_AVX2
+// may only be called then
+inline bool cpuSupportsAvx2()
+{
+  static const bool supported = []() -> bool
+  {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+      return false;
+
+    // FMA, OSXSAVE and AVX bits
+    __cpuid(info, 1);
+    const int required = (1 << 12) | (1 << 27) | (1 << 28);
+    if ((info[2] & required) != required)
+      return false;
+
+    // The OS must preserve the YMM registers
+    if ((_xgetbv(0) & 6) != 6)
+      return false;
+
+    // AVX2 bit
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+  }();
+  return supported;
+}
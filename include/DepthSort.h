@@ -0,0 +1,32 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Sorts objects front to back by their view depth, so that a depth prepass rejects as many hidden fragments
+// as possible: LSD radix sort of the view depths converted to ordered integers, 3 passes of 11 bits
+class DepthSort
+{
+public:
+  // Number of bits sorted per pass
+  static const unsigned int RADIX_BITS = 11;
+
+  DepthSort() {}
+
+  // Sorts the objects by the view depth of their positions, returns the object indices nearest first,
+  // the result stays valid until the next call
+  const std::vector<unsigned int> &FrontToBack(const glm::mat4x4 &worldToView, const glm::vec3 *positions, unsigned int count);
+
+private:
+  // Sort keys and the indices, double buffered for the passes
+  std::vector<uint32_t> _keys[2];
+  std::vector<unsigned int> _order[2];
+  // Bucket counts of all passes
+  std::vector<unsigned int> _histograms;
+};
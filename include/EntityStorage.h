@@ -0,0 +1,285 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <JobSystem.h>
+
+// Stable handle of an entity, the generation tells apart the entities reusing the same index
+struct Entity
+{
+  unsigned int index = ~0u;
+  unsigned int generation = 0;
+
+  bool operator == (const Entity &other) const { return index == other.index && generation == other.generation; }
+  bool operator != (const Entity &other) const { return !(*this == other); }
+};
+
+// Data oriented entity storage: entities with the same set of components (archetype) live in fixed size
+// chunks, each chunk stores one 64 B aligned array per component, so the systems iterating over the
+// components touch contiguous memory only, queries may run in parallel with a chunk per job
+class EntityStorage
+{
+public:
+  // Maximum number of component types
+  static const unsigned int MAX_COMPONENTS = 64;
+  // Size of a single chunk in bytes
+  static const size_t CHUNK_SIZE = 16 * 1024;
+  // Alignment of the component arrays, i.e., a cache line
+  static const size_t ARRAY_ALIGNMENT = 64;
+
+  EntityStorage() {}
+  ~EntityStorage() { Clear(); }
+
+  // Creates an entity with the given default constructed components
+  template <class... Components>
+  Entity Create();
+  // Destroys the entity, the last entity of its archetype takes its place
+  void Destroy(Entity entity);
+  // Destroys all entities, the handles issued so far stay invalid
+  void Clear();
+  // Returns true if the handle refers to a living entity
+  bool IsAlive(Entity entity) const;
+  // Returns the number of living entities
+  unsigned int GetCount() const { return _numEntities; }
+
+  // Returns the component of the entity or nullptr if the entity doesn't have it
+  template <class Component>
+  Component *Get(Entity entity);
+
+  // Calls fn(count, entities, components...) for each chunk having all the components, the component arguments
+  // are pointers to the arrays of count items
+  template <class... Components, class Fn>
+  void ForEachChunk(Fn fn);
+  // The same as ForEachChunk() with the chunks processed in parallel by the job system
+  template <class... Components, class Fn>
+  void ParallelForEachChunk(Fn fn);
+  // Calls fn(entity, components&...) for each entity having all the components
+  template <class... Components, class Fn>
+  void ForEach(Fn fn);
+  // The same as ForEach() with the chunks processed in parallel by the job system
+  template <class... Components, class Fn>
+  void ParallelForEach(Fn fn);
+
+  // Returns the id of the component type, ids are assigned on the first use
+  template <class Component>
+  static unsigned int GetComponentId();
+
+private:
+  // No copies allowed
+  EntityStorage(const EntityStorage &);
+  EntityStorage & operator = (const EntityStorage &);
+
+  typedef uint64_t ComponentMask;
+
+  // Block of entities of a single archetype
+  struct Chunk
+  {
+    // Allocated memory and its aligned start
+    unsigned char *memory;
+    unsigned char *data;
+    // Number of entities in the chunk
+    unsigned int count;
+  };
+
+  // Entities sharing the same set of components
+  struct Archetype
+  {
+    // Components of the archetype
+    ComponentMask mask;
+    // Offsets of the component arrays within the chunk, indexed by the component id
+    std::vector<size_t> offsets;
+    // Offset of the entity handles within the chunk
+    size_t entitiesOffset;
+    // Number of entities per chunk
+    unsigned int capacity;
+    // All chunks, only the last one may be partially filled
+    std::vector<Chunk> chunks;
+  };
+
+  // Location of an entity
+  struct EntityRecord
+  {
+    unsigned int archetype;
+    unsigned int chunk;
+    unsigned int row;
+    unsigned int generation;
+    bool alive;
+  };
+
+  // Registers the component type, returns its id
+  static unsigned int RegisterComponent(size_t size, size_t alignment);
+  // Returns the size of the component type
+  static size_t GetComponentSize(unsigned int id);
+
+  // Returns the archetype with the components, creates it if needed
+  unsigned int GetArchetype(ComponentMask mask);
+  // Allocates a row for a new entity in the archetype
+  EntityRecord AllocateRow(unsigned int archetype);
+  // Returns the array of the component within the chunk
+  static unsigned char *GetArray(const Archetype &archetype, const Chunk &chunk, unsigned int id) { return chunk.data + archetype.offsets[id]; }
+  static Entity *GetEntities(const Archetype &archetype, const Chunk &chunk) { return reinterpret_cast<Entity*>(chunk.data + archetype.entitiesOffset); }
+
+  // Helpers for the component packs
+  template <class... Components>
+  static ComponentMask GetMask();
+  template <class Component>
+  static void Construct(const Archetype &archetype, const Chunk &chunk, unsigned int row);
+
+  // All archetypes and their lookup by the component mask
+  std::vector<Archetype> _archetypes;
+  std::unordered_map<ComponentMask, unsigned int> _archetypeLookup;
+  // Records of all entities ever created and the indices free for reuse
+  std::vector<EntityRecord> _records;
+  std::vector<unsigned int> _freeRecords;
+  // Number of living entities
+  unsigned int _numEntities = 0;
+};
+
+template <class Component>
+unsigned int EntityStorage::GetComponentId()
+{
+  // Chunks are moved around via memcpy
+  static_assert(std::is_trivially_copyable<Component>::value, "Components must be trivially copyable");
+  static const unsigned int id = RegisterComponent(sizeof(Component), alignof(Component));
+  return id;
+}
+
+template <class... Components>
+EntityStorage::ComponentMask EntityStorage::GetMask()
+{
+  ComponentMask mask = 0;
+  const unsigned int ids[] = {GetComponentId<Components>()...};
+  for (unsigned int id : ids)
+    mask |= ComponentMask(1) << id;
+  return mask;
+}
+
+template <class Component>
+void EntityStorage::Construct(const Archetype &archetype, const Chunk &chunk, unsigned int row)
+{
+  new (GetArray(archetype, chunk, GetComponentId<Component>()) + row * sizeof(Component)) Component();
+}
+
+template <class... Components>
+Entity EntityStorage::Create()
+{
+  const unsigned int archetypeIndex = GetArchetype(GetMask<Components...>());
+
+  // Find a free handle and a row within the last chunk
+  unsigned int index = static_cast<unsigned int>(_records.size());
+  if (!_freeRecords.empty())
+  {
+    index = _freeRecords.back();
+    _freeRecords.pop_back();
+  }
+  else
+  {
+    _records.push_back({0, 0, 0, 0, false});
+  }
+
+  EntityRecord &record = _records[index];
+  const EntityRecord row = AllocateRow(archetypeIndex);
+  record.archetype = row.archetype;
+  record.chunk = row.chunk;
+  record.row = row.row;
+  record.alive = true;
+
+  const Archetype &archetype = _archetypes[archetypeIndex];
+  const Chunk &chunk = archetype.chunks[record.chunk];
+  const int dummy[] = {0, (Construct<Components>(archetype, chunk, record.row), 0)...};
+  (void)dummy;
+
+  Entity entity;
+  entity.index = index;
+  entity.generation = record.generation;
+  GetEntities(archetype, chunk)[record.row] = entity;
+
+  ++_numEntities;
+  return entity;
+}
+
+template <class Component>
+Component *EntityStorage::Get(Entity entity)
+{
+  if (!IsAlive(entity))
+    return nullptr;
+
+  const unsigned int id = GetComponentId<Component>();
+  const EntityRecord &record = _records[entity.index];
+  const Archetype &archetype = _archetypes[record.archetype];
+  if (!(archetype.mask & (ComponentMask(1) << id)))
+    return nullptr;
+
+  return reinterpret_cast<Component*>(GetArray(archetype, archetype.chunks[record.chunk], id)) + record.row;
+}
+
+template <class... Components, class Fn>
+void EntityStorage::ForEachChunk(Fn fn)
+{
+  const ComponentMask mask = GetMask<Components...>();
+  for (const Archetype &archetype : _archetypes)
+  {
+    if ((archetype.mask & mask) != mask)
+      continue;
+
+    for (const Chunk &chunk : archetype.chunks)
+      fn(chunk.count, GetEntities(archetype, chunk), reinterpret_cast<Components*>(GetArray(archetype, chunk, GetComponentId<Components>()))...);
+  }
+}
+
+template <class... Components, class Fn>
+void EntityStorage::ParallelForEachChunk(Fn fn)
+{
+  // Gather the matching chunks first, each job then processes a single chunk
+  const ComponentMask mask = GetMask<Components...>();
+  std::vector<std::pair<const Archetype*, const Chunk*>> chunks;
+  for (const Archetype &archetype : _archetypes)
+  {
+    if ((archetype.mask & mask) != mask)
+      continue;
+
+    for (const Chunk &chunk : archetype.chunks)
+      chunks.push_back(std::make_pair(&archetype, &chunk));
+  }
+
+  JobSystem::GetInstance().ParallelFor(static_cast<unsigned int>(chunks.size()), 1, [&chunks, &fn](unsigned int begin, unsigned int end)
+  {
+    for (unsigned int i = begin; i < end; ++i)
+    {
+      const Archetype &archetype = *chunks[i].first;
+      const Chunk &chunk = *chunks[i].second;
+      fn(chunk.count, GetEntities(archetype, chunk), reinterpret_cast<Components*>(GetArray(archetype, chunk, GetComponentId<Components>()))...);
+    }
+  });
+}
+
+template <class... Components, class Fn>
+void EntityStorage::ForEach(Fn fn)
+{
+  ForEachChunk<Components...>([&fn](unsigned int count, const Entity *entities, Components*... components)
+  {
+    for (unsigned int i = 0; i < count; ++i)
+      fn(entities[i], components[i]...);
+  });
+}
+
+template <class... Components, class Fn>
+void EntityStorage::ParallelForEach(Fn fn)
+{
+  ParallelForEachChunk<Components...>([&fn](unsigned int count, const Entity *entities, Components*... components)
+  {
+    for (unsigned int i = 0; i < count; ++i)
+      fn(entities[i], components[i]...);
+  });
+}
@@ -30,6 +30,8 @@ public:
   static Mesh<Vertex_Pos_Nrm_Tgt_Tex> *CreateCubeNormalTangentTex();
   // Create tethrahedron composed from vertices with normals
   static Mesh<Vertex_Pos_Nrm> *CreateTetrahedron();
+  // Create tethrahedron with shared vertices and averaged normals
+  static Mesh<Vertex_Pos_Nrm> *CreateTetrahedronShared();
   // Create regular icosahedron with just positions
   static Mesh<Vertex_Pos> *CreateIcosahedron();
 
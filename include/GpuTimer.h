@@ -0,0 +1,43 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/glad.h>
+
+// Measures the GPU time of the commands between Begin() and End(), GL_TIME_ELAPSED queries are kept
+// in a ring and read a few frames later so that nothing stalls, the result is smoothed over the frames
+class GpuTimer
+{
+public:
+  // Number of frames before the query result is read
+  static const int QUERY_LATENCY = 4;
+
+  GpuTimer() {}
+  ~GpuTimer();
+
+  // Starts the measurement, only one GL_TIME_ELAPSED query can be active at a time
+  void Begin();
+  // Stops the measurement
+  void End();
+  // Returns the smoothed GPU time in milliseconds
+  float GetMilliseconds() const { return _milliseconds; }
+
+private:
+  // No copies allowed
+  GpuTimer(const GpuTimer &);
+  GpuTimer & operator = (const GpuTimer &);
+
+  // Reads the result of the query
+  void Collect(int query);
+
+  GLuint _queries[QUERY_LATENCY] = {};
+  // Does the query wait for collection?
+  bool _pending[QUERY_LATENCY] = {};
+  // Query used by the next Begin()
+  int _next = 0;
+  // Smoothed GPU time
+  float _milliseconds = 0.0f;
+};
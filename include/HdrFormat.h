@@ -0,0 +1,51 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/glad.h>
+
+// Selects the internal format of the HDR color targets: R11G11B10F needs half the bandwidth of RGB16F (padded to
+// 8 B by the drivers), but has only 6 (5 for blue) bits of mantissa, the rounding of many additive light passes
+// is measured once and the policy falls back to RGB16F when the error exceeds the threshold
+class HdrFormat
+{
+public:
+  // Format policies
+  enum Policy
+  {
+    // R11G11B10F if the measured error is acceptable, RGB16F otherwise
+    Auto,
+    // Always R11G11B10F
+    Packed,
+    // Always RGB16F
+    HalfFloat,
+    NumPolicies
+  };
+
+  // Number of additive passes accumulated by the measurement, i.e., overlapping lights
+  static const int ACCUMULATION_PASSES = 16;
+  // Maximum relative error of the accumulated color allowed for R11G11B10F, blending with round to nearest
+  // ends up around 4 %, hardware truncating the results drifts over 10 %
+  static constexpr float MAX_RELATIVE_ERROR = 1.0f / 16.0f;
+
+  // Returns the internal format for the HDR color targets, requires a current OpenGL 3.3 context
+  static GLenum Select(Policy policy);
+  // Returns the relative error of R11G11B10F measured by the first Select(), 1 if it can't be rendered to
+  static float GetMeasuredError() { return _measuredError; }
+  // Returns the bytes per pixel the format occupies in the memory
+  static unsigned int GetBytesPerPixel(GLenum format) { return format == GL_R11F_G11F_B10F ? 4 : 8; }
+  // Returns the name of the format for printing
+  static const char *GetName(GLenum format) { return format == GL_R11F_G11F_B10F ? "R11G11B10F" : "RGB16F"; }
+  // Returns the name of the policy for printing
+  static const char *GetName(Policy policy);
+
+private:
+  // Accumulates the passes into a R11G11B10F target and returns the maximum relative error
+  static float MeasureError();
+
+  // Measured error, negative until measured
+  static float _measuredError;
+};
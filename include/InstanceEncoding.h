@@ -0,0 +1,132 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <emmintrin.h>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Compact instance transformations: translation, uniform scale and rotation as a quaternion instead
+// of the 48 B mat3x4, the shaders decode them with unpackSnorm2x16() and unpackHalf2x16(), i.e.,
+// GLSL 4.20 or GL_ARB_shading_language_packing
+
+// Decoded instance transformation
+struct InstanceTransform
+{
+  // Translation
+  glm::vec3 translation;
+  // Uniform scale
+  float scale;
+  // Unit quaternion (x, y, z, w)
+  glm::vec4 rotation;
+};
+
+// 32 B encoding: fp32 translation and scale, quaternion as snorm16x4, matches std140 struct of vec4, uvec2, uvec2
+struct CompactInstance
+{
+  // Translation and uniform scale
+  glm::vec4 translationScale;
+  // Quaternion packed as snorm16x4
+  GLuint rotation[2];
+  // Free for the user data, keeps the std140 array stride
+  GLuint padding[2];
+};
+
+// 16 B encoding for small worlds: half translation and scale, quaternion as snorm16x4, matches std140 uvec4
+struct CompactInstanceHalf
+{
+  // Translation and uniform scale packed as half4
+  GLuint translationScale[2];
+  // Quaternion packed as snorm16x4
+  GLuint rotation[2];
+};
+
+// Largest translation the half encoding keeps within 1/32 of a unit
+static const float HALF_ENCODING_MAX_EXTENT = 32.0f;
+
+// Decomposes the transformation into translation, uniform scale and rotation, assumes no shear and uniform scale
+inline InstanceTransform decomposeTransform(const glm::mat4x3 &transformation)
+{
+  InstanceTransform result;
+  result.translation = transformation[3];
+  result.scale = glm::length(transformation[0]);
+
+  glm::mat3 rotation = glm::mat3(transformation) * (result.scale > 0.0f ? 1.0f / result.scale : 0.0f);
+  glm::quat q = glm::quat_cast(rotation);
+  result.rotation = glm::vec4(q.x, q.y, q.z, q.w);
+  return result;
+}
+
+// Converts 4 floats to snorm16x4 packed to the lower 64 bits
+inline __m128i packSnorm16x4(__m128 v)
+{
+  v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+  __m128i i = _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(32767.0f)));
+  return _mm_packs_epi32(i, i);
+}
+
+// Converts 4 floats to halfs packed to the lower 64 bits, rounds to nearest even, handles denormals,
+// infinities and NaNs, SSE2 only so no F16C is needed
+inline __m128i packHalf4(__m128 f)
+{
+  const __m128i f16Max = _mm_set1_epi32((127 + 16) << 23);       // all values >= this overflow to infinity
+  const __m128i f32Infinity = _mm_set1_epi32(0x7f800000);
+  const __m128i f16Infinity = _mm_set1_epi32(0x7c00);
+  const __m128i nanBit = _mm_set1_epi32(0x200);
+  const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23);    // smallest value yielding a normalized half
+  const __m128i subnormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+  const __m128i normalBias = _mm_set1_epi32(0xfff - ((127 - 15) << 23)); // rebias the exponent, round the mantissa
+
+  __m128 sign = _mm_and_ps(f, _mm_set1_ps(-0.0f));
+  __m128 absF = _mm_xor_ps(f, sign);
+  __m128i absI = _mm_castps_si128(absF);
+
+  // Infinities and NaNs
+  __m128i isNan = _mm_cmpgt_epi32(absI, f32Infinity);
+  __m128i isRegular = _mm_cmpgt_epi32(f16Max, absI);
+  __m128i special = _mm_or_si128(_mm_and_si128(isNan, nanBit), f16Infinity);
+
+  // Subnormal results, the magic addition rounds the mantissa
+  __m128i isSubnormal = _mm_cmpgt_epi32(minNormal, absI);
+  __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absF, _mm_castsi128_ps(subnormalMagic))), subnormalMagic);
+
+  // Normal results, odd mantissa rounds up on ties
+  __m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(absI, 31 - 13), 31);
+  __m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absI, normalBias), mantissaOdd), 13);
+
+  __m128i regular = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+  __m128i joined = _mm_or_si128(_mm_and_si128(isRegular, regular), _mm_andnot_si128(isRegular, special));
+
+  // Sign extended to the upper half so that the signed saturating pack keeps the bits
+  __m128i result = _mm_or_si128(joined, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+  return _mm_packs_epi32(result, result);
+}
+
+// Encodes a batch of transformations to the 32 B encoding
+inline void encodeInstances(const InstanceTransform *input, CompactInstance *output, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    const InstanceTransform &t = input[i];
+    _mm_storeu_ps(&output[i].translationScale.x, _mm_set_ps(t.scale, t.translation.z, t.translation.y, t.translation.x));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(output[i].rotation), packSnorm16x4(_mm_loadu_ps(&t.rotation.x)));
+    output[i].padding[0] = output[i].padding[1] = 0;
+  }
+}
+
+// Encodes a batch of transformations to the 16 B encoding, the translation should stay within HALF_ENCODING_MAX_EXTENT
+inline void encodeInstances(const InstanceTransform *input, CompactInstanceHalf *output, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    const InstanceTransform &t = input[i];
+    __m128i translationScale = packHalf4(_mm_set_ps(t.scale, t.translation.z, t.translation.y, t.translation.x));
+    __m128i rotation = packSnorm16x4(_mm_loadu_ps(&t.rotation.x));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&output[i]), _mm_unpacklo_epi64(translationScale, rotation));
+  }
+}
@@ -0,0 +1,217 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/glad.h>
+#include <vector>
+
+// CPU side copy of the per instance GPU data with per instance dirty bits, only the dirty
+// instances are regenerated and uploaded, static scenes don't touch the buffer at all
+template <class InstanceType>
+class InstanceStore
+{
+public:
+  // Number of clean instances allowed inside a single upload range, one larger upload is cheaper than many small ones
+  static const unsigned int MAX_RANGE_GAP = 8;
+
+  InstanceStore() {}
+
+  // Resizes the store, all instances become dirty
+  void Resize(unsigned int count);
+  // Returns the number of instances
+  unsigned int GetCount() const { return static_cast<unsigned int>(_data.size()); }
+  // Returns the instance data
+  const InstanceType *GetData() const { return _data.data(); }
+  // Returns the version incremented on each modification, consumers may compare it to skip their uploads
+  unsigned int GetVersion() const { return _version; }
+  // Returns true if there's anything to regenerate or upload
+  bool IsDirty() const { return _numDirty > 0; }
+  // Returns the dirty bit of the instance
+  bool IsDirty(unsigned int index) const { return (_dirty[index >> 5] >> (index & 31)) & 1; }
+
+  // Overwrites the instance and marks it dirty
+  void Set(unsigned int index, const InstanceType &data);
+  // Marks the instance dirty, i.e., its data will be regenerated on the next Update()
+  void MarkDirty(unsigned int index);
+  // Marks all instances dirty
+  void MarkAllDirty();
+  // Forgets all dirty instances, for consumers tracking the changes via GetVersion()
+  void ClearDirty();
+
+  // Regenerates the dirty instances via fn(index, data), the instances stay dirty until uploaded
+  template <class Fn>
+  void Update(Fn fn);
+  // Uploads the coalesced dirty ranges to the buffer via glBufferSubData, offset is in bytes,
+  // returns the number of bytes uploaded
+  size_t Upload(GLenum target, GLuint buffer, GLintptr offset = 0);
+
+private:
+  // No copies allowed
+  InstanceStore(const InstanceStore &);
+  InstanceStore & operator = (const InstanceStore &);
+
+  // Calls fn(begin, end) for each coalesced range of the dirty instances
+  template <class Fn>
+  void ForEachDirtyRange(Fn fn) const;
+
+  // Instance data
+  std::vector<InstanceType> _data;
+  // Dirty bits, one per instance
+  std::vector<unsigned int> _dirty;
+  // Number of dirty instances
+  unsigned int _numDirty = 0;
+  // Range [begin, end) covering all dirty instances
+  unsigned int _dirtyBegin = 0;
+  unsigned int _dirtyEnd = 0;
+  // Modification counter
+  unsigned int _version = 0;
+};
+
+template <class InstanceType>
+void InstanceStore<InstanceType>::Resize(unsigned int count)
+{
+  // Clear the bits while the dirty range still fits the words, shrinking would leave it out of bounds
+  ClearDirty();
+  _data.resize(count);
+  _dirty.resize((count + 31) / 32);
+  MarkAllDirty();
+}
+
+template <class InstanceType>
+void InstanceStore<InstanceType>::Set(unsigned int index, const InstanceType &data)
+{
+  _data[index] = data;
+  MarkDirty(index);
+}
+
+template <class InstanceType>
+void InstanceStore<InstanceType>::MarkDirty(unsigned int index)
+{
+  ++_version;
+  if (IsDirty(index))
+    return;
+
+  _dirty[index >> 5] |= 1u << (index & 31);
+  if (_numDirty == 0)
+  {
+    _dirtyBegin = index;
+    _dirtyEnd = index + 1;
+  }
+  else
+  {
+    _dirtyBegin = index < _dirtyBegin ? index : _dirtyBegin;
+    _dirtyEnd = index + 1 > _dirtyEnd ? index + 1 : _dirtyEnd;
+  }
+  ++_numDirty;
+}
+
+template <class InstanceType>
+void InstanceStore<InstanceType>::MarkAllDirty()
+{
+  ++_version;
+  const unsigned int count = GetCount();
+  if (count == 0)
+  {
+    ClearDirty();
+    return;
+  }
+
+  // Set all bits, keep the bits past the last instance clear
+  for (unsigned int &word : _dirty)
+    word = ~0u;
+  if (count & 31)
+    _dirty.back() = (1u << (count & 31)) - 1;
+
+  _numDirty = count;
+  _dirtyBegin = 0;
+  _dirtyEnd = count;
+}
+
+template <class InstanceType>
+void InstanceStore<InstanceType>::ClearDirty()
+{
+  if (_numDirty == 0)
+    return;
+
+  // Only the words within the dirty range can have any bits set
+  for (unsigned int i = _dirtyBegin >> 5; i < (_dirtyEnd + 31) >> 5; ++i)
+    _dirty[i] = 0;
+
+  _numDirty = 0;
+  _dirtyBegin = _dirtyEnd = 0;
+}
+
+template <class InstanceType>
+template <class Fn>
+void InstanceStore<InstanceType>::ForEachDirtyRange(Fn fn) const
+{
+  if (_numDirty == 0)
+    return;
+
+  // Open range [begin, end), the first dirty instance is always at _dirtyBegin
+  unsigned int begin = _dirtyBegin, end = _dirtyBegin;
+  for (unsigned int i = _dirtyBegin; i < _dirtyEnd; ++i)
+  {
+    // Skip whole clean words at once
+    if ((i & 31) == 0 && _dirty[i >> 5] == 0)
+    {
+      i += 31;
+      continue;
+    }
+
+    if (!IsDirty(i))
+      continue;
+
+    // Close the current range if the gap is too large
+    if (i > end + MAX_RANGE_GAP)
+    {
+      fn(begin, end);
+      begin = i;
+    }
+    end = i + 1;
+  }
+
+  fn(begin, end);
+}
+
+template <class InstanceType>
+template <class Fn>
+void InstanceStore<InstanceType>::Update(Fn fn)
+{
+  // Static fast path
+  if (_numDirty == 0)
+    return;
+
+  ForEachDirtyRange([this, &fn](unsigned int begin, unsigned int end)
+  {
+    for (unsigned int i = begin; i < end; ++i)
+    {
+      if (IsDirty(i))
+        fn(i, _data[i]);
+    }
+  });
+}
+
+template <class InstanceType>
+size_t InstanceStore<InstanceType>::Upload(GLenum target, GLuint buffer, GLintptr offset)
+{
+  // Static fast path
+  if (_numDirty == 0)
+    return 0;
+
+  size_t uploadBytes = 0;
+  glBindBuffer(target, buffer);
+  ForEachDirtyRange([this, target, offset, &uploadBytes](unsigned int begin, unsigned int end)
+  {
+    const GLsizeiptr size = (end - begin) * sizeof(InstanceType);
+    glBufferSubData(target, offset + begin * sizeof(InstanceType), size, &_data[begin]);
+    uploadBytes += size;
+  });
+  glBindBuffer(target, 0);
+
+  ClearDirty();
+  return uploadBytes;
+}
@@ -0,0 +1,64 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Pool of worker threads for data parallel loops, the calling thread takes part in the work as well
+class JobSystem
+{
+public:
+  // Get and create instance for this singleton
+  static JobSystem& GetInstance();
+  // Returns the number of threads working on a loop, the calling one included
+  unsigned int GetNumThreads() const { return static_cast<unsigned int>(_workers.size()) + 1; }
+  // Calls fn(begin, end) for chunks of [0, count) of grainSize items in parallel, returns once all are done,
+  // loops fitting a single chunk and loops issued from the workers themselves run inline
+  void ParallelFor(unsigned int count, unsigned int grainSize, const std::function<void(unsigned int, unsigned int)> &fn);
+
+private:
+  // All is private, instance is created in GetInstance()
+  JobSystem();
+  ~JobSystem();
+  // No copies allowed
+  JobSystem(const JobSystem &);
+  JobSystem & operator = (const JobSystem &);
+
+  // Waits for the loops and works on them
+  void WorkerLoop();
+  // Executes the chunks of the current loop until there are none left
+  void ExecuteChunks();
+
+  // Worker threads
+  std::vector<std::thread> _workers;
+  // Serializes the loops issued from different threads
+  std::mutex _submitMutex;
+  // Guards the current loop, its generation, the active workers and the quit flag
+  std::mutex _mutex;
+  // Wakes the workers up when a loop is issued
+  std::condition_variable _wakeCondition;
+  // Wakes the issuing thread up when a worker is done
+  std::condition_variable _doneCondition;
+  // Incremented for each issued loop
+  unsigned int _generation = 0;
+  // Number of workers executing the chunks of the current loop
+  unsigned int _activeWorkers = 0;
+  // Are the workers supposed to quit?
+  bool _quit = false;
+
+  // Current loop, only modified while no worker is active
+  const std::function<void(unsigned int, unsigned int)> *_job = nullptr;
+  unsigned int _count = 0;
+  unsigned int _grainSize = 0;
+  unsigned int _numChunks = 0;
+  // Next chunk to grab
+  std::atomic<unsigned int> _nextChunk;
+};
@@ -0,0 +1,55 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <glm/glm.hpp>
+
+// Axis aligned bounding box
+struct BoundingBox
+{
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+// Batch math kernels, the inner loops of instance building, culling and light classification: each kernel
+// has scalar and SSE4.1 versions, some also AVX2 ones, the best level supported by the CPU is selected at runtime
+class MathBatch
+{
+public:
+  // Instruction set used by the kernels
+  enum class Level : int
+  {
+    Scalar, Sse41, Avx2, NumLevels
+  };
+
+  // Returns the best level supported by the CPU
+  static Level GetSupportedLevel();
+  // Returns the level used by the kernels
+  static Level GetLevel();
+  // Selects the level used by the kernels, clamped to the supported one
+  static void SetLevel(Level level);
+  // Returns name of the level
+  static const char *GetLevelName(Level level);
+
+  // out[i] = a[i] * b[i]
+  static void MultiplyMatrices(const glm::mat4x4 *a, const glm::mat4x4 *b, glm::mat4x4 *out, size_t count);
+  // out[i] = fastMatrixInverse(in[i]), assumes only rotation and translation
+  static void InverseRigid(const glm::mat4x4 *in, glm::mat4x4 *out, size_t count);
+  // out[i] = m * vec4(in[i], 1), assumes affine transformation
+  static void TransformPoints(const glm::mat4x4 &m, const glm::vec3 *in, glm::vec3 *out, size_t count);
+  // out[i] = normalize(mat3(m) * in[i]), m is expected to be the normal matrix already
+  static void TransformNormals(const glm::mat4x4 &m, const glm::vec3 *in, glm::vec3 *out, size_t count);
+  // Bounding boxes of the transformed boxes, assumes affine transformation
+  static void TransformBoxes(const glm::mat4x4 &m, const BoundingBox *in, BoundingBox *out, size_t count);
+  // visible[i] = 1 if the sphere (center, radius) isn't completely behind any of the planes (normal, distance), 0 otherwise
+  static void TestSpheresPlanes(const glm::vec4 *spheres, size_t count, const glm::vec4 *planes, unsigned int numPlanes, unsigned char *visible);
+  // out[i] = getLuminousIntensity(colors[i])
+  static void ComputeLuminance(const glm::vec3 *colors, float *out, size_t count);
+
+  // Verifies all supported levels against glm and prints their throughput
+  static void RunBenchmark();
+};
@@ -8,6 +8,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <Random.h>
+
 static const float PI = 3.1415926535897932384626433832795f;
 static const float PI_HALF = 1.5707963267948966192313216916398f;
 static const float TWO_PI = 6.283185307179586476925286766559f;
@@ -22,10 +24,10 @@ inline glm::mat4x4 fastMatrixInverse(const glm::mat4x4& matrix)
                      glm::vec4(-inv * glm::vec3(matrix[3]), 1.0f));
 }
 
-// Gets random number from the [min, max] range
+// Gets random number from the [min, max) range using the generator of the calling thread
 inline float getRandom(float min, float max)
 {
-  return min + static_cast<float>(rand()) / (static_cast <float>(RAND_MAX / (max - min)));
+  return getThreadRandom().NextFloat(min, max);
 }
 
 // C++ type safe signum function
@@ -35,6 +37,20 @@ inline int sign(T value)
   return (T(0) < value) - (value < T(0));
 }
 
+// Returns the index-th element of the Halton low discrepancy sequence with the given base
+inline float halton(unsigned int index, unsigned int base)
+{
+  float result = 0.0f;
+  float fraction = 1.0f / base;
+  while (index > 0)
+  {
+    result += fraction * (index % base);
+    index /= base;
+    fraction /= base;
+  }
+  return result;
+}
+
 // Converts RGB values to luminuos intensity
 inline float getLuminousIntensity(glm::vec3 color)
 {
@@ -0,0 +1,45 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <glad/glad.h>
+
+// Measures the overdraw of the draws between Begin() and End(): samples passing the depth test per framebuffer
+// sample, GL_SAMPLES_PASSED queries are kept in a ring and read a few frames later so that nothing stalls
+class OverdrawQuery
+{
+public:
+  // Number of frames before the query result is read
+  static const int QUERY_LATENCY = 4;
+
+  OverdrawQuery() {}
+  ~OverdrawQuery();
+
+  // Starts counting the samples
+  void Begin();
+  // Stops counting, the framebuffer has the given number of samples, i.e., width * height * MSAA samples
+  void End(GLuint64 framebufferSamples);
+  // Returns the overdraw of the last collected frame
+  float GetOverdraw() const { return _overdraw; }
+
+private:
+  // No copies allowed
+  OverdrawQuery(const OverdrawQuery &);
+  OverdrawQuery & operator = (const OverdrawQuery &);
+
+  // Reads the result of the query
+  void Collect(int query);
+
+  GLuint _queries[QUERY_LATENCY] = {};
+  // Framebuffer samples of each query
+  GLuint64 _framebufferSamples[QUERY_LATENCY] = {};
+  // Does the query wait for collection?
+  bool _pending[QUERY_LATENCY] = {};
+  // Query used by the next Begin()
+  int _next = 0;
+  // Last collected overdraw
+  float _overdraw = 0.0f;
+};
@@ -0,0 +1,126 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <emmintrin.h>
+
+// PCG32 random number generator (pcg-random.org): 64 bit LCG state with a permuted 32 bit output,
+// the same seed and stream give the same sequence on every platform, different streams are independent
+// and Advance() jumps ahead in O(log n), so parallel jobs can each generate their part of one sequence
+class Pcg32
+{
+public:
+  Pcg32(uint64_t seed = 0x853c49e6748fea9bull, uint64_t stream = 0xda3e39cb94b95bdbull) { Seed(seed, stream); }
+
+  // Restarts the generator with the given seed and stream
+  void Seed(uint64_t seed, uint64_t stream = 0xda3e39cb94b95bdbull)
+  {
+    _state = 0;
+    _increment = (stream << 1) | 1;
+    Step();
+    _state += seed;
+    Step();
+  }
+
+  // Returns the stream the generator was seeded with
+  uint64_t GetStream() const { return _increment >> 1; }
+
+  // Returns the next 32 random bits
+  uint32_t Next()
+  {
+    const uint64_t old = _state;
+    Step();
+    const uint32_t xorShifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+    const uint32_t rotation = static_cast<uint32_t>(old >> 59);
+    return (xorShifted >> rotation) | (xorShifted << ((0u - rotation) & 31));
+  }
+
+  // Returns a random number from the [0, 1) range
+  float NextFloat()
+  {
+    return static_cast<float>(Next() >> 8) * (1.0f / 16777216.0f);
+  }
+
+  // Returns a random number from the [min, max) range
+  float NextFloat(float min, float max)
+  {
+    return min + (max - min) * NextFloat();
+  }
+
+  // Skips the given number of outputs
+  void Advance(uint64_t delta)
+  {
+    // Composes the LCG step with itself by squaring, see Brown: Random Number Generation with Arbitrary Strides
+    uint64_t multiplier = MULTIPLIER, increment = _increment;
+    uint64_t accMultiplier = 1, accIncrement = 0;
+    while (delta > 0)
+    {
+      if (delta & 1)
+      {
+        accMultiplier *= multiplier;
+        accIncrement = accIncrement * multiplier + increment;
+      }
+      increment = (multiplier + 1) * increment;
+      multiplier *= multiplier;
+      delta >>= 1;
+    }
+    _state = accMultiplier * _state + accIncrement;
+  }
+
+  // Fills the array with random numbers from the [min, max) range, the same numbers NextFloat(min, max)
+  // would return, the LCG steps are serial but the conversion to floats runs 4 at a time
+  void FillUniform(float *out, size_t count, float min, float max)
+  {
+    const __m128 scale = _mm_set1_ps(max - min);
+    const __m128 offset = _mm_set1_ps(min);
+    const __m128 toFloat = _mm_set1_ps(1.0f / 16777216.0f);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+      const uint32_t a = Next(), b = Next(), c = Next(), d = Next();
+      const __m128i bits = _mm_srli_epi32(_mm_setr_epi32(a, b, c, d), 8);
+      const __m128 unit = _mm_mul_ps(_mm_cvtepi32_ps(bits), toFloat);
+      _mm_storeu_ps(out + i, _mm_add_ps(offset, _mm_mul_ps(scale, unit)));
+    }
+
+    for (; i < count; ++i)
+      out[i] = NextFloat(min, max);
+  }
+
+private:
+  static const uint64_t MULTIPLIER = 6364136223846793005ull;
+
+  // Single LCG step
+  void Step() { _state = _state * MULTIPLIER + _increment; }
+
+  uint64_t _state;
+  uint64_t _increment;
+};
+
+// Returns the generator of the calling thread, each thread gets its own stream in the order of the first use
+inline Pcg32 &getThreadRandom()
+{
+  static std::atomic<uint64_t> nextStream(0);
+  thread_local Pcg32 generator(0x853c49e6748fea9bull, nextStream++);
+  return generator;
+}
+
+// Restarts the generator of the calling thread with the given seed, the thread keeps its own stream
+inline void seedRandom(uint64_t seed)
+{
+  Pcg32 &generator = getThreadRandom();
+  generator.Seed(seed, generator.GetStream());
+}
+
+// Fills the array with random numbers from the [min, max) range using the generator of the calling thread
+inline void fillUniform(float *out, size_t count, float min, float max)
+{
+  getThreadRandom().FillUniform(out, count, min, max);
+}
@@ -14,8 +14,8 @@ public:
   // Maximum length for logging purposes
   static const unsigned int MAX_LOG_LENGTH = 1024;
 
-  // Compiles shader of a specified type
-  static GLuint CompileShader(const char* source[], int index, GLenum type);
+  // Compiles shader of a specified type, optional defines are inserted right after the #version line
+  static GLuint CompileShader(const char* source[], int index, GLenum type, const char* defines = nullptr);
   // Links specified program
   static bool LinkProgram(GLuint program);
 };
\ No newline at end of file
@@ -25,6 +25,8 @@ public:
   static GLuint CreateSingleColorTexture(unsigned char r, unsigned char g, unsigned char b);
   // Create mip-map chain testing texture
   static GLuint CreateMipMapTestTexture();
+  // Create the SMAA area texture for edge search distances up to maxDistance, see the definition for the layout
+  static GLuint CreateSmaaAreaTexture(unsigned int maxDistance);
   // Load texture from file stored on the disk
   static GLuint LoadTexture(const char name[], bool sRGB);
   // Create all samplers
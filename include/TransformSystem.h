@@ -0,0 +1,90 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Handle of a transformation node, stays valid while the nodes are reordered
+typedef unsigned int TransformHandle;
+// Handle of no node, i.e., parent of the root nodes
+static const TransformHandle INVALID_TRANSFORM = ~0u;
+
+// Hierarchy of transformations: local translation, rotation and scale are stored as structure of arrays
+// sorted by the hierarchy level, world transformations are computed level by level in parallel using
+// AVX2 kernels processing 8 nodes at a time and stored transposed as mat3x4 ready for the GPU
+class TransformSystem
+{
+public:
+  // Number of nodes processed by a single SIMD kernel call
+  static const unsigned int BATCH_SIZE = 8;
+  // Number of nodes per parallel job, multiple of BATCH_SIZE
+  static const unsigned int JOB_SIZE = 1024;
+
+  TransformSystem() {}
+
+  // Creates a node with identity local transformation, the parent must already exist
+  TransformHandle Create(TransformHandle parent = INVALID_TRANSFORM);
+  // Removes all nodes
+  void Clear();
+  // Returns the number of nodes
+  unsigned int GetCount() const { return static_cast<unsigned int>(_handleOf.size()); }
+
+  // Sets the local transformation relative to the parent
+  void SetLocal(TransformHandle node, const glm::vec3 &translation, const glm::quat &rotation, const glm::vec3 &scale = glm::vec3(1.0f));
+  void SetTranslation(TransformHandle node, const glm::vec3 &translation);
+  void SetRotation(TransformHandle node, const glm::quat &rotation);
+  void SetScale(TransformHandle node, const glm::vec3 &scale);
+  // Returns the local translation
+  glm::vec3 GetTranslation(TransformHandle node) const;
+
+  // Returns the transposed world transformation computed by the last Update()
+  const glm::mat3x4 &GetWorld(TransformHandle node) const { return _world[_indexOf[node]]; }
+  // Returns the world position computed by the last Update()
+  glm::vec3 GetWorldPosition(TransformHandle node) const;
+
+  // Computes the world transformations of all nodes, levels in order, nodes within a level in parallel
+  void Update();
+  // Enables the SIMD kernels if the CPU supports them, scalar code is used otherwise
+  void SetSimd(bool enabled) { _simd = enabled; }
+  // Returns true if the last Update() used the SIMD kernels
+  bool IsSimdUsed() const { return _simdUsed; }
+  // Returns the throughput of the last Update() in transforms per millisecond
+  double GetThroughput() const { return _throughput; }
+
+private:
+  // No copies allowed
+  TransformSystem(const TransformSystem &);
+  TransformSystem & operator = (const TransformSystem &);
+
+  // Reorders the nodes by their hierarchy level, parents thus always precede their children
+  void SortLevels();
+
+  // Local translation, rotation and scale, one array per component
+  std::vector<float> _tx, _ty, _tz;
+  std::vector<float> _qx, _qy, _qz, _qw;
+  std::vector<float> _sx, _sy, _sz;
+  // Parent index, -1 for the root nodes
+  std::vector<int> _parent;
+  // Hierarchy level, 0 for the root nodes
+  std::vector<unsigned int> _level;
+  // World transformations
+  std::vector<glm::mat3x4> _world;
+  // Mapping between the handles and the indices
+  std::vector<unsigned int> _indexOf;
+  std::vector<TransformHandle> _handleOf;
+  // First node of each level, the last item is the number of nodes
+  std::vector<unsigned int> _levelBegin;
+  // Are the nodes sorted by level?
+  bool _sorted = true;
+
+  // Use the SIMD kernels?
+  bool _simd = true;
+  bool _simdUsed = false;
+  // Transforms per millisecond of the last update
+  double _throughput = 0.0;
+};
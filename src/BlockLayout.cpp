@@ -0,0 +1,146 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include <BlockLayout.h>
+
+#include <cstdio>
+#include <string>
+
+// Layout of a block variable as reported by the program
+struct VariableLayout
+{
+  GLint offset;
+  GLint arrayStride;
+  GLint matrixStride;
+};
+
+// Queries the layout of the block variable, returns false if the program doesn't have it
+static bool getVariableLayout(GLuint program, BlockLayout::Rule rule, const std::string &name, VariableLayout &layout)
+{
+  if (rule == BlockLayout::Std140)
+  {
+    // Uniform blocks are queried through the uniform interface, available since OpenGL 3.1
+    const GLchar *names[] = {name.c_str()};
+    GLuint index = GL_INVALID_INDEX;
+    glGetUniformIndices(program, 1, names, &index);
+    if (index == GL_INVALID_INDEX)
+      return false;
+
+    glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_OFFSET, &layout.offset);
+    glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_ARRAY_STRIDE, &layout.arrayStride);
+    glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_MATRIX_STRIDE, &layout.matrixStride);
+  }
+  else
+  {
+    // Shader storage blocks need the program interface query of OpenGL 4.3
+    GLuint index = glGetProgramResourceIndex(program, GL_BUFFER_VARIABLE, name.c_str());
+    if (index == GL_INVALID_INDEX)
+      return false;
+
+    const GLenum properties[] = {GL_OFFSET, GL_ARRAY_STRIDE, GL_MATRIX_STRIDE};
+    GLint values[3] = {0};
+    glGetProgramResourceiv(program, GL_BUFFER_VARIABLE, index, 3, properties, 3, nullptr, values);
+    layout.offset = values[0];
+    layout.arrayStride = values[1];
+    layout.matrixStride = values[2];
+  }
+
+  return true;
+}
+
+// Queries the size of the block, returns -1 if the program doesn't have it
+static GLint getBlockSize(GLuint program, BlockLayout::Rule rule, const char *blockName)
+{
+  GLint size = -1;
+  if (rule == BlockLayout::Std140)
+  {
+    GLuint index = glGetUniformBlockIndex(program, blockName);
+    if (index != GL_INVALID_INDEX)
+      glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+  }
+  else
+  {
+    GLuint index = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, blockName);
+    if (index != GL_INVALID_INDEX)
+    {
+      const GLenum property = GL_BUFFER_DATA_SIZE;
+      glGetProgramResourceiv(program, GL_SHADER_STORAGE_BLOCK, index, 1, &property, 1, nullptr, &size);
+    }
+  }
+  return size;
+}
+
+bool BlockLayout::Verify(GLuint program, const char *blockName, Rule rule, const Member *members, size_t numMembers, size_t structSize,
+                         const char *arrayName, unsigned int count)
+{
+  const GLint blockSize = getBlockSize(program, rule, blockName);
+  if (blockSize < 0)
+  {
+    printf("Block %s isn't active in program %u!\n", blockName, program);
+    return false;
+  }
+
+  // Members of the struct array are named "array[i].member", arrays of basic types "member[0]"
+  auto getName = [arrayName](const Member &member, unsigned int element)
+  {
+    const std::string prefix = arrayName ? std::string(arrayName) + "[" + std::to_string(element) + "]." : std::string();
+    return prefix + member.name + (member.arraySize > 0 ? "[0]" : "");
+  };
+
+  bool valid = true;
+  for (size_t i = 0; i < numMembers; ++i)
+  {
+    const Member &member = members[i];
+    const std::string name = getName(member, 0);
+
+    VariableLayout layout;
+    if (!getVariableLayout(program, rule, name, layout))
+    {
+      printf("Block %s: member %s not found!\n", blockName, name.c_str());
+      valid = false;
+      continue;
+    }
+
+    if (layout.offset != static_cast<GLint>(member.offset))
+    {
+      printf("Block %s: member %s at offset %d, C++ struct has %zu!\n", blockName, name.c_str(), layout.offset, member.offset);
+      valid = false;
+    }
+
+    if (layout.arrayStride != static_cast<GLint>(GetArrayStride(member, rule)))
+    {
+      printf("Block %s: member %s has array stride %d, C++ struct has %zu!\n", blockName, name.c_str(), layout.arrayStride, GetArrayStride(member, rule));
+      valid = false;
+    }
+
+    if (layout.matrixStride != static_cast<GLint>(GetMatrixStride(member.type, rule)))
+    {
+      printf("Block %s: member %s has matrix stride %d, C++ struct has %zu!\n", blockName, name.c_str(), layout.matrixStride, GetMatrixStride(member.type, rule));
+      valid = false;
+    }
+  }
+
+  if (arrayName && numMembers > 0 && count > 1)
+  {
+    // Stride of the struct array is the distance of the first member in two consecutive elements
+    VariableLayout first, next;
+    if (getVariableLayout(program, rule, getName(members[0], 0), first) && getVariableLayout(program, rule, getName(members[0], 1), next) &&
+        next.offset - first.offset != static_cast<GLint>(structSize))
+    {
+      printf("Block %s: array %s has stride %d, C++ struct has %zu!\n", blockName, arrayName, next.offset - first.offset, structSize);
+      valid = false;
+    }
+  }
+
+  // Block holds either the struct itself or the array of structs, std140 blocks may be padded to vec4
+  const size_t expectedSize = arrayName ? count * structSize : structSize;
+  if (static_cast<size_t>(blockSize) != expectedSize && static_cast<size_t>(blockSize) != RoundUp(expectedSize, 16))
+  {
+    printf("Block %s has %d B, C++ side expects %zu B!\n", blockName, blockSize, expectedSize);
+    valid = false;
+  }
+
+  return valid;
+}
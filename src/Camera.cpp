@@ -10,6 +10,10 @@
 Camera::Camera():
   _worldToView(1.0f),
   _projection(1.0f),
+  _unjitteredProjection(1.0f),
+  _jitter(0.0f),
+  _previousWorldToView(1.0f),
+  _previousProjection(1.0f),
   _movementSpeed(5.0f),
   _sensitivity(0.002f)
 {}
@@ -23,9 +27,53 @@ void Camera::SetTransformation(const glm::vec3& eye, const glm::vec3& lookAt, co
 void Camera::SetProjection(float fov, float aspect, float nearClip, float farClip)
 {
   // Make sure you convert from degrees to radians as glm uses radians from 0.9.6 version
-  _projection = glm::perspective(glm::radians(fov), aspect, nearClip, farClip);
+  _unjitteredProjection = glm::perspective(glm::radians(fov), aspect, nearClip, farClip);
   _nearClip = nearClip;
   _farClip = farClip;
+
+  // Keep the jitter of the current frame
+  ApplyJitter();
+}
+
+void Camera::SetJitter(unsigned int frameIndex, int width, int height)
+{
+  // Minimized window has no pixels to jitter across
+  if (width <= 0 || height <= 0)
+  {
+    ClearJitter();
+    return;
+  }
+
+  // 8 samples of the Halton (2, 3) sequence cover the pixel evenly, skip the first one at the origin
+  const unsigned int index = (frameIndex % 8) + 1;
+  const glm::vec2 sample(halton(index, 2), halton(index, 3));
+
+  // Offset by [-0.5, 0.5] pixel, one pixel is 2 / size in NDC
+  _jitter = glm::vec2((sample.x - 0.5f) * 2.0f / width, (sample.y - 0.5f) * 2.0f / height);
+
+  ApplyJitter();
+}
+
+void Camera::ClearJitter()
+{
+  _jitter = glm::vec2(0.0f);
+  _projection = _unjitteredProjection;
+}
+
+void Camera::ApplyJitter()
+{
+  // Perspective projection has w = z in the left handed system (GLM_FORCE_LEFT_HANDED) and w = -z otherwise,
+  // offsetting the z column by the jitter times the sign of w shifts x/w and y/w by +jitter in NDC
+  const float wSign = _unjitteredProjection[2][3];
+  _projection = _unjitteredProjection;
+  _projection[2][0] += _jitter.x * wSign;
+  _projection[2][1] += _jitter.y * wSign;
+}
+
+void Camera::StorePreviousFrame()
+{
+  _previousWorldToView = _worldToView;
+  _previousProjection = _unjitteredProjection;
 }
 
 void Camera::Move(MovementDirections direction, const glm::vec2& mouseMove, float dt)
@@ -0,0 +1,76 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include <DepthSort.h>
+
+#include <cstring>
+
+// Number of radix sort passes covering all 32 bits of the key
+static const unsigned int NUM_PASSES = (32 + DepthSort::RADIX_BITS - 1) / DepthSort::RADIX_BITS;
+// Number of buckets per pass
+static const unsigned int NUM_BUCKETS = 1u << DepthSort::RADIX_BITS;
+
+// Converts the float to an unsigned integer with the same ordering: negative values have all bits flipped,
+// positive ones only the sign bit
+static uint32_t floatToOrderedKey(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits ^ ((bits & 0x80000000u) ? 0xffffffffu : 0x80000000u);
+}
+
+const std::vector<unsigned int> &DepthSort::FrontToBack(const glm::mat4x4 &worldToView, const glm::vec3 *positions, unsigned int count)
+{
+  for (int i = 0; i < 2; ++i)
+  {
+    _keys[i].resize(count);
+    _order[i].resize(count);
+  }
+
+  // View depth is the z row of the world to view transformation, left handed view space looks down +z
+  const glm::vec4 depthRow(worldToView[0][2], worldToView[1][2], worldToView[2][2], worldToView[3][2]);
+
+  // Keys and histograms of all passes in a single sweep
+  _histograms.assign(NUM_PASSES * NUM_BUCKETS, 0);
+  unsigned int *histograms = _histograms.data();
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    const float depth = glm::dot(depthRow, glm::vec4(positions[i], 1.0f));
+    const uint32_t key = floatToOrderedKey(depth);
+    _keys[0][i] = key;
+    _order[0][i] = i;
+    for (unsigned int pass = 0; pass < NUM_PASSES; ++pass)
+      ++histograms[pass * NUM_BUCKETS + ((key >> (pass * RADIX_BITS)) & (NUM_BUCKETS - 1))];
+  }
+
+  // Stable scatter pass by pass, from the least significant digit
+  int source = 0;
+  for (unsigned int pass = 0; pass < NUM_PASSES; ++pass)
+  {
+    // Prefix sums give the first slot of each bucket
+    unsigned int *histogram = histograms + pass * NUM_BUCKETS;
+    unsigned int sum = 0;
+    for (unsigned int bucket = 0; bucket < NUM_BUCKETS; ++bucket)
+    {
+      const unsigned int bucketSize = histogram[bucket];
+      histogram[bucket] = sum;
+      sum += bucketSize;
+    }
+
+    const uint32_t *keys = _keys[source].data();
+    const unsigned int *order = _order[source].data();
+    uint32_t *outKeys = _keys[source ^ 1].data();
+    unsigned int *outOrder = _order[source ^ 1].data();
+    for (unsigned int i = 0; i < count; ++i)
+    {
+      const unsigned int slot = histogram[(keys[i] >> (pass * RADIX_BITS)) & (NUM_BUCKETS - 1)]++;
+      outKeys[slot] = keys[i];
+      outOrder[slot] = order[i];
+    }
+    source ^= 1;
+  }
+
+  return _order[source];
+}
@@ -0,0 +1,195 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include <EntityStorage.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+// Size and alignment of a registered component type
+struct ComponentInfo
+{
+  size_t size;
+  size_t alignment;
+};
+
+// Registered component types, shared by all storages
+static std::vector<ComponentInfo> &getComponentInfos()
+{
+  static std::vector<ComponentInfo> infos;
+  return infos;
+}
+
+// Guards the registration, the ids may be first requested from the jobs
+static std::mutex &getComponentMutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
+// Rounds the offset up to the alignment
+static size_t alignOffset(size_t offset, size_t alignment)
+{
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+// ----------------------------------------------------------------------------
+
+unsigned int EntityStorage::RegisterComponent(size_t size, size_t alignment)
+{
+  std::lock_guard<std::mutex> lock(getComponentMutex());
+  std::vector<ComponentInfo> &infos = getComponentInfos();
+  assert(infos.size() < MAX_COMPONENTS && alignment <= ARRAY_ALIGNMENT);
+  infos.push_back({size, alignment});
+  return static_cast<unsigned int>(infos.size() - 1);
+}
+
+size_t EntityStorage::GetComponentSize(unsigned int id)
+{
+  std::lock_guard<std::mutex> lock(getComponentMutex());
+  return getComponentInfos()[id].size;
+}
+
+unsigned int EntityStorage::GetArchetype(ComponentMask mask)
+{
+  auto it = _archetypeLookup.find(mask);
+  if (it != _archetypeLookup.end())
+    return it->second;
+
+  Archetype archetype;
+  archetype.mask = mask;
+  archetype.offsets.assign(MAX_COMPONENTS, 0);
+
+  // Bytes per entity, each array may need up to a cache line of padding
+  size_t entityBytes = sizeof(Entity);
+  size_t padding = ARRAY_ALIGNMENT;
+  for (unsigned int id = 0; id < MAX_COMPONENTS; ++id)
+  {
+    if (mask & (ComponentMask(1) << id))
+    {
+      entityBytes += GetComponentSize(id);
+      padding += ARRAY_ALIGNMENT;
+    }
+  }
+  archetype.capacity = static_cast<unsigned int>((CHUNK_SIZE - padding) / entityBytes);
+  assert(archetype.capacity > 0);
+
+  // Lay out the arrays, each starting on a cache line
+  size_t offset = 0;
+  archetype.entitiesOffset = offset;
+  offset = alignOffset(offset + archetype.capacity * sizeof(Entity), ARRAY_ALIGNMENT);
+  for (unsigned int id = 0; id < MAX_COMPONENTS; ++id)
+  {
+    if (mask & (ComponentMask(1) << id))
+    {
+      archetype.offsets[id] = offset;
+      offset = alignOffset(offset + archetype.capacity * GetComponentSize(id), ARRAY_ALIGNMENT);
+    }
+  }
+
+  const unsigned int index = static_cast<unsigned int>(_archetypes.size());
+  _archetypes.push_back(archetype);
+  _archetypeLookup[mask] = index;
+  return index;
+}
+
+EntityStorage::EntityRecord EntityStorage::AllocateRow(unsigned int archetypeIndex)
+{
+  Archetype &archetype = _archetypes[archetypeIndex];
+
+  // Start a new chunk if the last one is full
+  if (archetype.chunks.empty() || archetype.chunks.back().count == archetype.capacity)
+  {
+    Chunk chunk;
+    chunk.memory = static_cast<unsigned char*>(malloc(CHUNK_SIZE + ARRAY_ALIGNMENT));
+    chunk.data = chunk.memory + (ARRAY_ALIGNMENT - reinterpret_cast<uintptr_t>(chunk.memory) % ARRAY_ALIGNMENT) % ARRAY_ALIGNMENT;
+    chunk.count = 0;
+    archetype.chunks.push_back(chunk);
+  }
+
+  EntityRecord record;
+  record.archetype = archetypeIndex;
+  record.chunk = static_cast<unsigned int>(archetype.chunks.size() - 1);
+  record.row = archetype.chunks.back().count++;
+  record.generation = 0;
+  record.alive = true;
+  return record;
+}
+
+bool EntityStorage::IsAlive(Entity entity) const
+{
+  return entity.index < _records.size() && _records[entity.index].alive && _records[entity.index].generation == entity.generation;
+}
+
+void EntityStorage::Destroy(Entity entity)
+{
+  if (!IsAlive(entity))
+    return;
+
+  EntityRecord &record = _records[entity.index];
+  Archetype &archetype = _archetypes[record.archetype];
+  Chunk &chunk = archetype.chunks[record.chunk];
+  Chunk &last = archetype.chunks.back();
+  const unsigned int lastRow = last.count - 1;
+
+  // Move the last entity of the archetype to the freed row, keeps all chunks but the last one full
+  if (&chunk != &last || record.row != lastRow)
+  {
+    for (unsigned int id = 0; id < MAX_COMPONENTS; ++id)
+    {
+      if (archetype.mask & (ComponentMask(1) << id))
+      {
+        const size_t size = GetComponentSize(id);
+        memcpy(GetArray(archetype, chunk, id) + record.row * size, GetArray(archetype, last, id) + lastRow * size, size);
+      }
+    }
+
+    const Entity moved = GetEntities(archetype, last)[lastRow];
+    GetEntities(archetype, chunk)[record.row] = moved;
+    _records[moved.index].chunk = record.chunk;
+    _records[moved.index].row = record.row;
+  }
+
+  // Release the last chunk once empty
+  if (--last.count == 0)
+  {
+    free(last.memory);
+    archetype.chunks.pop_back();
+  }
+
+  record.alive = false;
+  ++record.generation;
+  _freeRecords.push_back(entity.index);
+  --_numEntities;
+}
+
+void EntityStorage::Clear()
+{
+  for (Archetype &archetype : _archetypes)
+  {
+    for (Chunk &chunk : archetype.chunks)
+      free(chunk.memory);
+  }
+
+  _archetypes.clear();
+  _archetypeLookup.clear();
+
+  // Keep the records so that the handles from before the clear don't match the entities reusing their indices,
+  // free them in reverse so that the lowest indices are reused first
+  _freeRecords.clear();
+  for (size_t i = _records.size(); i-- > 0;)
+  {
+    EntityRecord &record = _records[i];
+    if (record.alive)
+    {
+      record.alive = false;
+      ++record.generation;
+    }
+    _freeRecords.push_back(static_cast<unsigned int>(i));
+  }
+  _numEntities = 0;
+}
@@ -558,6 +558,54 @@ Mesh<Vertex_Pos_Nrm> *Geometry::CreateTetrahedron()
   return mesh;
 }
 
+Mesh<Vertex_Pos_Nrm> *Geometry::CreateTetrahedronShared()
+{
+  // Create the vertex buffer for a tetrahedron
+  std::vector<Vertex_Pos_Nrm> vb;
+  vb.reserve(4);
+
+  // Define vertices, same as the regular tetrahedron
+  glm::vec3 v0 = glm::vec3(-0.5f, -0.3f, -0.5f);
+  glm::vec3 v1 = glm::vec3( 0.5f, -0.3f, -0.5f);
+  glm::vec3 v2 = glm::vec3( 0.0f, -0.3f,  1.5f);
+  glm::vec3 v3 = glm::vec3( 0.0f,  0.2f,  0.0f);
+
+  // Calculate edges
+  glm::vec3 e0 = v1 - v0;
+  glm::vec3 e1 = v2 - v0;
+  glm::vec3 e2 = v3 - v0;
+  glm::vec3 e3 = v3 - v1;
+  glm::vec3 e4 = v2 - v1;
+
+  // Calculate face normals (bottom, left, back, right)
+  glm::vec3 n0 = glm::normalize(glm::cross(e0, e1));
+  glm::vec3 n1 = glm::normalize(glm::cross(e1, e2));
+  glm::vec3 n2 = glm::normalize(glm::cross(e2, e0));
+  glm::vec3 n3 = glm::normalize(glm::cross(e3, e4));
+
+  // Vertex normals are averages of the adjacent face normals
+  glm::vec3 vn0 = glm::normalize(n0 + n1 + n2);
+  glm::vec3 vn1 = glm::normalize(n0 + n2 + n3);
+  glm::vec3 vn2 = glm::normalize(n0 + n1 + n3);
+  glm::vec3 vn3 = glm::normalize(n1 + n2 + n3);
+
+  vb.push_back({v0.x, v0.y, v0.z, vn0.x, vn0.y, vn0.z}); // 0
+  vb.push_back({v1.x, v1.y, v1.z, vn1.x, vn1.y, vn1.z}); // 1
+  vb.push_back({v2.x, v2.y, v2.z, vn2.x, vn2.y, vn2.z}); // 2
+  vb.push_back({v3.x, v3.y, v3.z, vn3.x, vn3.y, vn3.z}); // 3
+
+  // Fill in the index buffer (bottom, left, back, right)
+  std::vector<GLuint> ib = {0, 2, 1,
+                            0, 3, 2,
+                            0, 1, 3,
+                            1, 2, 3};
+
+  // Create, initialize and return the mesh
+  Mesh<Vertex_Pos_Nrm> *mesh = new Mesh<Vertex_Pos_Nrm>();
+  mesh->Init(vb, ib);
+  return mesh;
+}
+
 Mesh<Vertex_Pos> *Geometry::CreateIcosahedron()
 {
   // Create the vertex buffer for an icosahedron
@@ -0,0 +1,42 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include <GpuTimer.h>
+
+GpuTimer::~GpuTimer()
+{
+  if (_queries[0])
+    glDeleteQueries(QUERY_LATENCY, _queries);
+}
+
+void GpuTimer::Begin()
+{
+  if (!_queries[0])
+    glGenQueries(QUERY_LATENCY, _queries);
+
+  // Reuse the oldest query, its result should be long available
+  if (_pending[_next])
+    Collect(_next);
+
+  glBeginQuery(GL_TIME_ELAPSED, _queries[_next]);
+}
+
+void GpuTimer::End()
+{
+  glEndQuery(GL_TIME_ELAPSED);
+  _pending[_next] = true;
+  _next = (_next + 1) % QUERY_LATENCY;
+}
+
+void GpuTimer::Collect(int query)
+{
+  GLuint64 nanoseconds = 0;
+  glGetQueryObjectui64v(_queries[query], GL_QUERY_RESULT, &nanoseconds);
+  _pending[query] = false;
+
+  // Exponential moving average keeps the number readable in the window title
+  const float milliseconds = static_cast<float>(nanoseconds * 1e-6);
+  _milliseconds = _milliseconds > 0.0f ? 0.9f * _milliseconds + 0.1f * milliseconds : milliseconds;
+}
@@ -0,0 +1,181 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <HdrFormat.h>
+#include <ShaderCompiler.h>
+
+// Number of texels of the measurement target, each accumulates a different magnitude
+static const int MEASUREMENT_WIDTH = 64;
+// Magnitude of the texel is 2^(x * MEASUREMENT_STEP + MEASUREMENT_BIAS), i.e., 2^-8 to 2^8, must match the shader
+static const float MEASUREMENT_STEP = 0.25f;
+static const float MEASUREMENT_BIAS = -8.0f;
+
+// Shaders of the measurement, fullscreen triangle adding a light contribution of a different magnitude per texel
+static const char *measurementShaders[] =
+{
+R"(
+#version 330 core
+
+void main()
+{
+  const vec2 position[3] = vec2[3](vec2(-1.0f, -1.0f), vec2(3.0f, -1.0f), vec2(-1.0f, 3.0f));
+  gl_Position = vec4(position[gl_VertexID], 0.0f, 1.0f);
+}
+)",
+R"(
+#version 330 core
+
+const vec3 contribution = vec3(0.9f, 0.6f, 0.3f);
+const float step = 0.25f;
+const float bias = -8.0f;
+
+layout (location = 0) out vec4 color;
+
+void main()
+{
+  color = vec4(contribution * exp2(floor(gl_FragCoord.x) * step + bias), 1.0f);
+}
+)"
+};
+
+// Same contribution as in the shader
+static const float contribution[3] = {0.9f, 0.6f, 0.3f};
+
+float HdrFormat::_measuredError = -1.0f;
+
+GLenum HdrFormat::Select(Policy policy)
+{
+  if (policy == HalfFloat)
+    return GL_RGB16F;
+
+  // Measure just once, the rounding doesn't change at runtime
+  if (_measuredError < 0.0f)
+  {
+    _measuredError = MeasureError();
+    printf("R11G11B10F relative error after %d additive passes: %.2f%% (max %.2f%%)\n", ACCUMULATION_PASSES,
+           _measuredError * 100.0f, MAX_RELATIVE_ERROR * 100.0f);
+  }
+
+  if (policy == Packed || _measuredError <= MAX_RELATIVE_ERROR)
+    return GL_R11F_G11F_B10F;
+
+  return GL_RGB16F;
+}
+
+const char *HdrFormat::GetName(Policy policy)
+{
+  switch (policy)
+  {
+  case Auto: return "auto";
+  case Packed: return "R11G11B10F";
+  case HalfFloat: return "RGB16F";
+  default: return "unknown";
+  }
+}
+
+float HdrFormat::MeasureError()
+{
+  // Store the state we're going to change, the measurement may run in the middle of the initialization
+  GLint framebuffer = 0, texture = 0, program = 0, vao = 0, viewport[4] = {0};
+  GLint blendSrcRgb = 0, blendDstRgb = 0, blendSrcAlpha = 0, blendDstAlpha = 0, blendEqRgb = 0, blendEqAlpha = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+  glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glGetIntegerv(GL_BLEND_SRC_RGB, &blendSrcRgb);
+  glGetIntegerv(GL_BLEND_DST_RGB, &blendDstRgb);
+  glGetIntegerv(GL_BLEND_SRC_ALPHA, &blendSrcAlpha);
+  glGetIntegerv(GL_BLEND_DST_ALPHA, &blendDstAlpha);
+  glGetIntegerv(GL_BLEND_EQUATION_RGB, &blendEqRgb);
+  glGetIntegerv(GL_BLEND_EQUATION_ALPHA, &blendEqAlpha);
+  const GLboolean blend = glIsEnabled(GL_BLEND);
+  const GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+  const GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+
+  // Measurement target
+  GLuint target = 0, fbo = 0;
+  glGenTextures(1, &target);
+  glBindTexture(GL_TEXTURE_2D, target);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, MEASUREMENT_WIDTH, 1, 0, GL_RGB, GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+
+  // Measurement program
+  GLuint vertexShader = ShaderCompiler::CompileShader(measurementShaders, 0, GL_VERTEX_SHADER);
+  GLuint fragmentShader = ShaderCompiler::CompileShader(measurementShaders, 1, GL_FRAGMENT_SHADER);
+  GLuint measurementProgram = glCreateProgram();
+  glAttachShader(measurementProgram, vertexShader);
+  glAttachShader(measurementProgram, fragmentShader);
+  bool linked = vertexShader && fragmentShader && ShaderCompiler::LinkProgram(measurementProgram);
+  glDeleteShader(vertexShader);
+  glDeleteShader(fragmentShader);
+
+  // Can't render to the format at all, treat it as the maximum error
+  float error = 1.0f;
+  if (linked && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE)
+  {
+    // Empty VAO, the triangle is generated from gl_VertexID
+    GLuint emptyVao = 0;
+    glGenVertexArrays(1, &emptyVao);
+    glBindVertexArray(emptyVao);
+    glUseProgram(measurementProgram);
+
+    // Accumulate the passes the same way as the lights do
+    glViewport(0, 0, MEASUREMENT_WIDTH, 1);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_DEPTH_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendFunc(GL_ONE, GL_ONE);
+    for (int i = 0; i < ACCUMULATION_PASSES; ++i)
+    {
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    // Compare with the exact sum, the readback stalls but it's done just once
+    float result[MEASUREMENT_WIDTH * 3] = {0.0f};
+    glReadPixels(0, 0, MEASUREMENT_WIDTH, 1, GL_RGB, GL_FLOAT, result);
+
+    error = 0.0f;
+    for (int x = 0; x < MEASUREMENT_WIDTH; ++x)
+    {
+      const float magnitude = exp2f(x * MEASUREMENT_STEP + MEASUREMENT_BIAS);
+      for (int c = 0; c < 3; ++c)
+      {
+        const float expected = ACCUMULATION_PASSES * contribution[c] * magnitude;
+        const float relative = fabsf(result[x * 3 + c] - expected) / expected;
+        error = relative > error ? relative : error;
+      }
+    }
+
+    glDeleteVertexArrays(1, &emptyVao);
+  }
+
+  glDeleteProgram(measurementProgram);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteTextures(1, &target);
+
+  // Restore the state
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glUseProgram(program);
+  glBindVertexArray(vao);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  glBlendFuncSeparate(blendSrcRgb, blendDstRgb, blendSrcAlpha, blendDstAlpha);
+  glBlendEquationSeparate(blendEqRgb, blendEqAlpha);
+  if (blend) glEnable(GL_BLEND); else glDisable(GL_BLEND);
+  if (cullFace) glEnable(GL_CULL_FACE); else glDisable(GL_CULL_FACE);
+  if (depthTest) glEnable(GL_DEPTH_TEST); else glDisable(GL_DEPTH_TEST);
+
+  return error;
+}
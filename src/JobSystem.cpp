@@ -0,0 +1,112 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include <JobSystem.h>
+
+#include <algorithm>
+
+// Is the current thread one of the workers?
+static thread_local bool isWorkerThread = false;
+
+JobSystem& JobSystem::GetInstance()
+{
+  static JobSystem jobSystem;
+  return jobSystem;
+}
+
+JobSystem::JobSystem() : _nextChunk(0)
+{
+  // The calling thread works as well, hence one worker less than the hardware threads
+  const unsigned int numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  for (unsigned int i = 1; i < numThreads; ++i)
+    _workers.emplace_back(&JobSystem::WorkerLoop, this);
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _quit = true;
+  }
+  _wakeCondition.notify_all();
+
+  for (std::thread &worker : _workers)
+    worker.join();
+}
+
+void JobSystem::ParallelFor(unsigned int count, unsigned int grainSize, const std::function<void(unsigned int, unsigned int)> &fn)
+{
+  if (count == 0)
+    return;
+
+  grainSize = std::max(grainSize, 1u);
+  const unsigned int numChunks = (count + grainSize - 1) / grainSize;
+  if (numChunks == 1 || _workers.empty() || isWorkerThread)
+  {
+    fn(0, count);
+    return;
+  }
+
+  std::lock_guard<std::mutex> submit(_submitMutex);
+
+  // Publish the loop once no worker is active, a worker woken by the previous loop may grab the mutex only after
+  // that loop returned and it would read the loop while it's being rewritten
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _doneCondition.wait(lock, [this]() { return _activeWorkers == 0; });
+    _job = &fn;
+    _count = count;
+    _grainSize = grainSize;
+    _numChunks = numChunks;
+    _nextChunk = 0;
+    ++_generation;
+  }
+  _wakeCondition.notify_all();
+
+  // Help with the work, once there's nothing left to grab only the chunks of the active workers remain
+  ExecuteChunks();
+  std::unique_lock<std::mutex> lock(_mutex);
+  _doneCondition.wait(lock, [this]() { return _activeWorkers == 0; });
+  _job = nullptr;
+}
+
+void JobSystem::WorkerLoop()
+{
+  isWorkerThread = true;
+
+  unsigned int generation = 0;
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _wakeCondition.wait(lock, [this, generation]() { return _quit || _generation != generation; });
+      if (_quit)
+        return;
+      generation = _generation;
+      ++_activeWorkers;
+    }
+
+    ExecuteChunks();
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      --_activeWorkers;
+    }
+    _doneCondition.notify_one();
+  }
+}
+
+void JobSystem::ExecuteChunks()
+{
+  for (;;)
+  {
+    const unsigned int chunk = _nextChunk++;
+    if (chunk >= _numChunks)
+      return;
+
+    const unsigned int begin = chunk * _grainSize;
+    (*_job)(begin, std::min(begin + _grainSize, _count));
+  }
+}
@@ -0,0 +1,521 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include <MathBatch.h>
+#include <CpuFeatures.h>
+#include <MathSupport.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <immintrin.h>
+
+// ----------------------------------------------------------------------------
+// Scalar kernels, the reference for the SIMD ones
+// ----------------------------------------------------------------------------
+
+static void multiplyMatricesScalar(const glm::mat4x4 *a, const glm::mat4x4 *b, glm::mat4x4 *out, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+    out[i] = a[i] * b[i];
+}
+
+static void inverseRigidScalar(const glm::mat4x4 *in, glm::mat4x4 *out, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+    out[i] = fastMatrixInverse(in[i]);
+}
+
+static void transformPointsScalar(const glm::mat4x4 &m, const glm::vec3 *in, glm::vec3 *out, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+    out[i] = glm::vec3(m * glm::vec4(in[i], 1.0f));
+}
+
+static void transformNormalsScalar(const glm::mat4x4 &m, const glm::vec3 *in, glm::vec3 *out, size_t count)
+{
+  const glm::mat3x3 normalMatrix(m);
+  for (size_t i = 0; i < count; ++i)
+    out[i] = glm::normalize(normalMatrix * in[i]);
+}
+
+static void transformBoxesScalar(const glm::mat4x4 &m, const BoundingBox *in, BoundingBox *out, size_t count)
+{
+  // Transform the center, the extents by the absolute values of the matrix
+  const glm::mat3x3 absMatrix(glm::abs(glm::vec3(m[0])), glm::abs(glm::vec3(m[1])), glm::abs(glm::vec3(m[2])));
+  for (size_t i = 0; i < count; ++i)
+  {
+    const glm::vec3 center = glm::vec3(m * glm::vec4((in[i].min + in[i].max) * 0.5f, 1.0f));
+    const glm::vec3 extents = absMatrix * ((in[i].max - in[i].min) * 0.5f);
+    out[i].min = center - extents;
+    out[i].max = center + extents;
+  }
+}
+
+static void testSpheresPlanesScalar(const glm::vec4 *spheres, size_t count, const glm::vec4 *planes, unsigned int numPlanes, unsigned char *visible)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    unsigned char result = 1;
+    for (unsigned int p = 0; p < numPlanes; ++p)
+    {
+      if (glm::dot(glm::vec3(planes[p]), glm::vec3(spheres[i])) + planes[p].w < -spheres[i].w)
+        result = 0;
+    }
+    visible[i] = result;
+  }
+}
+
+static void computeLuminanceScalar(const glm::vec3 *colors, float *out, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+    out[i] = getLuminousIntensity(colors[i]);
+}
+
+// ----------------------------------------------------------------------------
+// SSE4.1 kernels, a single item per iteration unless the data are already in SoA layout
+// ----------------------------------------------------------------------------
+
+static CPU_TARGET_SSE41 void multiplyMatricesSse41(const glm::mat4x4 *a, const glm::mat4x4 *b, glm::mat4x4 *out, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    const float *pa = &a[i][0].x;
+    const float *pb = &b[i][0].x;
+    float *po = &out[i][0].x;
+    const __m128 a0 = _mm_loadu_ps(pa), a1 = _mm_loadu_ps(pa + 4), a2 = _mm_loadu_ps(pa + 8), a3 = _mm_loadu_ps(pa + 12);
+
+    // Each column of the result is a linear combination of the columns of a
+    for (int c = 0; c < 4; ++c)
+    {
+      const __m128 col = _mm_loadu_ps(pb + c * 4);
+      __m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(col, col, _MM_SHUFFLE(0, 0, 0, 0)));
+      r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(col, col, _MM_SHUFFLE(1, 1, 1, 1))));
+      r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(col, col, _MM_SHUFFLE(2, 2, 2, 2))));
+      r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(col, col, _MM_SHUFFLE(3, 3, 3, 3))));
+      _mm_storeu_ps(po + c * 4, r);
+    }
+  }
+}
+
+static CPU_TARGET_SSE41 void inverseRigidSse41(const glm::mat4x4 *in, glm::mat4x4 *out, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    const float *pi = &in[i][0].x;
+    float *po = &out[i][0].x;
+
+    // Transposing the columns gives the inverse rotation, the last row is zero for rigid transformations
+    __m128 r0 = _mm_loadu_ps(pi), r1 = _mm_loadu_ps(pi + 4), r2 = _mm_loadu_ps(pi + 8), r3 = _mm_setzero_ps();
+    const __m128 t = _mm_loadu_ps(pi + 12);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+    // Translation is -R^T * t with w = 1
+    __m128 translation = _mm_mul_ps(r0, _mm_shuffle_ps(t, t, _MM_SHUFFLE(0, 0, 0, 0)));
+    translation = _mm_add_ps(translation, _mm_mul_ps(r1, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1))));
+    translation = _mm_add_ps(translation, _mm_mul_ps(r2, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 2, 2, 2))));
+    translation = _mm_blend_ps(_mm_sub_ps(_mm_setzero_ps(), translation), _mm_set1_ps(1.0f), 0x8);
+
+    _mm_storeu_ps(po, r0);
+    _mm_storeu_ps(po + 4, r1);
+    _mm_storeu_ps(po + 8, r2);
+    _mm_storeu_ps(po + 12, translation);
+  }
+}
+
+// Stores xyz of the vector to the unaligned vec3
+static CPU_TARGET_SSE41 void storeVec3(glm::vec3 &out, __m128 v)
+{
+  _mm_storel_pi(reinterpret_cast<__m64*>(&out.x), v);
+  _mm_store_ss(&out.z, _mm_movehl_ps(v, v));
+}
+
+static CPU_TARGET_SSE41 void transformPointsSse41(const glm::mat4x4 &m, const glm::vec3 *in, glm::vec3 *out, size_t count)
+{
+  const __m128 c0 = _mm_loadu_ps(&m[0].x), c1 = _mm_loadu_ps(&m[1].x), c2 = _mm_loadu_ps(&m[2].x), c3 = _mm_loadu_ps(&m[3].x);
+  for (size_t i = 0; i < count; ++i)
+  {
+    __m128 r = _mm_add_ps(c3, _mm_mul_ps(c0, _mm_set1_ps(in[i].x)));
+    r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(in[i].y)));
+    r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(in[i].z)));
+    storeVec3(out[i], r);
+  }
+}
+
+static CPU_TARGET_SSE41 void transformNormalsSse41(const glm::mat4x4 &m, const glm::vec3 *in, glm::vec3 *out, size_t count)
+{
+  const __m128 c0 = _mm_loadu_ps(&m[0].x), c1 = _mm_loadu_ps(&m[1].x), c2 = _mm_loadu_ps(&m[2].x);
+  for (size_t i = 0; i < count; ++i)
+  {
+    __m128 r = _mm_mul_ps(c0, _mm_set1_ps(in[i].x));
+    r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(in[i].y)));
+    r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(in[i].z)));
+
+    // Dot product of xyz broadcast to all lanes
+    r = _mm_div_ps(r, _mm_sqrt_ps(_mm_dp_ps(r, r, 0x7F)));
+    storeVec3(out[i], r);
+  }
+}
+
+static CPU_TARGET_SSE41 void transformBoxesSse41(const glm::mat4x4 &m, const BoundingBox *in, BoundingBox *out, size_t count)
+{
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 c0 = _mm_loadu_ps(&m[0].x), c1 = _mm_loadu_ps(&m[1].x), c2 = _mm_loadu_ps(&m[2].x), c3 = _mm_loadu_ps(&m[3].x);
+  const __m128 a0 = _mm_andnot_ps(signMask, c0), a1 = _mm_andnot_ps(signMask, c1), a2 = _mm_andnot_ps(signMask, c2);
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    const __m128 boxMin = _mm_setr_ps(in[i].min.x, in[i].min.y, in[i].min.z, 0.0f);
+    const __m128 boxMax = _mm_setr_ps(in[i].max.x, in[i].max.y, in[i].max.z, 0.0f);
+    const __m128 center = _mm_mul_ps(_mm_add_ps(boxMin, boxMax), half);
+    const __m128 extents = _mm_mul_ps(_mm_sub_ps(boxMax, boxMin), half);
+
+    __m128 newCenter = _mm_add_ps(c3, _mm_mul_ps(c0, _mm_shuffle_ps(center, center, _MM_SHUFFLE(0, 0, 0, 0))));
+    newCenter = _mm_add_ps(newCenter, _mm_mul_ps(c1, _mm_shuffle_ps(center, center, _MM_SHUFFLE(1, 1, 1, 1))));
+    newCenter = _mm_add_ps(newCenter, _mm_mul_ps(c2, _mm_shuffle_ps(center, center, _MM_SHUFFLE(2, 2, 2, 2))));
+
+    __m128 newExtents = _mm_mul_ps(a0, _mm_shuffle_ps(extents, extents, _MM_SHUFFLE(0, 0, 0, 0)));
+    newExtents = _mm_add_ps(newExtents, _mm_mul_ps(a1, _mm_shuffle_ps(extents, extents, _MM_SHUFFLE(1, 1, 1, 1))));
+    newExtents = _mm_add_ps(newExtents, _mm_mul_ps(a2, _mm_shuffle_ps(extents, extents, _MM_SHUFFLE(2, 2, 2, 2))));
+
+    storeVec3(out[i].min, _mm_sub_ps(newCenter, newExtents));
+    storeVec3(out[i].max, _mm_add_ps(newCenter, newExtents));
+  }
+}
+
+static CPU_TARGET_SSE41 void testSpheresPlanesSse41(const glm::vec4 *spheres, size_t count, const glm::vec4 *planes, unsigned int numPlanes, unsigned char *visible)
+{
+  // 4 spheres at a time, transposed to SoA
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128 x = _mm_loadu_ps(&spheres[i].x), y = _mm_loadu_ps(&spheres[i + 1].x), z = _mm_loadu_ps(&spheres[i + 2].x), r = _mm_loadu_ps(&spheres[i + 3].x);
+    _MM_TRANSPOSE4_PS(x, y, z, r);
+    const __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), r);
+
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (unsigned int p = 0; p < numPlanes; ++p)
+    {
+      __m128 d = _mm_add_ps(_mm_set1_ps(planes[p].w), _mm_mul_ps(_mm_set1_ps(planes[p].x), x));
+      d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes[p].y), y));
+      d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes[p].z), z));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negRadius));
+    }
+
+    const int mask = _mm_movemask_ps(inside);
+    for (int j = 0; j < 4; ++j)
+      visible[i + j] = (mask >> j) & 1;
+  }
+
+  testSpheresPlanesScalar(spheres + i, count - i, planes, numPlanes, visible + i);
+}
+
+static CPU_TARGET_SSE41 void computeLuminanceSse41(const glm::vec3 *colors, float *out, size_t count)
+{
+  const __m128 wr = _mm_set1_ps(0.2126f), wg = _mm_set1_ps(0.7152f), wb = _mm_set1_ps(0.0722f);
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    // Load 12 floats and shuffle them to SoA: r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3
+    const float *p = &colors[i].x;
+    const __m128 v0 = _mm_loadu_ps(p), v1 = _mm_loadu_ps(p + 4), v2 = _mm_loadu_ps(p + 8);
+    const __m128 r2r3 = _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(1, 0, 2, 2));      // r2 r2 b2 r3
+    const __m128 r = _mm_shuffle_ps(v0, r2r3, _MM_SHUFFLE(3, 0, 3, 0));       // r0 r1 r2 r3
+    const __m128 g0g1 = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(0, 0, 1, 1));      // g0 g0 g1 g1
+    const __m128 g2g3 = _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(2, 2, 3, 3));      // g2 g2 g3 g3
+    const __m128 g = _mm_shuffle_ps(g0g1, g2g3, _MM_SHUFFLE(2, 0, 2, 0));     // g0 g1 g2 g3
+    const __m128 b0b1 = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(1, 1, 2, 2));      // b0 b0 b1 b1
+    const __m128 b2b3 = _mm_shuffle_ps(v2, v2, _MM_SHUFFLE(3, 3, 0, 0));      // b2 b2 b3 b3
+    const __m128 b = _mm_shuffle_ps(b0b1, b2b3, _MM_SHUFFLE(2, 0, 2, 0));     // b0 b1 b2 b3
+
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(wr, r), _mm_mul_ps(wg, g)), _mm_mul_ps(wb, b)));
+  }
+
+  computeLuminanceScalar(colors + i, out + i, count - i);
+}
+
+// ----------------------------------------------------------------------------
+// AVX2 kernels, only where the wider registers pay off, gathering the vec3 arrays to SoA
+// and scattering them back costs more than the SSE4.1 kernels spend on the math
+// ----------------------------------------------------------------------------
+
+static CPU_TARGET_AVX2 void multiplyMatricesAvx2(const glm::mat4x4 *a, const glm::mat4x4 *b, glm::mat4x4 *out, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    const float *pa = &a[i][0].x;
+    const float *pb = &b[i][0].x;
+    float *po = &out[i][0].x;
+
+    // Columns of a in both halves, two columns of the result per iteration
+    const __m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(pa));
+    const __m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(pa + 4));
+    const __m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(pa + 8));
+    const __m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(pa + 12));
+    for (int c = 0; c < 4; c += 2)
+    {
+      const __m256 cols = _mm256_loadu_ps(pb + c * 4);
+      __m256 r = _mm256_mul_ps(a3, _mm256_permute_ps(cols, _MM_SHUFFLE(3, 3, 3, 3)));
+      r = _mm256_fmadd_ps(a2, _mm256_permute_ps(cols, _MM_SHUFFLE(2, 2, 2, 2)), r);
+      r = _mm256_fmadd_ps(a1, _mm256_permute_ps(cols, _MM_SHUFFLE(1, 1, 1, 1)), r);
+      r = _mm256_fmadd_ps(a0, _mm256_permute_ps(cols, _MM_SHUFFLE(0, 0, 0, 0)), r);
+      _mm256_storeu_ps(po + c * 4, r);
+    }
+  }
+}
+
+static CPU_TARGET_AVX2 void testSpheresPlanesAvx2(const glm::vec4 *spheres, size_t count, const glm::vec4 *planes, unsigned int numPlanes, unsigned char *visible)
+{
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    // Sphere j in the lower half, sphere j + 4 in the upper one, then 4x4 transposes within the halves
+    const float *s = &spheres[i].x;
+    const __m256 s04 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(s)), _mm_loadu_ps(s + 16), 1);
+    const __m256 s15 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(s + 4)), _mm_loadu_ps(s + 20), 1);
+    const __m256 s26 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(s + 8)), _mm_loadu_ps(s + 24), 1);
+    const __m256 s37 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(s + 12)), _mm_loadu_ps(s + 28), 1);
+    const __m256 t0 = _mm256_unpacklo_ps(s04, s15), t1 = _mm256_unpackhi_ps(s04, s15);
+    const __m256 t2 = _mm256_unpacklo_ps(s26, s37), t3 = _mm256_unpackhi_ps(s26, s37);
+    const __m256 x = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 y = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 z = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2)));
+
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (unsigned int p = 0; p < numPlanes; ++p)
+    {
+      __m256 d = _mm256_fmadd_ps(_mm256_set1_ps(planes[p].x), x, _mm256_set1_ps(planes[p].w));
+      d = _mm256_fmadd_ps(_mm256_set1_ps(planes[p].y), y, d);
+      d = _mm256_fmadd_ps(_mm256_set1_ps(planes[p].z), z, d);
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negRadius, _CMP_GE_OQ));
+    }
+
+    const int mask = _mm256_movemask_ps(inside);
+    for (int j = 0; j < 8; ++j)
+      visible[i + j] = (mask >> j) & 1;
+  }
+
+  testSpheresPlanesScalar(spheres + i, count - i, planes, numPlanes, visible + i);
+}
+
+// ----------------------------------------------------------------------------
+// Dispatch
+// ----------------------------------------------------------------------------
+
+// Kernels of a single level, levels without their own version of a kernel reuse the lower one
+struct KernelTable
+{
+  void (*multiplyMatrices)(const glm::mat4x4 *, const glm::mat4x4 *, glm::mat4x4 *, size_t);
+  void (*inverseRigid)(const glm::mat4x4 *, glm::mat4x4 *, size_t);
+  void (*transformPoints)(const glm::mat4x4 &, const glm::vec3 *, glm::vec3 *, size_t);
+  void (*transformNormals)(const glm::mat4x4 &, const glm::vec3 *, glm::vec3 *, size_t);
+  void (*transformBoxes)(const glm::mat4x4 &, const BoundingBox *, BoundingBox *, size_t);
+  void (*testSpheresPlanes)(const glm::vec4 *, size_t, const glm::vec4 *, unsigned int, unsigned char *);
+  void (*computeLuminance)(const glm::vec3 *, float *, size_t);
+};
+
+static const KernelTable kernels[static_cast<int>(MathBatch::Level::NumLevels)] =
+{
+  {multiplyMatricesScalar, inverseRigidScalar, transformPointsScalar, transformNormalsScalar, transformBoxesScalar, testSpheresPlanesScalar, computeLuminanceScalar},
+  {multiplyMatricesSse41, inverseRigidSse41, transformPointsSse41, transformNormalsSse41, transformBoxesSse41, testSpheresPlanesSse41, computeLuminanceSse41},
+  {multiplyMatricesAvx2, inverseRigidSse41, transformPointsSse41, transformNormalsSse41, transformBoxesSse41, testSpheresPlanesAvx2, computeLuminanceSse41}
+};
+
+// Level used by the kernels, the supported one until changed
+static MathBatch::Level &currentLevel()
+{
+  static MathBatch::Level level = MathBatch::GetSupportedLevel();
+  return level;
+}
+
+// Kernels of the current level
+static const KernelTable &currentKernels()
+{
+  return kernels[static_cast<int>(currentLevel())];
+}
+
+MathBatch::Level MathBatch::GetSupportedLevel()
+{
+  if (cpuSupportsAvx2())
+    return Level::Avx2;
+  if (cpuSupportsSse41())
+    return Level::Sse41;
+  return Level::Scalar;
+}
+
+MathBatch::Level MathBatch::GetLevel()
+{
+  return currentLevel();
+}
+
+void MathBatch::SetLevel(Level level)
+{
+  currentLevel() = std::min(level, GetSupportedLevel());
+}
+
+const char *MathBatch::GetLevelName(Level level)
+{
+  switch (level)
+  {
+  case Level::Scalar:
+    return "Scalar";
+  case Level::Sse41:
+    return "SSE4.1";
+  case Level::Avx2:
+    return "AVX2";
+  default:
+    return "Unknown";
+  }
+}
+
+void MathBatch::MultiplyMatrices(const glm::mat4x4 *a, const glm::mat4x4 *b, glm::mat4x4 *out, size_t count)
+{
+  currentKernels().multiplyMatrices(a, b, out, count);
+}
+
+void MathBatch::InverseRigid(const glm::mat4x4 *in, glm::mat4x4 *out, size_t count)
+{
+  currentKernels().inverseRigid(in, out, count);
+}
+
+void MathBatch::TransformPoints(const glm::mat4x4 &m, const glm::vec3 *in, glm::vec3 *out, size_t count)
+{
+  currentKernels().transformPoints(m, in, out, count);
+}
+
+void MathBatch::TransformNormals(const glm::mat4x4 &m, const glm::vec3 *in, glm::vec3 *out, size_t count)
+{
+  currentKernels().transformNormals(m, in, out, count);
+}
+
+void MathBatch::TransformBoxes(const glm::mat4x4 &m, const BoundingBox *in, BoundingBox *out, size_t count)
+{
+  currentKernels().transformBoxes(m, in, out, count);
+}
+
+void MathBatch::TestSpheresPlanes(const glm::vec4 *spheres, size_t count, const glm::vec4 *planes, unsigned int numPlanes, unsigned char *visible)
+{
+  currentKernels().testSpheresPlanes(spheres, count, planes, numPlanes, visible);
+}
+
+void MathBatch::ComputeLuminance(const glm::vec3 *colors, float *out, size_t count)
+{
+  currentKernels().computeLuminance(colors, out, count);
+}
+
+// ----------------------------------------------------------------------------
+// Verification and benchmark
+// ----------------------------------------------------------------------------
+
+// Largest difference of the float arrays relative to the magnitude of the reference
+static float maxRelativeError(const float *reference, const float *result, size_t count)
+{
+  float error = 0.0f;
+  for (size_t i = 0; i < count; ++i)
+    error = std::max(error, std::abs(reference[i] - result[i]) / std::max(1.0f, std::abs(reference[i])));
+  return error;
+}
+
+void MathBatch::RunBenchmark()
+{
+  // Odd count so that the remainder loops are exercised as well
+  const size_t count = 65537;
+  const int repetitions = 20;
+  // Allowed error, the kernels may differ in the order of operations and FMA usage
+  const float tolerance = 1e-4f;
+
+  // Random rigid transformations and inputs
+  std::vector<glm::mat4x4> matricesA(count), matricesB(count);
+  std::vector<glm::vec3> points(count), normals(count), colors(count);
+  std::vector<BoundingBox> boxes(count);
+  std::vector<glm::vec4> spheres(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    const glm::vec3 axisA = glm::normalize(glm::vec3(getRandom(-1.0f, 1.0f), getRandom(-1.0f, 1.0f), 1.0f));
+    const glm::vec3 axisB = glm::normalize(glm::vec3(1.0f, getRandom(-1.0f, 1.0f), getRandom(-1.0f, 1.0f)));
+    matricesA[i] = glm::rotate(glm::translate(glm::mat4x4(1.0f), glm::vec3(getRandom(-10.0f, 10.0f), getRandom(-10.0f, 10.0f), getRandom(-10.0f, 10.0f))), getRandom(0.0f, TWO_PI), axisA);
+    matricesB[i] = glm::rotate(glm::translate(glm::mat4x4(1.0f), glm::vec3(getRandom(-10.0f, 10.0f), getRandom(-10.0f, 10.0f), getRandom(-10.0f, 10.0f))), getRandom(0.0f, TWO_PI), axisB);
+    points[i] = glm::vec3(getRandom(-10.0f, 10.0f), getRandom(-10.0f, 10.0f), getRandom(-10.0f, 10.0f));
+    normals[i] = glm::normalize(glm::vec3(getRandom(-1.0f, 1.0f), getRandom(-1.0f, 1.0f), getRandom(0.1f, 1.0f)));
+    colors[i] = glm::vec3(getRandom(0.0f, 25.0f), getRandom(0.0f, 25.0f), getRandom(0.0f, 25.0f));
+    boxes[i].min = points[i] - glm::vec3(getRandom(0.1f, 2.0f));
+    boxes[i].max = points[i] + glm::vec3(getRandom(0.1f, 2.0f));
+    spheres[i] = glm::vec4(points[i], getRandom(0.1f, 2.0f));
+  }
+  const glm::mat4x4 &m = matricesA[0];
+  const glm::vec4 planes[6] =
+  {
+    glm::vec4( 1.0f, 0.0f, 0.0f, 5.0f), glm::vec4(-1.0f, 0.0f, 0.0f, 5.0f),
+    glm::vec4( 0.0f, 1.0f, 0.0f, 5.0f), glm::vec4( 0.0f,-1.0f, 0.0f, 5.0f),
+    glm::vec4( 0.0f, 0.0f, 1.0f, 5.0f), glm::vec4( 0.0f, 0.0f,-1.0f, 5.0f)
+  };
+
+  // Reference results of the scalar kernels
+  std::vector<glm::mat4x4> refProducts(count), refInverses(count), products(count), inverses(count);
+  std::vector<glm::vec3> refPoints(count), refNormals(count), outPoints(count), outNormals(count);
+  std::vector<BoundingBox> refBoxes(count), outBoxes(count);
+  std::vector<unsigned char> refVisible(count), visible(count);
+  std::vector<float> refLuminance(count), luminance(count);
+  const KernelTable &reference = kernels[static_cast<int>(Level::Scalar)];
+  reference.multiplyMatrices(matricesA.data(), matricesB.data(), refProducts.data(), count);
+  reference.inverseRigid(matricesA.data(), refInverses.data(), count);
+  reference.transformPoints(m, points.data(), refPoints.data(), count);
+  reference.transformNormals(m, normals.data(), refNormals.data(), count);
+  reference.transformBoxes(m, boxes.data(), refBoxes.data(), count);
+  reference.testSpheresPlanes(spheres.data(), count, planes, 6, refVisible.data());
+  reference.computeLuminance(colors.data(), refLuminance.data(), count);
+
+  // Runs the kernel repeatedly, returns millions of items per second
+  auto measure = [count, repetitions](auto kernel) -> double
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < repetitions; ++r)
+      kernel();
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    return count * repetitions / elapsed.count() * 1e-6;
+  };
+
+  auto report = [tolerance](const char *name, double throughput, float error)
+  {
+    printf("  %-18s %10.1f M/s  max error %.2e %s\n", name, throughput, error, error <= tolerance ? "OK" : "FAILED");
+  };
+
+  printf("Batch math kernels, %zu items:\n", count);
+  for (int level = 0; level <= static_cast<int>(GetSupportedLevel()); ++level)
+  {
+    const KernelTable &k = kernels[level];
+    printf("%s\n", GetLevelName(static_cast<Level>(level)));
+
+    double throughput = measure([&]() { k.multiplyMatrices(matricesA.data(), matricesB.data(), products.data(), count); });
+    report("mat4 x mat4", throughput, maxRelativeError(&refProducts[0][0].x, &products[0][0].x, count * 16));
+
+    throughput = measure([&]() { k.inverseRigid(matricesA.data(), inverses.data(), count); });
+    report("rigid inverse", throughput, maxRelativeError(&refInverses[0][0].x, &inverses[0][0].x, count * 16));
+
+    throughput = measure([&]() { k.transformPoints(m, points.data(), outPoints.data(), count); });
+    report("transform points", throughput, maxRelativeError(&refPoints[0].x, &outPoints[0].x, count * 3));
+
+    throughput = measure([&]() { k.transformNormals(m, normals.data(), outNormals.data(), count); });
+    report("transform normals", throughput, maxRelativeError(&refNormals[0].x, &outNormals[0].x, count * 3));
+
+    throughput = measure([&]() { k.transformBoxes(m, boxes.data(), outBoxes.data(), count); });
+    report("transform AABBs", throughput, maxRelativeError(&refBoxes[0].min.x, &outBoxes[0].min.x, count * 6));
+
+    // Spheres exactly touching a plane may end up on either side, count the mismatches instead
+    throughput = measure([&]() { k.testSpheresPlanes(spheres.data(), count, planes, 6, visible.data()); });
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count; ++i)
+      mismatches += refVisible[i] != visible[i];
+    report("sphere-plane tests", throughput, static_cast<float>(mismatches) / count);
+
+    throughput = measure([&]() { k.computeLuminance(colors.data(), luminance.data(), count); });
+    report("luminance", throughput, maxRelativeError(refLuminance.data(), luminance.data(), count));
+  }
+}
@@ -0,0 +1,40 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include <OverdrawQuery.h>
+
+OverdrawQuery::~OverdrawQuery()
+{
+  if (_queries[0])
+    glDeleteQueries(QUERY_LATENCY, _queries);
+}
+
+void OverdrawQuery::Begin()
+{
+  if (!_queries[0])
+    glGenQueries(QUERY_LATENCY, _queries);
+
+  // Reuse the oldest query, its result should be long available
+  if (_pending[_next])
+    Collect(_next);
+
+  glBeginQuery(GL_SAMPLES_PASSED, _queries[_next]);
+}
+
+void OverdrawQuery::End(GLuint64 framebufferSamples)
+{
+  glEndQuery(GL_SAMPLES_PASSED);
+  _framebufferSamples[_next] = framebufferSamples;
+  _pending[_next] = true;
+  _next = (_next + 1) % QUERY_LATENCY;
+}
+
+void OverdrawQuery::Collect(int query)
+{
+  GLuint64 samples = 0;
+  glGetQueryObjectui64v(_queries[query], GL_QUERY_RESULT, &samples);
+  _overdraw = _framebufferSamples[query] > 0 ? static_cast<float>(static_cast<double>(samples) / _framebufferSamples[query]) : 0.0f;
+  _pending[query] = false;
+}
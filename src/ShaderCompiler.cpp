@@ -4,13 +4,29 @@
  */
 
 #include <cstdio>
+#include <cstring>
 #include <ShaderCompiler.h>
 
-GLuint ShaderCompiler::CompileShader(const char* source[], int index, GLenum type)
+GLuint ShaderCompiler::CompileShader(const char* source[], int index, GLenum type, const char* defines)
 {
   // Create and compile the shader
   GLuint shader = glCreateShader(type);
-  glShaderSource(shader, 1, source + index, nullptr);
+  if (defines)
+  {
+    // #version must be the first directive, split the source behind it and put the defines in between
+    const char *text = source[index];
+    const char *version = strstr(text, "#version");
+    const char *split = version ? strchr(version, '\n') : nullptr;
+    split = split ? split + 1 : text;
+
+    const char *strings[3] = {text, defines, split};
+    const GLint lengths[3] = {static_cast<GLint>(split - text), -1, -1};
+    glShaderSource(shader, 3, strings, lengths);
+  }
+  else
+  {
+    glShaderSource(shader, 1, source + index, nullptr);
+  }
   glCompileShader(shader);
 
   // Check that compilation was a success
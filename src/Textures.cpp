@@ -5,6 +5,8 @@
 
 #include <Textures.h>
 
+#include <algorithm>
+
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
@@ -136,6 +138,119 @@ GLuint Textures::CreateMipMapTestTexture()
   return tex;
 }
 
+// Area between the line p1-p2 and the edge (y = 0) within the pixel [x, x + 1], split by the side of the edge
+static void getAreaUnderLine(const glm::vec2 &p1, const glm::vec2 &p2, float x, float &negative, float &positive)
+{
+  negative = positive = 0.0f;
+
+  // Only the part of the pixel covered by the line counts
+  const float x1 = std::max(x, p1.x);
+  const float x2 = std::min(x + 1.0f, p2.x);
+  if (x1 >= x2)
+    return;
+
+  const float y1 = p1.y + (p2.y - p1.y) * (x1 - p1.x) / (p2.x - p1.x);
+  const float y2 = p1.y + (p2.y - p1.y) * (x2 - p1.x) / (p2.x - p1.x);
+  if (y1 * y2 >= 0.0f)
+  {
+    // Trapezoid on a single side of the edge
+    const float area = 0.5f * (y1 + y2) * (x2 - x1);
+    (area < 0.0f ? negative : positive) = std::abs(area);
+  }
+  else
+  {
+    // Line crosses the edge, two triangles on the opposite sides
+    const float xc = x1 + (x2 - x1) * y1 / (y1 - y2);
+    (y1 < 0.0f ? negative : positive) = std::abs(0.5f * y1 * (xc - x1));
+    (y2 < 0.0f ? negative : positive) = std::abs(0.5f * y2 * (x2 - xc));
+  }
+}
+
+GLuint Textures::CreateSmaaAreaTexture(unsigned int maxDistance)
+{
+  // The texture is a 4x4 grid of tiles, one for each pair of crossing edges at the left (e1) and the right (e2) end
+  // of the edge, each tile is indexed by the distances to the ends: texel (e1 * size + left, e2 * size + right).
+  // Crossing edges are a bitfield: 1 on the negative side of the edge, 2 on the positive side. The edge is
+  // revectorized to a line going from the middle of a single crossing edge to the middle or the other end,
+  // red is the area the pixel on the negative side takes from the positive one, green the other way round.
+  const unsigned int size = maxDistance + 1;
+  const unsigned int width = 4 * size;
+  const int stride = 2;
+  unsigned char *data = new unsigned char[stride * width * width];
+
+  for (unsigned int e2 = 0; e2 < 4; ++e2)
+  {
+    for (unsigned int e1 = 0; e1 < 4; ++e1)
+    {
+      for (unsigned int right = 0; right < size; ++right)
+      {
+        for (unsigned int left = 0; left < size; ++left)
+        {
+          // Both or no crossing edges don't tell where the line goes, only single crossing edges are its ends
+          const bool leftEnd = e1 == 1 || e1 == 2;
+          const bool rightEnd = e2 == 1 || e2 == 2;
+          const float y1 = e1 == 1 ? -0.5f : 0.5f;
+          const float y2 = e2 == 1 ? -0.5f : 0.5f;
+          const float d = static_cast<float>(left + right + 1);
+          const float x = static_cast<float>(left);
+
+          float negative = 0.0f, positive = 0.0f, n, p;
+          if (leftEnd && rightEnd && y1 != y2)
+          {
+            // Z shape, a single line across the whole edge
+            getAreaUnderLine(glm::vec2(0.0f, y1), glm::vec2(d, y2), x, negative, positive);
+          }
+          else if (leftEnd && rightEnd)
+          {
+            // U shape, two lines meeting in the middle
+            getAreaUnderLine(glm::vec2(0.0f, y1), glm::vec2(0.5f * d, 0.0f), x, negative, positive);
+            getAreaUnderLine(glm::vec2(0.5f * d, 0.0f), glm::vec2(d, y2), x, n, p);
+            negative += n;
+            positive += p;
+          }
+          else if (leftEnd && left <= right)
+          {
+            // L shape, only the half closer to the crossing edge is filtered
+            getAreaUnderLine(glm::vec2(0.0f, y1), glm::vec2(0.5f * d, 0.0f), x, negative, positive);
+          }
+          else if (rightEnd && left >= right)
+          {
+            getAreaUnderLine(glm::vec2(0.5f * d, 0.0f), glm::vec2(d, y2), x, negative, positive);
+          }
+
+          int i = (e2 * size + right) * stride * width + (e1 * size + left) * stride;
+          data[i] = (unsigned char)(std::min(negative, 1.0f) * 255.0f + 0.5f);
+          data[i + 1] = (unsigned char)(std::min(positive, 1.0f) * 255.0f + 0.5f);
+        }
+      }
+    }
+  }
+
+  // Generate the texture name
+  GLuint tex;
+  glGenTextures(1, &tex);
+
+  // Create the texture object (first bind call for this name)
+  glBindTexture(GL_TEXTURE_2D, tex);
+
+  // Upload texture data, it's only read by texelFetch()
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, width, width, 0, GL_RG, GL_UNSIGNED_BYTE, data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+  // Unbind the texture
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // Delete the temporary buffer
+  delete[] data;
+
+  // Note: the caller is now responsible for handling this resource
+  return tex;
+}
+
 GLuint Textures::LoadTexture(const char name[], bool sRGB)
 {
   // Load stored texture on the disk
@@ -0,0 +1,301 @@
+/*
+ * Source code for the NPGR019 lab practices. Copyright Martin Kahoun 2021.
+ * Licensed under the zlib license, see LICENSE.txt in the root directory.
+ */
+
+#include <TransformSystem.h>
+#include <CpuFeatures.h>
+#include <JobSystem.h>
+
+#include <algorithm>
+#include <chrono>
+#include <immintrin.h>
+
+// Number of floats of a single transposed world transformation
+static const unsigned int WORLD_FLOATS = 12;
+
+// Arrays the kernels work on
+struct TransformArrays
+{
+  const float *tx, *ty, *tz;
+  const float *qx, *qy, *qz, *qw;
+  const float *sx, *sy, *sz;
+  const int *parent;
+  float *world;
+};
+
+// Computes the world transformations of the nodes [begin, end), parents must be done already
+static void computeWorldScalar(const TransformArrays &a, unsigned int begin, unsigned int end, bool hasParents)
+{
+  for (unsigned int i = begin; i < end; ++i)
+  {
+    const float x = a.qx[i], y = a.qy[i], z = a.qz[i], w = a.qw[i];
+    const float xx = x * x, yy = y * y, zz = z * z;
+    const float xy = x * y, xz = x * z, yz = y * z;
+    const float wx = w * x, wy = w * y, wz = w * z;
+
+    // Rows of the local transformation: translation * rotation * scale
+    const float local[3][4] =
+    {
+      {(1.0f - 2.0f * (yy + zz)) * a.sx[i], 2.0f * (xy - wz) * a.sy[i], 2.0f * (xz + wy) * a.sz[i], a.tx[i]},
+      {2.0f * (xy + wz) * a.sx[i], (1.0f - 2.0f * (xx + zz)) * a.sy[i], 2.0f * (yz - wx) * a.sz[i], a.ty[i]},
+      {2.0f * (xz - wy) * a.sx[i], 2.0f * (yz + wx) * a.sy[i], (1.0f - 2.0f * (xx + yy)) * a.sz[i], a.tz[i]}
+    };
+
+    float *world = a.world + i * WORLD_FLOATS;
+    if (!hasParents)
+    {
+      for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 4; ++c)
+          world[r * 4 + c] = local[r][c];
+      continue;
+    }
+
+    // World = parent world * local, both are affine
+    const float *parent = a.world + a.parent[i] * WORLD_FLOATS;
+    for (int r = 0; r < 3; ++r)
+    {
+      for (int c = 0; c < 4; ++c)
+      {
+        world[r * 4 + c] = parent[r * 4 + 0] * local[0][c] + parent[r * 4 + 1] * local[1][c] + parent[r * 4 + 2] * local[2][c] +
+                           (c == 3 ? parent[r * 4 + 3] : 0.0f);
+      }
+    }
+  }
+}
+
+// AVX2 version of computeWorldScalar(), 8 nodes at a time, the remainder is done by the scalar code
+static CPU_TARGET_AVX2 void computeWorldAvx2(const TransformArrays &a, unsigned int begin, unsigned int end, bool hasParents)
+{
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+
+  unsigned int i = begin;
+  for (; i + TransformSystem::BATCH_SIZE <= end; i += TransformSystem::BATCH_SIZE)
+  {
+    const __m256 x = _mm256_loadu_ps(a.qx + i), y = _mm256_loadu_ps(a.qy + i), z = _mm256_loadu_ps(a.qz + i), w = _mm256_loadu_ps(a.qw + i);
+    const __m256 sx = _mm256_loadu_ps(a.sx + i), sy = _mm256_loadu_ps(a.sy + i), sz = _mm256_loadu_ps(a.sz + i);
+    const __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+    const __m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+    const __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+    // Rows of the local transformation of 8 nodes: translation * rotation * scale
+    __m256 local[3][4];
+    local[0][0] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(yy, zz), one), sx);
+    local[0][1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy);
+    local[0][2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz);
+    local[0][3] = _mm256_loadu_ps(a.tx + i);
+    local[1][0] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx);
+    local[1][1] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, zz), one), sy);
+    local[1][2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz);
+    local[1][3] = _mm256_loadu_ps(a.ty + i);
+    local[2][0] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx);
+    local[2][1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy);
+    local[2][2] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, yy), one), sz);
+    local[2][3] = _mm256_loadu_ps(a.tz + i);
+
+    // World = parent world * local, parent rows are gathered from the already computed transformations
+    alignas(32) float world[WORLD_FLOATS][TransformSystem::BATCH_SIZE];
+    if (!hasParents)
+    {
+      for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 4; ++c)
+          _mm256_store_ps(world[r * 4 + c], local[r][c]);
+    }
+    else
+    {
+      const __m256i parent = _mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a.parent + i)), _mm256_set1_epi32(WORLD_FLOATS));
+      for (int r = 0; r < 3; ++r)
+      {
+        const __m256 p0 = _mm256_i32gather_ps(a.world + r * 4 + 0, parent, 4);
+        const __m256 p1 = _mm256_i32gather_ps(a.world + r * 4 + 1, parent, 4);
+        const __m256 p2 = _mm256_i32gather_ps(a.world + r * 4 + 2, parent, 4);
+        const __m256 p3 = _mm256_i32gather_ps(a.world + r * 4 + 3, parent, 4);
+        for (int c = 0; c < 4; ++c)
+        {
+          __m256 v = _mm256_fmadd_ps(p0, local[0][c], _mm256_fmadd_ps(p1, local[1][c], _mm256_mul_ps(p2, local[2][c])));
+          if (c == 3)
+            v = _mm256_add_ps(v, p3);
+          _mm256_store_ps(world[r * 4 + c], v);
+        }
+      }
+    }
+
+    // Scatter the structure of arrays to the transposed mat3x4 layout
+    for (unsigned int j = 0; j < TransformSystem::BATCH_SIZE; ++j)
+    {
+      float *dst = a.world + (i + j) * WORLD_FLOATS;
+      for (unsigned int k = 0; k < WORLD_FLOATS; ++k)
+        dst[k] = world[k][j];
+    }
+  }
+
+  computeWorldScalar(a, i, end, hasParents);
+}
+
+// ----------------------------------------------------------------------------
+
+TransformHandle TransformSystem::Create(TransformHandle parent)
+{
+  // Nodes are never removed one by one, so the handles are the creation order
+  const unsigned int index = GetCount();
+  const TransformHandle handle = index;
+
+  const int parentIndex = parent == INVALID_TRANSFORM ? -1 : static_cast<int>(_indexOf[parent]);
+  _parent.push_back(parentIndex);
+  _level.push_back(parentIndex < 0 ? 0 : _level[parentIndex] + 1);
+
+  _tx.push_back(0.0f); _ty.push_back(0.0f); _tz.push_back(0.0f);
+  _qx.push_back(0.0f); _qy.push_back(0.0f); _qz.push_back(0.0f); _qw.push_back(1.0f);
+  _sx.push_back(1.0f); _sy.push_back(1.0f); _sz.push_back(1.0f);
+  _world.push_back(glm::mat3x4(1.0f));
+
+  _indexOf.push_back(index);
+  _handleOf.push_back(handle);
+
+  // Levels are recomputed on the next update
+  _sorted = false;
+  return handle;
+}
+
+void TransformSystem::Clear()
+{
+  _tx.clear(); _ty.clear(); _tz.clear();
+  _qx.clear(); _qy.clear(); _qz.clear(); _qw.clear();
+  _sx.clear(); _sy.clear(); _sz.clear();
+  _parent.clear();
+  _level.clear();
+  _world.clear();
+  _indexOf.clear();
+  _handleOf.clear();
+  _levelBegin.clear();
+  _sorted = true;
+}
+
+void TransformSystem::SetLocal(TransformHandle node, const glm::vec3 &translation, const glm::quat &rotation, const glm::vec3 &scale)
+{
+  SetTranslation(node, translation);
+  SetRotation(node, rotation);
+  SetScale(node, scale);
+}
+
+void TransformSystem::SetTranslation(TransformHandle node, const glm::vec3 &translation)
+{
+  const unsigned int i = _indexOf[node];
+  _tx[i] = translation.x;
+  _ty[i] = translation.y;
+  _tz[i] = translation.z;
+}
+
+void TransformSystem::SetRotation(TransformHandle node, const glm::quat &rotation)
+{
+  const unsigned int i = _indexOf[node];
+  _qx[i] = rotation.x;
+  _qy[i] = rotation.y;
+  _qz[i] = rotation.z;
+  _qw[i] = rotation.w;
+}
+
+void TransformSystem::SetScale(TransformHandle node, const glm::vec3 &scale)
+{
+  const unsigned int i = _indexOf[node];
+  _sx[i] = scale.x;
+  _sy[i] = scale.y;
+  _sz[i] = scale.z;
+}
+
+glm::vec3 TransformSystem::GetTranslation(TransformHandle node) const
+{
+  const unsigned int i = _indexOf[node];
+  return glm::vec3(_tx[i], _ty[i], _tz[i]);
+}
+
+glm::vec3 TransformSystem::GetWorldPosition(TransformHandle node) const
+{
+  // Translation is the last column of the transposed rows
+  const glm::mat3x4 &world = _world[_indexOf[node]];
+  return glm::vec3(world[0][3], world[1][3], world[2][3]);
+}
+
+void TransformSystem::SortLevels()
+{
+  const unsigned int count = GetCount();
+
+  // Count the nodes per level
+  unsigned int numLevels = 0;
+  for (unsigned int level : _level)
+    numLevels = std::max(numLevels, level + 1);
+
+  _levelBegin.assign(numLevels + 1, 0);
+  for (unsigned int level : _level)
+    ++_levelBegin[level + 1];
+  for (unsigned int l = 0; l < numLevels; ++l)
+    _levelBegin[l + 1] += _levelBegin[l];
+
+  // Stable counting sort, the order within a level is kept
+  std::vector<unsigned int> next(_levelBegin.begin(), _levelBegin.end() - 1);
+  std::vector<unsigned int> newIndex(count);
+  for (unsigned int i = 0; i < count; ++i)
+    newIndex[i] = next[_level[i]]++;
+
+  auto permute = [&newIndex, count](auto &items)
+  {
+    auto old = items;
+    for (unsigned int i = 0; i < count; ++i)
+      items[newIndex[i]] = old[i];
+  };
+  permute(_tx); permute(_ty); permute(_tz);
+  permute(_qx); permute(_qy); permute(_qz); permute(_qw);
+  permute(_sx); permute(_sy); permute(_sz);
+  permute(_level);
+  permute(_world);
+  permute(_handleOf);
+
+  // Parents have to be remapped to the new indices as well
+  std::vector<int> parent(count);
+  for (unsigned int i = 0; i < count; ++i)
+    parent[newIndex[i]] = _parent[i] < 0 ? -1 : static_cast<int>(newIndex[_parent[i]]);
+  _parent.swap(parent);
+
+  for (unsigned int i = 0; i < count; ++i)
+    _indexOf[_handleOf[i]] = i;
+
+  _sorted = true;
+}
+
+void TransformSystem::Update()
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  if (!_sorted)
+    SortLevels();
+
+  _simdUsed = _simd && cpuSupportsAvx2();
+  const TransformArrays arrays =
+  {
+    _tx.data(), _ty.data(), _tz.data(),
+    _qx.data(), _qy.data(), _qz.data(), _qw.data(),
+    _sx.data(), _sy.data(), _sz.data(),
+    _parent.data(),
+    reinterpret_cast<float*>(_world.data())
+  };
+
+  // Levels must go in order as the children read the world transformations of their parents
+  JobSystem &jobSystem = JobSystem::GetInstance();
+  for (size_t l = 0; l + 1 < _levelBegin.size(); ++l)
+  {
+    const unsigned int levelBegin = _levelBegin[l];
+    const bool hasParents = l > 0;
+    const bool simd = _simdUsed;
+    jobSystem.ParallelFor(_levelBegin[l + 1] - levelBegin, JOB_SIZE, [&arrays, levelBegin, hasParents, simd](unsigned int begin, unsigned int end)
+    {
+      if (simd)
+        computeWorldAvx2(arrays, levelBegin + begin, levelBegin + end, hasParents);
+      else
+        computeWorldScalar(arrays, levelBegin + begin, levelBegin + end, hasParents);
+    });
+  }
+
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+  _throughput = elapsed.count() > 0.0 ? GetCount() / elapsed.count() : 0.0;
+}